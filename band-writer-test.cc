@@ -0,0 +1,210 @@
+// band-writer-test.cc
+// Tests for `band-writer`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also writes a 4K frame as 24-bit BMP bands to a real file, first
+// encoding and writing in turn and then with a `BandWriter`.
+
+#include "band-writer.h"               // module under test
+
+#include "frame-source.h"              // SyntheticFrameSource
+#include "pixel-image.h"               // encodeBMPRows
+#include "test-util.h"                 // EXPECT
+
+#include <algorithm>                   // std::min
+#include <chrono>                      // std::chrono
+#include <cstdio>                      // std::{fopen, fwrite, remove}
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+using Clock = std::chrono::steady_clock;
+
+
+static double msSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(
+    Clock::now() - start).count();
+}
+
+
+// Buffers reach the write function whole and in order, and the caller
+// gets back buffers to reuse.
+static void testOrder()
+{
+  std::vector<unsigned char> written;
+  BandWriter writer([&](std::vector<unsigned char> const &buffer) {
+    written.insert(written.end(), buffer.begin(), buffer.end());
+    return std::string();
+  });
+
+  std::vector<unsigned char> expect;
+  std::vector<unsigned char> buffer;
+  for (int i = 0; i < 100; ++i) {
+    buffer.assign(i % 7 + 1, (unsigned char)i);
+    expect.insert(expect.end(), buffer.begin(), buffer.end());
+    EXPECT(writer.write(buffer));
+  }
+  EXPECT(writer.finish().empty());
+  EXPECT(written == expect);
+
+  // Finishing again is harmless.
+  EXPECT(writer.finish().empty());
+}
+
+
+// After a failure, nothing more is written, and the error is kept.
+static void testError()
+{
+  int calls = 0;
+  BandWriter writer([&](std::vector<unsigned char> const &) {
+    return ++calls == 3? std::string("disk full") : std::string();
+  });
+
+  std::vector<unsigned char> buffer(10);
+  bool ok = true;
+  int accepted = 0;
+  for (int i = 0; i < 10 && ok; ++i) {
+    ok = writer.write(buffer);
+    accepted += ok;
+  }
+  EXPECT(writer.finish() == "disk full");
+  EXPECT(calls == 3);
+  EXPECT(accepted == 3);
+}
+
+
+// Filling one buffer and writing another happen at the same time.
+// Each takes 10 ms, so ten bands take about 110 ms rather than 200.
+static void testOverlap()
+{
+  BandWriter writer([](std::vector<unsigned char> const &) {
+    sleepMs(10);
+    return std::string();
+  });
+
+  auto start = Clock::now();
+  std::vector<unsigned char> buffer;
+  for (int i = 0; i < 10; ++i) {
+    sleepMs(10);
+    buffer.assign(1, 0);
+    writer.write(buffer);
+  }
+  writer.finish();
+  double ms = msSince(start);
+
+  EXPECT(ms < 170);
+}
+
+
+// Milliseconds spent on each part of writing a file.
+struct WriteTimes {
+  double m_encode = 0;
+  double m_write = 0;
+  double m_total = 0;
+};
+
+
+// Write a 4K frame to `fname` as 24-bit BMP in bands, encoding each
+// while the last is written if `threaded`, and add the time taken to
+// `times`.
+static void timeWrite(PixelImage const &img, char const *fname,
+                      bool threaded, WriteTimes &times)
+{
+  std::FILE *fp = std::fopen(fname, "wb");
+  if (!fp) {
+    std::cout << "cannot open " << fname << "\n";
+    return;
+  }
+
+  auto writeBuffer = [fp, &times](std::vector<unsigned char> const &buffer) {
+    auto start = Clock::now();
+    std::string error;
+    if (std::fwrite(buffer.data(), 1, buffer.size(), fp) != buffer.size()
+        || std::fflush(fp) != 0) {
+      error = "fwrite failed";
+    }
+    times.m_write += msSince(start);
+    return error;
+  };
+
+  auto start = Clock::now();
+  {
+    BandWriter writer(writeBuffer);
+    std::vector<unsigned char> buffer =
+      encodeBMPHeader(img.m_width, img.m_height, BF_24);
+    std::size_t rowBytes = bmpRowBytes(img.m_width, BF_24);
+    for (int row = 0; row < img.m_height; row += 64) {
+      int numRows = std::min(64, img.m_height - row);
+      std::size_t at = row == 0? buffer.size() : 0;
+      buffer.resize(at + numRows * rowBytes);
+      auto encodeStart = Clock::now();
+      encodeBMPRows(img, row, numRows, buffer.data() + at, BF_24);
+      times.m_encode += msSince(encodeStart);
+      if (threaded) {
+        writer.write(buffer);
+      }
+      else {
+        writeBuffer(buffer);
+      }
+    }
+    writer.finish();
+  }
+  times.m_total += msSince(start);
+
+  std::fclose(fp);
+  std::remove(fname);
+}
+
+
+static void bench()
+{
+  SyntheticFrameSource src(3840, 2160);
+  PixelImage img = grabFrame(src);
+  char const *fname = "band-writer-bench.tmp";
+
+  // The time hidden is what encoding and writing took beyond the
+  // total, which is zero when they take turns.
+  int const reps = 10;
+  for (bool threaded : { false, true }) {
+    WriteTimes times;
+    for (int i = 0; i < reps; ++i) {
+      timeWrite(img, fname, threaded, times);
+    }
+    std::cout << "3840x2160 24-bit BMP, "
+              << (threaded? "with BandWriter" : "in turn")
+              << ": encode " << times.m_encode / reps
+              << " ms, write " << times.m_write / reps
+              << " ms, total " << times.m_total / reps
+              << " ms, hidden "
+              << (times.m_encode + times.m_write - times.m_total) / reps
+              << " ms\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testOrder();
+  testError();
+  testOverlap();
+
+  if (s_failures) {
+    std::cout << "band-writer-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "band-writer-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
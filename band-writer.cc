@@ -0,0 +1,93 @@
+// band-writer.cc
+// Code for `band-writer` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "band-writer.h"               // this module
+
+#include "perf-counters.h"             // perfHistogram, etc.
+
+#include <utility>                     // std::move
+
+
+BandWriter::BandWriter(WriteFunc write)
+  : m_write(std::move(write)),
+    m_mutex(),
+    m_cv(),
+    m_buffer(),
+    m_full(false),
+    m_done(false),
+    m_error(),
+    m_thread()
+{
+  m_thread = std::thread(&BandWriter::threadMain, this);
+}
+
+
+BandWriter::~BandWriter()
+{
+  finish();
+}
+
+
+void BandWriter::threadMain()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_cv.wait(lock, [this] { return m_full || m_done; });
+    if (!m_full) {
+      return;
+    }
+
+    if (m_error.empty()) {
+      // The caller does not touch the buffer while it is full.
+      lock.unlock();
+      std::string error = m_write(m_buffer);
+      lock.lock();
+      m_error = error;
+    }
+
+    m_full = false;
+    m_cv.notify_all();
+  }
+}
+
+
+bool BandWriter::write(std::vector<unsigned char> &buffer)
+{
+  // How long the caller had to wait for the disk.  Zero means filling
+  // the buffer took longer than writing the last one.
+  static LatencyHistogram &waitTime = perfHistogram("io.bandWait.ns");
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  std::uint64_t start = perfNowNs();
+  m_cv.wait(lock, [this] { return !m_full; });
+  waitTime.record(perfNowNs() - start);
+
+  if (!m_error.empty()) {
+    return false;
+  }
+
+  m_buffer.swap(buffer);
+  m_full = true;
+  m_cv.notify_all();
+  return true;
+}
+
+
+std::string BandWriter::finish()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_done = true;
+  }
+  m_cv.notify_all();
+
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  return m_error;
+}
+
+
+// EOF
@@ -0,0 +1,86 @@
+// band-writer.h
+// Write a file a buffer at a time on a thread of its own.
+
+// See license.txt for copyright and terms of use.
+
+// A `BandWriter` takes successive buffers of a file's contents and
+// passes each to its write function on a second thread, so the caller
+// can fill the next buffer while the last is written.  It holds at most
+// one buffer, and hands the previous one back for reuse, so together
+// with the caller's there are two.
+//
+// Overlapped I/O cannot do this for files being extended, which NTFS
+// writes synchronously, so a thread is used instead.
+//
+// This module does not depend on the Windows API.
+
+#ifndef BAND_WRITER_H
+#define BAND_WRITER_H
+
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <condition_variable>          // std::condition_variable
+#include <functional>                  // std::function
+#include <mutex>                       // std::mutex
+#include <string>                      // std::string
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+
+class BandWriter {
+  NO_OBJECT_COPIES(BandWriter);
+
+public:      // types
+  // Append `buffer` to the file.  Return a non-empty error message on
+  // failure.
+  using WriteFunc =
+    std::function<std::string (std::vector<unsigned char> const &buffer)>;
+
+private:     // data
+  WriteFunc const m_write;
+
+  // Protects everything below.
+  std::mutex m_mutex;
+
+  // Signalled when `m_full` or `m_done` changes.
+  std::condition_variable m_cv;
+
+  // Buffer being written, if `m_full`.  Only the writer thread touches
+  // it then.
+  std::vector<unsigned char> m_buffer;
+  bool m_full;
+
+  // Set by `finish`: no more buffers are coming.
+  bool m_done;
+
+  // First failure of `m_write`.  Once set, no more buffers are written.
+  std::string m_error;
+
+  // Started by the constructor.
+  std::thread m_thread;
+
+private:     // methods
+  // Body of the writer thread.
+  void threadMain();
+
+public:      // methods
+  // Start the writer thread, which passes buffers to `write`.
+  explicit BandWriter(WriteFunc write);
+
+  // Calls `finish`.
+  ~BandWriter();
+
+  // Wait for the previous buffer to be written, then take `buffer` to
+  // write, leaving the previous one, with its contents unspecified, in
+  // its place.  Return false if an earlier write failed, in which case
+  // `buffer` is left alone.
+  bool write(std::vector<unsigned char> &buffer);
+
+  // Wait for the last buffer to be written and stop the thread.
+  // Return the first error, or an empty string.  Later calls do
+  // nothing but return it again.
+  std::string finish();
+};
+
+
+#endif // BAND_WRITER_H
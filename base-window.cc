@@ -5,15 +5,116 @@
 
 #include "base-window.h"               // this module
 
-#include "winapi-util.h"               // winapiDie, CreateWindowExWArgs
+#include "perf-counters.h"             // perfHistogram, perfNowNs
+#include "winapi-util.h"               // winapiDie, CreateWindowExWArgs, windowMessageName
 
+#include <algorithm>                   // std::{min, sort}
+#include <atomic>                      // std::atomic
 #include <cassert>                     // assert
+#include <cstdio>                      // std::snprintf
+#include <cstdint>                     // std::uint64_t
+#include <cwchar>                      // std::swprintf
+#include <string>                      // std::{string, wstring}
+#include <vector>                      // std::vector
 
 
 wchar_t const *BaseWindow::s_windowClassName = L"Base Window Class";
 
 bool BaseWindow::s_windowClassRegistered = false;
 
+bool BaseWindow::s_profileMessages = true;
+
+
+// ------------------------- Message profiling -------------------------
+// Messages below this number each get their own histogram.  Those at or
+// above it, which are application-defined, share one.
+static UINT const c_numProfiledMessages = WM_USER;
+
+// Histogram for each message, created on first use.  The last entry is
+// the shared one.
+static std::atomic<LatencyHistogram*>
+  s_messageHistograms[c_numProfiledMessages + 1];
+
+
+// Name of the histogram for messages at `index`.
+static std::string messageHistogramName(UINT index)
+{
+  std::string name = "msg.";
+  if (index == c_numProfiledMessages) {
+    name += "WM_USER+";
+  }
+  else if (char const *msgName = windowMessageName(index)) {
+    name += msgName;
+  }
+  else {
+    char buf[16];
+    std::snprintf(buf, TABLESIZE(buf), "0x%04X", index);
+    name += buf;
+  }
+  return name + ".ns";
+}
+
+
+// Histogram for `uMsg`.
+static LatencyHistogram &messageHistogram(UINT uMsg)
+{
+  UINT index = std::min(uMsg, c_numProfiledMessages);
+
+  LatencyHistogram *h =
+    s_messageHistograms[index].load(std::memory_order_relaxed);
+  if (!h) {
+    // Looking up the same name twice yields the same histogram, so a
+    // race here is harmless.
+    h = &perfHistogram(messageHistogramName(index));
+    s_messageHistograms[index].store(h, std::memory_order_relaxed);
+  }
+  return *h;
+}
+
+
+/*static*/ std::wstring BaseWindow::messageProfileReport()
+{
+  struct Row {
+    UINT m_index;
+    LatencyHistogram const *m_histogram;
+  };
+
+  std::vector<Row> rows;
+  for (UINT i = 0; i <= c_numProfiledMessages; ++i) {
+    if (LatencyHistogram const *h =
+          s_messageHistograms[i].load(std::memory_order_relaxed)) {
+      rows.push_back(Row{i, h});
+    }
+  }
+
+  std::sort(rows.begin(), rows.end(),
+    [](Row const &a, Row const &b) {
+      return a.m_histogram->sum() > b.m_histogram->sum();
+    });
+
+  std::wstring ret;
+  for (Row const &row : rows) {
+    LatencyHistogram const &h = *row.m_histogram;
+    std::wstring name = toWideString(messageHistogramName(row.m_index));
+
+    wchar_t buf[200];
+    std::swprintf(buf, TABLESIZE(buf),
+      L"%-32ls %8llu msgs %10.3f ms total  p50 %8.1f us  "
+      L"p99 %8.1f us  max %8.1f us\n",
+      name.c_str(),
+      (unsigned long long)h.count(),
+      h.sum() / 1e6,
+      h.percentile(0.50) / 1e3,
+      h.percentile(0.99) / 1e3,
+      h.max() / 1e3);
+    ret += buf;
+  }
+  return ret;
+}
+
+
+// ---------------------------- BaseWindow -----------------------------
+
 
 BaseWindow::~BaseWindow()
 {}
@@ -95,6 +196,12 @@ void BaseWindow::invalidateAllPixels()
   }
 
   if (pThis) {
+    if (s_profileMessages) {
+      std::uint64_t start = perfNowNs();
+      LRESULT ret = pThis->handleMessage(uMsg, wParam, lParam);
+      messageHistogram(uMsg).record(perfNowNs() - start);
+      return ret;
+    }
     return pThis->handleMessage(uMsg, wParam, lParam);
   }
   else {
@@ -0,0 +1,167 @@
+// blank-frame-test.cc
+// Tests for `blank-frame`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times 4K frames.
+
+#include "blank-frame.h"               // module under test
+
+#include "frame-source.h"              // SyntheticFrameSource
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <cstdint>                     // std::uint32_t
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937
+#include <string>                      // std::string
+
+
+// Draw a `w` by `h` rectangle of `color` at `x`, `y`.
+static void fillRect(PixelImage &img, int x, int y, int w, int h,
+                     std::uint32_t color)
+{
+  for (int j = y; j < y+h; ++j) {
+    for (int i = x; i < x+w; ++i) {
+      img.row(j)[i] = color;
+    }
+  }
+}
+
+
+// What `computeLumaHistogram` computes, written out directly.
+static LumaHistogram referenceHistogram(PixelImage const &img, int rowStep)
+{
+  LumaHistogram hist;
+  for (int y = 0; y < img.m_height; y += rowStep) {
+    for (int x = 0; x < img.m_width; ++x) {
+      std::uint32_t px = img.at(x, y);
+      int br = ((px & 0xFF) + ((px >> 16) & 0xFF) + 1) / 2;
+      ++hist.m_bins[(br + ((px >> 8) & 0xFF) + 1) / 2];
+      ++hist.m_total;
+    }
+  }
+  return hist;
+}
+
+
+// Sizes on either side of the 16-pixel vector width.
+static void testAgainstReference()
+{
+  std::mt19937 rng(9);
+  for (int w = 0; w <= 50; ++w) {
+    for (int rowStep : { 1, 3 }) {
+      PixelImage img = randomImage(w, 7, rng);
+
+      LumaHistogram hist = computeLumaHistogram(img, rowStep);
+      LumaHistogram expect = referenceHistogram(img, rowStep);
+      bool same = hist.m_total == expect.m_total;
+      for (int v = 0; v < 256; ++v) {
+        same = same && hist.m_bins[v] == expect.m_bins[v];
+      }
+      EXPECT(same);
+    }
+  }
+}
+
+
+static void testClassify()
+{
+  EXPECT(classifyFrame(PixelImage()) == BK_NONE);
+  EXPECT(classifyFrame(PixelImage(64, 36)) == BK_BLACK);
+
+  // Partway through a fade.
+  EXPECT(classifyFrame(solidImage(64, 36, 0x141414)) == BK_BLACK);
+
+  // "Loading..." in a corner of a black screen.
+  PixelImage loading(400, 200);
+  fillRect(loading, 340, 180, 40, 8, 0xFFFFFF);
+  EXPECT(classifyFrame(loading) == BK_BLACK);
+
+  // A flat colored screen with a spinner.
+  PixelImage splash = solidImage(400, 200, 0x304080);
+  fillRect(splash, 190, 90, 12, 12, 0xFFFFFF);
+  EXPECT(classifyFrame(splash) == BK_UNIFORM);
+
+  // Half black and half white is neither.
+  PixelImage split(400, 200);
+  fillRect(split, 200, 0, 200, 200, 0xFFFFFF);
+  EXPECT(classifyFrame(split) == BK_NONE);
+
+  // A game frame is neither.
+  SyntheticFrameSource src(640, 360, 4);
+  EXPECT(classifyFrame(grabFrame(src)) == BK_NONE);
+}
+
+
+static void testNames()
+{
+  for (int i = 0; i < NUM_BLANK_KINDS; ++i) {
+    BlankKind kind = BK_NONE;
+    EXPECT(parseBlankKind(toString((BlankKind)i), kind) && kind == i);
+  }
+  for (int i = 0; i < NUM_BLANK_FRAME_POLICIES; ++i) {
+    BlankFramePolicy policy = BFP_OFF;
+    EXPECT(parseBlankFramePolicy(toString((BlankFramePolicy)i), policy) &&
+           policy == i);
+  }
+
+  BlankKind kind;
+  EXPECT(!parseBlankKind("gray", kind));
+  BlankFramePolicy policy;
+  EXPECT(!parseBlankFramePolicy("on", policy));
+}
+
+
+// Time classifying 4K frames, both a game frame and a black one, and
+// reading every row rather than every fourth.
+static void bench()
+{
+  SyntheticFrameSource src(3840, 2160);
+  PixelImage frames[] = { grabFrame(src), PixelImage(3840, 2160) };
+  char const * const names[] = { "game", "black" };
+
+  using Clock = std::chrono::steady_clock;
+  int const reps = 50;
+  for (int f = 0; f < 2; ++f) {
+    for (int rowStep : { 4, 1 }) {
+      int flagged = 0;
+      auto start = Clock::now();
+      for (int i = 0; i < reps; ++i) {
+        flagged += classifyLumaHistogram(
+          computeLumaHistogram(frames[f], rowStep)) != BK_NONE;
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count() / reps;
+
+      std::cout << "3840x2160 " << names[f] << ", every " << rowStep
+                << " rows: " << ms << " ms"
+                << (flagged? ", flagged" : "") << "\n";
+    }
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testAgainstReference();
+  testClassify();
+  testNames();
+
+  if (s_failures) {
+    std::cout << "blank-frame-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "blank-frame-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
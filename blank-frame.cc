@@ -0,0 +1,190 @@
+// blank-frame.cc
+// Code for `blank-frame` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "blank-frame.h"               // this module
+
+#include "sm-macros.h"                 // TABLESIZE
+
+#include <algorithm>                   // std::max
+#include <cassert>                     // assert
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_avg_epu8, etc.
+#endif
+
+
+// Highest luminance that counts as black.
+static int const c_blackLevel = 24;
+
+// Width, in levels, of the band a uniform frame falls in.
+static int const c_uniformBand = 16;
+
+// Number of interleaved histograms.  Consecutive pixels go to
+// different ones.
+static int const c_numSubHistograms = 4;
+
+
+char const *toString(BlankKind kind)
+{
+  static char const * const names[] = {
+    "none",
+    "black",
+    "uniform",
+  };
+  static_assert(TABLESIZE(names) == NUM_BLANK_KINDS);
+
+  assert(0 <= kind && kind < NUM_BLANK_KINDS);
+  return names[kind];
+}
+
+
+bool parseBlankKind(std::string const &str, BlankKind &kind /*OUT*/)
+{
+  for (int i = 0; i < NUM_BLANK_KINDS; ++i) {
+    if (str == toString((BlankKind)i)) {
+      kind = (BlankKind)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+char const *toString(BlankFramePolicy policy)
+{
+  static char const * const names[] = {
+    "off",
+    "mark",
+    "drop",
+  };
+  static_assert(TABLESIZE(names) == NUM_BLANK_FRAME_POLICIES);
+
+  assert(0 <= policy && policy < NUM_BLANK_FRAME_POLICIES);
+  return names[policy];
+}
+
+
+bool parseBlankFramePolicy(std::string const &str,
+                           BlankFramePolicy &policy /*OUT*/)
+{
+  for (int i = 0; i < NUM_BLANK_FRAME_POLICIES; ++i) {
+    if (str == toString((BlankFramePolicy)i)) {
+      policy = (BlankFramePolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Luminance of `px`.  The vector code computes the same.
+static inline unsigned char pixelLuma(std::uint32_t px)
+{
+  std::uint32_t b = px & 0xFF;
+  std::uint32_t g = (px >> 8) & 0xFF;
+  std::uint32_t r = (px >> 16) & 0xFF;
+  std::uint32_t br = (b + r + 1) >> 1;
+  return (unsigned char)((br + g + 1) >> 1);
+}
+
+
+#ifdef __SSE2__
+// Luminance of the four pixels at `p`, in the low byte of each 32-bit
+// lane.
+static inline __m128i pixelLuma4(std::uint32_t const *p)
+{
+  __m128i v = _mm_loadu_si128((__m128i const*)p);
+  __m128i br = _mm_avg_epu8(v, _mm_srli_epi32(v, 16));
+  __m128i y = _mm_avg_epu8(br, _mm_srli_epi32(v, 8));
+  return _mm_and_si128(y, _mm_set1_epi32(0xFF));
+}
+#endif // __SSE2__
+
+
+LumaHistogram computeLumaHistogram(PixelImage const &img, int rowStep)
+{
+  std::uint32_t sub[c_numSubHistograms][256] = {};
+  std::uint32_t total = 0;
+  rowStep = std::max(1, rowStep);
+
+  int const w = img.m_width;
+  for (int y = 0; y < img.m_height; y += rowStep) {
+    std::uint32_t const *row = img.row(y);
+    int x = 0;
+
+#ifdef __SSE2__
+    alignas(16) unsigned char luma[16];
+    for (; x + 16 <= w; x += 16) {
+      __m128i a = pixelLuma4(row + x);
+      __m128i b = pixelLuma4(row + x + 4);
+      __m128i c = pixelLuma4(row + x + 8);
+      __m128i d = pixelLuma4(row + x + 12);
+      _mm_store_si128((__m128i*)luma,
+        _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+
+      for (int i = 0; i < 16; i += c_numSubHistograms) {
+        ++sub[0][luma[i]];
+        ++sub[1][luma[i+1]];
+        ++sub[2][luma[i+2]];
+        ++sub[3][luma[i+3]];
+      }
+    }
+#endif // __SSE2__
+
+    for (; x < w; ++x) {
+      ++sub[x % c_numSubHistograms][pixelLuma(row[x])];
+    }
+    total += (std::uint32_t)w;
+  }
+
+  LumaHistogram hist;
+  for (int v = 0; v < 256; ++v) {
+    for (int k = 0; k < c_numSubHistograms; ++k) {
+      hist.m_bins[v] += sub[k][v];
+    }
+  }
+  hist.m_total = total;
+  return hist;
+}
+
+
+BlankKind classifyLumaHistogram(LumaHistogram const &hist,
+                                double fraction)
+{
+  if (hist.m_total == 0) {
+    return BK_NONE;
+  }
+  double needed = fraction * hist.m_total;
+
+  std::uint32_t dark = 0;
+  for (int v = 0; v <= c_blackLevel; ++v) {
+    dark += hist.m_bins[v];
+  }
+  if (dark >= needed) {
+    return BK_BLACK;
+  }
+
+  // Slide a window of `c_uniformBand` levels across the histogram.
+  std::uint32_t inBand = 0;
+  for (int v = 0; v < 256; ++v) {
+    inBand += hist.m_bins[v];
+    if (v >= c_uniformBand) {
+      inBand -= hist.m_bins[v - c_uniformBand];
+    }
+    if (inBand >= needed) {
+      return BK_UNIFORM;
+    }
+  }
+  return BK_NONE;
+}
+
+
+BlankKind classifyFrame(PixelImage const &img)
+{
+  return classifyLumaHistogram(computeLumaHistogram(img));
+}
+
+
+// EOF
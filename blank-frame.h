@@ -0,0 +1,100 @@
+// blank-frame.h
+// Detection of black and nearly uniform frames, such as loading screens.
+
+// See license.txt for copyright and terms of use.
+
+// Auto-capture and bursts keep whatever is on the screen, which
+// includes fades to black and loading screens: a flat color with a
+// spinner or a line of text.  Such frames are recognized from the
+// histogram of their luminance, in which nearly every pixel falls
+// either near black or in one narrow band of levels.
+//
+// The histogram is built from every few scanlines, which is plenty for
+// a frame that is almost all one color.  Luminance is approximated as
+// (B + 2G + R) / 4, computed 16 pixels at a time with SSE2, and counted
+// into several interleaved histograms, so that runs of equal values do
+// not wait on each other's increments.  A 4K frame takes about 1 ms on
+// one core (see the "bench" mode of `blank-frame-test`).
+//
+// This module does not depend on the Windows API.
+
+#ifndef BLANK_FRAME_H
+#define BLANK_FRAME_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <cstdint>                     // std::uint32_t
+#include <string>                      // std::string
+
+
+// Counts of the luminance values of the pixels examined.
+struct LumaHistogram {
+  std::uint32_t m_bins[256] = {};
+
+  // Sum of `m_bins`.
+  std::uint32_t m_total = 0;
+};
+
+
+// What kind of blank frame an image is, if any.
+enum BlankKind {
+  // Not blank.
+  BK_NONE,
+
+  // Nearly all black, as during a fade.
+  BK_BLACK,
+
+  // Nearly all one level, other than black.
+  BK_UNIFORM,
+
+  NUM_BLANK_KINDS
+};
+
+// Return "none", "black", or "uniform".
+char const *toString(BlankKind kind);
+
+// Parse the result of `toString`.  Return false if `str` is not one of
+// those.
+bool parseBlankKind(std::string const &str, BlankKind &kind /*OUT*/);
+
+
+// What to do with a blank frame from auto-capture or a burst.
+enum BlankFramePolicy {
+  // Do not look for them.
+  BFP_OFF,
+
+  // Keep it, marked so it can be reviewed.
+  BFP_MARK,
+
+  // Discard it before it is encoded.
+  BFP_DROP,
+
+  NUM_BLANK_FRAME_POLICIES
+};
+
+// Return "off", "mark", or "drop".
+char const *toString(BlankFramePolicy policy);
+
+// Parse the result of `toString`.  Return false if `str` is not one of
+// those.
+bool parseBlankFramePolicy(std::string const &str,
+                           BlankFramePolicy &policy /*OUT*/);
+
+
+// Return the histogram of the luminance of every `rowStep`th row of
+// `img`, starting with the first.
+LumaHistogram computeLumaHistogram(PixelImage const &img,
+                                   int rowStep = 4);
+
+// Classify the frame `hist` came from.  It is `BK_BLACK` if at least
+// `fraction` of the pixels have a luminance of at most 24, and
+// otherwise `BK_UNIFORM` if at least `fraction` of them lie within 16
+// adjacent levels.  An empty histogram is not blank.
+BlankKind classifyLumaHistogram(LumaHistogram const &hist,
+                                double fraction = 0.98);
+
+// `classifyLumaHistogram(computeLumaHistogram(img))`.
+BlankKind classifyFrame(PixelImage const &img);
+
+
+#endif // BLANK_FRAME_H
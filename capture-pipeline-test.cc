@@ -0,0 +1,265 @@
+// capture-pipeline-test.cc
+// Tests for `capture-pipeline`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "capture-pipeline.h"          // module under test
+
+#include "perf-counters.h"             // perfGauge
+#include "test-util.h"                 // EXPECT
+
+#include <algorithm>                   // std::max
+#include <atomic>                      // std::atomic
+#include <iostream>                    // std::cout
+#include <mutex>                       // std::{mutex, lock_guard}
+#include <thread>                      // std::this_thread
+#include <vector>                      // std::vector
+
+
+static CaptureJobPtr makeJob(std::uint64_t id)
+{
+  CaptureJobPtr job = std::make_shared<CaptureJob>();
+  job->m_id = id;
+  return job;
+}
+
+
+// Records which jobs reached the last stage, and the most jobs seen in
+// the pipeline at once.
+struct Recorder {
+  std::mutex m_mutex;
+  std::vector<std::uint64_t> m_finished;
+  std::vector<std::uint64_t> m_spilled;
+
+  // Threads the spill function ran on.
+  std::vector<std::thread::id> m_spillThreads;
+
+  void finish(CaptureJob &job)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished.push_back(job.m_id);
+  }
+
+  void spill(CaptureJob &job)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_spilled.push_back(job.m_id);
+    m_spillThreads.push_back(std::this_thread::get_id());
+  }
+};
+
+
+// Three stages, the middle one slow, with queues of 2.
+static void buildPipeline(CapturePipeline &pipeline, Recorder &rec,
+                          std::atomic<int> &maxInFlight)
+{
+  pipeline.addStage("first", 2, [&](CaptureJob &job) {
+    job.m_hash.m_lo = job.m_id * 10;
+  });
+  pipeline.addStage("slow", 2, [&](CaptureJob &job) {
+    maxInFlight = std::max<int>(maxInFlight, pipeline.inFlightCount());
+    sleepMs(10);
+  });
+  pipeline.addStage("last", 2, [&](CaptureJob &job) {
+    rec.finish(job);
+  });
+  pipeline.setSpillFunc([&](CaptureJob &job) {
+    rec.spill(job);
+  });
+}
+
+
+// Jobs come out in order, having passed through every stage, and no
+// more are held than the queues allow.
+static void testBlock(ThreadPool &pool)
+{
+  Recorder rec;
+  std::atomic<int> maxInFlight{0};
+  CapturePipeline pipeline(pool, OP_BLOCK);
+  buildPipeline(pipeline, rec, maxInFlight);
+
+  for (std::uint64_t i = 0; i < 20; ++i) {
+    CaptureJobPtr dropped;
+    EXPECT(pipeline.submit(makeJob(i), dropped) ==
+           CapturePipeline::SR_QUEUED);
+    EXPECT(!dropped);
+  }
+  pipeline.waitIdle();
+
+  std::vector<std::uint64_t> expect;
+  for (std::uint64_t i = 0; i < 20; ++i) {
+    expect.push_back(i);
+  }
+  EXPECT(rec.m_finished == expect);
+
+  // Three queues of 2, plus one job running in each stage.
+  EXPECT(maxInFlight <= 9);
+
+  for (auto const &s : pipeline.stageStatus()) {
+    EXPECT(s.m_processed == 20);
+    EXPECT(s.m_depth == 0);
+  }
+  EXPECT(perfGauge("pipeline.slow.depth").get() == 0);
+}
+
+
+// When full, the oldest waiting job is dropped.
+static void testDrop(ThreadPool &pool)
+{
+  Recorder rec;
+  std::atomic<int> maxInFlight{0};
+  CapturePipeline pipeline(pool, OP_DROP_OLDEST);
+  buildPipeline(pipeline, rec, maxInFlight);
+
+  int drops = 0;
+  for (std::uint64_t i = 0; i < 20; ++i) {
+    CaptureJobPtr dropped;
+    if (pipeline.submit(makeJob(i), dropped) ==
+          CapturePipeline::SR_QUEUED_AFTER_DROP) {
+      EXPECT(dropped && dropped->m_id < i);
+      ++drops;
+    }
+  }
+  pipeline.waitIdle();
+
+  EXPECT(drops > 0);
+  EXPECT(rec.m_finished.size() + drops == 20);
+
+  // Survivors stay in order, and the newest always survives.
+  for (std::size_t i = 1; i < rec.m_finished.size(); ++i) {
+    EXPECT(rec.m_finished[i-1] < rec.m_finished[i]);
+  }
+  EXPECT(!rec.m_finished.empty() && rec.m_finished.back() == 19);
+}
+
+
+// When full, new jobs go to the spill function instead, which runs on
+// the pool rather than in `submit`.
+static void testSpill(ThreadPool &pool)
+{
+  Recorder rec;
+  std::atomic<int> maxInFlight{0};
+  CapturePipeline pipeline(pool, OP_SPILL);
+  buildPipeline(pipeline, rec, maxInFlight);
+
+  for (std::uint64_t i = 0; i < 20; ++i) {
+    CaptureJobPtr dropped;
+    pipeline.submit(makeJob(i), dropped);
+  }
+  pipeline.waitIdle();
+
+  EXPECT(!rec.m_spilled.empty());
+  EXPECT(rec.m_finished.size() + rec.m_spilled.size() == 20);
+  EXPECT(rec.m_finished.front() == 0);
+
+  for (std::thread::id id : rec.m_spillThreads) {
+    EXPECT(id != std::this_thread::get_id());
+  }
+
+  CapturePipeline::StageStatus spill = pipeline.spillStatus();
+  EXPECT(spill.m_processed == rec.m_spilled.size());
+  EXPECT(spill.m_depth == 0);
+  EXPECT(spill.m_capacity == 2);
+}
+
+
+// After a failure, or a stage deciding to skip the capture, only the
+// last stage still runs.
+static void testError(ThreadPool &pool)
+{
+  std::atomic<int> middleRuns{0};
+  std::atomic<int> lastRuns{0};
+
+  CapturePipeline pipeline(pool, OP_BLOCK);
+  pipeline.addStage("fail", 1, [](CaptureJob &job) {
+    if (job.m_id == 1) {
+      job.m_error = "disk full";
+    }
+    else {
+      job.m_skip = true;
+    }
+  });
+  pipeline.addStage("middle", 1, [&](CaptureJob &) { ++middleRuns; });
+  pipeline.addStage("report", 1, [&](CaptureJob &job) {
+    EXPECT(job.m_id == 1? job.m_error == "disk full" :
+                          job.m_skip && job.m_error.empty());
+    ++lastRuns;
+  });
+
+  CaptureJobPtr dropped;
+  pipeline.submit(makeJob(1), dropped);
+  pipeline.submit(makeJob(2), dropped);
+  pipeline.waitIdle();
+
+  EXPECT(middleRuns == 0);
+  EXPECT(lastRuns == 2);
+}
+
+
+// A stage with several workers runs that many jobs at once, and no
+// more, and every job still reaches the end.
+static void testParallelStage(ThreadPool &pool)
+{
+  Recorder rec;
+  std::atomic<int> running{0};
+  std::atomic<int> maxRunning{0};
+
+  CapturePipeline pipeline(pool, OP_BLOCK);
+  pipeline.addStage("wide", 3, [&](CaptureJob &) {
+    int n = ++running;
+    maxRunning = std::max<int>(maxRunning, n);
+    sleepMs(20);
+    --running;
+  }, 3 /*workers*/);
+  pipeline.addStage("last", 3, [&](CaptureJob &job) {
+    rec.finish(job);
+  });
+
+  for (std::uint64_t i = 0; i < 9; ++i) {
+    CaptureJobPtr dropped;
+    pipeline.submit(makeJob(i), dropped);
+  }
+  pipeline.waitIdle();
+
+  EXPECT(maxRunning > 1);
+  EXPECT(maxRunning <= 3);
+  EXPECT(rec.m_finished.size() == 9);
+}
+
+
+static void testPolicyNames()
+{
+  for (int i = 0; i < NUM_OVERLOAD_POLICIES; ++i) {
+    OverloadPolicy p;
+    EXPECT(parseOverloadPolicy(toString((OverloadPolicy)i), p));
+    EXPECT(p == i);
+  }
+
+  OverloadPolicy p;
+  EXPECT(!parseOverloadPolicy("explode", p));
+}
+
+
+int main()
+{
+  ThreadPool pool(4);
+
+  testBlock(pool);
+  testDrop(pool);
+  testSpill(pool);
+  testError(pool);
+  testParallelStage(pool);
+  testPolicyNames();
+
+  if (s_failures) {
+    std::cout << "capture-pipeline-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "capture-pipeline-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,325 @@
+// capture-pipeline.cc
+// Code for `capture-pipeline` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "capture-pipeline.h"          // this module
+
+#include "perf-counters.h"             // perfHistogram, etc.
+#include "timeline.h"                  // TIMELINE_SPAN
+
+#include <cassert>                     // assert
+#include <utility>                     // std::move
+
+
+char const *toString(OverloadPolicy policy)
+{
+  static char const * const names[] = {
+    "block",
+    "drop",
+    "spill",
+  };
+  static_assert(TABLESIZE(names) == NUM_OVERLOAD_POLICIES);
+
+  assert(0 <= policy && policy < NUM_OVERLOAD_POLICIES);
+  return names[policy];
+}
+
+
+bool parseOverloadPolicy(std::string const &str,
+                         OverloadPolicy &policy /*OUT*/)
+{
+  for (int i = 0; i < NUM_OVERLOAD_POLICIES; ++i) {
+    if (str == toString((OverloadPolicy)i)) {
+      policy = (OverloadPolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+CapturePipeline::CapturePipeline(ThreadPool &pool, OverloadPolicy policy)
+  : m_pool(pool),
+    m_mutex(),
+    m_policy(policy),
+    m_progressCV(),
+    m_stages(),
+    m_spill(),
+    m_inFlight(0)
+{
+  m_spill.m_name = "spill";
+  m_spill.m_capacity = 1;
+  m_spill.m_reserved = 0;
+  m_spill.m_workers = 1;
+  m_spill.m_running = 0;
+  m_spill.m_processed = 0;
+  m_spill.m_latency = &perfHistogram("pipeline.spill.ns");
+  m_spill.m_depthGauge = &perfGauge("pipeline.spill.depth");
+}
+
+
+CapturePipeline::~CapturePipeline()
+{
+  waitIdle();
+}
+
+
+void CapturePipeline::addStage(char const *name, std::size_t capacity,
+                               StageFunc func, std::size_t workers)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  assert(m_inFlight == 0);
+  assert(capacity >= 1);
+  assert(workers >= 1);
+
+  std::string prefix = std::string("pipeline.") + name;
+
+  Stage stage;
+  stage.m_name = name;
+  stage.m_func = std::move(func);
+  stage.m_capacity = capacity;
+  stage.m_reserved = 0;
+  stage.m_workers = workers;
+  stage.m_running = 0;
+  stage.m_processed = 0;
+  stage.m_latency = &perfHistogram(prefix + ".ns");
+  stage.m_depthGauge = &perfGauge(prefix + ".depth");
+  if (m_stages.empty()) {
+    m_spill.m_capacity = capacity;
+  }
+  m_stages.push_back(std::move(stage));
+}
+
+
+void CapturePipeline::setSpillFunc(StageFunc func)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_spill.m_func = std::move(func);
+}
+
+
+OverloadPolicy CapturePipeline::policy() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_policy;
+}
+
+
+void CapturePipeline::setPolicy(OverloadPolicy policy)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_policy = policy;
+}
+
+
+/*static*/ bool CapturePipeline::isFull(Stage const &stage)
+{
+  return stage.m_queue.size() + stage.m_reserved >= stage.m_capacity;
+}
+
+
+CapturePipeline::SubmitResult CapturePipeline::submit(
+  CaptureJobPtr job, CaptureJobPtr &dropped /*OUT*/)
+{
+  static PerfCounter &droppedCount = perfCounter("pipeline.dropped");
+  static PerfCounter &spilledCount = perfCounter("pipeline.spilled");
+  static LatencyHistogram &blockedTime =
+    perfHistogram("pipeline.blocked.ns");
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  assert(!m_stages.empty());
+  Stage &first = m_stages.front();
+
+  SubmitResult ret = SR_QUEUED;
+  if (isFull(first)) {
+    switch (m_policy) {
+      default:
+        assert(!"invalid policy");
+        // fallthrough
+
+      case OP_BLOCK: {
+        TIMELINE_SPAN("pipelineBlocked");
+        std::uint64_t start = perfNowNs();
+        m_progressCV.wait(lock, [&] { return !isFull(first); });
+        blockedTime.record(perfNowNs() - start);
+        break;
+      }
+
+      case OP_DROP_OLDEST:
+        dropped = std::move(first.m_queue.front());
+        first.m_queue.pop_front();
+        --m_inFlight;
+        droppedCount.inc();
+        ret = SR_QUEUED_AFTER_DROP;
+        break;
+
+      case OP_SPILL: {
+        // Waiting here means the disk is behind by two full queues.
+        if (isFull(m_spill)) {
+          TIMELINE_SPAN("pipelineBlocked");
+          std::uint64_t start = perfNowNs();
+          m_progressCV.wait(lock, [&] {
+            return !isFull(first) || !isFull(m_spill);
+          });
+          blockedTime.record(perfNowNs() - start);
+        }
+        if (isFull(first)) {
+          assert(m_spill.m_func);
+          job->m_submitNs = perfNowNs();
+          m_spill.m_queue.push_back(std::move(job));
+          ++m_inFlight;
+          spilledCount.inc();
+          pumpLocked();
+          return SR_SPILLED;
+        }
+        break;
+      }
+    }
+  }
+
+  job->m_submitNs = perfNowNs();
+  first.m_queue.push_back(std::move(job));
+  ++m_inFlight;
+  pumpLocked();
+
+  return ret;
+}
+
+
+void CapturePipeline::pumpLocked()
+{
+  // Work from the back, so that jobs finishing make room for those
+  // behind them in the same pass.
+  for (std::size_t i = m_stages.size(); i-- > 0; ) {
+    Stage &stage = m_stages[i];
+    while (stage.m_running < stage.m_workers && !stage.m_queue.empty()) {
+      if (i+1 < m_stages.size()) {
+        Stage &next = m_stages[i+1];
+        if (isFull(next)) {
+          // Backpressure: wait for the next stage to drain.
+          break;
+        }
+        ++next.m_reserved;
+      }
+
+      CaptureJobPtr job = std::move(stage.m_queue.front());
+      stage.m_queue.pop_front();
+      ++stage.m_running;
+
+      m_pool.submit(TP_CAPTURE, [this, i, job](PoolTask const &) {
+        runStage(i, job);
+      });
+    }
+
+    stage.m_depthGauge->set(stage.m_queue.size());
+  }
+
+  if (m_spill.m_running == 0 && !m_spill.m_queue.empty()) {
+    CaptureJobPtr job = std::move(m_spill.m_queue.front());
+    m_spill.m_queue.pop_front();
+    ++m_spill.m_running;
+
+    m_pool.submit(TP_CAPTURE, [this, job](PoolTask const &) {
+      runSpill(job);
+    });
+  }
+  m_spill.m_depthGauge->set(m_spill.m_queue.size());
+}
+
+
+void CapturePipeline::runStage(std::size_t index, CaptureJobPtr job)
+{
+  // The stage list is fixed while jobs are in flight, so this does not
+  // need the lock.
+  Stage &stage = m_stages[index];
+  bool isLast = (index+1 == m_stages.size());
+
+  if ((job->m_error.empty() && !job->m_skip) || isLast) {
+    TIMELINE_SPAN(stage.m_name);
+    std::uint64_t start = perfNowNs();
+    stage.m_func(*job);
+    stage.m_latency->record(perfNowNs() - start);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    --stage.m_running;
+    ++stage.m_processed;
+
+    if (!isLast) {
+      Stage &next = m_stages[index+1];
+      --next.m_reserved;
+      next.m_queue.push_back(std::move(job));
+    }
+    else {
+      static LatencyHistogram &totalTime =
+        perfHistogram("pipeline.total.ns");
+      totalTime.record(perfNowNs() - job->m_submitNs);
+      --m_inFlight;
+    }
+
+    pumpLocked();
+
+    // Notify while holding the lock, since once it is released, a
+    // waiter in the destructor can return and destroy the CV.
+    m_progressCV.notify_all();
+  }
+}
+
+
+void CapturePipeline::runSpill(CaptureJobPtr job)
+{
+  {
+    TIMELINE_SPAN("pipelineSpill");
+    std::uint64_t start = perfNowNs();
+    m_spill.m_func(*job);
+    m_spill.m_latency->record(perfNowNs() - start);
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  --m_spill.m_running;
+  ++m_spill.m_processed;
+  --m_inFlight;
+  pumpLocked();
+  m_progressCV.notify_all();
+}
+
+
+void CapturePipeline::waitIdle()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_progressCV.wait(lock, [this] { return m_inFlight == 0; });
+}
+
+
+std::size_t CapturePipeline::inFlightCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_inFlight;
+}
+
+
+std::vector<CapturePipeline::StageStatus> CapturePipeline::stageStatus() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::vector<StageStatus> ret;
+  for (Stage const &s : m_stages) {
+    ret.push_back(StageStatus{s.m_name, s.m_queue.size(), s.m_capacity,
+                              s.m_running, s.m_processed});
+  }
+  return ret;
+}
+
+
+CapturePipeline::StageStatus CapturePipeline::spillStatus() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return StageStatus{m_spill.m_name, m_spill.m_queue.size(),
+                     m_spill.m_capacity, m_spill.m_running,
+                     m_spill.m_processed};
+}
+
+
+// EOF
@@ -0,0 +1,256 @@
+// capture-pipeline.h
+// Staged processing of captured frames with bounded queues.
+
+// See license.txt for copyright and terms of use.
+
+// A capture is grabbed on the UI thread and then handed to a
+// `CapturePipeline`, which carries it through a fixed sequence of
+// stages (convert, blank, hash, thumbnail, sharpness, write, index)
+// on the `ThreadPool`.  Each stage processes one job at a time, in
+// order, and has a bounded input queue.  A stage may instead be given
+// several workers, so that jobs submitted together (such as the
+// monitors of one capture) are processed in parallel there, at the
+// cost of leaving it in any order.  A stage whose successor's queue is
+// full waits, so when the disk falls behind, the queues fill from the
+// back, and at most a fixed number of frames are ever held in memory.
+//
+// When the first queue is full, `submit` applies the `OverloadPolicy`.
+// Under `OP_SPILL`, the job skips the stages and joins a separate
+// queue, as long as the first stage's, whose jobs the spill function
+// handles one at a time on the pool.
+//
+// Each stage reports, through `perf-counters`, a latency histogram
+// "pipeline.<stage>.ns" and a queue depth gauge
+// "pipeline.<stage>.depth".
+//
+// This module does not depend on the Windows API.
+
+#ifndef CAPTURE_PIPELINE_H
+#define CAPTURE_PIPELINE_H
+
+#include "blank-frame.h"               // BlankFramePolicy, BlankKind
+#include "pixel-image.h"               // ContentHash, PixelImage
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+#include "thread-pool.h"               // ThreadPool
+
+#include <condition_variable>          // std::condition_variable
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <deque>                       // std::deque
+#include <functional>                  // std::function
+#include <memory>                      // std::shared_ptr
+#include <mutex>                       // std::mutex
+#include <string>                      // std::{string, wstring}
+#include <vector>                      // std::vector
+
+
+class LatencyHistogram;                // perf-counters.h
+class PerfGauge;                       // perf-counters.h
+
+
+// What to do with a new capture when the first stage's queue is full.
+enum OverloadPolicy {
+  // Wait for room.  This stalls the caller, normally the UI thread.
+  OP_BLOCK,
+
+  // Discard the oldest capture that has not started processing.
+  OP_DROP_OLDEST,
+
+  // Bypass the stages, handing the frame to the spill function on the
+  // pool.  If its queue is full too, wait for room.
+  OP_SPILL,
+
+  NUM_OVERLOAD_POLICIES
+};
+
+// Return "block", "drop", or "spill".
+char const *toString(OverloadPolicy policy);
+
+// Parse the result of `toString`.  Return false if `str` is not one of
+// those.
+bool parseOverloadPolicy(std::string const &str,
+                         OverloadPolicy &policy /*OUT*/);
+
+
+// One capture moving through the pipeline.  Each stage reads what
+// earlier ones produced and adds its own part.
+struct CaptureJob {
+  // Identifies the capture to whoever submitted it.
+  std::uint64_t m_id = 0;
+
+  // File the capture will be written to.
+  std::wstring m_fname;
+
+  // Format it is written in.
+  BmpFormat m_bmpFormat = BF_32;
+
+  // What the blank stage does if the frame is blank.
+  BlankFramePolicy m_blankPolicy = BFP_OFF;
+
+  // The full frame.
+  PixelImage m_image;
+
+  // Set by the hash stage.
+  ContentHash m_hash;
+
+  // Set by a write stage that found an identical capture already saved
+  // and reused its file, which `m_fname` then names, rather than
+  // writing a new one.
+  bool m_reusedFile = false;
+
+  // Set by the thumbnail stage.
+  PixelImage m_thumbnail;
+
+  // Set by the thumbnail stage, from the thumbnail.  See
+  // `perceptualHash`.
+  std::uint64_t m_perceptualHash = 0;
+
+  // Set by the sharpness stage.  See `imageSharpness`.
+  double m_sharpness = 0;
+
+  // Set by the blank stage.  See `classifyFrame`.
+  BlankKind m_blank = BK_NONE;
+
+  // If true, a stage decided the capture is not worth keeping, and, as
+  // after an error, later stages other than the last are skipped.
+  bool m_skip = false;
+
+  // If not empty, a stage failed, and later stages other than the last
+  // are skipped.
+  std::string m_error;
+
+  // When `submit` accepted the job, on the `perfNowNs` clock.
+  std::uint64_t m_submitNs = 0;
+};
+
+using CaptureJobPtr = std::shared_ptr<CaptureJob>;
+
+
+class CapturePipeline {
+  NO_OBJECT_COPIES(CapturePipeline);
+
+public:      // types
+  // Work done by one stage.  It runs on a pool worker.
+  using StageFunc = std::function<void (CaptureJob &)>;
+
+  // Result of `submit`.
+  enum SubmitResult {
+    SR_QUEUED,
+    SR_QUEUED_AFTER_DROP,
+    SR_SPILLED,
+  };
+
+  // Snapshot of one stage, for diagnostics.
+  struct StageStatus {
+    char const *m_name;
+    std::size_t m_depth;
+    std::size_t m_capacity;
+    std::size_t m_running;
+    std::uint64_t m_processed;
+  };
+
+private:     // types
+  struct Stage {
+    // Name, with static storage duration.
+    char const *m_name;
+
+    StageFunc m_func;
+
+    // Jobs waiting for this stage, oldest first.
+    std::deque<CaptureJobPtr> m_queue;
+
+    // Maximum `m_queue.size() + m_reserved`.
+    std::size_t m_capacity;
+
+    // Number of jobs being processed by the previous stage that have
+    // been promised a place in `m_queue`.
+    std::size_t m_reserved;
+
+    // Most jobs this stage processes at once.
+    std::size_t m_workers;
+
+    // Number of jobs being processed by this stage.
+    std::size_t m_running;
+
+    // Number of jobs this stage has finished.
+    std::uint64_t m_processed;
+
+    // Statistics.
+    LatencyHistogram *m_latency;
+    PerfGauge *m_depthGauge;
+  };
+
+private:     // data
+  ThreadPool &m_pool;
+
+  // Protects everything below.
+  mutable std::mutex m_mutex;
+
+  OverloadPolicy m_policy;
+
+  // Signalled whenever a job leaves a queue or the pipeline.
+  std::condition_variable m_progressCV;
+
+  // Stages in order.  Fixed once the first job is submitted.
+  std::vector<Stage> m_stages;
+
+  // Jobs waiting for the spill function, which is `m_spill.m_func`.
+  // It has one worker, and its queue has the capacity of the first
+  // stage's, which `addStage` copies.
+  Stage m_spill;
+
+  // Number of jobs accepted and not yet finished.
+  std::size_t m_inFlight;
+
+private:     // methods
+  // True if `stage` has no room for another job.
+  static bool isFull(Stage const &stage);
+
+  // Start whatever stages can start.  Caller must hold `m_mutex`.
+  void pumpLocked();
+
+  // Run stage `index` on `job`, then pass it on.  Runs on a worker.
+  void runStage(std::size_t index, CaptureJobPtr job);
+
+  // Run the spill function on `job`.  Runs on a worker.
+  void runSpill(CaptureJobPtr job);
+
+public:      // methods
+  CapturePipeline(ThreadPool &pool, OverloadPolicy policy);
+
+  // Waits for jobs in flight to finish.
+  ~CapturePipeline();
+
+  // Append a stage whose input queue holds up to `capacity` jobs, and
+  // which processes up to `workers` of them at once.
+  void addStage(char const *name, std::size_t capacity, StageFunc func,
+                std::size_t workers = 1);
+
+  // Set the function used by `OP_SPILL`.  It runs on a pool worker,
+  // and must report the job's result itself, as the last stage does.
+  // Set it before submitting anything.
+  void setSpillFunc(StageFunc func);
+
+  OverloadPolicy policy() const;
+  void setPolicy(OverloadPolicy policy);
+
+  // Accept `job`, applying the overload policy if the first queue is
+  // full.  If a job is dropped to make room, set `dropped` to it.
+  // The job itself is finished later, on the pool.
+  SubmitResult submit(CaptureJobPtr job, CaptureJobPtr &dropped /*OUT*/);
+
+  // Block until every accepted job has left the last stage or the
+  // spill function.
+  void waitIdle();
+
+  // Number of jobs accepted and not yet finished.
+  std::size_t inFlightCount() const;
+
+  std::vector<StageStatus> stageStatus() const;
+
+  // Same, for the queue of jobs waiting for the spill function.
+  StageStatus spillStatus() const;
+};
+
+
+#endif // CAPTURE_PIPELINE_H
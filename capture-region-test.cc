@@ -0,0 +1,122 @@
+// capture-region-test.cc
+// Tests for `capture-region`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "capture-region.h"            // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <iostream>                    // std::cout
+
+
+static void testKeyNames()
+{
+  EXPECT(parseKeyName("F1") == 0x70);
+  EXPECT(parseKeyName("f9") == 0x78);
+  EXPECT(parseKeyName("F24") == 0x87);
+  EXPECT(parseKeyName("m") == 'M');
+  EXPECT(parseKeyName("7") == '7');
+
+  EXPECT(parseKeyName("") == 0);
+  EXPECT(parseKeyName("F0") == 0);
+  EXPECT(parseKeyName("F25") == 0);
+  EXPECT(parseKeyName("F1x") == 0);
+  EXPECT(parseKeyName("Esc") == 0);
+  EXPECT(parseKeyName("-") == 0);
+
+  for (char const *name : { "F1", "F9", "F24", "A", "Z", "0", "9" }) {
+    EXPECT(keyName(parseKeyName(name)) == name);
+  }
+  EXPECT(keyName(0) == "");
+  EXPECT(keyName(0x0D) == "");
+}
+
+
+static void testParse()
+{
+  std::vector<CaptureRegion> regions;
+  EXPECT(parseCaptureRegions(
+    "minimap:F9:3520,0,320,320;;chat::0,1760,900,400;", regions) == "");
+  EXPECT(regions.size() == 2);
+  if (regions.size() == 2) {
+    EXPECT(regions[0].m_name == "minimap" && regions[0].m_vk == 0x78);
+    EXPECT(regions[0].m_x == 3520 && regions[0].m_y == 0 &&
+           regions[0].m_width == 320 && regions[0].m_height == 320);
+    EXPECT(regions[1].m_name == "chat" && regions[1].m_vk == 0);
+    EXPECT(regions[1].m_height == 400);
+  }
+
+  EXPECT(parseCaptureRegions("", regions) == "" && regions.empty());
+
+  // Each of these is malformed.
+  for (char const *bad : {
+         "minimap",
+         "minimap:F9",
+         ":F9:0,0,1,1",
+         "a:F99:0,0,1,1",
+         "a:F9:0,0,1",
+         "a:F9:0,0,1,1,1",
+         "a:F9:0,0,1,x",
+         "a:F9:0,0,0,1",
+         "a:F9:0,0,1,99999999999",
+         "a:F9:0,0,1,1;a:F8:0,0,1,1",
+         "a:F9:0,0,1,1;b:f9:0,0,1,1",
+       }) {
+    std::string error = parseCaptureRegions(bad, regions);
+    if (error.empty()) {
+      std::cout << "accepted: " << bad << "\n";
+      ++s_failures;
+    }
+  }
+}
+
+
+static void testClip()
+{
+  CaptureRegion r;
+  r.m_x = 1800;
+  r.m_y = -20;
+  r.m_width = 300;
+  r.m_height = 100;
+
+  int x, y, w, h;
+  EXPECT(clipCaptureRegion(r, 0, 0, 1920, 1080, x, y, w, h));
+  EXPECT(x == 1800 && y == 0 && w == 120 && h == 80);
+
+  r.m_x = 1920;
+  EXPECT(!clipCaptureRegion(r, 0, 0, 1920, 1080, x, y, w, h));
+
+  // On a second monitor to the right of the primary.
+  EXPECT(clipCaptureRegion(r, 0, 0, 3840, 1080, x, y, w, h));
+  EXPECT(x == 1920 && y == 0 && w == 300 && h == 80);
+
+  // Partly on one to the left, at negative coordinates.
+  r.m_x = -2000;
+  EXPECT(clipCaptureRegion(r, -1920, 0, 1920, 1080, x, y, w, h));
+  EXPECT(x == -1920 && y == 0 && w == 220 && h == 80);
+
+  r.m_x = 2147483000;
+  r.m_width = 2000;
+  EXPECT(!clipCaptureRegion(r, 0, 0, 1920, 1080, x, y, w, h));
+}
+
+
+int main()
+{
+  testKeyNames();
+  testParse();
+  testClip();
+
+  if (s_failures) {
+    std::cout << "capture-region-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "capture-region-test: ok\n";
+  return 0;
+}
+
+
+// EOF
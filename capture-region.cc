@@ -0,0 +1,177 @@
+// capture-region.cc
+// Code for `capture-region` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "capture-region.h"            // this module
+
+#include <algorithm>                   // std::{max, min}
+#include <cerrno>                      // errno
+#include <climits>                     // INT_{MIN, MAX}
+#include <cstdlib>                     // std::strtol
+#include <set>                         // std::set
+
+
+// Virtual key code of F1.  The others follow it.
+static int const c_vkF1 = 0x70;
+
+
+int parseKeyName(std::string const &name)
+{
+  if (name.size() == 1) {
+    // Letters and digits are their own (uppercase) codes.
+    char c = name[0];
+    if ('a' <= c && c <= 'z') {
+      return c - 'a' + 'A';
+    }
+    if (('A' <= c && c <= 'Z') || ('0' <= c && c <= '9')) {
+      return c;
+    }
+    return 0;
+  }
+
+  if (name.size() <= 3 && (name[0] == 'F' || name[0] == 'f')) {
+    int n = 0;
+    for (std::size_t i = 1; i < name.size(); ++i) {
+      if (name[i] < '0' || name[i] > '9') {
+        return 0;
+      }
+      n = n*10 + (name[i] - '0');
+    }
+    if (1 <= n && n <= 24) {
+      return c_vkF1 + n - 1;
+    }
+  }
+
+  return 0;
+}
+
+
+std::string keyName(int vk)
+{
+  if (('A' <= vk && vk <= 'Z') || ('0' <= vk && vk <= '9')) {
+    return std::string(1, (char)vk);
+  }
+  if (c_vkF1 <= vk && vk < c_vkF1 + 24) {
+    return "F" + std::to_string(vk - c_vkF1 + 1);
+  }
+  return "";
+}
+
+
+// Split `str` at each `sep`.
+static std::vector<std::string> split(std::string const &str, char sep)
+{
+  std::vector<std::string> ret;
+  std::size_t start = 0;
+  for (;;) {
+    std::size_t end = str.find(sep, start);
+    if (end == std::string::npos) {
+      ret.push_back(str.substr(start));
+      return ret;
+    }
+    ret.push_back(str.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+
+// Parse all of `str` as a decimal `int`.
+static bool parseInt(std::string const &str, int &value /*OUT*/)
+{
+  if (str.empty()) {
+    return false;
+  }
+
+  char *end;
+  errno = 0;
+  long v = std::strtol(str.c_str(), &end, 10);
+  if (*end != 0 || errno != 0 || v < INT_MIN || v > INT_MAX) {
+    return false;
+  }
+  value = (int)v;
+  return true;
+}
+
+
+std::string parseCaptureRegions(std::string const &spec,
+                                std::vector<CaptureRegion> &regions)
+{
+  regions.clear();
+  std::set<std::string> names;
+  std::set<int> keys;
+
+  for (std::string const &entry : split(spec, ';')) {
+    if (entry.empty()) {
+      continue;
+    }
+
+    std::vector<std::string> fields = split(entry, ':');
+    if (fields.size() != 3) {
+      return "\"" + entry + "\": expected name:key:x,y,width,height";
+    }
+
+    CaptureRegion region;
+    region.m_name = fields[0];
+    if (region.m_name.empty()) {
+      return "\"" + entry + "\": the name is empty";
+    }
+    if (!names.insert(region.m_name).second) {
+      return "\"" + entry + "\": the name is used twice";
+    }
+
+    if (!fields[1].empty()) {
+      region.m_vk = parseKeyName(fields[1]);
+      if (region.m_vk == 0) {
+        return "\"" + entry + "\": unknown key \"" + fields[1] + "\"";
+      }
+      if (!keys.insert(region.m_vk).second) {
+        return "\"" + entry + "\": the key is used twice";
+      }
+    }
+
+    std::vector<std::string> coords = split(fields[2], ',');
+    if (coords.size() != 4 ||
+        !parseInt(coords[0], region.m_x) ||
+        !parseInt(coords[1], region.m_y) ||
+        !parseInt(coords[2], region.m_width) ||
+        !parseInt(coords[3], region.m_height)) {
+      return "\"" + entry + "\": expected four integers x,y,width,height";
+    }
+    if (region.m_width <= 0 || region.m_height <= 0) {
+      return "\"" + entry + "\": the size must be positive";
+    }
+
+    regions.push_back(region);
+  }
+
+  return "";
+}
+
+
+bool clipCaptureRegion(CaptureRegion const &region,
+                       int screenLeft, int screenTop,
+                       int screenRight, int screenBottom,
+                       int &x, int &y, int &w, int &h)
+{
+  // Computed in 64 bits, since the rectangle can be anywhere.
+  long long left = std::max<long long>(region.m_x, screenLeft);
+  long long top = std::max<long long>(region.m_y, screenTop);
+  long long right = std::min<long long>(
+    (long long)region.m_x + region.m_width, screenRight);
+  long long bottom = std::min<long long>(
+    (long long)region.m_y + region.m_height, screenBottom);
+
+  if (left >= right || top >= bottom) {
+    return false;
+  }
+
+  x = (int)left;
+  y = (int)top;
+  w = (int)(right - left);
+  h = (int)(bottom - top);
+  return true;
+}
+
+
+// EOF
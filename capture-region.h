@@ -0,0 +1,71 @@
+// capture-region.h
+// Named screen rectangles to capture instead of the whole screen.
+
+// See license.txt for copyright and terms of use.
+
+// Often only part of the screen matters: a minimap, an inventory panel,
+// a chat box.  A `CaptureRegion` names such a rectangle and the key
+// that captures it.  Capturing less cuts the cost of the grab, of the
+// encode and of the file in proportion to the area.
+//
+// Regions are written as a semicolon-separated list of
+// "name:key:x,y,width,height", for example
+//
+//   minimap:F9:3520,0,320,320;chat:F8:0,1760,900,400
+//
+// where `key` is "F1" through "F24", a letter, a digit, or nothing for
+// a region captured only from the menu.
+//
+// This module does not depend on the Windows API.  Key names map to
+// Windows virtual key codes, which are fixed numbers.
+
+#ifndef CAPTURE_REGION_H
+#define CAPTURE_REGION_H
+
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// One named rectangle.
+struct CaptureRegion {
+  std::string m_name;
+
+  // Virtual key code that captures it, or 0 for none.
+  int m_vk = 0;
+
+  // Rectangle in virtual-screen pixels, where the primary monitor's
+  // top left is 0, 0 and other monitors may be at negative coordinates.
+  int m_x = 0;
+  int m_y = 0;
+  int m_width = 0;
+  int m_height = 0;
+};
+
+
+// Return the virtual key code of the key called `name`, or 0 if it is
+// not one that can be bound to a region.
+int parseKeyName(std::string const &name);
+
+// Return the name of virtual key code `vk`, the inverse of
+// `parseKeyName`, or an empty string if there is none.
+std::string keyName(int vk);
+
+// Parse `spec`, in the format described above, into `regions`.  Return
+// an empty string on success, and otherwise a message describing the
+// first problem.
+std::string parseCaptureRegions(std::string const &spec,
+                                std::vector<CaptureRegion> &regions
+                                  /*OUT*/);
+
+// Intersect `region` with the screen rectangle from `screenLeft`,
+// `screenTop` to `screenRight`, `screenBottom` (exclusive), setting
+// `x`, `y`, `w` and `h` to the result.  Return false if nothing is
+// left.
+bool clipCaptureRegion(CaptureRegion const &region,
+                       int screenLeft, int screenTop,
+                       int screenRight, int screenBottom,
+                       int &x /*OUT*/, int &y /*OUT*/,
+                       int &w /*OUT*/, int &h /*OUT*/);
+
+
+#endif // CAPTURE_REGION_H
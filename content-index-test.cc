@@ -0,0 +1,132 @@
+// content-index-test.cc
+// Tests for `content-index`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "content-index.h"             // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <iostream>                    // std::cout
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+
+static ContentHash makeHash(std::uint64_t lo, std::uint64_t hi = 1)
+{
+  ContentHash h;
+  h.m_lo = lo;
+  h.m_hi = hi;
+  return h;
+}
+
+
+// References come and go, and the entry with them.
+static void testRefCounts()
+{
+  ContentIndex index;
+  ContentHash const a = makeHash(1);
+  std::wstring fname;
+
+  EXPECT(!index.acquire(a, fname));
+  index.add(a, L"a.bmp");
+  EXPECT(index.refCount(a) == 1);
+
+  EXPECT(index.acquire(a, fname) && fname == L"a.bmp");
+  EXPECT(index.refCount(a) == 2);
+
+  // Adding again keeps the first file.
+  index.add(a, L"other.bmp");
+  EXPECT(index.lookup(a, fname) && fname == L"a.bmp");
+  EXPECT(index.refCount(a) == 3);
+
+  EXPECT(index.release(a) == 2);
+  EXPECT(index.release(a) == 1);
+  EXPECT(index.release(a) == 0);
+  EXPECT(!index.lookup(a, fname));
+  EXPECT(index.size() == 0);
+
+  // Releasing what is not there does nothing.
+  EXPECT(index.release(a) == 0);
+  EXPECT(index.release(ContentHash()) == 0);
+}
+
+
+// Hashes differing in either half are different entries.
+static void testDistinct()
+{
+  ContentIndex index;
+  index.add(makeHash(1, 2), L"x");
+  index.add(makeHash(2, 1), L"y");
+  index.add(makeHash(1, 3), L"z");
+  EXPECT(index.size() == 3);
+
+  std::wstring fname;
+  EXPECT(index.lookup(makeHash(2, 1), fname) && fname == L"y");
+
+  index.clear();
+  EXPECT(index.size() == 0);
+}
+
+
+// Renaming applies only to the expected file.
+static void testRename()
+{
+  ContentIndex index;
+  ContentHash const a = makeHash(5);
+  index.add(a, L"a.bmp");
+
+  std::wstring fname;
+  index.rename(a, L"b.bmp", L"b.qoi");
+  EXPECT(index.lookup(a, fname) && fname == L"a.bmp");
+
+  index.rename(a, L"a.bmp", L"a.qoi");
+  EXPECT(index.lookup(a, fname) && fname == L"a.qoi");
+  EXPECT(index.refCount(a) == 1);
+}
+
+
+// Concurrent acquires and releases balance.
+static void testThreads()
+{
+  ContentIndex index;
+  ContentHash const a = makeHash(9);
+  index.add(a, L"a.bmp");
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&index, a]() {
+      for (int i = 0; i < 10000; ++i) {
+        std::wstring fname;
+        index.acquire(a, fname);
+        index.release(a);
+      }
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  EXPECT(index.refCount(a) == 1);
+}
+
+
+int main()
+{
+  testRefCounts();
+  testDistinct();
+  testRename();
+  testThreads();
+
+  if (s_failures) {
+    std::cout << "content-index-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "content-index-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,110 @@
+// content-index.cc
+// Code for `content-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "content-index.h"             // this module
+
+#include <cassert>                     // assert
+
+
+ContentIndex::ContentIndex()
+  : m_mutex(),
+    m_entries()
+{}
+
+
+bool ContentIndex::acquire(ContentHash const &h, std::wstring &fname)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  if (it == m_entries.end()) {
+    return false;
+  }
+
+  ++it->second.m_refs;
+  fname = it->second.m_fname;
+  return true;
+}
+
+
+void ContentIndex::add(ContentHash const &h, std::wstring const &fname)
+{
+  assert(!h.empty());
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  if (it == m_entries.end()) {
+    m_entries.emplace(h, Entry{fname, 1});
+  }
+  else {
+    ++it->second.m_refs;
+  }
+}
+
+
+int ContentIndex::release(ContentHash const &h)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  if (it == m_entries.end()) {
+    return 0;
+  }
+
+  int refs = --it->second.m_refs;
+  if (refs == 0) {
+    m_entries.erase(it);
+  }
+  return refs;
+}
+
+
+void ContentIndex::rename(ContentHash const &h,
+                          std::wstring const &oldName,
+                          std::wstring const &newName)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  if (it != m_entries.end() && it->second.m_fname == oldName) {
+    it->second.m_fname = newName;
+  }
+}
+
+
+bool ContentIndex::lookup(ContentHash const &h,
+                          std::wstring &fname) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  if (it == m_entries.end()) {
+    return false;
+  }
+
+  fname = it->second.m_fname;
+  return true;
+}
+
+
+int ContentIndex::refCount(ContentHash const &h) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(h);
+  return it == m_entries.end()? 0 : it->second.m_refs;
+}
+
+
+std::size_t ContentIndex::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+
+void ContentIndex::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.clear();
+}
+
+
+// EOF
@@ -0,0 +1,96 @@
+// content-index.h
+// Map from image content to the file holding it, with reference counts.
+
+// See license.txt for copyright and terms of use.
+
+// Capturing an unchanging screen, such as a paused game, twice gives
+// identical pixels.  Rather than write a second file, the new shot
+// shares the file of the first.  `ContentIndex` finds that file from
+// the `ContentHash` of the pixels, and counts the shots sharing each
+// file, so an entry lasts exactly as long as some shot refers to it.
+//
+// The index itself is not saved.  Each shot's hash is saved with it in
+// the list, and loading the list re-adds every shot, which is one map
+// insertion each.  A separate index file could disagree with the list
+// after a crash between writing the two.
+//
+// All methods are thread-safe: the capture pipeline's write stage
+// looks entries up on a pool worker while the UI thread adds and
+// releases them.
+//
+// This module does not depend on the Windows API.
+
+#ifndef CONTENT_INDEX_H
+#define CONTENT_INDEX_H
+
+#include "pixel-image.h"               // ContentHash
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <mutex>                       // std::mutex
+#include <string>                      // std::wstring
+#include <unordered_map>               // std::unordered_map
+
+
+class ContentIndex {
+  NO_OBJECT_COPIES(ContentIndex);
+
+private:     // types
+  struct Entry {
+    // File holding the content.
+    std::wstring m_fname;
+
+    // Number of shots referring to it.  Always positive.
+    int m_refs;
+  };
+
+  struct HashHasher {
+    std::size_t operator()(ContentHash const &h) const
+      { return (std::size_t)(h.m_lo ^ h.m_hi); }
+  };
+
+private:     // data
+  // Protects everything below.
+  mutable std::mutex m_mutex;
+
+  std::unordered_map<ContentHash, Entry, HashHasher> m_entries;
+
+public:      // methods
+  ContentIndex();
+
+  // If there is an entry for `h`, add a reference to it, set `fname`
+  // to its file, and return true.  Otherwise return false.
+  bool acquire(ContentHash const &h, std::wstring &fname /*OUT*/);
+
+  // Add a reference to the entry for `h`, creating it with `fname` if
+  // there is none.  An existing entry keeps its file.  `h` must not be
+  // empty.
+  void add(ContentHash const &h, std::wstring const &fname);
+
+  // Drop a reference to the entry for `h`, removing the entry when none
+  // remain.  Return the number remaining.  Doing nothing, and returning
+  // 0, if there is no entry makes it safe to call for any shot.
+  int release(ContentHash const &h);
+
+  // If the entry for `h` refers to `oldName`, make it refer to
+  // `newName`.  This is for when a file is replaced by another with
+  // the same content, as when it is archived.
+  void rename(ContentHash const &h, std::wstring const &oldName,
+              std::wstring const &newName);
+
+  // If there is an entry for `h`, set `fname` to its file and return
+  // true.
+  bool lookup(ContentHash const &h, std::wstring &fname /*OUT*/) const;
+
+  // Number of references to the entry for `h`, or 0 if none.
+  int refCount(ContentHash const &h) const;
+
+  // Number of entries.
+  std::size_t size() const;
+
+  // Remove every entry.
+  void clear();
+};
+
+
+#endif // CONTENT_INDEX_H
@@ -0,0 +1,109 @@
+// cpu-budget-test.cc
+// Tests for `cpu-budget`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "cpu-budget.h"                // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <cstdint>                     // std::uint64_t
+#include <iostream>                    // std::cout
+
+
+static std::uint64_t const c_ms = 1000000;
+
+
+// With no limit, nothing ever waits.
+static void testUnlimited()
+{
+  CpuBudget budget;
+  budget.charge(1000 * c_ms, 0);
+  EXPECT(budget.delayNs(0) == 0);
+}
+
+
+// Debt is repaid at the limit rate.
+static void testDebt()
+{
+  // 10% of a core over one second: 100 ms of credit at most.
+  CpuBudget budget(0.1);
+  EXPECT(budget.balanceNs(0) == 100 * c_ms);
+  EXPECT(budget.delayNs(0) == 0);
+
+  // Using 150 ms leaves 50 ms of debt, which takes 500 ms to repay.
+  budget.charge(150 * c_ms, 0);
+  std::uint64_t delay = budget.delayNs(0);
+  EXPECT(delay >= 500 * c_ms && delay <= 501 * c_ms);
+
+  EXPECT(budget.delayNs(250 * c_ms) > 0);
+  EXPECT(budget.delayNs(delay) == 0);
+}
+
+
+// Credit accumulates while idle, but only up to one window's worth.
+static void testCapacity()
+{
+  CpuBudget budget(0.1);
+  budget.charge(100 * c_ms, 0);
+  EXPECT(budget.balanceNs(0) == 0);
+
+  EXPECT(budget.balanceNs(500 * c_ms) == 50 * c_ms);
+  EXPECT(budget.balanceNs(10000 * c_ms) == 100 * c_ms);
+}
+
+
+// Lowering the limit clamps the balance; removing it stops waits.
+static void testSetLimit()
+{
+  CpuBudget budget(0.5);
+  budget.setLimit(0.1, 0);
+  EXPECT(budget.limit() == 0.1);
+  EXPECT(budget.balanceNs(0) == 100 * c_ms);
+
+  budget.charge(300 * c_ms, 0);
+  EXPECT(budget.delayNs(0) > 0);
+
+  budget.setLimit(0, 0);
+  EXPECT(budget.delayNs(0) == 0);
+
+  // Limiting again starts with full credit.
+  budget.setLimit(0.2, 0);
+  EXPECT(budget.balanceNs(0) == 200 * c_ms);
+}
+
+
+static void testThreadCpuTime()
+{
+  std::uint64_t start = threadCpuTimeNs();
+
+  // Spin until the clock has visibly advanced.
+  volatile std::uint64_t sink = 0;
+  for (std::uint64_t i = 0; threadCpuTimeNs() - start < 5 * c_ms; ++i) {
+    sink = sink + i;
+  }
+
+  EXPECT(threadCpuTimeNs() > start);
+}
+
+
+int main()
+{
+  testUnlimited();
+  testDebt();
+  testCapacity();
+  testSetLimit();
+  testThreadCpuTime();
+
+  if (s_failures) {
+    std::cout << "cpu-budget-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "cpu-budget-test: ok\n";
+  return 0;
+}
+
+
+// EOF
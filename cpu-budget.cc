@@ -0,0 +1,155 @@
+// cpu-budget.cc
+// Code for `cpu-budget` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "cpu-budget.h"                // this module
+
+#include <algorithm>                   // std::min
+
+#ifdef _WIN32
+#  include <windows.h>                 // QueryThreadCycleTime, etc.
+#  include <intrin.h>                  // __rdtsc
+#else
+#  include <time.h>                    // clock_gettime
+#endif
+
+
+CpuBudget::CpuBudget(double limit, std::uint64_t windowNs)
+  : m_mutex(),
+    m_limit(limit > 0? limit : 0),
+    m_windowNs(windowNs),
+    m_balanceNs(0),
+    m_lastRefillNs(0)
+{
+  // Start with a full bucket.
+  m_balanceNs = capacityNsLocked();
+}
+
+
+void CpuBudget::refillLocked(std::uint64_t nowNs)
+{
+  if (nowNs > m_lastRefillNs) {
+    m_balanceNs = std::min(capacityNsLocked(),
+      m_balanceNs + m_limit * (double)(nowNs - m_lastRefillNs));
+  }
+  m_lastRefillNs = nowNs;
+}
+
+
+void CpuBudget::setLimit(double limit, std::uint64_t nowNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  refillLocked(nowNs);
+
+  bool wasUnlimited = (m_limit == 0);
+  m_limit = limit > 0? limit : 0;
+  if (wasUnlimited) {
+    // Begin with a full bucket, as the constructor does.
+    m_balanceNs = capacityNsLocked();
+  }
+  else {
+    m_balanceNs = std::min(m_balanceNs, capacityNsLocked());
+  }
+}
+
+
+double CpuBudget::limit() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_limit;
+}
+
+
+void CpuBudget::setWindow(std::uint64_t windowNs, std::uint64_t nowNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  refillLocked(nowNs);
+
+  m_windowNs = windowNs;
+  m_balanceNs = std::min(m_balanceNs, capacityNsLocked());
+}
+
+
+std::uint64_t CpuBudget::delayNs(std::uint64_t nowNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_limit == 0) {
+    return 0;
+  }
+
+  refillLocked(nowNs);
+  if (m_balanceNs >= 0) {
+    return 0;
+  }
+
+  // Round up so that waiting this long is always enough.
+  return (std::uint64_t)(-m_balanceNs / m_limit) + 1;
+}
+
+
+void CpuBudget::charge(std::uint64_t cpuNs, std::uint64_t nowNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_limit == 0) {
+    return;
+  }
+
+  refillLocked(nowNs);
+  m_balanceNs -= (double)cpuNs;
+}
+
+
+std::int64_t CpuBudget::balanceNs(std::uint64_t nowNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  refillLocked(nowNs);
+  return (std::int64_t)m_balanceNs;
+}
+
+
+#ifdef _WIN32
+// Time stamp counter ticks per nanosecond, which is the rate
+// `QueryThreadCycleTime` counts at.  It is measured once, against
+// `QueryPerformanceCounter`, over a few milliseconds.
+static double tscTicksPerNs()
+{
+  static double const ratio = [] {
+    LARGE_INTEGER freq, qpcStart, qpcEnd;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&qpcStart);
+    unsigned __int64 tscStart = __rdtsc();
+    Sleep(10);
+    QueryPerformanceCounter(&qpcEnd);
+    unsigned __int64 tscEnd = __rdtsc();
+
+    double ns = (qpcEnd.QuadPart - qpcStart.QuadPart) * 1e9 /
+                freq.QuadPart;
+    return ns > 0? (tscEnd - tscStart) / ns : 1.0;
+  }();
+  return ratio;
+}
+#endif
+
+
+std::uint64_t threadCpuTimeNs()
+{
+#ifdef _WIN32
+  // Unlike `GetThreadTimes`, which only advances on scheduler ticks,
+  // this counts the cycles the thread actually ran.
+  ULONG64 cycles = 0;
+  if (!QueryThreadCycleTime(GetCurrentThread(), &cycles)) {
+    return 0;
+  }
+  return (std::uint64_t)(cycles / tscTicksPerNs());
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return (std::uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+// EOF
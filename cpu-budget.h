@@ -0,0 +1,91 @@
+// cpu-budget.h
+// Token bucket limiting the CPU time used by background work.
+
+// See license.txt for copyright and terms of use.
+
+// The game we run next to is what is being captured, so our background
+// work must not take enough of its CPU to cause the frame drops the
+// user is trying to record.  A `CpuBudget` allows a fraction of one
+// core, averaged over a window (one second by default).
+//
+// Credit accrues at `limit` nanoseconds per nanosecond, up to one
+// window's worth, so after a quiet period a backlog can run at full
+// speed until that is spent.  Work is charged the CPU time it actually
+// used after it finishes, which can drive the balance negative; then
+// `delayNs` says how long to wait for it to recover.  Work is delayed,
+// never dropped, so it catches up once the budget allows.
+//
+// Times are passed in explicitly, normally from `perfNowNs`, so the
+// arithmetic can be tested without waiting.
+//
+// This module does not depend on the Windows API, except to read the
+// thread CPU time there.
+
+#ifndef CPU_BUDGET_H
+#define CPU_BUDGET_H
+
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <cstdint>                     // std::{int64_t, uint64_t}
+#include <mutex>                       // std::mutex
+
+
+class CpuBudget {
+  NO_OBJECT_COPIES(CpuBudget);
+
+private:     // data
+  // Protects everything below.
+  mutable std::mutex m_mutex;
+
+  // Allowed fraction of one core, or 0 for no limit.
+  double m_limit;
+
+  // Period over which the limit is averaged.
+  std::uint64_t m_windowNs;
+
+  // Available CPU time.  Negative when in debt.
+  double m_balanceNs;
+
+  // When `m_balanceNs` was last brought up to date.
+  std::uint64_t m_lastRefillNs;
+
+private:     // methods
+  // Add the credit accrued up to `nowNs`.  Caller holds `m_mutex`.
+  void refillLocked(std::uint64_t nowNs);
+
+  // Most credit that can accumulate.
+  double capacityNsLocked() const { return m_limit * m_windowNs; }
+
+public:      // methods
+  // Allow `limit` of one core (e.g., 0.1 for 10%), averaged over
+  // `windowNs`.  A `limit` of 0 means no limit.
+  explicit CpuBudget(double limit = 0,
+                     std::uint64_t windowNs = 1000000000);
+
+  // Change the limit.  The balance is kept, but clamped to the new
+  // capacity, except that a budget that had no limit starts full.
+  void setLimit(double limit, std::uint64_t nowNs);
+  double limit() const;
+
+  // Change the averaging window, likewise clamping the balance.
+  void setWindow(std::uint64_t windowNs, std::uint64_t nowNs);
+
+  // Return how long to wait, from `nowNs`, before more work may start.
+  // Zero if it may start now.
+  std::uint64_t delayNs(std::uint64_t nowNs);
+
+  // Charge `cpuNs` of CPU time, used by work that finished at `nowNs`.
+  void charge(std::uint64_t cpuNs, std::uint64_t nowNs);
+
+  // Available CPU time at `nowNs`, negative when in debt.
+  std::int64_t balanceNs(std::uint64_t nowNs);
+};
+
+
+// CPU time consumed so far by the calling thread, in nanoseconds.  On
+// Windows this converts the thread's cycle count at the time stamp
+// counter rate, measured on the first call.
+std::uint64_t threadCpuTimeNs();
+
+
+#endif // CPU_BUDGET_H
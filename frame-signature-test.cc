@@ -0,0 +1,131 @@
+// frame-signature-test.cc
+// Tests for `frame-signature`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times the signature of a 4K frame.
+
+#include "frame-signature.h"           // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+
+
+// Cells hold the mean of the color channels, ignoring alpha, including
+// at widths that are not a multiple of the SIMD block.
+static void testAverages()
+{
+  for (int w : { 640, 641, 642, 643, 7 }) {
+    FrameSignature sig = computeFrameSignature(
+      solidImage(w, 360, 0xFF102030), 64, 36);
+    EXPECT(sig.m_cols == std::min(64, w) && sig.m_rows == 36);
+    bool allSame = true;
+    for (unsigned char cell : sig.m_cells) {
+      allSame = allSame && cell == (0x10 + 0x20 + 0x30) / 3;
+    }
+    EXPECT(allSame);
+  }
+
+  // GDI leaves alpha zero, so it must not matter.
+  EXPECT(computeFrameSignature(solidImage(100, 50, 0x00808080)).m_cells ==
+         computeFrameSignature(solidImage(100, 50, 0xFF808080)).m_cells);
+
+  EXPECT(computeFrameSignature(PixelImage()).empty());
+}
+
+
+// One changed cell out of the grid is that fraction of difference, and
+// small noise is none.
+static void testDifference()
+{
+  PixelImage a = solidImage(640, 360, 0xFF404040);
+  FrameSignature sigA = computeFrameSignature(a, 64, 36);
+  EXPECT(signatureDifference(sigA, sigA) == 0);
+
+  // Cells are 10 by 10.  Whiten cell (3, 2).
+  PixelImage b = a;
+  for (int y = 20; y < 30; ++y) {
+    for (int x = 30; x < 40; ++x) {
+      b.row(y)[x] = 0xFFFFFFFF;
+    }
+  }
+  FrameSignature sigB = computeFrameSignature(b, 64, 36);
+  EXPECT(signatureDifference(sigA, sigB) == 1.0 / (64*36));
+  EXPECT(sigB.m_cells[2*64 + 3] == 0xFF);
+
+  // Noise of a few levels everywhere.
+  PixelImage c = a;
+  for (std::size_t i = 0; i < c.m_pixels.size(); ++i) {
+    c.m_pixels[i] += 0x00010101 * (std::uint32_t)(i % 5);
+  }
+  EXPECT(signatureDifference(sigA, computeFrameSignature(c, 64, 36)) == 0);
+
+  // A different grid is entirely different.
+  EXPECT(signatureDifference(sigA, computeFrameSignature(a, 32, 18)) == 1);
+}
+
+
+// Images smaller than the grid get one cell per pixel.
+static void testTinyImage()
+{
+  PixelImage img = solidImage(3, 2, 0xFF000000);
+  img.row(1)[2] = 0xFFFFFFFF;
+
+  FrameSignature sig = computeFrameSignature(img);
+  EXPECT(sig.m_cols == 3 && sig.m_rows == 2);
+  EXPECT(sig.m_cells == std::vector<unsigned char>({ 0, 0, 0, 0, 0, 255 }));
+}
+
+
+// Time the signature of a 4K frame.
+static void bench()
+{
+  PixelImage img(3840, 2160);
+  for (std::size_t i = 0; i < img.m_pixels.size(); ++i) {
+    img.m_pixels[i] = (std::uint32_t)(i * 2654435761u);
+  }
+  int const iters = 200;
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  std::size_t sink = 0;
+  for (int i = 0; i < iters; ++i) {
+    sink += computeFrameSignature(img).m_cells[i % 64];
+  }
+  double us = std::chrono::duration<double, std::micro>(
+    Clock::now() - start).count() / iters;
+  std::cout << "4K signature: " << us << " us\n";
+
+  // Keep the loop from being optimized away.
+  if (sink == 0) {
+    std::cout << "unexpected\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testAverages();
+  testDifference();
+  testTinyImage();
+
+  if (s_failures) {
+    std::cout << "frame-signature-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "frame-signature-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
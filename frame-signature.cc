@@ -0,0 +1,117 @@
+// frame-signature.cc
+// Code for `frame-signature` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "frame-signature.h"           // this module
+
+#include <algorithm>                   // std::{clamp, fill}
+#include <cstdint>                     // std::{uint32_t, uint64_t}
+#include <cstdlib>                     // std::abs
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_sad_epu8, etc.
+#endif
+
+
+// Return the sum of B+G+R over the `n` pixels at `p`.
+static std::uint64_t sumBGR(std::uint32_t const *p, int n)
+{
+  std::uint64_t sum = 0;
+  int i = 0;
+
+#ifdef __SSE2__
+  // Clearing the alpha bytes and then summing absolute differences from
+  // zero adds up each half of the register, six color bytes per half,
+  // into a 64-bit lane.
+  __m128i const colorMask = _mm_set1_epi32(0x00FFFFFF);
+  __m128i const zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((__m128i const*)(p+i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_and_si128(v, colorMask),
+                                          zero));
+  }
+
+  alignas(16) std::uint64_t lanes[2];
+  _mm_store_si128((__m128i*)lanes, acc);
+  sum = lanes[0] + lanes[1];
+#endif // __SSE2__
+
+  for (; i < n; ++i) {
+    std::uint32_t px = p[i];
+    sum += (px & 0xFF) + ((px >> 8) & 0xFF) + ((px >> 16) & 0xFF);
+  }
+  return sum;
+}
+
+
+FrameSignature computeFrameSignature(PixelImage const &img,
+                                     int cols, int rows,
+                                     int linesPerRow)
+{
+  FrameSignature sig;
+  if (img.empty()) {
+    return sig;
+  }
+
+  cols = std::clamp(cols, 1, img.m_width);
+  rows = std::clamp(rows, 1, img.m_height);
+  sig.m_cols = cols;
+  sig.m_rows = rows;
+  sig.m_cells.resize((std::size_t)cols * rows);
+
+  // Left edge of each column of cells, plus the right edge of the last.
+  std::vector<int> left(cols + 1);
+  for (int c = 0; c <= cols; ++c) {
+    left[c] = (int)((long long)c * img.m_width / cols);
+  }
+
+  std::vector<std::uint64_t> sums(cols);
+  for (int r = 0; r < rows; ++r) {
+    int top = (int)((long long)r * img.m_height / rows);
+    int cellHeight = (int)((long long)(r+1) * img.m_height / rows) - top;
+    int lines = std::clamp(linesPerRow, 1, cellHeight);
+
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int k = 0; k < lines; ++k) {
+      // Center each line in an equal share of the cell height.
+      int y = top + (2*k + 1) * cellHeight / (2*lines);
+      std::uint32_t const *row = img.row(y);
+      for (int c = 0; c < cols; ++c) {
+        sums[c] += sumBGR(row + left[c], left[c+1] - left[c]);
+      }
+    }
+
+    for (int c = 0; c < cols; ++c) {
+      std::uint64_t count =
+        (std::uint64_t)(left[c+1] - left[c]) * lines * 3;
+      sig.m_cells[(std::size_t)r * cols + c] =
+        (unsigned char)(sums[c] / count);
+    }
+  }
+
+  return sig;
+}
+
+
+double signatureDifference(FrameSignature const &a,
+                           FrameSignature const &b,
+                           int tolerance)
+{
+  if (a.m_cols != b.m_cols || a.m_rows != b.m_rows) {
+    return 1.0;
+  }
+  if (a.m_cells.empty()) {
+    return 0.0;
+  }
+
+  std::size_t changed = 0;
+  for (std::size_t i = 0; i < a.m_cells.size(); ++i) {
+    changed += std::abs(a.m_cells[i] - b.m_cells[i]) > tolerance;
+  }
+  return (double)changed / a.m_cells.size();
+}
+
+
+// EOF
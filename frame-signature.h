@@ -0,0 +1,60 @@
+// frame-signature.h
+// Cheap downsampled signature of a frame, for change detection.
+
+// See license.txt for copyright and terms of use.
+
+// Automatic capture grabs a frame every few seconds, but a game sitting
+// on a menu yields the same frame over and over.  Before a candidate
+// frame is encoded, its signature is compared with that of the last
+// frame kept, and the candidate is dropped if too little changed.
+//
+// The signature divides the image into a grid of cells and records the
+// average brightness of each.  To stay well under a millisecond at 4K,
+// only a few evenly spaced scanlines of each row of cells are read,
+// about a fifteenth of a 4K image with the defaults.  A change confined
+// to unread scanlines goes unnoticed, which is acceptable for deciding
+// whether a screen is worth keeping.
+//
+// With SSE2, the pixel sums are computed four pixels at a time.
+//
+// This module does not depend on the Windows API.
+
+#ifndef FRAME_SIGNATURE_H
+#define FRAME_SIGNATURE_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <vector>                      // std::vector
+
+
+// Grid of average cell brightnesses.
+struct FrameSignature {
+  int m_cols = 0;
+  int m_rows = 0;
+
+  // For each cell, row by row, the mean of (B+G+R)/3 over the pixels
+  // read.
+  std::vector<unsigned char> m_cells;
+
+  bool empty() const { return m_cells.empty(); }
+};
+
+
+// Compute the signature of `img` on a `cols` by `rows` grid, reduced
+// if the image has fewer pixels than that, reading `linesPerRow`
+// scanlines of each row of cells.  The default cells are about 60
+// pixels square at 4K.
+FrameSignature computeFrameSignature(PixelImage const &img,
+                                     int cols = 64, int rows = 36,
+                                     int linesPerRow = 4);
+
+// Return the fraction of cells, from 0 to 1, whose values in `a` and
+// `b` differ by more than `tolerance`, which absorbs dithering and
+// compression noise.  Signatures of different grid sizes differ
+// completely.
+double signatureDifference(FrameSignature const &a,
+                           FrameSignature const &b,
+                           int tolerance = 8);
+
+
+#endif // FRAME_SIGNATURE_H
@@ -0,0 +1,250 @@
+// frame-source-test.cc
+// Tests for `frame-source`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also pushes synthetic frames through a capture pipeline built like
+// the app's, writing temporary files in each BMP format, and reports
+// the throughput and file sizes.  The frame size and count can follow,
+// as in "bench 3840 2160 200".
+
+#include "frame-source.h"              // module under test
+
+#include "blank-frame.h"               // classifyFrame
+#include "capture-pipeline.h"          // CapturePipeline
+#include "perceptual-hash.h"           // perceptualHash
+#include "perf-counters.h"             // perfHistogram, perfNowNs
+#include "sharpness.h"                 // imageSharpness
+#include "test-util.h"                 // EXPECT
+#include "thread-pool.h"               // ThreadPool
+
+#include <algorithm>                   // std::min
+#include <atomic>                      // std::atomic
+#include <cstdio>                      // std::{fclose, fwrite, tmpfile}
+#include <cstdlib>                     // std::atoi
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+
+
+// Rows per band when writing, as in the app.
+static int const c_bandRows = 64;
+
+
+// The same seed gives the same frames, and another seed does not.
+static void testDeterministic()
+{
+  SyntheticFrameSource a(320, 200, 3);
+  SyntheticFrameSource b(320, 200, 3);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT(grabFrame(a).m_pixels == grabFrame(b).m_pixels);
+  }
+  EXPECT(a.frameNumber() == 3);
+
+  SyntheticFrameSource c(320, 200, 4);
+  SyntheticFrameSource d(320, 200, 3);
+  EXPECT(grabFrame(c).m_pixels != grabFrame(d).m_pixels);
+}
+
+
+// Successive frames differ, but the HUD stays put, and alpha is zero
+// as GDI leaves it.
+static void testFramesChange()
+{
+  SyntheticFrameSource src(320, 200);
+  PixelImage f0 = grabFrame(src);
+  PixelImage f1 = grabFrame(src);
+
+  EXPECT(f0.m_width == 320 && f0.m_height == 200);
+  EXPECT(f0.m_pixels != f1.m_pixels);
+
+  // Center of the crosshair.
+  EXPECT(f0.at(160, 100) == 0x00FF00);
+  EXPECT(f1.at(160, 100) == 0x00FF00);
+
+  bool alphaZero = true;
+  for (std::uint32_t p : f0.m_pixels) {
+    alphaZero = alphaZero && (p >> 24) == 0;
+  }
+  EXPECT(alphaZero);
+}
+
+
+// A region is the same as that part of the whole frame.
+static void testRegion()
+{
+  SyntheticFrameSource whole(320, 200, 9);
+  SyntheticFrameSource part(320, 200, 9);
+
+  // Advance both, so scrolling and animation are not at zero.
+  grabFrame(whole);
+  grabFrame(part);
+
+  PixelImage full = grabFrame(whole);
+  PixelImage region;
+  part.grabRegion(250, 10, 70, 150, region);
+
+  EXPECT(region.m_width == 70 && region.m_height == 150);
+  bool same = true;
+  for (int y = 0; y < region.m_height; ++y) {
+    for (int x = 0; x < region.m_width; ++x) {
+      same = same && region.at(x, y) == full.at(250 + x, 10 + y);
+    }
+  }
+  EXPECT(same);
+}
+
+
+static void testParse()
+{
+  std::unique_ptr<FrameSource> src;
+  EXPECT(parseFrameSource("synthetic", src) == "");
+  EXPECT(src && src->width() == 1920 && src->height() == 1080);
+
+  EXPECT(parseFrameSource("synthetic:640x480", src) == "");
+  EXPECT(src && src->width() == 640 && src->height() == 480);
+
+  EXPECT(parseFrameSource("screen", src) != "");
+  EXPECT(parseFrameSource("synthetic:640", src) != "");
+  EXPECT(parseFrameSource("synthetic:640x480x", src) != "");
+  EXPECT(parseFrameSource("synthetic:0x480", src) != "");
+  EXPECT(parseFrameSource("syntheticx", src) != "");
+}
+
+
+// Capture `frames` synthetic frames of `w` by `h` and save them as
+// `fmt` through a pipeline with the app's stages, reporting the
+// throughput, the file size and the time spent in each stage.
+static void bench(int w, int h, int frames, BmpFormat fmt)
+{
+  ThreadPool pool(ThreadPool::defaultWorkerCount());
+  std::size_t workers = pool.numWorkers();
+  std::atomic<std::uint64_t> bytesWritten(0);
+
+  CapturePipeline pipeline(pool, OP_BLOCK);
+  pipeline.addStage("convert", workers, [](CaptureJob &job) {
+    setOpaque(job.m_image);
+  }, workers);
+  pipeline.addStage("blank", workers, [](CaptureJob &job) {
+    job.m_blank = classifyFrame(job.m_image);
+  }, workers);
+  pipeline.addStage("hash", workers, [](CaptureJob &job) {
+    job.m_hash = hashPixelContent(job.m_image);
+  }, workers);
+  pipeline.addStage("thumbnail", workers, [](CaptureJob &job) {
+    job.m_thumbnail = downscaleImage(job.m_image, 400);
+    job.m_perceptualHash = perceptualHash(job.m_thumbnail);
+  }, workers);
+  pipeline.addStage("sharpness", workers, [](CaptureJob &job) {
+    job.m_sharpness = imageSharpness(job.m_image);
+  }, workers);
+  pipeline.addStage("write", workers, [&bytesWritten](CaptureJob &job) {
+    // Encode and write in bands, as the app does.  A temporary file is
+    // removed when closed, so the disk does not fill, but the data is
+    // still handed to the OS.
+    std::FILE *fp = std::tmpfile();
+    if (!fp) {
+      job.m_error = "tmpfile failed";
+      return;
+    }
+
+    PixelImage const &img = job.m_image;
+    std::vector<unsigned char> band =
+      encodeBMPHeader(img.m_width, img.m_height, job.m_bmpFormat);
+    std::size_t rowBytes = bmpRowBytes(img.m_width, job.m_bmpFormat);
+    for (int row = 0; row < img.m_height; row += c_bandRows) {
+      int n = std::min(c_bandRows, img.m_height - row);
+      std::size_t at = row == 0? band.size() : 0;
+      band.resize(at + n * rowBytes);
+      encodeBMPRows(img, row, n, band.data() + at, job.m_bmpFormat);
+      if (std::fwrite(band.data(), 1, band.size(), fp) != band.size()) {
+        job.m_error = "short write";
+        break;
+      }
+      bytesWritten += band.size();
+    }
+    std::fclose(fp);
+    job.m_image = PixelImage();
+  });
+  pipeline.addStage("index", workers, [](CaptureJob &job) {
+    if (!job.m_error.empty()) {
+      std::cout << "frame " << job.m_id << ": " << job.m_error << "\n";
+    }
+  });
+
+  SyntheticFrameSource src(w, h);
+  LatencyHistogram &grabTime = perfHistogram("bench.grab.ns");
+
+  // Each run reports only its own times.
+  char const * const stages[] = {
+    "convert", "blank", "hash", "thumbnail", "sharpness", "write"
+  };
+  grabTime.reset();
+  for (char const *stage : stages) {
+    perfHistogram(std::string("pipeline.") + stage + ".ns").reset();
+  }
+
+  std::uint64_t start = perfNowNs();
+  for (int i = 0; i < frames; ++i) {
+    CaptureJobPtr job = std::make_shared<CaptureJob>();
+    job->m_id = i;
+    job->m_bmpFormat = fmt;
+
+    std::uint64_t grabStart = perfNowNs();
+    src.grabRegion(0, 0, w, h, job->m_image);
+    grabTime.record(perfNowNs() - grabStart);
+
+    CaptureJobPtr dropped;
+    pipeline.submit(job, dropped);
+  }
+  pipeline.waitIdle();
+  double seconds = (perfNowNs() - start) / 1e9;
+
+  std::cout << bmpFormatName(fmt) << " bpp: " << frames << " frames of "
+            << w << "x" << h << " with " << workers << " workers: "
+            << frames / seconds << " fps, "
+            << bytesWritten / (double)frames / (1 << 20)
+            << " MiB per file, "
+            << bytesWritten / seconds / (1 << 20) << " MiB/s written\n";
+
+  std::cout << "  grab: " << grabTime.mean() / 1e6 << " ms mean\n";
+  for (char const *stage : stages) {
+    LatencyHistogram &hist =
+      perfHistogram(std::string("pipeline.") + stage + ".ns");
+    std::cout << "  " << stage << ": " << hist.mean() / 1e6
+              << " ms mean, " << hist.percentile(0.99) / 1e6
+              << " ms p99\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testDeterministic();
+  testFramesChange();
+  testRegion();
+  testParse();
+
+  if (s_failures) {
+    std::cout << "frame-source-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "frame-source-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    int w = argc >= 3? std::atoi(argv[2]) : 1920;
+    int h = argc >= 4? std::atoi(argv[3]) : 1080;
+    int frames = argc >= 5? std::atoi(argv[4]) : 120;
+    if (w > 0 && h > 0 && frames > 0) {
+      for (int f = 0; f < NUM_BMP_FORMATS; ++f) {
+        bench(w, h, frames, (BmpFormat)f);
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,273 @@
+// frame-source.cc
+// Code for `frame-source` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "frame-source.h"              // this module
+
+#include <algorithm>                   // std::{max, min}
+#include <cassert>                     // assert
+#include <cstdio>                      // std::sscanf
+
+
+// Texture size.  A power of two, so scrolling wraps with a mask.
+static int const c_textureSize = 256;
+
+// Background scroll per frame, in pixels.
+static int const c_scrollX = 3;
+static int const c_scrollY = 1;
+
+// Glyphs of the score digits, 3 wide and 5 tall, one bit per cell,
+// rows top first, the high bit of each row on the left.
+static unsigned char const c_digitGlyphs[10][5] = {
+  { 7, 5, 5, 5, 7 },                   // 0
+  { 2, 6, 2, 2, 7 },                   // 1
+  { 7, 1, 7, 4, 7 },                   // 2
+  { 7, 1, 7, 1, 7 },                   // 3
+  { 5, 5, 7, 1, 1 },                   // 4
+  { 7, 4, 7, 1, 7 },                   // 5
+  { 7, 4, 7, 5, 7 },                   // 6
+  { 7, 1, 1, 1, 1 },                   // 7
+  { 7, 5, 7, 5, 7 },                   // 8
+  { 7, 5, 7, 1, 7 },                   // 9
+};
+
+// Number of score digits shown.
+static int const c_scoreDigits = 6;
+
+// Largest synthetic frame dimension `parseFrameSource` accepts.
+static int const c_maxSyntheticSize = 16384;
+
+
+// Mix `v` into a well-distributed 32-bit value.
+static inline std::uint32_t mix32(std::uint32_t v)
+{
+  v ^= v >> 16;
+  v *= 0x7FEB352Du;
+  v ^= v >> 15;
+  v *= 0x846CA68Bu;
+  v ^= v >> 16;
+  return v;
+}
+
+
+// Pixel from channel values, with alpha zero as GDI leaves it.
+static inline std::uint32_t bgr(int r, int g, int b)
+{
+  return (std::uint32_t)b | ((std::uint32_t)g << 8) |
+         ((std::uint32_t)r << 16);
+}
+
+
+// Linear interpolation of each channel of `a` and `b`, by `t`/256.
+static std::uint32_t lerpPixel(std::uint32_t a, std::uint32_t b, int t)
+{
+  std::uint32_t ret = 0;
+  for (int shift = 0; shift < 24; shift += 8) {
+    int ca = (a >> shift) & 0xFF;
+    int cb = (b >> shift) & 0xFF;
+    ret |= (std::uint32_t)((ca * (256-t) + cb * t) >> 8) << shift;
+  }
+  return ret;
+}
+
+
+// Triangle wave rising from 0 to `period/2` and back over `period`.
+static int triangle(std::uint64_t frame, int period)
+{
+  int t = (int)(frame % period);
+  return t < period/2? t : period - t;
+}
+
+
+// Fill the part of the `w` by `h` rectangle at `x`, `y` (in frame
+// coordinates) that lies within `img`, whose top left is at `originX`,
+// `originY`.
+static void fillRect(PixelImage &img, int originX, int originY,
+                     int x, int y, int w, int h, std::uint32_t color)
+{
+  int x0 = std::max(x, originX) - originX;
+  int y0 = std::max(y, originY) - originY;
+  int x1 = std::min(x+w, originX + img.m_width) - originX;
+  int y1 = std::min(y+h, originY + img.m_height) - originY;
+
+  for (int row = y0; row < y1; ++row) {
+    std::uint32_t *p = img.row(row);
+    std::fill(p + x0, p + std::max(x0, x1), color);
+  }
+}
+
+
+SyntheticFrameSource::SyntheticFrameSource(int width, int height,
+                                           std::uint32_t seed)
+  : m_width(width),
+    m_height(height),
+    m_texture((std::size_t)c_textureSize * c_textureSize),
+    m_frame(0)
+{
+  assert(width > 0 && height > 0);
+
+  // Interpolate a coarse lattice of random earthy colors, so the
+  // texture has broad gradients rather than pure noise.
+  int const cells = 8;
+  int const cellSize = c_textureSize / cells;
+  std::uint32_t lattice[cells][cells];
+  for (int j = 0; j < cells; ++j) {
+    for (int i = 0; i < cells; ++i) {
+      std::uint32_t h = mix32(seed * 0x9E3779B9u + j * cells + i);
+      lattice[j][i] = bgr(60 + (h & 0x7F), 50 + ((h >> 8) & 0x7F),
+                          30 + ((h >> 16) & 0x3F));
+    }
+  }
+
+  for (int y = 0; y < c_textureSize; ++y) {
+    int j = y / cellSize;
+    int ty = (y % cellSize) * 256 / cellSize;
+    for (int x = 0; x < c_textureSize; ++x) {
+      int i = x / cellSize;
+      int tx = (x % cellSize) * 256 / cellSize;
+
+      // Wrap at the edges so the texture tiles.
+      std::uint32_t top = lerpPixel(lattice[j][i],
+                                    lattice[j][(i+1) % cells], tx);
+      std::uint32_t bottom = lerpPixel(lattice[(j+1) % cells][i],
+        lattice[(j+1) % cells][(i+1) % cells], tx);
+      std::uint32_t p = lerpPixel(top, bottom, ty);
+
+      // Mortar lines between staggered bricks.
+      int brickX = (x + ((y / 16) % 2) * 16) % 32;
+      if (y % 16 == 0 || brickX == 0) {
+        p = (p >> 1) & 0x7F7F7F;
+      }
+
+      m_texture[(std::size_t)y * c_textureSize + x] = p;
+    }
+  }
+}
+
+
+void SyntheticFrameSource::grabRegion(int x, int y, int w, int h,
+                                      PixelImage &img)
+{
+  assert(0 <= x && 0 <= w && x+w <= m_width);
+  assert(0 <= y && 0 <= h && y+h <= m_height);
+
+  std::uint64_t frame = m_frame++;
+  img = PixelImage(w, h);
+
+  // Scrolling background, with noise over the middle of the frame.
+  int const mask = c_textureSize - 1;
+  int scrollX = (int)((frame * c_scrollX) & mask);
+  int scrollY = (int)((frame * c_scrollY) & mask);
+  int noiseX0 = m_width / 4, noiseX1 = m_width * 3 / 4;
+  int noiseY0 = m_height / 4, noiseY1 = m_height * 3 / 4;
+  std::uint32_t frameSalt = mix32((std::uint32_t)frame + 0x51ED27u);
+
+  for (int row = 0; row < h; ++row) {
+    int fy = y + row;
+    std::uint32_t const *tex =
+      &m_texture[(std::size_t)((fy + scrollY) & mask) * c_textureSize];
+    std::uint32_t *out = img.row(row);
+    bool noisyRow = noiseY0 <= fy && fy < noiseY1;
+
+    for (int col = 0; col < w; ++col) {
+      int fx = x + col;
+      std::uint32_t p = tex[(fx + scrollX) & mask];
+      if (noisyRow && noiseX0 <= fx && fx < noiseX1) {
+        std::uint32_t n = mix32((std::uint32_t)(fy * m_width + fx) ^
+                                frameSalt);
+        p ^= n & 0x1F1F1F;
+      }
+      out[col] = p;
+    }
+  }
+
+  // HUD, sized relative to the frame.
+  int margin = std::max(1, m_width / 40);
+
+  // Health bar, bottom left, whose fill rises and falls.
+  {
+    int barW = m_width / 4;
+    int barH = std::max(3, m_height / 36);
+    int barX = margin;
+    int barY = m_height - margin - barH;
+    fillRect(img, x, y, barX, barY, barW, barH, bgr(40, 40, 40));
+
+    int inner = std::max(0, barW - 2);
+    int fill = inner * (50 + triangle(frame, 200)) / 150;
+    fillRect(img, x, y, barX+1, barY+1, fill, barH-2, bgr(200, 30, 30));
+  }
+
+  // Minimap, top right, with a dot for the player.
+  {
+    int size = std::max(8, m_height / 5);
+    int mapX = m_width - margin - size;
+    int mapY = margin;
+    fillRect(img, x, y, mapX, mapY, size, size, bgr(20, 60, 30));
+
+    int dot = std::max(2, size / 30);
+    int range = size - dot;
+    int dotX = mapX + triangle(frame, 2*range) % (range+1);
+    int dotY = mapY + triangle(frame * 3 / 2, 2*range) % (range+1);
+    fillRect(img, x, y, dotX, dotY, dot, dot, bgr(255, 255, 80));
+  }
+
+  // Score, top left, counting up.
+  {
+    int cell = std::max(1, m_height / 120);
+    std::uint64_t score = frame * 7;
+    for (int d = c_scoreDigits-1; d >= 0; --d) {
+      unsigned char const *glyph = c_digitGlyphs[score % 10];
+      score /= 10;
+
+      int digitX = margin + d * 4 * cell;
+      for (int gy = 0; gy < 5; ++gy) {
+        for (int gx = 0; gx < 3; ++gx) {
+          if (glyph[gy] & (4 >> gx)) {
+            fillRect(img, x, y, digitX + gx*cell, margin + gy*cell,
+                     cell, cell, bgr(255, 255, 255));
+          }
+        }
+      }
+    }
+  }
+
+  // Crosshair, centered.
+  {
+    int arm = std::max(2, m_height / 60);
+    int cx = m_width / 2, cy = m_height / 2;
+    fillRect(img, x, y, cx - arm, cy, 2*arm + 1, 1, bgr(0, 255, 0));
+    fillRect(img, x, y, cx, cy - arm, 1, 2*arm + 1, bgr(0, 255, 0));
+  }
+}
+
+
+std::string parseFrameSource(std::string const &spec,
+                             std::unique_ptr<FrameSource> &source)
+{
+  std::string const kind = "synthetic";
+  if (spec.compare(0, kind.size(), kind) != 0) {
+    return "\"" + spec + "\": unknown frame source";
+  }
+
+  int w = 1920, h = 1080;
+  if (spec.size() > kind.size()) {
+    char extra;
+    if (spec[kind.size()] != ':' ||
+        std::sscanf(spec.c_str() + kind.size() + 1, "%dx%d%c",
+                    &w, &h, &extra) != 2) {
+      return "\"" + spec + "\": expected synthetic:WIDTHxHEIGHT";
+    }
+    if (w <= 0 || h <= 0 ||
+        w > c_maxSyntheticSize || h > c_maxSyntheticSize) {
+      return "\"" + spec + "\": the size must be from 1 to " +
+             std::to_string(c_maxSyntheticSize);
+    }
+  }
+
+  source = std::make_unique<SyntheticFrameSource>(w, h);
+  return "";
+}
+
+
+// EOF
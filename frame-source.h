@@ -0,0 +1,93 @@
+// frame-source.h
+// Alternative sources of captured frames, such as a synthetic game.
+
+// See license.txt for copyright and terms of use.
+
+// Captures normally come from the GDI screen DC, which only exists on
+// Windows, so capture throughput cannot be measured on a build server.
+// A `FrameSource` stands in for the screen: when one is installed (see
+// `setFrameSource` in `screenshot.h`), captures are taken from it
+// instead.
+//
+// The screen itself is deliberately not a `FrameSource`.  It is copied
+// straight into a GDI bitmap, and going through `PixelImage` would add
+// a copy of every frame to the normal capture path.
+//
+// `SyntheticFrameSource` renders deterministic frames that resemble a
+// game: a scrolling textured background, a region of per-pixel noise
+// (particles, film grain), and HUD elements that are mostly still but
+// partly animated.  That mix gives change detection, hashing and the
+// encoders work of a realistic kind, so the capture pipeline can be
+// benchmarked and stress-tested headless (see the "bench" mode of
+// `frame-source-test`).
+//
+// This module does not depend on the Windows API.
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "pixel-image.h"               // PixelImage
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <cstdint>                     // std::{uint32_t, uint64_t}
+#include <memory>                      // std::unique_ptr
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// Something captures can be taken from.  Methods are called on one
+// thread at a time.
+class FrameSource {
+public:      // methods
+  virtual ~FrameSource() {}
+
+  // Size of a whole frame.
+  virtual int width() const = 0;
+  virtual int height() const = 0;
+
+  // Advance to the next frame and set `img` to its `w` by `h`
+  // rectangle at `x`, `y`, which must be within the frame.  As with
+  // GDI, the alpha channel is left zero.
+  virtual void grabRegion(int x, int y, int w, int h,
+                          PixelImage &img /*OUT*/) = 0;
+};
+
+
+// Deterministic game-like frames.  Frame `n` depends only on the size,
+// the seed and `n`, and renders only the rectangle asked for.
+class SyntheticFrameSource : public FrameSource {
+  NO_OBJECT_COPIES(SyntheticFrameSource);
+
+private:     // data
+  int m_width;
+  int m_height;
+
+  // Tileable 256x256 background texture, made from the seed.
+  std::vector<std::uint32_t> m_texture;
+
+  // Number of the frame the next grab renders.
+  std::uint64_t m_frame;
+
+public:      // methods
+  SyntheticFrameSource(int width, int height, std::uint32_t seed = 1);
+
+  // Number of the frame the next grab renders, starting at 0.
+  std::uint64_t frameNumber() const { return m_frame; }
+
+  // FrameSource methods.
+  virtual int width() const override { return m_width; }
+  virtual int height() const override { return m_height; }
+  virtual void grabRegion(int x, int y, int w, int h,
+                          PixelImage &img /*OUT*/) override;
+};
+
+
+// Create the source described by `spec`: "synthetic", optionally
+// followed by ":WIDTHxHEIGHT" (the default is 1920x1080).  Return an
+// empty string on success, and otherwise a message describing the
+// problem.
+std::string parseFrameSource(std::string const &spec,
+                             std::unique_ptr<FrameSource> &source /*OUT*/);
+
+
+#endif // FRAME_SOURCE_H
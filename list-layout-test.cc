@@ -0,0 +1,216 @@
+// list-layout-test.cc
+// Tests for `list-layout`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times lookups in 100,000 items, comparing with summing heights.
+
+#include "list-layout.h"               // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// What `ListLayout::offset` computes, by summing.
+static int sumAbove(std::vector<int> const &heights, int index)
+{
+  int y = 0;
+  for (int i = 0; i < index; ++i) {
+    y += heights[i];
+  }
+  return y;
+}
+
+
+// What `ListLayout::indexAt` computes, by scanning.
+static int scanIndexAt(std::vector<int> const &heights, int y)
+{
+  int top = 0;
+  for (int i = 0; i < (int)heights.size(); ++i) {
+    if (y < top + heights[i]) {
+      return i;
+    }
+    top += heights[i];
+  }
+  return (int)heights.size();
+}
+
+
+// True if `layout` agrees with `heights` everywhere.
+static bool agrees(ListLayout const &layout, std::vector<int> const &heights)
+{
+  int n = (int)heights.size();
+  if (layout.size() != n) {
+    return false;
+  }
+  for (int i = 0; i <= n; ++i) {
+    if (layout.offset(i) != sumAbove(heights, i) ||
+        (i < n && layout.height(i) != heights[i])) {
+      return false;
+    }
+  }
+  int total = sumAbove(heights, n);
+  for (int y = -1; y <= total; ++y) {
+    if (layout.indexAt(y) != scanIndexAt(heights, y < 0? 0 : y)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static void testSmall()
+{
+  ListLayout layout;
+  EXPECT(layout.size() == 0);
+  EXPECT(layout.total() == 0);
+  EXPECT(layout.indexAt(0) == 0);
+
+  // Items 1 and 3 are hidden.
+  layout.assign({ 10, 0, 20, 0, 5 });
+  EXPECT(layout.total() == 35);
+  EXPECT(layout.offset(2) == 10);
+  EXPECT(layout.offset(3) == 30);
+  EXPECT(layout.offset(5) == 35);
+  EXPECT(layout.indexAt(9) == 0);
+  EXPECT(layout.indexAt(10) == 2);
+  EXPECT(layout.indexAt(30) == 4);
+  EXPECT(layout.indexAt(35) == 5);
+
+  layout.pushFront(7);
+  EXPECT(layout.size() == 6);
+  EXPECT(layout.offset(1) == 7);
+  EXPECT(layout.indexAt(7) == 1);
+
+  layout.setHeight(1, 0);
+  EXPECT(layout.indexAt(7) == 3);
+
+  layout.erase(0);
+  EXPECT(agrees(layout, { 0, 0, 20, 0, 5 }));
+
+  layout.clear();
+  EXPECT(layout.size() == 0);
+  layout.pushFront(3);
+  EXPECT(agrees(layout, { 3 }));
+}
+
+
+// Random edits, checked against a plain vector after each.
+static void testAgainstSums()
+{
+  std::mt19937 rng(11);
+  std::vector<int> heights;
+  ListLayout layout;
+  for (int step = 0; step < 400; ++step) {
+    int n = (int)heights.size();
+    switch (rng() % 4) {
+      case 0:
+      case 1: {
+        int h = rng() % 3 == 0? 0 : (int)(rng() % 50);
+        heights.insert(heights.begin(), h);
+        layout.pushFront(h);
+        break;
+      }
+
+      case 2:
+        if (n) {
+          int i = rng() % n;
+          int h = rng() % 2? 0 : (int)(rng() % 50);
+          heights[i] = h;
+          layout.setHeight(i, h);
+        }
+        break;
+
+      case 3:
+        if (n) {
+          int i = rng() % n;
+          heights.erase(heights.begin() + i);
+          layout.erase(i);
+        }
+        break;
+    }
+
+    if (!agrees(layout, heights)) {
+      std::cout << "mismatch at step " << step << "\n";
+      ++s_failures;
+      return;
+    }
+  }
+}
+
+
+// Build 100,000 items a few of which are hidden, then time `offset`
+// and `indexAt` against summing.
+static void bench()
+{
+  int const n = 100000;
+  std::mt19937 rng(5);
+  std::vector<int> heights;
+  ListLayout layout;
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  for (int i = 0; i < n; ++i) {
+    int h = rng() % 4 == 0? 0 : 230;
+    heights.push_back(h);
+    layout.pushFront(h);
+  }
+  double pushNs = std::chrono::duration<double, std::nano>(
+    Clock::now() - start).count() / n;
+  heights = std::vector<int>(heights.rbegin(), heights.rend());
+
+  int const queries = 1000;
+  long long check = 0;
+  start = Clock::now();
+  for (int q = 0; q < queries; ++q) {
+    int i = (q * 7919) % n;
+    check += layout.offset(i);
+    check -= layout.indexAt(layout.offset(i));
+  }
+  double layoutNs = std::chrono::duration<double, std::nano>(
+    Clock::now() - start).count() / queries;
+
+  start = Clock::now();
+  for (int q = 0; q < queries; ++q) {
+    int i = (q * 7919) % n;
+    int y = sumAbove(heights, i);
+    check -= y;
+    check += scanIndexAt(heights, y);
+  }
+  double scanNs = std::chrono::duration<double, std::nano>(
+    Clock::now() - start).count() / queries;
+
+  std::cout << n << " items: pushFront " << pushNs
+            << " ns; offset and indexAt " << layoutNs
+            << " ns; summing " << scanNs << " ns\n";
+  EXPECT(check == 0);
+}
+
+
+int main(int argc, char **argv)
+{
+  testSmall();
+  testAgainstSums();
+
+  if (s_failures) {
+    std::cout << "list-layout-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "list-layout-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
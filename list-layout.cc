@@ -0,0 +1,127 @@
+// list-layout.cc
+// Code for `list-layout` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "list-layout.h"               // this module
+
+
+// Lowest set bit of `k`.
+static inline int lowBit(int k)
+{
+  return k & -k;
+}
+
+
+ListLayout::ListLayout()
+  : m_heights(),
+    m_tree(1, 0)
+{}
+
+
+int ListLayout::sumBottom(int k) const
+{
+  int sum = 0;
+  for (; k > 0; k -= lowBit(k)) {
+    sum += m_tree[k];
+  }
+  return sum;
+}
+
+
+void ListLayout::assign(std::vector<int> const &heights)
+{
+  m_heights.assign(heights.rbegin(), heights.rend());
+
+  // Build in O(n) by passing each partial sum up to its parent.
+  int n = size();
+  m_tree.assign(n+1, 0);
+  for (int k = 1; k <= n; ++k) {
+    m_tree[k] += m_heights[k-1];
+    int parent = k + lowBit(k);
+    if (parent <= n) {
+      m_tree[parent] += m_tree[k];
+    }
+  }
+}
+
+
+void ListLayout::pushFront(int h)
+{
+  // The new element covers itself and the `lowBit(k)-1` before it.
+  int k = size() + 1;
+  m_heights.push_back(h);
+  m_tree.push_back(h + sumBottom(k-1) - sumBottom(k - lowBit(k)));
+}
+
+
+void ListLayout::erase(int index)
+{
+  std::vector<int> heights(m_heights.rbegin(), m_heights.rend());
+  heights.erase(heights.begin() + index);
+  assign(heights);
+}
+
+
+void ListLayout::clear()
+{
+  m_heights.clear();
+  m_tree.assign(1, 0);
+}
+
+
+void ListLayout::setHeight(int index, int h)
+{
+  int pos = size()-1 - index;
+  int delta = h - m_heights.at(pos);
+  m_heights[pos] = h;
+  for (int k = pos+1; k <= size(); k += lowBit(k)) {
+    m_tree[k] += delta;
+  }
+}
+
+
+int ListLayout::height(int index) const
+{
+  return m_heights.at(size()-1 - index);
+}
+
+
+int ListLayout::offset(int index) const
+{
+  return total() - sumBottom(size() - index);
+}
+
+
+int ListLayout::total() const
+{
+  return sumBottom(size());
+}
+
+
+int ListLayout::indexAt(int y) const
+{
+  int n = size();
+  int target = total() - (y < 0? 0 : y);
+  if (target <= 0) {
+    return n;
+  }
+
+  // Find the most bottom elements, `k`, summing to less than
+  // `target`.  The item containing `y` is the next one up.
+  int k = 0;
+  int step = 1;
+  while (step*2 <= n) {
+    step *= 2;
+  }
+  for (; step > 0; step /= 2) {
+    if (k+step <= n && m_tree[k+step] < target) {
+      k += step;
+      target -= m_tree[k];
+    }
+  }
+  return n-1 - k;
+}
+
+
+// EOF
@@ -0,0 +1,83 @@
+// list-layout.h
+// Vertical positions of the items in a list, kept as prefix sums.
+
+// See license.txt for copyright and terms of use.
+
+// Drawing the shot list, scrolling to the selection, and sizing the
+// scroll bar all need the position of some item, which is the sum of
+// the heights of the items above it.  Summing them on each call costs
+// time proportional to the list, which can hold a hundred thousand
+// shots, and collapsed groups make the heights vary.
+//
+// `ListLayout` keeps the heights in a Fenwick tree, so finding an
+// item's position, finding the item at a position, and changing one
+// height each take O(log n).  Hidden items have height 0.
+//
+// Items are numbered as in the list, from 0 at the top.  New shots are
+// added at the top, so the tree stores the items bottom first, where
+// adding one is appending, which is also O(log n).  Removing an item
+// rebuilds the tree, in O(n), as removing it from the list does.
+//
+// This module does not depend on the Windows API.
+
+#ifndef LIST_LAYOUT_H
+#define LIST_LAYOUT_H
+
+#include <vector>                      // std::vector
+
+
+class ListLayout {
+private:     // data
+  // Height of each item, bottom first, so item `i` is at
+  // `size()-1-i`.
+  std::vector<int> m_heights;
+
+  // Fenwick tree over `m_heights`, indexed from 1.  Element `k` is the
+  // sum of the `k & -k` heights ending at `m_heights[k-1]`.
+  // `m_tree[0]` is unused.
+  std::vector<int> m_tree;
+
+private:     // methods
+  // Sum of the first `k` elements of `m_heights`.
+  int sumBottom(int k) const;
+
+public:      // methods
+  ListLayout();
+
+  // Replace the contents with items having `heights`, top first.
+  void assign(std::vector<int> const &heights);
+
+  // Add an item of height `h` at the top.
+  void pushFront(int h);
+
+  // Remove item `index`.
+  void erase(int index);
+
+  // Remove every item.
+  void clear();
+
+  // Set the height of item `index` to `h`.
+  void setHeight(int index, int h);
+
+  // Number of items.
+  int size() const { return (int)m_heights.size(); }
+
+  // Height of item `index`.
+  int height(int index) const;
+
+  // Sum of the heights of the items above item `index`.  `index` can
+  // be `size()`, giving `total()`.
+  int offset(int index) const;
+
+  // Sum of all heights.
+  int total() const;
+
+  // Return the index of the item whose span, from its offset to its
+  // offset plus its height, contains `y`, or `size()` if `y` is at or
+  // beyond the total.  A negative `y` is treated as 0.  Items of
+  // height 0 contain nothing, so this never returns one.
+  int indexAt(int y) const;
+};
+
+
+#endif // LIST_LAYOUT_H
@@ -0,0 +1,127 @@
+// perceptual-hash-test.cc
+// Tests for `perceptual-hash`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "perceptual-hash.h"           // module under test
+
+#include "frame-source.h"              // SyntheticFrameSource
+#include "test-util.h"                 // EXPECT
+
+#include <iostream>                    // std::cout
+
+
+// Image getting brighter to the right, in every channel.
+static PixelImage rampRight(int w, int h)
+{
+  PixelImage img(w, h);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      std::uint32_t v = (std::uint32_t)(x * 255 / (w-1));
+      img.row(y)[x] = v | (v << 8) | (v << 16);
+    }
+  }
+  return img;
+}
+
+
+static void testKnownValues()
+{
+  // Every cell is darker than its right neighbor.
+  EXPECT(perceptualHash(rampRight(90, 40)) == ~(std::uint64_t)0);
+
+  // A flat image has no differences.
+  PixelImage flat(50, 50);
+  for (std::uint32_t &p : flat.m_pixels) {
+    p = 0x808080;
+  }
+  EXPECT(perceptualHash(flat) == 0);
+
+  EXPECT(perceptualHash(PixelImage()) == 0);
+
+  // Smaller than the grid still works.
+  EXPECT(perceptualHash(rampRight(3, 2)) != 0);
+}
+
+
+// Small changes move the hash a little, and a different scene moves
+// it a lot.
+static void testSimilarity()
+{
+  SyntheticFrameSource src(400, 225, 5);
+  PixelImage a = grabFrame(src);
+  std::uint64_t ha = perceptualHash(a);
+
+  // A blinking cursor.
+  PixelImage b = a;
+  for (int y = 100; y < 110; ++y) {
+    for (int x = 200; x < 203; ++x) {
+      b.row(y)[x] = 0xFFFFFF;
+    }
+  }
+  EXPECT(hammingDistance(ha, perceptualHash(b)) <= 2);
+
+  // Brightness does not matter.
+  PixelImage dim = a;
+  for (std::uint32_t &p : dim.m_pixels) {
+    p = (p >> 1) & 0x7F7F7F;
+  }
+  EXPECT(hammingDistance(ha, perceptualHash(dim)) <= 4);
+
+  // Nor does scale.
+  PixelImage small = downscaleImage(a, 100);
+  EXPECT(hammingDistance(ha, perceptualHash(small)) <= 4);
+
+  // A mirrored image differs in most bits.
+  PixelImage mirror = a;
+  for (int y = 0; y < a.m_height; ++y) {
+    for (int x = 0; x < a.m_width; ++x) {
+      mirror.row(y)[x] = a.at(a.m_width - 1 - x, y);
+    }
+  }
+  EXPECT(hammingDistance(ha, perceptualHash(mirror)) > 20);
+}
+
+
+static void testHamming()
+{
+  EXPECT(hammingDistance(0, 0) == 0);
+  EXPECT(hammingDistance(0, ~(std::uint64_t)0) == 64);
+  EXPECT(hammingDistance(0x5, 0x3) == 2);
+}
+
+
+static void testHex()
+{
+  EXPECT(perceptualHashToHex(0x00AB) == "00000000000000ab");
+
+  std::uint64_t h = 0;
+  EXPECT(parsePerceptualHash("0123456789ABCDEF", h));
+  EXPECT(h == 0x0123456789ABCDEFull);
+  EXPECT(parsePerceptualHash(perceptualHashToHex(~h), h) &&
+         h == ~0x0123456789ABCDEFull);
+
+  EXPECT(!parsePerceptualHash("123", h));
+  EXPECT(!parsePerceptualHash("0123456789abcdeg", h));
+}
+
+
+int main()
+{
+  testKnownValues();
+  testSimilarity();
+  testHamming();
+  testHex();
+
+  if (s_failures) {
+    std::cout << "perceptual-hash-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "perceptual-hash-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,106 @@
+// perceptual-hash.cc
+// Code for `perceptual-hash` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "perceptual-hash.h"           // this module
+
+#include <algorithm>                   // std::max
+#include <bitset>                      // std::bitset
+#include <cstdio>                      // std::snprintf
+#include <vector>                      // std::vector
+
+
+// Size of the luminance grid.  One more column than bits per row, so
+// each bit has a right neighbor.
+static int const c_gridCols = 9;
+static int const c_gridRows = 8;
+
+
+std::uint64_t perceptualHash(PixelImage const &img)
+{
+  if (img.empty()) {
+    return 0;
+  }
+
+  // Sum the luminance of the pixels falling in each cell.  Each cell
+  // gets an equal share of the image, give or take a pixel.
+  std::uint64_t sums[c_gridRows][c_gridCols] = {};
+  std::uint32_t counts[c_gridRows][c_gridCols] = {};
+
+  // Grid column of each image column.
+  int const w = img.m_width;
+  std::vector<int> cellCol(w);
+  for (int x = 0; x < w; ++x) {
+    cellCol[x] = (int)((std::int64_t)x * c_gridCols / w);
+  }
+
+  for (int y = 0; y < img.m_height; ++y) {
+    int r = (int)((std::int64_t)y * c_gridRows / img.m_height);
+    std::uint32_t const *p = img.row(y);
+    for (int x = 0; x < w; ++x) {
+      std::uint32_t px = p[x];
+
+      // Rec. 601 weights, scaled to 256.
+      std::uint32_t luma = (29 * (px & 0xFF) +
+                            150 * ((px >> 8) & 0xFF) +
+                            77 * ((px >> 16) & 0xFF)) >> 8;
+      sums[r][cellCol[x]] += luma;
+      ++counts[r][cellCol[x]];
+    }
+  }
+
+  // Compare averages by cross-multiplying, exactly.  A cell with no
+  // pixels, in an image narrower or shorter than the grid, counts as
+  // black.
+  std::uint64_t ret = 0;
+  for (int r = 0; r < c_gridRows; ++r) {
+    for (int c = 0; c+1 < c_gridCols; ++c) {
+      std::uint64_t left = sums[r][c] * std::max(1u, counts[r][c+1]);
+      std::uint64_t right = sums[r][c+1] * std::max(1u, counts[r][c]);
+      if (left < right) {
+        ret |= (std::uint64_t)1 << (r * (c_gridCols-1) + c);
+      }
+    }
+  }
+  return ret;
+}
+
+
+int hammingDistance(std::uint64_t a, std::uint64_t b)
+{
+  return (int)std::bitset<64>(a ^ b).count();
+}
+
+
+std::string perceptualHashToHex(std::uint64_t h)
+{
+  char buf[17];
+  std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+
+bool parsePerceptualHash(std::string const &hex, std::uint64_t &h)
+{
+  if (hex.size() != 16) {
+    return false;
+  }
+
+  std::uint64_t v = 0;
+  for (char c : hex) {
+    int d = '0' <= c && c <= '9'? c - '0' :
+            'a' <= c && c <= 'f'? c - 'a' + 10 :
+            'A' <= c && c <= 'F'? c - 'A' + 10 : -1;
+    if (d < 0) {
+      return false;
+    }
+    v = (v << 4) | (unsigned)d;
+  }
+
+  h = v;
+  return true;
+}
+
+
+// EOF
@@ -0,0 +1,47 @@
+// perceptual-hash.h
+// 64-bit hashes of how an image looks, compared by Hamming distance.
+
+// See license.txt for copyright and terms of use.
+
+// `ContentHash` tells only whether two images are identical.  Shots of
+// the same scene usually differ somewhere, by a blinking cursor or a
+// particle effect, and then their content hashes are unrelated.
+//
+// A perceptual hash instead summarizes the coarse structure of the
+// image, so similar images get hashes differing in few bits.  This is
+// the "difference hash": the image is reduced to a 9x8 grid of
+// luminance averages, and each bit says whether a cell is darker than
+// its right neighbor.  Comparing neighbors, rather than levels, makes
+// the hash insensitive to overall brightness and contrast, and the
+// coarse grid makes it insensitive to small details and to scale, so
+// it can be computed from a thumbnail.
+//
+// This module does not depend on the Windows API.
+
+#ifndef PERCEPTUAL_HASH_H
+#define PERCEPTUAL_HASH_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <cstdint>                     // std::uint64_t
+#include <string>                      // std::string
+
+
+// Return the difference hash of `img`.  Bit `r*8 + c` is set if cell
+// `c` of grid row `r` is darker than cell `c+1`.  An empty image
+// hashes to 0.
+std::uint64_t perceptualHash(PixelImage const &img);
+
+// Number of bits in which `a` and `b` differ.
+int hammingDistance(std::uint64_t a, std::uint64_t b);
+
+// 16 lowercase hex digits.  JSON integers are too narrow to store a
+// hash directly.
+std::string perceptualHashToHex(std::uint64_t h);
+
+// Set `h` from `perceptualHashToHex` output.  Return false if `hex` is
+// not 16 hex digits.
+bool parsePerceptualHash(std::string const &hex, std::uint64_t &h /*OUT*/);
+
+
+#endif // PERCEPTUAL_HASH_H
@@ -0,0 +1,138 @@
+// perf-counters-test.cc
+// Tests for `perf-counters`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "perf-counters.h"             // module under test
+
+#include "json.hpp"                    // json::JSON
+#include "test-util.h"                 // EXPECT
+
+#include <cstdint>                     // std::uint64_t
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937_64
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+using json::JSON;
+
+
+// Every value lands in a bucket whose bounds contain it, and bucket
+// widths stay within the advertised relative error.
+static void testBuckets()
+{
+  std::mt19937_64 rng(1);
+  for (int i = 0; i < 100000; ++i) {
+    std::uint64_t v = rng() >> (rng() % 64);
+    int b = LatencyHistogram::bucketIndex(v);
+    EXPECT(0 <= b && b < LatencyHistogram::c_numBuckets);
+    EXPECT(LatencyHistogram::bucketLow(b) <= v);
+    EXPECT(v <= LatencyHistogram::bucketHigh(b));
+
+    std::uint64_t width = LatencyHistogram::bucketHigh(b) -
+                          LatencyHistogram::bucketLow(b);
+    EXPECT(width <= LatencyHistogram::bucketLow(b) / 16);
+  }
+
+  // Adjacent buckets tile the number line.
+  for (int b = 0; b+1 < LatencyHistogram::c_numBuckets; ++b) {
+    EXPECT(LatencyHistogram::bucketHigh(b) + 1 ==
+           LatencyHistogram::bucketLow(b+1));
+  }
+  EXPECT(LatencyHistogram::bucketIndex(~(std::uint64_t)0) ==
+         LatencyHistogram::c_numBuckets - 1);
+}
+
+
+static void testPercentiles()
+{
+  LatencyHistogram h;
+  EXPECT(h.percentile(0.5) == 0);
+
+  // 1..1000 microseconds.
+  for (int i = 1; i <= 1000; ++i) {
+    h.record(i * 1000);
+  }
+  EXPECT(h.count() == 1000);
+  EXPECT(h.max() == 1000000);
+  EXPECT(h.mean() == 500500.0);
+
+  auto near = [](std::uint64_t actual, double expect) {
+    return actual >= expect * 0.94 && actual <= expect * 1.06;
+  };
+  EXPECT(near(h.percentile(0.5), 500000));
+  EXPECT(near(h.percentile(0.9), 900000));
+  EXPECT(near(h.percentile(0.99), 990000));
+  EXPECT(h.percentile(1.0) == 1000000);
+
+  h.reset();
+  EXPECT(h.count() == 0 && h.max() == 0);
+}
+
+
+// Updates from several threads are all counted.
+static void testThreads()
+{
+  PerfCounter &c = perfCounter("test.count");
+  LatencyHistogram &h = perfHistogram("test.ns");
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&c, &h, t]() {
+      for (int i = 0; i < 10000; ++i) {
+        c.inc();
+        h.record(t * 10000 + i);
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+
+  EXPECT(c.get() == 40000);
+  EXPECT(h.count() == 40000);
+  EXPECT(h.max() == 39999);
+}
+
+
+static void testRegistry()
+{
+  EXPECT(&perfCounter("test.count") == &perfCounter("test.count"));
+
+  PerfGauge &g = perfGauge("test.gauge");
+  g.set(10);
+  g.add(-15);
+  EXPECT(perfGauge("test.gauge").get() == -5);
+
+  {
+    PERF_TIME_SCOPE("test.scope");
+  }
+  EXPECT(perfHistogram("test.scope").count() == 1);
+
+  JSON doc = JSON::Load(perfCountersToJSON());
+  EXPECT(doc.at("counters").at("test.count").ToInt() == 40000);
+  EXPECT(doc.at("gauges").at("test.gauge").ToInt() == -5);
+  EXPECT(doc.at("histograms").at("test.ns").at("count").ToInt() == 40000);
+  EXPECT(doc.at("histograms").at("test.ns").at("max").ToInt() == 39999);
+}
+
+
+int main()
+{
+  testBuckets();
+  testPercentiles();
+  testThreads();
+  testRegistry();
+
+  if (s_failures) {
+    std::cout << "perf-counters-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "perf-counters-test: ok\n";
+  return 0;
+}
+
+
+// EOF
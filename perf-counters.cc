@@ -0,0 +1,243 @@
+// perf-counters.cc
+// Code for `perf-counters` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "perf-counters.h"             // this module
+
+#include <algorithm>                   // std::{min, max}
+#include <cassert>                     // assert
+#include <cerrno>                      // errno
+#include <chrono>                      // std::chrono
+#include <cstring>                     // std::strerror
+#include <fstream>                     // std::ofstream
+#include <map>                         // std::map
+#include <memory>                      // std::unique_ptr
+#include <mutex>                       // std::{mutex, lock_guard}
+#include <sstream>                     // std::ostringstream
+
+
+// ------------------------- LatencyHistogram --------------------------
+LatencyHistogram::LatencyHistogram()
+{
+  for (auto &b : m_buckets) {
+    b.store(0, std::memory_order_relaxed);
+  }
+}
+
+
+/*static*/ int LatencyHistogram::bucketIndex(std::uint64_t v)
+{
+  if (v < (std::uint64_t)c_subBuckets) {
+    return (int)v;
+  }
+
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - c_subBits;
+  int sub = (int)((v >> shift) & (c_subBuckets - 1));
+  return (shift + 1) * c_subBuckets + sub;
+}
+
+
+/*static*/ std::uint64_t LatencyHistogram::bucketLow(int index)
+{
+  if (index < c_subBuckets) {
+    return index;
+  }
+
+  int shift = index / c_subBuckets - 1;
+  int sub = index % c_subBuckets;
+  return (std::uint64_t)(c_subBuckets + sub) << shift;
+}
+
+
+/*static*/ std::uint64_t LatencyHistogram::bucketHigh(int index)
+{
+  if (index < c_subBuckets) {
+    return index;
+  }
+
+  int shift = index / c_subBuckets - 1;
+  return bucketLow(index) + (((std::uint64_t)1 << shift) - 1);
+}
+
+
+void LatencyHistogram::record(std::uint64_t ns)
+{
+  m_buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum.fetch_add(ns, std::memory_order_relaxed);
+
+  std::uint64_t prev = m_max.load(std::memory_order_relaxed);
+  while (ns > prev &&
+         !m_max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+    {}
+}
+
+
+double LatencyHistogram::mean() const
+{
+  std::uint64_t n = count();
+  return n? (double)sum() / (double)n : 0.0;
+}
+
+
+std::uint64_t LatencyHistogram::percentile(double fraction) const
+{
+  std::uint64_t n = count();
+  if (n == 0) {
+    return 0;
+  }
+
+  // Rank of the sample we want, counting from 1.
+  std::uint64_t rank = (std::uint64_t)(fraction * (double)n + 0.5);
+  rank = std::max<std::uint64_t>(1, std::min(rank, n));
+  if (rank == n) {
+    return max();                      // Known exactly.
+  }
+
+  std::uint64_t seen = 0;
+  for (int i = 0; i < c_numBuckets; ++i) {
+    seen += m_buckets[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      std::uint64_t mid = bucketLow(i) + (bucketHigh(i) - bucketLow(i)) / 2;
+      return std::min(mid, max());
+    }
+  }
+
+  // Concurrent updates can make `count` run ahead of the buckets.
+  return max();
+}
+
+
+void LatencyHistogram::reset()
+{
+  for (auto &b : m_buckets) {
+    b.store(0, std::memory_order_relaxed);
+  }
+  m_count.store(0, std::memory_order_relaxed);
+  m_sum.store(0, std::memory_order_relaxed);
+  m_max.store(0, std::memory_order_relaxed);
+}
+
+
+std::uint64_t perfNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// ----------------------------- Registry ------------------------------
+// Protects the maps.  The statistics themselves are never destroyed,
+// so references handed out remain valid during static destruction.
+static std::mutex s_registryMutex;
+
+static auto &s_counters =
+  *new std::map<std::string, std::unique_ptr<PerfCounter>>;
+static auto &s_gauges =
+  *new std::map<std::string, std::unique_ptr<PerfGauge>>;
+static auto &s_histograms =
+  *new std::map<std::string, std::unique_ptr<LatencyHistogram>>;
+
+
+// Find or create `name` in `map`, checking that `name` is not in use in
+// `other1` or `other2`.
+template <typename T, typename O1, typename O2>
+static T &getOrCreate(std::map<std::string, std::unique_ptr<T>> &map,
+                      O1 const &other1, O2 const &other2,
+                      std::string const &name)
+{
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+
+  std::unique_ptr<T> &p = map[name];
+  if (!p) {
+    assert(other1.find(name) == other1.end());
+    assert(other2.find(name) == other2.end());
+    p.reset(new T);
+  }
+  return *p;
+}
+
+
+PerfCounter &perfCounter(std::string const &name)
+{
+  return getOrCreate(s_counters, s_gauges, s_histograms, name);
+}
+
+
+PerfGauge &perfGauge(std::string const &name)
+{
+  return getOrCreate(s_gauges, s_counters, s_histograms, name);
+}
+
+
+LatencyHistogram &perfHistogram(std::string const &name)
+{
+  return getOrCreate(s_histograms, s_counters, s_gauges, name);
+}
+
+
+std::string perfCountersToJSON()
+{
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+
+  // None of the names need escaping, as they are all chosen by this
+  // program.
+  std::ostringstream oss;
+  oss << "{\n";
+
+  oss << "  \"counters\": {";
+  char const *sep = "\n";
+  for (auto const &kv : s_counters) {
+    oss << sep << "    \"" << kv.first << "\": " << kv.second->get();
+    sep = ",\n";
+  }
+  oss << "\n  },\n";
+
+  oss << "  \"gauges\": {";
+  sep = "\n";
+  for (auto const &kv : s_gauges) {
+    oss << sep << "    \"" << kv.first << "\": " << kv.second->get();
+    sep = ",\n";
+  }
+  oss << "\n  },\n";
+
+  oss << "  \"histograms\": {";
+  sep = "\n";
+  for (auto const &kv : s_histograms) {
+    LatencyHistogram const &h = *kv.second;
+    oss << sep << "    \"" << kv.first << "\": {"
+        << "\"count\": " << h.count()
+        << ", \"mean\": " << (std::uint64_t)h.mean()
+        << ", \"p50\": " << h.percentile(0.50)
+        << ", \"p90\": " << h.percentile(0.90)
+        << ", \"p99\": " << h.percentile(0.99)
+        << ", \"p999\": " << h.percentile(0.999)
+        << ", \"max\": " << h.max()
+        << "}";
+    sep = ",\n";
+  }
+  oss << "\n  }\n";
+
+  oss << "}\n";
+  return oss.str();
+}
+
+
+std::string savePerfCountersToFile(std::string const &fname)
+{
+  std::string serialized = perfCountersToJSON();
+
+  std::ofstream out(fname, std::ios::binary);
+  if (out) {
+    out << serialized;
+    return "";
+  }
+  else {
+    return std::strerror(errno);
+  }
+}
+
+
+// EOF
@@ -0,0 +1,172 @@
+// perf-counters.h
+// Registry of named performance counters, gauges and histograms.
+
+// See license.txt for copyright and terms of use.
+
+// Each statistic is created on first lookup by name and then lives for
+// the rest of the program, so call sites can look it up once and keep
+// the reference:
+//
+//   static PerfCounter &captures = perfCounter("capture.count");
+//   captures.inc();
+//
+// Updates use relaxed atomics, so they can be made from any thread
+// without locking, and reads give a recent, not necessarily
+// consistent, snapshot.
+//
+// This module does not depend on the Windows API.
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "sm-macros.h"                 // SMBASE_PP_CAT
+
+#include <atomic>                      // std::atomic
+#include <cstdint>                     // std::{int64_t, uint64_t}
+#include <string>                      // std::string
+
+
+// ---------------------------- PerfCounter ----------------------------
+// Monotonically increasing count, such as captures taken or bytes
+// written.
+class PerfCounter {
+private:     // data
+  std::atomic<std::uint64_t> m_value{0};
+
+public:      // methods
+  void add(std::uint64_t n)
+    { m_value.fetch_add(n, std::memory_order_relaxed); }
+  void inc()
+    { add(1); }
+  std::uint64_t get() const
+    { return m_value.load(std::memory_order_relaxed); }
+};
+
+
+// ----------------------------- PerfGauge -----------------------------
+// Value that goes up and down, such as bytes held in bitmaps.
+class PerfGauge {
+private:     // data
+  std::atomic<std::int64_t> m_value{0};
+
+public:      // methods
+  void set(std::int64_t v)
+    { m_value.store(v, std::memory_order_relaxed); }
+  void add(std::int64_t n)
+    { m_value.fetch_add(n, std::memory_order_relaxed); }
+  std::int64_t get() const
+    { return m_value.load(std::memory_order_relaxed); }
+};
+
+
+// ------------------------- LatencyHistogram --------------------------
+// Histogram of nanosecond durations in the style of HdrHistogram:
+// buckets are exact below 16, and above that each power of two is
+// split into 16 equal sub-buckets, so any recorded value is known to
+// within 1/16 (about 6%) across the entire 64-bit range, in fixed
+// space and with one atomic increment per sample.
+class LatencyHistogram {
+public:      // constants
+  // Number of bits of precision below the leading one bit.
+  static int const c_subBits = 4;
+  static int const c_subBuckets = 1 << c_subBits;
+
+  // Total number of buckets.
+  static int const c_numBuckets = (64 - c_subBits + 1) * c_subBuckets;
+
+private:     // data
+  std::atomic<std::uint64_t> m_buckets[c_numBuckets];
+
+  // Number of samples, their sum, and the largest.
+  std::atomic<std::uint64_t> m_count{0};
+  std::atomic<std::uint64_t> m_sum{0};
+  std::atomic<std::uint64_t> m_max{0};
+
+public:      // methods
+  LatencyHistogram();
+
+  // Index of the bucket that holds `v`.
+  static int bucketIndex(std::uint64_t v);
+
+  // Smallest and largest values that land in bucket `index`.
+  static std::uint64_t bucketLow(int index);
+  static std::uint64_t bucketHigh(int index);
+
+  // Add a sample.
+  void record(std::uint64_t ns);
+
+  std::uint64_t count() const
+    { return m_count.load(std::memory_order_relaxed); }
+  std::uint64_t sum() const
+    { return m_sum.load(std::memory_order_relaxed); }
+  std::uint64_t max() const
+    { return m_max.load(std::memory_order_relaxed); }
+
+  // Mean of the samples, or 0 if there are none.
+  double mean() const;
+
+  // Value at or below which `fraction` (in [0,1]) of the samples lie,
+  // reported as the middle of its bucket (but never above `max()`).
+  // Returns 0 if there are no samples.
+  std::uint64_t percentile(double fraction) const;
+
+  // Discard all samples.
+  void reset();
+};
+
+
+// Current time in nanoseconds on a monotonic clock.
+std::uint64_t perfNowNs();
+
+
+// Record the lifetime of the enclosing scope in a histogram.
+class PerfScopeTimer {
+  PerfScopeTimer(PerfScopeTimer const &obj) = delete;
+  PerfScopeTimer &operator=(PerfScopeTimer const &obj) = delete;
+
+private:     // data
+  LatencyHistogram &m_histogram;
+  std::uint64_t m_startNs;
+
+public:      // methods
+  explicit PerfScopeTimer(LatencyHistogram &histogram)
+    : m_histogram(histogram),
+      m_startNs(perfNowNs())
+  {}
+
+  ~PerfScopeTimer()
+  {
+    m_histogram.record(perfNowNs() - m_startNs);
+  }
+};
+
+
+// Time the rest of the enclosing scope into the histogram called
+// `name`.
+#define PERF_TIME_SCOPE(name)                                           \
+  static LatencyHistogram &SMBASE_PP_CAT(perfHist_,__LINE__) =          \
+    perfHistogram(name);                                                \
+  PerfScopeTimer SMBASE_PP_CAT(perfTimer_,__LINE__)(                    \
+    SMBASE_PP_CAT(perfHist_,__LINE__)) /* user ; */
+
+
+// ----------------------------- Registry ------------------------------
+// Return the statistic called `name`, creating it if necessary.  A
+// name identifies one statistic of one kind; it is an error (checked
+// with `assert`) to use the same name for two kinds.
+PerfCounter &perfCounter(std::string const &name);
+PerfGauge &perfGauge(std::string const &name);
+LatencyHistogram &perfHistogram(std::string const &name);
+
+// Return all statistics as a JSON object with "counters", "gauges" and
+// "histograms" members, each mapping names to values.  Histograms are
+// summarized by count, mean, max and several percentiles, all in
+// nanoseconds.
+std::string perfCountersToJSON();
+
+// Write `perfCountersToJSON()` to `fname`.  Return a non-empty error
+// message on failure.
+std::string savePerfCountersToFile(std::string const &fname);
+
+
+#endif // PERF_COUNTERS_H
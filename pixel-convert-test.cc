@@ -0,0 +1,280 @@
+// pixel-convert-test.cc
+// Tests for `pixel-convert`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times each conversion of a 1920x1080 frame with each instruction
+// set the CPU supports.
+
+#include "pixel-convert.h"             // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <cstdint>                     // std::uint32_t
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// `n` random bytes.
+static std::vector<unsigned char> randomBytes(std::size_t n,
+                                              unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::vector<unsigned char> ret(n);
+  for (unsigned char &b : ret) {
+    b = (unsigned char)rng();
+  }
+  return ret;
+}
+
+
+// Convert `n` pixels of `src` with the instruction set in use.
+static std::vector<unsigned char> convert(
+  PixelFormat srcFmt, std::vector<unsigned char> const &src,
+  PixelFormat destFmt, std::size_t n)
+{
+  // A guard byte past the end catches overruns.
+  std::vector<unsigned char> dest(n * pixelFormatBytes(destFmt) + 1, 0x5A);
+  convertPixels(srcFmt, src.data(), destFmt, dest.data(), n);
+  EXPECT(dest.back() == 0x5A);
+  dest.pop_back();
+  return dest;
+}
+
+
+// Known values for single pixels.
+static void testKnownValues()
+{
+  // B=0x10, G=0x20, R=0x30, A=0x40.
+  std::vector<unsigned char> px = { 0x10, 0x20, 0x30, 0x40 };
+
+  EXPECT((convert(PF_BGRA32, px, PF_BGRX32, 1) ==
+          std::vector<unsigned char>{ 0x10, 0x20, 0x30, 0xFF }));
+  EXPECT((convert(PF_BGRA32, px, PF_RGBA32, 1) ==
+          std::vector<unsigned char>{ 0x30, 0x20, 0x10, 0x40 }));
+  EXPECT((convert(PF_BGRA32, px, PF_BGR24, 1) ==
+          std::vector<unsigned char>{ 0x10, 0x20, 0x30 }));
+
+  // Pure red, green and blue in 5-6-5.
+  std::vector<unsigned char> rgb = {
+    0x00, 0x00, 0xFF, 0x00,
+    0x00, 0xFF, 0x00, 0x00,
+    0xFF, 0x00, 0x00, 0x00,
+  };
+  EXPECT((convert(PF_BGRA32, rgb, PF_RGB565, 3) ==
+          std::vector<unsigned char>{ 0x00, 0xF8, 0xE0, 0x07, 0x1F, 0x00 }));
+
+  // Expanding repeats the high bits, so white stays white.
+  std::vector<unsigned char> white = { 0xFF, 0xFF };
+  EXPECT((convert(PF_RGB565, white, PF_BGRA32, 1) ==
+          std::vector<unsigned char>{ 0xFF, 0xFF, 0xFF, 0xFF }));
+
+  std::vector<unsigned char> bgr = { 1, 2, 3 };
+  EXPECT((convert(PF_BGR24, bgr, PF_BGRA32, 1) ==
+          std::vector<unsigned char>{ 1, 2, 3, 0xFF }));
+}
+
+
+// Every instruction set gives the same results as the scalar code, for
+// every format pair and for lengths around the vector widths.
+static void testIsasAgree()
+{
+  ConvertIsa const best = bestConvertIsa();
+  for (int s = 0; s < NUM_PIXEL_FORMATS; ++s) {
+    PixelFormat srcFmt = (PixelFormat)s;
+    for (int d = 0; d < NUM_PIXEL_FORMATS; ++d) {
+      PixelFormat destFmt = (PixelFormat)d;
+      for (std::size_t n = 0; n <= 70; ++n) {
+        std::vector<unsigned char> src =
+          randomBytes(n * pixelFormatBytes(srcFmt), (unsigned)(s*100 + n));
+
+        setConvertIsa(CI_SCALAR);
+        std::vector<unsigned char> expect =
+          convert(srcFmt, src, destFmt, n);
+
+        for (int isa = CI_SCALAR+1; isa <= best; ++isa) {
+          setConvertIsa((ConvertIsa)isa);
+          bool same = convert(srcFmt, src, destFmt, n) == expect;
+          EXPECT(same);
+          if (!same) {
+            std::cout << "  " << pixelFormatName(srcFmt) << " -> "
+                      << pixelFormatName(destFmt) << ", " << n
+                      << " pixels, " << convertIsaName((ConvertIsa)isa)
+                      << "\n";
+          }
+        }
+      }
+    }
+  }
+  setConvertIsa(best);
+}
+
+
+// Conversions that lose nothing come back unchanged.
+static void testRoundTrips()
+{
+  std::size_t const n = 37;
+  std::vector<unsigned char> src = randomBytes(n * 4, 7);
+
+  std::vector<unsigned char> rgba = convert(PF_BGRA32, src, PF_RGBA32, n);
+  EXPECT(convert(PF_RGBA32, rgba, PF_BGRA32, n) == src);
+
+  // Through 24 bpp, alpha becomes opaque.
+  std::vector<unsigned char> opaque = convert(PF_BGRA32, src, PF_BGRX32, n);
+  std::vector<unsigned char> bgr = convert(PF_BGRA32, src, PF_BGR24, n);
+  EXPECT(convert(PF_BGR24, bgr, PF_BGRA32, n) == opaque);
+
+  // 5-6-5 values survive expansion and truncation.
+  std::vector<unsigned char> c565 = randomBytes(n * 2, 8);
+  std::vector<unsigned char> expanded =
+    convert(PF_RGB565, c565, PF_BGRA32, n);
+  EXPECT(convert(PF_BGRA32, expanded, PF_RGB565, n) == c565);
+}
+
+
+// Converting between formats of the same size works in place.
+static void testInPlace()
+{
+  std::size_t const n = 29;
+  std::vector<unsigned char> buf = randomBytes(n * 4, 9);
+  std::vector<unsigned char> expect = convert(PF_BGRA32, buf, PF_RGBA32, n);
+  convertPixels(PF_BGRA32, buf.data(), PF_RGBA32, buf.data(), n);
+  EXPECT(buf == expect);
+}
+
+
+// Rows are flipped and read from the right place, skipping padding.
+static void testRows()
+{
+  // Three 24 bpp rows of two pixels, padded to 8 bytes, whose pixel at
+  // (x, i) is blue x and green i.
+  std::vector<unsigned char> rows = {
+    0, 0, 0,  1, 0, 0,  0xEE, 0xEE,
+    0, 1, 0,  1, 1, 0,  0xEE, 0xEE,
+    0, 2, 0,  1, 2, 0,  0xEE, 0xEE,
+  };
+
+  PixelImage img(2, 3);
+  convertRowsToImage(rows.data(), 8, false /*bottomUp*/, PF_BGR24, img);
+  EXPECT(img.at(0, 0) == 0xFF000000u && img.at(1, 2) == 0xFF000201u);
+
+  // Bottom up, the first row read is the last in the image.
+  convertRowsToImage(rows.data(), 8, true /*bottomUp*/, PF_BGR24, img);
+  EXPECT(img.at(0, 2) == 0xFF000000u && img.at(1, 0) == 0xFF000201u);
+}
+
+
+// Dithering agrees across instruction sets, and keeps the average of a
+// flat area that truncation would darken.
+static void testDither()
+{
+  int const w = 67, h = 4;
+  std::vector<unsigned char> src = randomBytes(w * h * 4, 11);
+  std::uint32_t const *px = (std::uint32_t const*)src.data();
+
+  ConvertIsa const best = bestConvertIsa();
+  std::vector<unsigned char> expect(w * 2), out(w * 2);
+  for (int y = 0; y < h; ++y) {
+    setConvertIsa(CI_SCALAR);
+    ditherPixelsTo565(px + y*w, y, expect.data(), w);
+    for (int isa = CI_SCALAR+1; isa <= best; ++isa) {
+      setConvertIsa((ConvertIsa)isa);
+      ditherPixelsTo565(px + y*w, y, out.data(), w);
+      EXPECT(out == expect);
+    }
+  }
+  setConvertIsa(best);
+
+  // Blue 0x0C is halfway between the 5-bit levels 0x08 and 0x10.
+  std::vector<std::uint32_t> flat(16, 0x0C);
+  double sum = 0;
+  for (int y = 0; y < 4; ++y) {
+    std::vector<unsigned char> c565(16 * 2);
+    ditherPixelsTo565(flat.data(), y, c565.data(), 16);
+    std::vector<unsigned char> back =
+      convert(PF_RGB565, c565, PF_BGRA32, 16);
+    for (int x = 0; x < 16; ++x) {
+      sum += back[x*4];
+    }
+  }
+  double mean = sum / 64;
+  EXPECT(mean > 0x0A && mean < 0x0E);
+}
+
+
+static void testNames()
+{
+  EXPECT(std::string(pixelFormatName(PF_RGB565)) == "RGB565");
+  EXPECT(std::string(convertIsaName(CI_AVX2)) == "AVX2");
+  EXPECT(pixelFormatBytes(PF_BGR24) == 3);
+  EXPECT(convertIsa() == bestConvertIsa());
+}
+
+
+// Time each conversion of a 1920x1080 frame with each instruction set.
+static void bench()
+{
+  std::size_t const n = 1920 * 1080;
+  int const iters = 50;
+  std::vector<unsigned char> src = randomBytes(n * 4, 1);
+  std::vector<unsigned char> dest(n * 4);
+
+  using Clock = std::chrono::steady_clock;
+  PixelFormat const bgra = PF_BGRA32;
+  std::pair<PixelFormat, PixelFormat> const pairs[] = {
+    { bgra, PF_BGRX32 }, { bgra, PF_RGBA32 }, { bgra, PF_BGR24 },
+    { bgra, PF_RGB565 }, { PF_BGR24, bgra }, { PF_RGB565, bgra },
+  };
+
+  ConvertIsa const best = bestConvertIsa();
+  std::cout << "best instruction set: " << convertIsaName(best) << "\n";
+  for (auto const &pair : pairs) {
+    std::cout << pixelFormatName(pair.first) << " -> "
+              << pixelFormatName(pair.second) << ":";
+    for (int isa = CI_SCALAR; isa <= best; ++isa) {
+      setConvertIsa((ConvertIsa)isa);
+      auto start = Clock::now();
+      for (int i = 0; i < iters; ++i) {
+        convertPixels(pair.first, src.data(), pair.second, dest.data(), n);
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count() / iters;
+      std::cout << " " << convertIsaName((ConvertIsa)isa) << " "
+                << ms << " ms";
+    }
+    std::cout << "\n";
+  }
+  setConvertIsa(best);
+}
+
+
+int main(int argc, char **argv)
+{
+  testKnownValues();
+  testIsasAgree();
+  testRoundTrips();
+  testInPlace();
+  testRows();
+  testDither();
+  testNames();
+
+  if (s_failures) {
+    std::cout << "pixel-convert-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "pixel-convert-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,649 @@
+// pixel-convert.cc
+// Code for `pixel-convert` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "pixel-convert.h"             // this module
+
+#include <cassert>                     // assert
+#include <cstdint>                     // std::{uint16_t, uint32_t}
+#include <cstring>                     // std::memcpy
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_or_si128, etc.
+#endif
+
+// AVX2 kernels are compiled with a per-function target attribute, so
+// the rest of the program does not need AVX2, and are only called when
+// the CPU has it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define PIXEL_CONVERT_AVX2 1
+#  define AVX2_TARGET __attribute__((target("avx2")))
+#  include <immintrin.h>               // _mm256_shuffle_epi8, etc.
+#endif
+
+
+// ------------------------------ Formats ------------------------------
+// Reading and writing one pixel of format `F`, as a BGRA value.
+template <PixelFormat F>
+struct Format;
+
+template <>
+struct Format<PF_BGRA32> {
+  static int const c_bytes = 4;
+
+  static std::uint32_t load(unsigned char const *p)
+  {
+    std::uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  }
+
+  static void store(unsigned char *p, std::uint32_t v)
+  {
+    std::memcpy(p, &v, 4);
+  }
+};
+
+template <>
+struct Format<PF_BGRX32> {
+  static int const c_bytes = 4;
+
+  static std::uint32_t load(unsigned char const *p)
+  {
+    return Format<PF_BGRA32>::load(p) | 0xFF000000u;
+  }
+
+  static void store(unsigned char *p, std::uint32_t v)
+  {
+    Format<PF_BGRA32>::store(p, v | 0xFF000000u);
+  }
+};
+
+// Exchange the bytes holding red and blue.
+static inline std::uint32_t swapRB(std::uint32_t v)
+{
+  return (v & 0xFF00FF00u) | ((v >> 16) & 0xFF) | ((v & 0xFF) << 16);
+}
+
+template <>
+struct Format<PF_RGBA32> {
+  static int const c_bytes = 4;
+
+  static std::uint32_t load(unsigned char const *p)
+  {
+    return swapRB(Format<PF_BGRA32>::load(p));
+  }
+
+  static void store(unsigned char *p, std::uint32_t v)
+  {
+    Format<PF_BGRA32>::store(p, swapRB(v));
+  }
+};
+
+template <>
+struct Format<PF_BGR24> {
+  static int const c_bytes = 3;
+
+  static std::uint32_t load(unsigned char const *p)
+  {
+    return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8) |
+           ((std::uint32_t)p[2] << 16) | 0xFF000000u;
+  }
+
+  static void store(unsigned char *p, std::uint32_t v)
+  {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+  }
+};
+
+template <>
+struct Format<PF_RGB565> {
+  static int const c_bytes = 2;
+
+  static std::uint32_t load(unsigned char const *p)
+  {
+    std::uint32_t c = (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8);
+    std::uint32_t r = c >> 11;
+    std::uint32_t g = (c >> 5) & 0x3F;
+    std::uint32_t b = c & 0x1F;
+    return ((b << 3) | (b >> 2)) |
+           (((g << 2) | (g >> 4)) << 8) |
+           (((r << 3) | (r >> 2)) << 16) | 0xFF000000u;
+  }
+
+  static void store(unsigned char *p, std::uint32_t v)
+  {
+    std::uint32_t c = ((v >> 8) & 0xF800) | ((v >> 5) & 0x07E0) |
+                      ((v >> 3) & 0x001F);
+    p[0] = (unsigned char)c;
+    p[1] = (unsigned char)(c >> 8);
+  }
+};
+
+
+// ------------------------------ Kernels ------------------------------
+// Conversions that have vector kernels.  Each format pair maps to one
+// of these at compile time.
+enum KernelKind {
+  KK_COPY,                             // same layout
+  KK_OPAQUE,                           // set alpha
+  KK_SWAP_RB,                          // BGRA <-> RGBA
+  KK_TO_BGR24,                         // drop alpha
+  KK_FROM_BGR24,                       // add opaque alpha
+  KK_TO_RGB565,                        // truncate channels
+  KK_GENERIC,                          // only the scalar loop
+};
+
+static constexpr bool isBGRA(PixelFormat f)
+{
+  return f == PF_BGRA32 || f == PF_BGRX32;
+}
+
+static constexpr KernelKind kernelKind(PixelFormat src, PixelFormat dest)
+{
+  return
+    src == dest && src != PF_BGRX32?                 KK_COPY :
+    isBGRA(src) && isBGRA(dest)?                     KK_OPAQUE :
+    (src == PF_BGRA32 && dest == PF_RGBA32) ||
+    (src == PF_RGBA32 && dest == PF_BGRA32)?         KK_SWAP_RB :
+    isBGRA(src) && dest == PF_BGR24?                 KK_TO_BGR24 :
+    src == PF_BGR24 && isBGRA(dest)?                 KK_FROM_BGR24 :
+    isBGRA(src) && dest == PF_RGB565?                KK_TO_RGB565 :
+                                                     KK_GENERIC;
+}
+
+
+// Convert as many of the `n` pixels at `src` as a vector kernel for
+// `KIND` using `ISA` can, and return how many that was.  The scalar
+// loop does the rest.  This general case has no kernel.
+template <KernelKind KIND, ConvertIsa ISA>
+struct SimdKernel {
+  static std::size_t run(unsigned char const *, unsigned char *,
+                         std::size_t)
+  {
+    return 0;
+  }
+};
+
+
+#ifdef __SSE2__
+template <>
+struct SimdKernel<KK_OPAQUE, CI_SSE2> {
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    __m128i const alpha = _mm_set1_epi32((int)0xFF000000);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((__m128i const*)(src + i*4));
+      _mm_storeu_si128((__m128i*)(dest + i*4), _mm_or_si128(v, alpha));
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_SWAP_RB, CI_SSE2> {
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    // Without a byte shuffle, move red and blue past each other with
+    // shifts of the 32-bit lanes.
+    __m128i const ga = _mm_set1_epi32((int)0xFF00FF00);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((__m128i const*)(src + i*4));
+      __m128i rb = _mm_andnot_si128(ga, v);
+      __m128i swapped = _mm_or_si128(_mm_slli_epi32(rb, 16),
+                                     _mm_srli_epi32(rb, 16));
+      _mm_storeu_si128((__m128i*)(dest + i*4),
+                       _mm_or_si128(_mm_and_si128(v, ga), swapped));
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_TO_RGB565, CI_SSE2> {
+  // Return the four pixels of `v` as 5-6-5 values in 32-bit lanes,
+  // sign-extended from 16 bits so a saturating pack keeps them.
+  static __m128i pack565(__m128i v)
+  {
+    __m128i r = _mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xF800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(v, 5), _mm_set1_epi32(0x07E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(v, 3), _mm_set1_epi32(0x001F));
+    __m128i c = _mm_or_si128(_mm_or_si128(r, g), b);
+    return _mm_srai_epi32(_mm_slli_epi32(c, 16), 16);
+  }
+
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m128i a = _mm_loadu_si128((__m128i const*)(src + i*4));
+      __m128i b = _mm_loadu_si128((__m128i const*)(src + i*4 + 16));
+      _mm_storeu_si128((__m128i*)(dest + i*2),
+                       _mm_packs_epi32(pack565(a), pack565(b)));
+    }
+    return i;
+  }
+};
+
+// SSE2 has no byte shuffle, so the 24 bpp conversions are left to the
+// scalar loop, or AVX2.
+#endif // __SSE2__
+
+
+#ifdef PIXEL_CONVERT_AVX2
+template <>
+struct SimdKernel<KK_OPAQUE, CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    __m256i const alpha = _mm256_set1_epi32((int)0xFF000000);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((__m256i const*)(src + i*4));
+      _mm256_storeu_si256((__m256i*)(dest + i*4),
+                          _mm256_or_si256(v, alpha));
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_SWAP_RB, CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    __m256i const shuffle = _mm256_setr_epi8(
+      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((__m256i const*)(src + i*4));
+      _mm256_storeu_si256((__m256i*)(dest + i*4),
+                          _mm256_shuffle_epi8(v, shuffle));
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_TO_BGR24, CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    // Pack each 128-bit lane's four pixels into its low 12 bytes.
+    __m256i const shuffle = _mm256_setr_epi8(
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // Each lane is stored as 16 bytes, the last 4 of which are junk
+    // that the next store overwrites.  After the last store, the junk
+    // lands where the next two pixels go, so those must exist.
+    std::size_t i = 0;
+    for (; i + 10 <= n; i += 8) {
+      __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256((__m256i const*)(src + i*4)), shuffle);
+      unsigned char *d = dest + i*3;
+      _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(v));
+      _mm_storeu_si128((__m128i*)(d + 12), _mm256_extracti128_si256(v, 1));
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_FROM_BGR24, CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    // Spread 12 bytes of each lane over four pixels.
+    __m256i const shuffle = _mm256_setr_epi8(
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m256i const alpha = _mm256_set1_epi32((int)0xFF000000);
+
+    // Each lane is loaded as 16 bytes, so the second load reads 4 bytes
+    // past the 8 pixels, which the next two pixels provide.
+    std::size_t i = 0;
+    for (; i + 10 <= n; i += 8) {
+      unsigned char const *s = src + i*3;
+      __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((__m128i const*)s)),
+        _mm_loadu_si128((__m128i const*)(s + 12)), 1);
+      v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha);
+      _mm256_storeu_si256((__m256i*)(dest + i*4), v);
+    }
+    return i;
+  }
+};
+
+
+template <>
+struct SimdKernel<KK_TO_RGB565, CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src, unsigned char *dest,
+                         std::size_t n)
+  {
+    __m256i const rMask = _mm256_set1_epi32(0xF800);
+    __m256i const gMask = _mm256_set1_epi32(0x07E0);
+    __m256i const bMask = _mm256_set1_epi32(0x001F);
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+      __m256i c[2];
+      for (int k = 0; k < 2; ++k) {
+        __m256i v =
+          _mm256_loadu_si256((__m256i const*)(src + i*4 + k*32));
+        __m256i rgb = _mm256_or_si256(
+          _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 8), rMask),
+                          _mm256_and_si256(_mm256_srli_epi32(v, 5), gMask)),
+          _mm256_and_si256(_mm256_srli_epi32(v, 3), bMask));
+
+        // Sign-extend from 16 bits so the saturating pack keeps it.
+        c[k] = _mm256_srai_epi32(_mm256_slli_epi32(rgb, 16), 16);
+      }
+
+      // The pack works within 128-bit lanes, leaving the quarters in
+      // the order 0, 2, 1, 3.
+      __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(c[0], c[1]), 0xD8);
+      _mm256_storeu_si256((__m256i*)(dest + i*2), packed);
+    }
+    return i;
+  }
+};
+#endif // PIXEL_CONVERT_AVX2
+
+
+// Convert `n` pixels from `SRC` to `DEST` using `ISA`.
+template <PixelFormat SRC, PixelFormat DEST, ConvertIsa ISA>
+static void convertKernel(unsigned char const *src, unsigned char *dest,
+                          std::size_t n)
+{
+  constexpr KernelKind kind = kernelKind(SRC, DEST);
+  if constexpr (kind == KK_COPY) {
+    if (src != dest) {
+      std::memcpy(dest, src, n * Format<SRC>::c_bytes);
+    }
+  }
+  else {
+    std::size_t i = SimdKernel<kind, ISA>::run(src, dest, n);
+    for (; i < n; ++i) {
+      Format<DEST>::store(dest + i * Format<DEST>::c_bytes,
+                          Format<SRC>::load(src + i * Format<SRC>::c_bytes));
+    }
+  }
+}
+
+
+// ----------------------------- Dispatch ------------------------------
+typedef void (*ConvertFunc)(unsigned char const *src, unsigned char *dest,
+                            std::size_t n);
+
+
+template <ConvertIsa ISA, PixelFormat SRC>
+static ConvertFunc kernelFrom(PixelFormat dest)
+{
+  switch (dest) {
+    case PF_BGRA32:  return &convertKernel<SRC, PF_BGRA32, ISA>;
+    case PF_BGRX32:  return &convertKernel<SRC, PF_BGRX32, ISA>;
+    case PF_RGBA32:  return &convertKernel<SRC, PF_RGBA32, ISA>;
+    case PF_BGR24:   return &convertKernel<SRC, PF_BGR24, ISA>;
+    case PF_RGB565:  return &convertKernel<SRC, PF_RGB565, ISA>;
+    default:         break;
+  }
+  assert(!"invalid destination format");
+  return nullptr;
+}
+
+
+template <ConvertIsa ISA>
+static ConvertFunc kernelFor(PixelFormat src, PixelFormat dest)
+{
+  switch (src) {
+    case PF_BGRA32:  return kernelFrom<ISA, PF_BGRA32>(dest);
+    case PF_BGRX32:  return kernelFrom<ISA, PF_BGRX32>(dest);
+    case PF_RGBA32:  return kernelFrom<ISA, PF_RGBA32>(dest);
+    case PF_BGR24:   return kernelFrom<ISA, PF_BGR24>(dest);
+    case PF_RGB565:  return kernelFrom<ISA, PF_RGB565>(dest);
+    default:         break;
+  }
+  assert(!"invalid source format");
+  return nullptr;
+}
+
+
+ConvertIsa bestConvertIsa()
+{
+#ifdef PIXEL_CONVERT_AVX2
+  // This may run during static initialization, before the runtime
+  // has looked at the CPU.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return CI_AVX2;
+  }
+#endif
+
+#ifdef __SSE2__
+  return CI_SSE2;
+#else
+  return CI_SCALAR;
+#endif
+}
+
+
+// Instruction set in use.
+static ConvertIsa s_isa = bestConvertIsa();
+
+
+ConvertIsa convertIsa()
+{
+  return s_isa;
+}
+
+
+void setConvertIsa(ConvertIsa isa)
+{
+  ConvertIsa best = bestConvertIsa();
+  s_isa = isa < best? isa : best;
+}
+
+
+static ConvertFunc lookupKernel(PixelFormat src, PixelFormat dest)
+{
+  switch (s_isa) {
+    case CI_AVX2:    return kernelFor<CI_AVX2>(src, dest);
+    case CI_SSE2:    return kernelFor<CI_SSE2>(src, dest);
+    default:         return kernelFor<CI_SCALAR>(src, dest);
+  }
+}
+
+
+// ----------------------------- Dithering -----------------------------
+// 4x4 ordered-dither (Bayer) thresholds, from 0 to 15.
+static unsigned char const c_bayer4[4][4] = {
+  {  0,  8,  2, 10 },
+  { 12,  4, 14,  6 },
+  {  3, 11,  1,  9 },
+  { 15,  7, 13,  5 },
+};
+
+
+// Add the 16 bytes of `pattern`, repeating every four pixels, to the
+// `n` pixels at `src`, saturating, and store them at `dest`.  Return
+// how many pixels that was; the caller does the rest.
+template <ConvertIsa ISA>
+struct AddPattern {
+  static std::size_t run(unsigned char const *, unsigned char const *,
+                         unsigned char *, std::size_t)
+  {
+    return 0;
+  }
+};
+
+
+#ifdef __SSE2__
+template <>
+struct AddPattern<CI_SSE2> {
+  static std::size_t run(unsigned char const *src,
+                         unsigned char const *pattern,
+                         unsigned char *dest, std::size_t n)
+  {
+    __m128i const pat = _mm_loadu_si128((__m128i const*)pattern);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((__m128i const*)(src + i*4));
+      _mm_storeu_si128((__m128i*)(dest + i*4), _mm_adds_epu8(v, pat));
+    }
+    return i;
+  }
+};
+#endif // __SSE2__
+
+
+#ifdef PIXEL_CONVERT_AVX2
+template <>
+struct AddPattern<CI_AVX2> {
+  AVX2_TARGET
+  static std::size_t run(unsigned char const *src,
+                         unsigned char const *pattern,
+                         unsigned char *dest, std::size_t n)
+  {
+    __m256i const pat = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((__m128i const*)pattern));
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((__m256i const*)(src + i*4));
+      _mm256_storeu_si256((__m256i*)(dest + i*4), _mm256_adds_epu8(v, pat));
+    }
+    return i;
+  }
+};
+#endif // PIXEL_CONVERT_AVX2
+
+
+void ditherPixelsTo565(std::uint32_t const *src, int y,
+                       void *dest /*OUT*/, std::size_t n)
+{
+  // The thresholds, scaled to the step between representable levels
+  // (8 for red and blue, 4 for green), for four pixels of this row.
+  // Truncation then rounds up with a probability equal to the part of
+  // the step that was dropped.
+  unsigned char pattern[16];
+  for (int x = 0; x < 4; ++x) {
+    int t = c_bayer4[y & 3][x];
+    pattern[x*4 + 0] = (unsigned char)(t / 2);     // blue
+    pattern[x*4 + 1] = (unsigned char)(t / 4);     // green
+    pattern[x*4 + 2] = (unsigned char)(t / 2);     // red
+    pattern[x*4 + 3] = 0;                          // alpha
+  }
+
+  // Dither in chunks small enough to stay in L1 before packing.
+  std::size_t const chunk = 256;
+  std::uint32_t tmp[chunk];
+  unsigned char const *s = (unsigned char const*)src;
+  unsigned char *d = (unsigned char*)dest;
+  ConvertFunc pack = lookupKernel(PF_BGRA32, PF_RGB565);
+
+  for (std::size_t start = 0; start < n; start += chunk) {
+    std::size_t len = n - start < chunk? n - start : chunk;
+    unsigned char const *cs = s + start*4;
+    unsigned char *ct = (unsigned char*)tmp;
+
+    std::size_t i;
+    switch (s_isa) {
+      case CI_AVX2:  i = AddPattern<CI_AVX2>::run(cs, pattern, ct, len);
+                     break;
+      case CI_SSE2:  i = AddPattern<CI_SSE2>::run(cs, pattern, ct, len);
+                     break;
+      default:       i = 0; break;
+    }
+    for (i *= 4; i < len*4; ++i) {
+      int v = cs[i] + pattern[i % 16];
+      ct[i] = (unsigned char)(v < 255? v : 255);
+    }
+
+    pack(ct, d + start*2, len);
+  }
+}
+
+
+// ----------------------------- Interface -----------------------------
+int pixelFormatBytes(PixelFormat fmt)
+{
+  switch (fmt) {
+    case PF_BGRA32:  return Format<PF_BGRA32>::c_bytes;
+    case PF_BGRX32:  return Format<PF_BGRX32>::c_bytes;
+    case PF_RGBA32:  return Format<PF_RGBA32>::c_bytes;
+    case PF_BGR24:   return Format<PF_BGR24>::c_bytes;
+    case PF_RGB565:  return Format<PF_RGB565>::c_bytes;
+    default:         break;
+  }
+  assert(!"invalid format");
+  return 0;
+}
+
+
+char const *pixelFormatName(PixelFormat fmt)
+{
+  switch (fmt) {
+    case PF_BGRA32:  return "BGRA32";
+    case PF_BGRX32:  return "BGRX32";
+    case PF_RGBA32:  return "RGBA32";
+    case PF_BGR24:   return "BGR24";
+    case PF_RGB565:  return "RGB565";
+    default:         return "invalid";
+  }
+}
+
+
+char const *convertIsaName(ConvertIsa isa)
+{
+  switch (isa) {
+    case CI_SCALAR:  return "scalar";
+    case CI_SSE2:    return "SSE2";
+    case CI_AVX2:    return "AVX2";
+    default:         return "invalid";
+  }
+}
+
+
+void convertPixels(PixelFormat srcFmt, void const *src,
+                   PixelFormat destFmt, void *dest /*OUT*/,
+                   std::size_t n)
+{
+  lookupKernel(srcFmt, destFmt)((unsigned char const*)src,
+                                (unsigned char*)dest, n);
+}
+
+
+void convertRowsToImage(unsigned char const *src, std::size_t srcStride,
+                        bool bottomUp, PixelFormat fmt,
+                        PixelImage &img /*OUT*/)
+{
+  ConvertFunc func = lookupKernel(fmt, PF_BGRA32);
+  for (int i = 0; i < img.m_height; ++i) {
+    int y = bottomUp? img.m_height - 1 - i : i;
+    func(src, (unsigned char*)img.row(y), img.m_width);
+    src += srcStride;
+  }
+}
+
+
+// EOF
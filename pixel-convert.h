@@ -0,0 +1,101 @@
+// pixel-convert.h
+// Conversion of pixel rows between memory layouts.
+
+// See license.txt for copyright and terms of use.
+
+// Captures are held as 32-bit BGRA (see `PixelImage`), but files and
+// codecs want other layouts: 24 and 16 bpp DIB rows, RGBA, opaque
+// pixels, and rows in the opposite order.  Done a pixel at a time,
+// these conversions would take most of the time spent saving.
+//
+// The kernels are generated from templates parameterized on the source
+// and destination formats, with SSE2 and AVX2 specializations of the
+// common ones.  Which instruction set is used is decided at run time
+// from what the CPU supports, so one binary runs everywhere.
+//
+// This module does not depend on the Windows API.
+
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint32_t
+
+
+// Pixel layouts, named by the order of the bytes in memory.
+enum PixelFormat {
+  // The layout of `PixelImage` and 32 bpp DIBs.
+  PF_BGRA32,
+
+  // The same, but always written with alpha 0xFF.  As a source, alpha
+  // is ignored.
+  PF_BGRX32,
+
+  // Red first, as PNG and QOI order the channels.
+  PF_RGBA32,
+
+  // 24 bpp DIB.  No alpha; pixels read from it are opaque.
+  PF_BGR24,
+
+  // 16-bit little-endian values with red in the top 5 bits, green in
+  // the middle 6 and blue in the low 5.  Reading expands each channel
+  // to 8 bits by repeating its high bits, and the pixels are opaque.
+  PF_RGB565,
+
+  NUM_PIXEL_FORMATS
+};
+
+// Instruction sets the kernels can use.
+enum ConvertIsa {
+  CI_SCALAR,
+  CI_SSE2,
+  CI_AVX2,
+
+  NUM_CONVERT_ISAS
+};
+
+
+// Bytes per pixel in `fmt`.
+int pixelFormatBytes(PixelFormat fmt);
+
+// Name of `fmt`, such as "BGR24".
+char const *pixelFormatName(PixelFormat fmt);
+
+// Name of `isa`, such as "AVX2".
+char const *convertIsaName(ConvertIsa isa);
+
+// Best instruction set the CPU supports.
+ConvertIsa bestConvertIsa();
+
+// Instruction set in use.  It starts as `bestConvertIsa()`.
+ConvertIsa convertIsa();
+
+// Use `isa`, or the best supported one if that is lower.  This is for
+// tests and benchmarks, and must not race with conversions.
+void setConvertIsa(ConvertIsa isa);
+
+// Convert `n` pixels at `src`, in `srcFmt`, to `destFmt` at `dest`.
+// If the two formats have the same size, `src` and `dest` may be the
+// same, converting in place; otherwise they must not overlap.
+void convertPixels(PixelFormat srcFmt, void const *src,
+                   PixelFormat destFmt, void *dest /*OUT*/,
+                   std::size_t n);
+
+// Convert the `n` BGRA pixels at `src`, which are the start of row `y`
+// of an image, to `PF_RGB565` at `dest`, with ordered dithering.
+// Truncating to 5 and 6 bits turns smooth gradients into visible
+// bands; the dither pattern, which depends on the pixel position,
+// breaks them up.
+void ditherPixelsTo565(std::uint32_t const *src, int y,
+                       void *dest /*OUT*/, std::size_t n);
+
+// Fill all of `img`, which has its final size, from rows in `fmt` that
+// are `srcStride` bytes apart at `src`, bottom first if `bottomUp`.
+void convertRowsToImage(unsigned char const *src, std::size_t srcStride,
+                        bool bottomUp, PixelFormat fmt,
+                        PixelImage &img /*OUT*/);
+
+
+#endif // PIXEL_CONVERT_H
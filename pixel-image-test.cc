@@ -0,0 +1,290 @@
+// pixel-image-test.cc
+// Tests for `pixel-image`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "pixel-image.h"               // module under test
+
+#include "pixel-convert.h"             // setConvertIsa
+#include "test-util.h"                 // EXPECT
+
+#include <algorithm>                   // std::min
+#include <cstdint>                     // std::uint32_t
+#include <cstdlib>                     // std::abs
+#include <cstring>                     // std::memcpy
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+
+
+// Image whose pixel at (x,y) has blue x, green y, red 7, alpha 0.
+static PixelImage gradient(int w, int h)
+{
+  PixelImage img(w, h);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      img.row(y)[x] = (std::uint32_t)x | ((std::uint32_t)y << 8) | (7 << 16);
+    }
+  }
+  return img;
+}
+
+
+static void testOpaque()
+{
+  PixelImage img = gradient(3, 2);
+  setOpaque(img);
+  EXPECT(img.at(2, 1) == 0xFF070102u);
+}
+
+
+static void testContentHash()
+{
+  PixelImage a = gradient(33, 7);
+  PixelImage b = gradient(33, 7);
+  EXPECT(hashPixelContent(a) == hashPixelContent(b));
+  EXPECT(!hashPixelContent(a).empty());
+
+  // A change in the padded last stripe, and in a whole one.
+  b.row(6)[32] ^= 1;
+  EXPECT(hashPixelContent(a) != hashPixelContent(b));
+  b = gradient(33, 7);
+  b.row(0)[0] ^= 0x80000000u;
+  EXPECT(hashPixelContent(a) != hashPixelContent(b));
+
+  // Same pixels, different shape.
+  PixelImage c(7, 33);
+  c.m_pixels = a.m_pixels;
+  EXPECT(hashPixelContent(a) != hashPixelContent(c));
+
+  // A 16-pixel sprite moved sideways by its width, on a blank screen.
+  // Each row of 256 pixels is one group of stripes between scrambles,
+  // and the move swaps two of its stripes.
+  for (int dx : { 16, 32, 240 }) {
+    PixelImage before(256, 4);
+    PixelImage after(256, 4);
+    for (int x = 0; x < 16; ++x) {
+      before.row(2)[x] = 0xFF000000u | (x * 0x10305);
+      after.row(2)[x + dx] = before.row(2)[x];
+    }
+    EXPECT(hashPixelContent(before) != hashPixelContent(after));
+  }
+
+  // Saved hashes are compared with new ones, so the function must not
+  // change by accident.  Hashes saved before stripes were keyed by
+  // position just never match.
+  PixelImage big = gradient(100, 60);
+  EXPECT(hashPixelContent(big).toHex() ==
+         "a6377246907224a47a45b608b6185c39");
+
+  // Every instruction set gives the same result, for sizes around the
+  // stripe and scramble lengths.
+  ConvertIsa const best = bestConvertIsa();
+  for (int w = 1; w <= 80; w += 3) {
+    PixelImage img = gradient(w, 17);
+    setConvertIsa(CI_SCALAR);
+    ContentHash expect = hashPixelContent(img);
+    for (int isa = CI_SCALAR+1; isa <= best; ++isa) {
+      setConvertIsa((ConvertIsa)isa);
+      EXPECT(hashPixelContent(img) == expect);
+    }
+  }
+  setConvertIsa(best);
+}
+
+
+static void testContentHashHex()
+{
+  ContentHash h;
+  h.m_hi = 0x0123456789ABCDEFull;
+  h.m_lo = 0xFEDCBA9876543210ull;
+  EXPECT(h.toHex() == "0123456789abcdeffedcba9876543210");
+
+  ContentHash back;
+  EXPECT(ContentHash::fromHex(h.toHex(), back) && back == h);
+  EXPECT(ContentHash::fromHex("0123456789ABCDEFFEDCBA9876543210", back));
+  EXPECT(back == h);
+
+  EXPECT(!ContentHash::fromHex("0123", back));
+  EXPECT(!ContentHash::fromHex("0123456789abcdeffedcba987654321g", back));
+}
+
+
+static void testDownscale()
+{
+  PixelImage src = gradient(8, 4);
+
+  PixelImage copy = downscaleImage(src, 8);
+  EXPECT(copy.m_pixels == src.m_pixels);
+
+  // Halving averages 2x2 blocks: blue of block (1,0) is mean(2,3,2,3),
+  // rounded, and green of row block 1 is mean(2,2,3,3).
+  PixelImage half = downscaleImage(src, 4);
+  EXPECT(half.m_width == 4 && half.m_height == 2);
+  EXPECT((half.at(1, 1) & 0xFF) == 3);
+  EXPECT(((half.at(1, 1) >> 8) & 0xFF) == 3);
+  EXPECT(((half.at(1, 1) >> 16) & 0xFF) == 7);
+
+  // Extreme reduction still yields a pixel.
+  PixelImage tiny = downscaleImage(gradient(1000, 2), 10);
+  EXPECT(tiny.m_width == 10 && tiny.m_height == 1);
+}
+
+
+static std::uint32_t readLE32(unsigned char const *p)
+{
+  std::uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+
+static void testEncodeBMP()
+{
+  PixelImage img = gradient(3, 2);
+  std::vector<unsigned char> bmp = encodeBMP(img);
+
+  EXPECT(bmp.size() == 14 + 40 + 3*2*4);
+  EXPECT(bmp[0] == 'B' && bmp[1] == 'M');
+  EXPECT(readLE32(&bmp[2]) == bmp.size());
+  EXPECT(readLE32(&bmp[10]) == 54);
+  EXPECT(readLE32(&bmp[18]) == 3);
+  EXPECT(readLE32(&bmp[22]) == 2);
+  EXPECT(bmp[28] == 32);
+
+  // Bottom row first.
+  EXPECT(readLE32(&bmp[54]) == img.at(0, 1));
+  EXPECT(readLE32(&bmp[54 + 12]) == img.at(0, 0));
+}
+
+
+// Writing the header and then bands of rows gives the same file.
+static void testEncodeBMPBands()
+{
+  PixelImage img = gradient(5, 7);
+  std::vector<unsigned char> whole = encodeBMP(img);
+
+  std::vector<unsigned char> banded = encodeBMPHeader(5, 7);
+  for (int first = 0; first < 7; first += 3) {
+    int n = std::min(3, 7 - first);
+    std::size_t at = banded.size();
+    banded.resize(at + (std::size_t)n * 5 * 4);
+    encodeBMPRows(img, first, n, banded.data() + at);
+  }
+  EXPECT(banded == whole);
+}
+
+
+// Each format's header is right, banding gives the same file, and it
+// decodes back to the image as that format can hold it.
+static void testBMPFormats()
+{
+  PixelImage img = gradient(5, 3);
+  setOpaque(img);
+
+  for (int f = 0; f < NUM_BMP_FORMATS; ++f) {
+    BmpFormat fmt = (BmpFormat)f;
+    std::vector<unsigned char> bmp = encodeBMP(img, fmt);
+
+    std::size_t rowBytes = bmpRowBytes(5, fmt);
+    std::size_t offBits = bmpBitCount(fmt) == 16? 66 : 54;
+    EXPECT(rowBytes % 4 == 0 && rowBytes >= 5u * bmpBitCount(fmt) / 8);
+    EXPECT(bmp.size() == offBits + rowBytes * 3);
+    EXPECT(readLE32(&bmp[10]) == offBits);
+    EXPECT(bmp[28] == bmpBitCount(fmt));
+
+    std::vector<unsigned char> banded = encodeBMPHeader(5, 3, fmt);
+    for (int first = 0; first < 3; first += 2) {
+      int n = std::min(2, 3 - first);
+      std::size_t at = banded.size();
+      banded.resize(at + n * rowBytes);
+      encodeBMPRows(img, first, n, banded.data() + at, fmt);
+    }
+    EXPECT(banded == bmp);
+
+    PixelImage back;
+    EXPECT(decodeBMP(bmp, back));
+    EXPECT(back.m_width == 5 && back.m_height == 3);
+
+    // Truncation to 5-6-5 and back loses the low bits, and dithering
+    // can round up by one step.
+    int tolerance = fmt == BF_16? 7 : fmt == BF_16_DITHERED? 15 : 0;
+    bool close = true;
+    for (std::size_t i = 0; i < img.m_pixels.size(); ++i) {
+      for (int shift = 0; shift < 32; shift += 8) {
+        int a = (img.m_pixels[i] >> shift) & 0xFF;
+        int b = (back.m_pixels[i] >> shift) & 0xFF;
+        close = close && std::abs(a - b) <= tolerance;
+      }
+    }
+    EXPECT(close);
+  }
+
+  // Names.
+  BmpFormat fmt = BF_32;
+  EXPECT(parseBmpFormat("16d", fmt) && fmt == BF_16_DITHERED);
+  EXPECT(!parseBmpFormat("8", fmt) && fmt == BF_16_DITHERED);
+
+  // 16 bpp other than 5-6-5 is rejected.
+  std::vector<unsigned char> bmp = encodeBMP(img, BF_16);
+  bmp[58] = 0xE0;
+  bmp[59] = 0x03;
+  PixelImage back;
+  EXPECT(!decodeBMP(bmp, back));
+}
+
+
+static void testDecodeBMP()
+{
+  PixelImage img = gradient(5, 3);
+  std::vector<unsigned char> bmp = encodeBMP(img);
+
+  PixelImage back;
+  EXPECT(decodeBMP(bmp, back));
+  EXPECT(back.m_width == 5 && back.m_height == 3);
+  EXPECT(back.m_pixels == img.m_pixels);
+
+  // Truncated pixel data.
+  bmp.resize(bmp.size() - 1);
+  EXPECT(!decodeBMP(bmp, back));
+
+  // A hand-made 24 bpp, 2x2 image: rows padded to 8 bytes, bottom row
+  // first.
+  std::vector<unsigned char> bmp24(encodeBMP(PixelImage(2, 2)));
+  bmp24.resize(54);
+  bmp24[28] = 24;
+  unsigned char const rows[] = {
+    1, 2, 3,  4, 5, 6,  0, 0,          // bottom
+    7, 8, 9,  10, 11, 12,  0, 0,       // top
+  };
+  bmp24.insert(bmp24.end(), rows, rows + sizeof(rows));
+  EXPECT(decodeBMP(bmp24, back));
+  EXPECT(back.at(0, 0) == 0xFF090807u);
+  EXPECT(back.at(1, 1) == 0xFF060504u);
+
+  EXPECT(!decodeBMP(std::vector<unsigned char>(10, 'B'), back));
+}
+
+
+int main()
+{
+  testOpaque();
+  testContentHash();
+  testContentHashHex();
+  testDownscale();
+  testEncodeBMP();
+  testEncodeBMPBands();
+  testBMPFormats();
+  testDecodeBMP();
+
+  if (s_failures) {
+    std::cout << "pixel-image-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "pixel-image-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,563 @@
+// pixel-image.cc
+// Code for `pixel-image` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "pixel-image.h"               // this module
+
+#include "pixel-convert.h"             // convertPixels, etc.
+
+#include <algorithm>                   // std::max
+#include <cassert>                     // assert
+#include <cstdint>                     // INT32_MIN
+#include <cstring>                     // std::{memcpy, memset, strcmp}
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_mul_epu32, etc.
+#endif
+
+
+PixelImage::PixelImage()
+  : m_width(0),
+    m_height(0),
+    m_pixels()
+{}
+
+
+PixelImage::PixelImage(int w, int h)
+  : m_width(w),
+    m_height(h),
+    m_pixels((std::size_t)w * h, 0)
+{
+  assert(w >= 0 && h >= 0);
+}
+
+
+void setOpaque(PixelImage &img)
+{
+  convertPixels(PF_BGRA32, img.m_pixels.data(),
+                PF_BGRX32, img.m_pixels.data(), img.m_pixels.size());
+}
+
+
+// ------------------------------ Hashing ------------------------------
+static inline std::uint64_t rotl64(std::uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+
+// Absorb `v` into lane state `h`.
+static inline std::uint64_t mixLane(std::uint64_t h, std::uint64_t v)
+{
+  h ^= v * 0x9E3779B97F4A7C15ull;
+  return rotl64(h, 31) * 0xBF58476D1CE4E5B9ull;
+}
+
+
+// Final avalanche, from SplitMix64.
+static inline std::uint64_t finalizeHash(std::uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBull;
+  h ^= h >> 31;
+  return h;
+}
+
+
+std::string ContentHash::toHex() const
+{
+  static char const digits[] = "0123456789abcdef";
+  std::string ret(32, '0');
+  for (int i = 0; i < 16; ++i) {
+    ret[15 - i] = digits[(m_hi >> (i*4)) & 0xF];
+    ret[31 - i] = digits[(m_lo >> (i*4)) & 0xF];
+  }
+  return ret;
+}
+
+
+/*static*/ bool ContentHash::fromHex(std::string const &hex,
+                                     ContentHash &h)
+{
+  if (hex.size() != 32) {
+    return false;
+  }
+
+  std::uint64_t halves[2] = { 0, 0 };
+  for (std::size_t i = 0; i < 32; ++i) {
+    char c = hex[i];
+    int d = '0' <= c && c <= '9'? c - '0' :
+            'a' <= c && c <= 'f'? c - 'a' + 10 :
+            'A' <= c && c <= 'F'? c - 'A' + 10 : -1;
+    if (d < 0) {
+      return false;
+    }
+    halves[i / 16] = (halves[i / 16] << 4) | (unsigned)d;
+  }
+
+  h.m_hi = halves[0];
+  h.m_lo = halves[1];
+  return true;
+}
+
+
+// Bytes taken per step of `hashPixelContent`: eight 64-bit lanes.
+static std::size_t const c_stripeBytes = 64;
+
+// Steps between scrambles of the lane state.
+static int const c_stripesPerScramble = 16;
+
+// Keys mixed with the data before the multiply, which keeps runs of
+// zero pixels, common in captures, from zeroing it.  As in XXH3, stripe
+// `s` between scrambles keys its eight lanes with entries `s` through
+// `s+7`, so two stripes that trade places give different sums.  The
+// first eight also key the scramble and the final mix.
+static std::uint64_t const c_laneKeys[8 + c_stripesPerScramble - 1] = {
+  0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull,
+  0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull,
+  0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull,
+  0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull,
+  0x822A87DC52E17FD9ull, 0xCC73ABE99EBA409Full,
+  0x43D283EF022BBED8ull, 0x27A004FDFB9C9161ull,
+  0xC1B49F1BD278FADCull, 0x330344EFFFBFC2CBull,
+  0x1634DD0D436AECF3ull, 0x8321AA143311B035ull,
+  0x982EC5350E034ECCull, 0x81378455319D0859ull,
+  0xD002817E0631091Dull, 0x86D7F506B115BE58ull,
+  0xEE5732255D9C8760ull, 0x75055A82D0C8A5D3ull,
+  0x214C4929C2BB66E6ull,
+};
+
+// Odd 32-bit multiplier of the scramble.
+static std::uint32_t const c_scramblePrime = 0x9E3779B1u;
+
+
+// Absorb one stripe at `p` into `acc`, keying lane `i` with `keys[i]`.
+// Each lane adds the product of the two 32-bit halves of its keyed
+// data, and the raw data of its neighbor, so no input is lost when a
+// product is zero.
+static inline void accumulateStripeScalar(std::uint64_t acc[8],
+                                          unsigned char const *p,
+                                          std::uint64_t const *keys)
+{
+  for (int i = 0; i < 8; ++i) {
+    std::uint64_t v;
+    std::memcpy(&v, p + i*8, 8);
+    std::uint64_t k = v ^ keys[i];
+    acc[i ^ 1] += v;
+    acc[i] += (k & 0xFFFFFFFFu) * (k >> 32);
+  }
+}
+
+
+// Spread the high bits of each lane down, since the multiplies only
+// carry information upward.
+static inline void scrambleScalar(std::uint64_t acc[8])
+{
+  for (int i = 0; i < 8; ++i) {
+    std::uint64_t a = acc[i];
+    acc[i] = (a ^ (a >> 47) ^ c_laneKeys[i]) * c_scramblePrime;
+  }
+}
+
+
+#ifdef __SSE2__
+// The same as `accumulateStripeScalar`, two lanes per register.
+static inline void accumulateStripeSSE2(__m128i acc[4],
+                                        unsigned char const *p,
+                                        std::uint64_t const *keys)
+{
+  for (int i = 0; i < 4; ++i) {
+    __m128i v = _mm_loadu_si128((__m128i const*)(p + i*16));
+    __m128i key = _mm_loadu_si128((__m128i const*)(keys + i*2));
+    __m128i k = _mm_xor_si128(v, key);
+    __m128i kHi = _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1));
+    __m128i product = _mm_mul_epu32(k, kHi);
+    __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(swapped, product));
+  }
+}
+
+
+static inline void scrambleSSE2(__m128i acc[4])
+{
+  __m128i const prime = _mm_set1_epi32((int)c_scramblePrime);
+  for (int i = 0; i < 4; ++i) {
+    __m128i key = _mm_loadu_si128((__m128i const*)(c_laneKeys + i*2));
+    __m128i a = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+    a = _mm_xor_si128(a, key);
+
+    // 64x32-bit multiply from two 32x32-bit ones.
+    __m128i aHi = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1));
+    __m128i lo = _mm_mul_epu32(a, prime);
+    __m128i hi = _mm_mul_epu32(aHi, prime);
+    acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+  }
+}
+#endif // __SSE2__
+
+
+// Absorb the `numStripes` whole stripes at `p` into `acc`, using
+// `stripeCount` to know when to scramble.
+static void accumulateStripes(std::uint64_t acc[8],
+                              unsigned char const *p,
+                              std::size_t numStripes,
+                              std::size_t &stripeCount)
+{
+#ifdef __SSE2__
+  if (convertIsa() != CI_SCALAR) {
+    __m128i v[4];
+    for (int i = 0; i < 4; ++i) {
+      v[i] = _mm_loadu_si128((__m128i const*)(acc + i*2));
+    }
+    for (std::size_t s = 0; s < numStripes; ++s) {
+      accumulateStripeSSE2(v, p + s * c_stripeBytes,
+        c_laneKeys + stripeCount % c_stripesPerScramble);
+      if (++stripeCount % c_stripesPerScramble == 0) {
+        scrambleSSE2(v);
+      }
+    }
+    for (int i = 0; i < 4; ++i) {
+      _mm_storeu_si128((__m128i*)(acc + i*2), v[i]);
+    }
+    return;
+  }
+#endif // __SSE2__
+
+  for (std::size_t s = 0; s < numStripes; ++s) {
+    accumulateStripeScalar(acc, p + s * c_stripeBytes,
+      c_laneKeys + stripeCount % c_stripesPerScramble);
+    if (++stripeCount % c_stripesPerScramble == 0) {
+      scrambleScalar(acc);
+    }
+  }
+}
+
+
+ContentHash hashPixelContent(PixelImage const &img)
+{
+  std::uint64_t acc[8];
+  for (int i = 0; i < 8; ++i) {
+    acc[i] = c_laneKeys[7 - i];
+  }
+
+  unsigned char const *p = (unsigned char const*)img.m_pixels.data();
+  std::size_t n = img.sizeBytes();
+  std::size_t stripeCount = 0;
+  accumulateStripes(acc, p, n / c_stripeBytes, stripeCount);
+
+  // The partial stripe at the end, padded with zeroes.  The dimensions
+  // go into the result, so the padding cannot be confused with pixels.
+  if (std::size_t tail = n % c_stripeBytes) {
+    unsigned char last[c_stripeBytes] = {};
+    std::memcpy(last, p + n - tail, tail);
+    accumulateStripes(acc, last, 1, stripeCount);
+  }
+
+  std::uint64_t dims =
+    ((std::uint64_t)img.m_width << 32) | (std::uint32_t)img.m_height;
+  std::uint64_t lo = dims;
+  std::uint64_t hi = ~dims;
+  for (int i = 0; i < 8; ++i) {
+    lo = mixLane(lo, acc[i]);
+    hi = mixLane(hi, acc[7 - i] ^ c_laneKeys[i]);
+  }
+
+  ContentHash ret;
+  ret.m_lo = finalizeHash(lo);
+  ret.m_hi = finalizeHash(hi);
+  return ret;
+}
+
+
+// ----------------------------- Scaling -------------------------------
+PixelImage downscaleImage(PixelImage const &src, int maxWidth)
+{
+  if (src.m_width <= maxWidth || src.m_height == 0) {
+    return src;
+  }
+
+  int const sw = src.m_width;
+  int const sh = src.m_height;
+  int const dw = std::max(1, maxWidth);
+  int const dh = std::max(1, (int)((long long)sh * dw / sw));
+  PixelImage dest(dw, dh);
+
+  // Source column range [xBound[dx], xBound[dx+1]) for each dest column.
+  std::vector<int> xBound(dw + 1);
+  for (int dx = 0; dx <= dw; ++dx) {
+    xBound[dx] = (int)((long long)dx * sw / dw);
+  }
+
+  // Per-channel sums for one dest row.
+  std::vector<std::uint32_t> sums((std::size_t)dw * 4);
+
+  for (int dy = 0; dy < dh; ++dy) {
+    int sy0 = (int)((long long)dy * sh / dh);
+    int sy1 = std::max(sy0 + 1, (int)((long long)(dy+1) * sh / dh));
+
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int sy = sy0; sy < sy1; ++sy) {
+      std::uint32_t const *srow = src.row(sy);
+      for (int dx = 0; dx < dw; ++dx) {
+        std::uint32_t *s = &sums[dx*4];
+        for (int sx = xBound[dx]; sx < xBound[dx+1]; ++sx) {
+          std::uint32_t p = srow[sx];
+          s[0] += p & 0xFF;
+          s[1] += (p >> 8) & 0xFF;
+          s[2] += (p >> 16) & 0xFF;
+          s[3] += p >> 24;
+        }
+      }
+    }
+
+    std::uint32_t *drow = dest.row(dy);
+    for (int dx = 0; dx < dw; ++dx) {
+      std::uint32_t count = (std::uint32_t)(sy1 - sy0) *
+                            (std::uint32_t)(xBound[dx+1] - xBound[dx]);
+      std::uint32_t const *s = &sums[dx*4];
+      std::uint32_t half = count / 2;
+      drow[dx] =  ((s[0] + half) / count) |
+                 (((s[1] + half) / count) << 8) |
+                 (((s[2] + half) / count) << 16) |
+                 (((s[3] + half) / count) << 24);
+    }
+  }
+
+  return dest;
+}
+
+
+// ---------------------------- BMP output -----------------------------
+// Append `n` bytes of `v`, least significant first.
+static void putLE(std::vector<unsigned char> &out, std::uint32_t v, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    out.push_back((unsigned char)(v >> (8*i)));
+  }
+}
+
+
+// BITMAPINFOHEADER::biCompression values.
+static std::uint32_t const c_BI_RGB = 0;
+static std::uint32_t const c_BI_BITFIELDS = 3;
+
+// Red, green and blue masks of 5-6-5 pixels.
+static std::uint32_t const c_masks565[3] = { 0xF800, 0x07E0, 0x001F };
+
+
+char const *bmpFormatName(BmpFormat fmt)
+{
+  switch (fmt) {
+    case BF_32:           return "32";
+    case BF_24:           return "24";
+    case BF_16:           return "16";
+    case BF_16_DITHERED:  return "16d";
+    default:              return "invalid";
+  }
+}
+
+
+bool parseBmpFormat(char const *name, BmpFormat &fmt /*OUT*/)
+{
+  for (int i = 0; i < NUM_BMP_FORMATS; ++i) {
+    if (std::strcmp(name, bmpFormatName((BmpFormat)i)) == 0) {
+      fmt = (BmpFormat)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+int bmpBitCount(BmpFormat fmt)
+{
+  switch (fmt) {
+    case BF_24:           return 24;
+    case BF_16:
+    case BF_16_DITHERED:  return 16;
+    default:              return 32;
+  }
+}
+
+
+std::size_t bmpRowBytes(int width, BmpFormat fmt)
+{
+  return ((std::size_t)width * (bmpBitCount(fmt) / 8) + 3) & ~(std::size_t)3;
+}
+
+
+std::vector<unsigned char> encodeBMP(PixelImage const &img, BmpFormat fmt)
+{
+  std::vector<unsigned char> out =
+    encodeBMPHeader(img.m_width, img.m_height, fmt);
+  std::size_t offBits = out.size();
+
+  out.resize(offBits + bmpRowBytes(img.m_width, fmt) * img.m_height);
+  encodeBMPRows(img, 0, img.m_height, out.data() + offBits, fmt);
+  return out;
+}
+
+
+std::vector<unsigned char> encodeBMPHeader(int width, int height,
+                                           BmpFormat fmt)
+{
+  int bitCount = bmpBitCount(fmt);
+  bool bitfields = bitCount == 16;
+
+  // Sizes of BITMAPFILEHEADER and BITMAPINFOHEADER, and the color
+  // masks that follow the latter for BI_BITFIELDS.
+  std::uint32_t const fileHeaderSize = 14;
+  std::uint32_t const infoHeaderSize = 40;
+  std::uint32_t const masksSize = bitfields? 12 : 0;
+  std::uint32_t const offBits = fileHeaderSize + infoHeaderSize + masksSize;
+  std::uint32_t const pixelBytes =
+    (std::uint32_t)(bmpRowBytes(width, fmt) * height);
+
+  std::vector<unsigned char> out;
+  out.reserve(offBits);
+
+  // BITMAPFILEHEADER.
+  putLE(out, 0x4D42, 2);               // bfType: "BM"
+  putLE(out, offBits + pixelBytes, 4); // bfSize
+  putLE(out, 0, 2);                    // bfReserved1
+  putLE(out, 0, 2);                    // bfReserved2
+  putLE(out, offBits, 4);              // bfOffBits
+
+  // BITMAPINFOHEADER.
+  putLE(out, infoHeaderSize, 4);       // biSize
+  putLE(out, width, 4);                // biWidth
+  putLE(out, height, 4);               // biHeight: positive, so bottom-up
+  putLE(out, 1, 2);                    // biPlanes
+  putLE(out, bitCount, 2);             // biBitCount
+  putLE(out, bitfields? c_BI_BITFIELDS : c_BI_RGB, 4); // biCompression
+  putLE(out, pixelBytes, 4);           // biSizeImage
+  putLE(out, 0, 4);                    // biXPelsPerMeter
+  putLE(out, 0, 4);                    // biYPelsPerMeter
+  putLE(out, 0, 4);                    // biClrUsed
+  putLE(out, 0, 4);                    // biClrImportant
+
+  if (bitfields) {
+    for (std::uint32_t mask : c_masks565) {
+      putLE(out, mask, 4);
+    }
+  }
+  assert(out.size() == offBits);
+
+  return out;
+}
+
+
+void encodeBMPRows(PixelImage const &img, int firstRow, int numRows,
+                   unsigned char *dest, BmpFormat fmt)
+{
+  assert(0 <= firstRow && 0 <= numRows &&
+         firstRow + numRows <= img.m_height);
+
+  // Rows, bottom first.
+  std::size_t rowBytes = bmpRowBytes(img.m_width, fmt);
+  for (int i = 0; i < numRows; ++i) {
+    int y = img.m_height - 1 - firstRow - i;
+    encodeBMPRow(img.row(y), img.m_width, y, dest, fmt);
+    dest += rowBytes;
+  }
+}
+
+
+void encodeBMPRow(std::uint32_t const *src, int width, int y,
+                  unsigned char *dest, BmpFormat fmt)
+{
+  switch (fmt) {
+    case BF_24:
+      convertPixels(PF_BGRA32, src, PF_BGR24, dest, width);
+      break;
+
+    case BF_16:
+      convertPixels(PF_BGRA32, src, PF_RGB565, dest, width);
+      break;
+
+    case BF_16_DITHERED:
+      ditherPixelsTo565(src, y, dest, width);
+      break;
+
+    default:
+      // 32 bpp rows need no padding.
+      std::memcpy(dest, src, (std::size_t)width * 4);
+      return;
+  }
+
+  std::size_t used = (std::size_t)width * (bmpBitCount(fmt) / 8);
+  std::memset(dest + used, 0, bmpRowBytes(width, fmt) - used);
+}
+
+
+// Return the `n`-byte little-endian value at `p`.
+static std::uint32_t getLE(unsigned char const *p, int n)
+{
+  std::uint32_t v = 0;
+  for (int i = 0; i < n; ++i) {
+    v |= (std::uint32_t)p[i] << (8*i);
+  }
+  return v;
+}
+
+
+bool decodeBMP(std::vector<unsigned char> const &data,
+               PixelImage &img /*OUT*/)
+{
+  if (data.size() < 14 + 40 || data[0] != 'B' || data[1] != 'M') {
+    return false;
+  }
+  unsigned char const *p = data.data();
+
+  std::uint32_t offBits = getLE(p + 10, 4);
+  std::uint32_t infoSize = getLE(p + 14, 4);
+  std::int32_t width = (std::int32_t)getLE(p + 18, 4);
+  std::int32_t height = (std::int32_t)getLE(p + 22, 4);
+  std::uint32_t bitCount = getLE(p + 28, 2);
+  std::uint32_t compression = getLE(p + 30, 4);
+
+  if (infoSize < 40 || width <= 0 || height == 0 || height == INT32_MIN) {
+    return false;
+  }
+
+  // 16 bpp must be 5-6-5, which needs BI_BITFIELDS.  Otherwise it
+  // would be 5-5-5, which we never write.  The masks directly follow a
+  // BITMAPINFOHEADER, and are at the same place within the larger
+  // headers.
+  PixelFormat fmt = bitCount == 32? PF_BGRA32 :
+                    bitCount == 24? PF_BGR24 : PF_RGB565;
+  if (bitCount == 16) {
+    if (compression != c_BI_BITFIELDS || data.size() < 14 + 40 + 12 ||
+        getLE(p + 54, 4) != c_masks565[0] ||
+        getLE(p + 58, 4) != c_masks565[1] ||
+        getLE(p + 62, 4) != c_masks565[2]) {
+      return false;
+    }
+  }
+  else if (compression != c_BI_RGB || (bitCount != 24 && bitCount != 32)) {
+    return false;
+  }
+
+  // A negative height means the rows are stored top first.
+  bool topDown = height < 0;
+  int h = topDown? -height : height;
+
+  // Rows are padded to a multiple of 4 bytes.
+  std::size_t bytesPerPixel = bitCount / 8;
+  std::size_t stride = ((std::size_t)width * bytesPerPixel + 3) & ~3;
+  if (offBits > data.size() ||
+      (data.size() - offBits) / stride < (std::size_t)h) {
+    return false;
+  }
+
+  img = PixelImage(width, h);
+  convertRowsToImage(p + offBits, stride, !topDown, fmt, img);
+
+  return true;
+}
+
+
+// EOF
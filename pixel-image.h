@@ -0,0 +1,149 @@
+// pixel-image.h
+// `PixelImage`, an in-memory 32-bit image, and operations on it.
+
+// See license.txt for copyright and terms of use.
+
+// This is the form in which captured frames travel through the capture
+// pipeline, away from GDI.
+//
+// This module does not depend on the Windows API.
+
+#ifndef PIXEL_IMAGE_H
+#define PIXEL_IMAGE_H
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::{uint32_t, uint64_t}
+#include <string>                      // std::string
+#include <vector>                      // std::vector
+
+
+// Image whose pixels are 32-bit values laid out as B, G, R, A bytes in
+// memory, the same as a Windows 32 bpp DIB, with the top row first and
+// no row padding.
+class PixelImage {
+public:      // data
+  int m_width;
+  int m_height;
+
+  // `m_width * m_height` pixels.
+  std::vector<std::uint32_t> m_pixels;
+
+public:      // methods
+  // Empty image.
+  PixelImage();
+
+  // Image of the given size with all pixels zero.
+  PixelImage(int w, int h);
+
+  bool empty() const { return m_pixels.empty(); }
+
+  // Number of bytes of pixel data.
+  std::size_t sizeBytes() const { return m_pixels.size() * 4; }
+
+  // Pixels of row `y`.
+  std::uint32_t *row(int y)
+    { return m_pixels.data() + (std::size_t)y * m_width; }
+  std::uint32_t const *row(int y) const
+    { return m_pixels.data() + (std::size_t)y * m_width; }
+
+  std::uint32_t at(int x, int y) const
+    { return row(y)[x]; }
+};
+
+
+// Set the alpha channel of every pixel to 0xFF.  GDI leaves it
+// undefined.
+void setOpaque(PixelImage &img);
+
+// 128-bit hash identifying the content of an image, wide enough that
+// two different captures are never expected to share one.
+struct ContentHash {
+  std::uint64_t m_lo = 0;
+  std::uint64_t m_hi = 0;
+
+  // True for the zero value, which means "not computed".
+  bool empty() const { return (m_lo | m_hi) == 0; }
+
+  bool operator==(ContentHash const &obj) const
+    { return m_lo == obj.m_lo && m_hi == obj.m_hi; }
+  bool operator!=(ContentHash const &obj) const
+    { return !operator==(obj); }
+
+  // 32 lowercase hex digits, high half first.
+  std::string toHex() const;
+
+  // Set `h` from `toHex` output.  Return false if `hex` is not 32 hex
+  // digits.
+  static bool fromHex(std::string const &hex, ContentHash &h /*OUT*/);
+};
+
+// Return the `ContentHash` of the dimensions and pixels of `img`.  It
+// is not cryptographic, but runs at memory speed: with SSE2 it takes
+// 64 bytes per step in eight 64-bit lanes.  The result does not depend
+// on the instruction set, which follows `convertIsa()`.
+ContentHash hashPixelContent(PixelImage const &img);
+
+// Return `src` scaled down, preserving its aspect ratio, so that it is
+// at most `maxWidth` wide, by averaging each block of source pixels.
+// If it is already narrow enough, return a copy.
+PixelImage downscaleImage(PixelImage const &src, int maxWidth);
+
+// Pixel formats of BMP files we write.  The alpha channel of a capture
+// carries nothing, so 24 bpp loses nothing but a quarter of the size.
+// 16 bpp is 5-6-5, stored as BI_BITFIELDS, half the size of 32 bpp.
+enum BmpFormat {
+  BF_32,
+  BF_24,
+  BF_16,
+
+  // 16 bpp with ordered dithering, so gradients do not band.
+  BF_16_DITHERED,
+
+  NUM_BMP_FORMATS
+};
+
+// Name of `fmt`, as saved in settings: "32", "24", "16", or "16d".
+char const *bmpFormatName(BmpFormat fmt);
+
+// Set `fmt` to the format named `name`.  Return false if there is none.
+bool parseBmpFormat(char const *name, BmpFormat &fmt /*OUT*/);
+
+// Bits per pixel of `fmt`.
+int bmpBitCount(BmpFormat fmt);
+
+// Bytes per row of a `width` pixel image in `fmt`, including the
+// padding to a multiple of 4.
+std::size_t bmpRowBytes(int width, BmpFormat fmt);
+
+// Return the complete contents of an uncompressed BMP file holding
+// `img` in `fmt`.
+std::vector<unsigned char> encodeBMP(PixelImage const &img,
+                                     BmpFormat fmt = BF_32);
+
+// The same file in pieces, so it can be written a band at a time
+// without ever holding all of it: the headers for a `width` by
+// `height` image, which are followed by its rows bottom first.
+std::vector<unsigned char> encodeBMPHeader(int width, int height,
+                                           BmpFormat fmt = BF_32);
+
+// Encode `numRows` rows of `img` into `dest`, in file order, starting
+// with the one `firstRow` rows from the bottom.  Each takes
+// `bmpRowBytes(img.m_width, fmt)` bytes.
+void encodeBMPRows(PixelImage const &img, int firstRow, int numRows,
+                   unsigned char *dest /*OUT*/, BmpFormat fmt = BF_32);
+
+// Encode the `width` pixels at `src`, which are row `y` of an image
+// (counting from the top, for dithering), as one row of a BMP file in
+// `fmt`, including its padding.
+void encodeBMPRow(std::uint32_t const *src, int width, int y,
+                  unsigned char *dest /*OUT*/, BmpFormat fmt);
+
+// Decode the contents of an uncompressed 24 or 32 bpp BMP file, or a
+// 16 bpp 5-6-5 one such as `encodeBMP` writes, into `img`.  Return
+// false if the data is malformed or uses some other format.  Decoded
+// 24 and 16 bpp pixels are opaque.
+bool decodeBMP(std::vector<unsigned char> const &data,
+               PixelImage &img /*OUT*/);
+
+
+#endif // PIXEL_IMAGE_H
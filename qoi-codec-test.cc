@@ -0,0 +1,149 @@
+// qoi-codec-test.cc
+// Tests for `qoi-codec`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "qoi-codec.h"                 // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <cstdint>                     // std::uint32_t
+#include <iostream>                    // std::cout
+
+
+// Encode and decode `img`, checking the result is identical.  Return
+// the encoded size.
+static std::size_t roundTrip(PixelImage const &img)
+{
+  std::vector<unsigned char> qoi = encodeQOI(img);
+
+  PixelImage back;
+  EXPECT(decodeQOI(qoi, back));
+  EXPECT(back.m_width == img.m_width && back.m_height == img.m_height);
+  EXPECT(back.m_pixels == img.m_pixels);
+
+  return qoi.size();
+}
+
+
+// A single opaque black pixel matches the initial "previous" pixel, so
+// it is a run of one.
+static void testKnownEncoding()
+{
+  PixelImage img(1, 1);
+  img.m_pixels[0] = 0xFF000000u;
+
+  std::vector<unsigned char> expect = {
+    'q', 'o', 'i', 'f',
+    0, 0, 0, 1,                        // width
+    0, 0, 0, 1,                        // height
+    4, 0,                              // channels, colorspace
+    0xC0,                              // QOI_OP_RUN, length 1
+    0, 0, 0, 0, 0, 0, 0, 1,            // end marker
+  };
+  EXPECT(encodeQOI(img) == expect);
+
+  // Encoding into a used buffer replaces its contents.
+  std::vector<unsigned char> reused(1000, 7);
+  encodeQOI(img, reused);
+  EXPECT(reused == expect);
+}
+
+
+// Exercise every chunk type.
+static void testRoundTrip()
+{
+  PixelImage img(97, 31);
+  std::uint32_t state = 12345;
+  for (int y = 0; y < img.m_height; ++y) {
+    for (int x = 0; x < img.m_width; ++x) {
+      std::uint32_t p;
+      if (y < 4) {
+        // Long runs, longer than the 62-pixel run limit.
+        p = 0xFF336699u;
+      }
+      else if (y < 8) {
+        // Small and medium steps, for DIFF and LUMA.
+        p = 0xFF000000u | ((x * 1) & 0xFF) | (((x * 3) & 0xFF) << 8) |
+            (((x * 17) & 0xFF) << 16);
+      }
+      else if (y < 12) {
+        // Alternating colors, for INDEX.
+        p = (x & 1)? 0xFF112233u : 0xFF445566u;
+      }
+      else {
+        // Noise, including alpha changes, for RGB and RGBA.
+        state = state * 1664525 + 1013904223;
+        p = state;
+        if (y < 20) {
+          p |= 0xFF000000u;
+        }
+      }
+      img.row(y)[x] = p;
+    }
+  }
+
+  roundTrip(img);
+}
+
+
+// Flat screenshots compress far below the BMP size.
+static void testCompresses()
+{
+  PixelImage img(640, 480);
+  for (int y = 0; y < img.m_height; ++y) {
+    for (int x = 0; x < img.m_width; ++x) {
+      img.row(y)[x] = (x / 64 + y / 48) & 1? 0xFFFFFFFFu : 0xFF202020u;
+    }
+  }
+
+  std::size_t size = roundTrip(img);
+  EXPECT(size * 20 < img.sizeBytes());
+}
+
+
+static void testMalformed()
+{
+  PixelImage img(8, 8);
+  for (int i = 0; i < 64; ++i) {
+    img.m_pixels[i] = 0xFF000000u | (i * 0x01030507u);
+  }
+  std::vector<unsigned char> qoi = encodeQOI(img);
+  PixelImage back;
+
+  // Truncated.
+  std::vector<unsigned char> truncated(qoi.begin(), qoi.end() - 12);
+  EXPECT(!decodeQOI(truncated, back));
+
+  // Bad magic.
+  std::vector<unsigned char> badMagic = qoi;
+  badMagic[0] = 'x';
+  EXPECT(!decodeQOI(badMagic, back));
+
+  // Absurd dimensions.
+  std::vector<unsigned char> huge = qoi;
+  huge[4] = 0x7F;
+  huge[8] = 0x7F;
+  EXPECT(!decodeQOI(huge, back));
+}
+
+
+int main()
+{
+  testKnownEncoding();
+  testRoundTrip();
+  testCompresses();
+  testMalformed();
+
+  if (s_failures) {
+    std::cout << "qoi-codec-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "qoi-codec-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,260 @@
+// qoi-codec.cc
+// Code for `qoi-codec` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "qoi-codec.h"                 // this module
+
+#include <cstdint>                     // std::uint32_t
+#include <cstring>                     // std::memcmp
+
+
+// Chunk tags.
+static unsigned char const QOI_OP_INDEX = 0x00;    // 00xxxxxx
+static unsigned char const QOI_OP_DIFF  = 0x40;    // 01xxxxxx
+static unsigned char const QOI_OP_LUMA  = 0x80;    // 10xxxxxx
+static unsigned char const QOI_OP_RUN   = 0xC0;    // 11xxxxxx
+static unsigned char const QOI_OP_RGB   = 0xFE;
+static unsigned char const QOI_OP_RGBA  = 0xFF;
+static unsigned char const QOI_MASK_2   = 0xC0;
+
+// Size of the file header.
+static std::size_t const c_headerSize = 14;
+
+// The stream ends with seven 0x00 bytes and one 0x01.
+static unsigned char const c_endMarker[8] = { 0,0,0,0,0,0,0,1 };
+
+// Images larger than this many pixels are rejected when decoding, as
+// the specification recommends.
+static std::size_t const c_maxPixels = 400000000;
+
+
+// A pixel split into channels, in QOI's order.
+struct QoiRGBA {
+  unsigned char r, g, b, a;
+};
+
+
+// Our pixels are B, G, R, A in memory, so, as a little-endian 32-bit
+// value, B is the low byte.
+static inline QoiRGBA fromPixel(std::uint32_t p)
+{
+  return QoiRGBA{
+    (unsigned char)(p >> 16),
+    (unsigned char)(p >> 8),
+    (unsigned char)p,
+    (unsigned char)(p >> 24),
+  };
+}
+
+
+static inline std::uint32_t toPixel(QoiRGBA c)
+{
+  return (std::uint32_t)c.b |
+         ((std::uint32_t)c.g << 8) |
+         ((std::uint32_t)c.r << 16) |
+         ((std::uint32_t)c.a << 24);
+}
+
+
+static inline int colorHash(QoiRGBA c)
+{
+  return (c.r*3 + c.g*5 + c.b*7 + c.a*11) % 64;
+}
+
+
+static void putBE32(std::vector<unsigned char> &out, std::uint32_t v)
+{
+  out.push_back((unsigned char)(v >> 24));
+  out.push_back((unsigned char)(v >> 16));
+  out.push_back((unsigned char)(v >> 8));
+  out.push_back((unsigned char)v);
+}
+
+
+static std::uint32_t getBE32(unsigned char const *p)
+{
+  return ((std::uint32_t)p[0] << 24) | ((std::uint32_t)p[1] << 16) |
+         ((std::uint32_t)p[2] << 8) | (std::uint32_t)p[3];
+}
+
+
+std::vector<unsigned char> encodeQOI(PixelImage const &img)
+{
+  std::vector<unsigned char> out;
+  encodeQOI(img, out);
+  return out;
+}
+
+
+void encodeQOI(PixelImage const &img,
+               std::vector<unsigned char> &out /*OUT*/)
+{
+  out.clear();
+
+  // Screenshots usually compress well, so start smaller than the worst
+  // case of 5 bytes per pixel.
+  out.reserve(c_headerSize + img.m_pixels.size() + sizeof(c_endMarker));
+
+  out.insert(out.end(), { 'q', 'o', 'i', 'f' });
+  putBE32(out, img.m_width);
+  putBE32(out, img.m_height);
+  out.push_back(4);                    // channels: RGBA
+  out.push_back(0);                    // colorspace: sRGB, linear alpha
+
+  QoiRGBA index[64] = {};
+  std::uint32_t prevPixel = 0xFF000000u;
+  QoiRGBA prev = fromPixel(prevPixel);
+  int run = 0;
+
+  std::size_t n = img.m_pixels.size();
+  for (std::size_t i = 0; i < n; ++i) {
+    std::uint32_t pixel = img.m_pixels[i];
+
+    if (pixel == prevPixel) {
+      ++run;
+      if (run == 62 || i+1 == n) {
+        out.push_back(QOI_OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0) {
+      out.push_back(QOI_OP_RUN | (run - 1));
+      run = 0;
+    }
+
+    QoiRGBA px = fromPixel(pixel);
+    int h = colorHash(px);
+
+    if (toPixel(index[h]) == pixel) {
+      out.push_back(QOI_OP_INDEX | h);
+    }
+    else {
+      index[h] = px;
+
+      if (px.a == prev.a) {
+        // Differences wrap around, as the specification requires.
+        signed char vr = (signed char)(px.r - prev.r);
+        signed char vg = (signed char)(px.g - prev.g);
+        signed char vb = (signed char)(px.b - prev.b);
+        signed char vgr = (signed char)(vr - vg);
+        signed char vgb = (signed char)(vb - vg);
+
+        if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+          out.push_back(QOI_OP_DIFF |
+            ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+        }
+        else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 &&
+                 vgb > -9 && vgb < 8) {
+          out.push_back(QOI_OP_LUMA | (vg + 32));
+          out.push_back(((vgr + 8) << 4) | (vgb + 8));
+        }
+        else {
+          out.insert(out.end(), { QOI_OP_RGB, px.r, px.g, px.b });
+        }
+      }
+      else {
+        out.insert(out.end(), { QOI_OP_RGBA, px.r, px.g, px.b, px.a });
+      }
+    }
+
+    prev = px;
+    prevPixel = pixel;
+  }
+
+  out.insert(out.end(), c_endMarker, c_endMarker + sizeof(c_endMarker));
+}
+
+
+bool decodeQOI(std::vector<unsigned char> const &data,
+               PixelImage &img /*OUT*/)
+{
+  if (data.size() < c_headerSize + sizeof(c_endMarker) ||
+      std::memcmp(data.data(), "qoif", 4) != 0) {
+    return false;
+  }
+
+  std::uint32_t width = getBE32(&data[4]);
+  std::uint32_t height = getBE32(&data[8]);
+  unsigned char channels = data[12];
+  if (width == 0 || height == 0 || width > 0x7FFFFFFF ||
+      height > 0x7FFFFFFF || (std::size_t)width * height > c_maxPixels ||
+      (channels != 3 && channels != 4)) {
+    return false;
+  }
+
+  img = PixelImage((int)width, (int)height);
+
+  QoiRGBA index[64] = {};
+  QoiRGBA px{0, 0, 0, 255};
+  int run = 0;
+
+  // Chunks never extend into the end marker.
+  std::size_t p = c_headerSize;
+  std::size_t const chunksEnd = data.size() - sizeof(c_endMarker);
+
+  for (std::uint32_t &pixel : img.m_pixels) {
+    if (run > 0) {
+      --run;
+    }
+    else if (p < chunksEnd) {
+      unsigned char b1 = data[p++];
+
+      if (b1 == QOI_OP_RGB) {
+        if (chunksEnd - p < 3) {
+          return false;
+        }
+        px.r = data[p++];
+        px.g = data[p++];
+        px.b = data[p++];
+      }
+      else if (b1 == QOI_OP_RGBA) {
+        if (chunksEnd - p < 4) {
+          return false;
+        }
+        px.r = data[p++];
+        px.g = data[p++];
+        px.b = data[p++];
+        px.a = data[p++];
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+        px = index[b1];
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+        px.r += ((b1 >> 4) & 3) - 2;
+        px.g += ((b1 >> 2) & 3) - 2;
+        px.b += (b1 & 3) - 2;
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+        if (chunksEnd - p < 1) {
+          return false;
+        }
+        unsigned char b2 = data[p++];
+        int vg = (b1 & 0x3F) - 32;
+        px.r += vg - 8 + ((b2 >> 4) & 0x0F);
+        px.g += vg;
+        px.b += vg - 8 + (b2 & 0x0F);
+      }
+      else {
+        // QOI_OP_RUN.  This pixel is the first of the run.
+        run = b1 & 0x3F;
+      }
+
+      index[colorHash(px)] = px;
+    }
+    else {
+      // Out of data before out of pixels.
+      return false;
+    }
+
+    pixel = toPixel(px);
+  }
+
+  return std::memcmp(&data[chunksEnd], c_endMarker,
+                     sizeof(c_endMarker)) == 0;
+}
+
+
+// EOF
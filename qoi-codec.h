@@ -0,0 +1,36 @@
+// qoi-codec.h
+// Encode and decode images in the QOI ("Quite OK Image") format.
+
+// See license.txt for copyright and terms of use.
+
+// QOI is a simple lossless format that compresses screenshots to a
+// fraction of their BMP size at close to memory speed, which makes it
+// suitable as the archival format that raw captures are recompressed
+// into in the background.  The format is specified at
+// https://qoiformat.org/qoi-specification.pdf.
+//
+// This module does not depend on the Windows API.
+
+#ifndef QOI_CODEC_H
+#define QOI_CODEC_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <vector>                      // std::vector
+
+
+// Return the complete contents of a QOI file holding `img`, with four
+// channels, so the alpha channel is preserved.
+std::vector<unsigned char> encodeQOI(PixelImage const &img);
+
+// Same, but replace the contents of `out`, reusing its storage.
+void encodeQOI(PixelImage const &img,
+               std::vector<unsigned char> &out /*OUT*/);
+
+// Decode the contents of a QOI file into `img`.  Return false if the
+// data is malformed.
+bool decodeQOI(std::vector<unsigned char> const &data,
+               PixelImage &img /*OUT*/);
+
+
+#endif // QOI_CODEC_H
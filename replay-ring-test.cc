@@ -0,0 +1,140 @@
+// replay-ring-test.cc
+// Tests for `replay-ring`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "replay-ring.h"               // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <iostream>                    // std::cout
+#include <thread>                      // std::thread
+
+
+// A frame at `timeNs` with `size` bytes of data.
+static ReplayFrame makeFrame(std::uint64_t timeNs, std::size_t size)
+{
+  ReplayFrame frame;
+  frame.m_timeNs = timeNs;
+  frame.m_wallTime = timeNs * 10;
+  frame.m_width = 4;
+  frame.m_height = 3;
+  frame.m_data.assign(size, (unsigned char)timeNs);
+  return frame;
+}
+
+
+// The frame count limit drops the oldest.
+static void testFrameLimit()
+{
+  ReplayRing ring(3, 1000);
+  for (std::uint64_t t = 1; t <= 5; ++t) {
+    ring.push(makeFrame(t, 10));
+  }
+
+  EXPECT(ring.numFrames() == 3);
+  EXPECT(ring.numBytes() == 30);
+  EXPECT(ring.evictedCount() == 2);
+
+  EXPECT(ring.takeFramesSince(6).empty());
+  EXPECT(ring.takeFramesSince(5).size() == 1);
+  EXPECT(ring.numFrames() == 2 && ring.numBytes() == 20);
+
+  std::vector<ReplayFrame> frames = ring.takeFramesSince(0);
+  EXPECT(frames.size() == 2);
+  EXPECT(frames.front().m_timeNs == 3 && frames.back().m_timeNs == 4);
+  EXPECT(frames.back().m_wallTime == 40);
+  EXPECT(frames.back().m_data == std::vector<unsigned char>(10, 4));
+  EXPECT(ring.numFrames() == 0 && ring.numBytes() == 0);
+  EXPECT(ring.evictedCount() == 2);
+}
+
+
+// The byte limit drops as many as needed, and oversized frames are
+// not kept at all.
+static void testByteLimit()
+{
+  ReplayRing ring(100, 100);
+  ring.push(makeFrame(1, 40));
+  ring.push(makeFrame(2, 40));
+  ring.push(makeFrame(3, 70));
+  EXPECT(ring.numFrames() == 1);
+  EXPECT(ring.numBytes() == 70);
+
+  ring.push(makeFrame(4, 101));
+  EXPECT(ring.rejectedCount() == 1);
+  EXPECT(ring.numFrames() == 1);
+
+  ring.setLimits(100, 50);
+  EXPECT(ring.numFrames() == 0);
+  EXPECT(ring.numBytes() == 0);
+}
+
+
+// Buffers of dropped frames come back from `takeBuffer`.
+static void testRecycling()
+{
+  ReplayRing ring(1, 1000);
+  EXPECT(ring.takeBuffer().capacity() == 0);
+
+  ring.push(makeFrame(1, 500));
+  ring.push(makeFrame(2, 10));
+
+  std::vector<unsigned char> buf = ring.takeBuffer();
+  EXPECT(buf.empty());
+  EXPECT(buf.capacity() >= 500);
+
+  ring.clear();
+  EXPECT(ring.numFrames() == 0);
+  EXPECT(ring.evictedCount() == 1);
+  EXPECT(ring.takeBuffer().capacity() >= 10);
+}
+
+
+// Concurrent pushes and takes keep the limits.
+static void testThreads()
+{
+  ReplayRing ring(8, 8 * 100);
+
+  std::thread pusher([&] {
+    for (std::uint64_t t = 0; t < 2000; ++t) {
+      ReplayFrame frame = makeFrame(t, 50 + t % 100);
+      std::vector<unsigned char> buf = ring.takeBuffer();
+      buf.assign(frame.m_data.begin(), frame.m_data.end());
+      frame.m_data = std::move(buf);
+      ring.push(std::move(frame));
+    }
+  });
+
+  for (int i = 0; i < 500; ++i) {
+    std::vector<ReplayFrame> frames = ring.takeFramesSince(0);
+    EXPECT(frames.size() <= 8);
+    for (std::size_t j = 1; j < frames.size(); ++j) {
+      EXPECT(frames[j-1].m_timeNs < frames[j].m_timeNs);
+    }
+  }
+
+  pusher.join();
+  EXPECT(ring.numBytes() <= 8 * 100);
+}
+
+
+int main()
+{
+  testFrameLimit();
+  testByteLimit();
+  testRecycling();
+  testThreads();
+
+  if (s_failures) {
+    std::cout << "replay-ring-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "replay-ring-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,149 @@
+// replay-ring.cc
+// Code for `replay-ring` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "replay-ring.h"               // this module
+
+#include <utility>                     // std::move
+
+
+// Most dropped-frame buffers kept for reuse.  A couple is enough for
+// one frame being encoded while another is pushed.
+static std::size_t const c_maxSpares = 2;
+
+
+ReplayRing::ReplayRing(std::size_t maxFrames, std::size_t maxBytes)
+  : m_mutex(),
+    m_maxFrames(maxFrames),
+    m_maxBytes(maxBytes),
+    m_frames(),
+    m_bytes(0),
+    m_spares(),
+    m_evictedCount(0),
+    m_rejectedCount(0)
+{}
+
+
+void ReplayRing::evictOldestLocked()
+{
+  ReplayFrame &oldest = m_frames.front();
+  m_bytes -= oldest.m_data.size();
+  if (m_spares.size() < c_maxSpares) {
+    m_spares.push_back(std::move(oldest.m_data));
+  }
+  m_frames.pop_front();
+  ++m_evictedCount;
+}
+
+
+void ReplayRing::setLimits(std::size_t maxFrames, std::size_t maxBytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_maxFrames = maxFrames;
+  m_maxBytes = maxBytes;
+
+  while (!m_frames.empty() &&
+         (m_frames.size() > m_maxFrames || m_bytes > m_maxBytes)) {
+    evictOldestLocked();
+  }
+}
+
+
+std::vector<unsigned char> ReplayRing::takeBuffer()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_spares.empty()) {
+    return std::vector<unsigned char>();
+  }
+
+  std::vector<unsigned char> ret = std::move(m_spares.back());
+  m_spares.pop_back();
+  ret.clear();
+  return ret;
+}
+
+
+void ReplayRing::push(ReplayFrame &&frame)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  std::size_t size = frame.m_data.size();
+  if (size > m_maxBytes || m_maxFrames == 0) {
+    ++m_rejectedCount;
+    return;
+  }
+
+  while (!m_frames.empty() &&
+         (m_frames.size() + 1 > m_maxFrames ||
+          m_bytes + size > m_maxBytes)) {
+    evictOldestLocked();
+  }
+
+  m_bytes += size;
+  m_frames.push_back(std::move(frame));
+}
+
+
+std::vector<ReplayFrame> ReplayRing::takeFramesSince(std::uint64_t sinceNs)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // Frames are in grab order, so the ones wanted are a suffix.
+  auto first = m_frames.end();
+  while (first != m_frames.begin() && (first-1)->m_timeNs >= sinceNs) {
+    --first;
+  }
+
+  std::vector<ReplayFrame> ret;
+  for (auto it = first; it != m_frames.end(); ++it) {
+    m_bytes -= it->m_data.size();
+    ret.push_back(std::move(*it));
+  }
+  m_frames.erase(first, m_frames.end());
+  return ret;
+}
+
+
+void ReplayRing::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::uint64_t evicted = m_evictedCount;
+  while (!m_frames.empty()) {
+    evictOldestLocked();
+  }
+
+  // These were not dropped to make room.
+  m_evictedCount = evicted;
+}
+
+
+std::size_t ReplayRing::numFrames() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_frames.size();
+}
+
+
+std::size_t ReplayRing::numBytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_bytes;
+}
+
+
+std::uint64_t ReplayRing::evictedCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_evictedCount;
+}
+
+
+std::uint64_t ReplayRing::rejectedCount() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_rejectedCount;
+}
+
+
+// EOF
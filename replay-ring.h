@@ -0,0 +1,109 @@
+// replay-ring.h
+// Fixed-size ring of recent compressed frames for instant replay.
+
+// See license.txt for copyright and terms of use.
+
+// In instant-replay mode the screen is grabbed a few times per second
+// and each frame, once compressed, is pushed into a `ReplayRing`.  When
+// the user asks, the last few seconds are taken out and become shots.
+//
+// Memory is fixed: the ring holds at most `maxFrames` frames and
+// `maxBytes` bytes of frame data, dropping the oldest frames to make
+// room.  The buffers of dropped frames are kept (up to a small number)
+// and handed out again by `takeBuffer`, so a steady stream of frames of
+// similar size does not allocate.
+//
+// All methods are thread-safe: frames are pushed by pool workers and
+// read on the UI thread.
+//
+// This module does not depend on the Windows API.
+
+#ifndef REPLAY_RING_H
+#define REPLAY_RING_H
+
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <deque>                       // std::deque
+#include <mutex>                       // std::mutex
+#include <vector>                      // std::vector
+
+
+// One compressed frame.
+struct ReplayFrame {
+  // When it was grabbed, on the `perfNowNs` clock.
+  std::uint64_t m_timeNs = 0;
+
+  // Wall clock time of the grab, in whatever form the caller uses for
+  // naming files.
+  std::uint64_t m_wallTime = 0;
+
+  // Image dimensions.
+  int m_width = 0;
+  int m_height = 0;
+
+  // Compressed image.
+  std::vector<unsigned char> m_data;
+};
+
+
+class ReplayRing {
+  NO_OBJECT_COPIES(ReplayRing);
+
+private:     // data
+  // Protects everything below.
+  mutable std::mutex m_mutex;
+
+  // Limits.
+  std::size_t m_maxFrames;
+  std::size_t m_maxBytes;
+
+  // Frames, oldest first.
+  std::deque<ReplayFrame> m_frames;
+
+  // Sum of `m_data.size()` over `m_frames`.
+  std::size_t m_bytes;
+
+  // Buffers of dropped frames, ready for reuse.
+  std::vector<std::vector<unsigned char>> m_spares;
+
+  // Number of frames dropped to make room, and pushed frames that
+  // were too big to keep at all.
+  std::uint64_t m_evictedCount;
+  std::uint64_t m_rejectedCount;
+
+private:     // methods
+  // Drop the oldest frame, keeping its buffer if there is room.
+  void evictOldestLocked();
+
+public:      // methods
+  ReplayRing(std::size_t maxFrames, std::size_t maxBytes);
+
+  // Change the limits, dropping frames as needed.
+  void setLimits(std::size_t maxFrames, std::size_t maxBytes);
+
+  // Return an empty buffer to encode a frame into, recycled if one is
+  // available.
+  std::vector<unsigned char> takeBuffer();
+
+  // Add `frame` as the newest, dropping old frames to make room.  A
+  // frame larger than `maxBytes` is discarded.
+  void push(ReplayFrame &&frame);
+
+  // Remove and return the frames grabbed at or after `sinceNs`, oldest
+  // first.  Moving them out, rather than copying, keeps the memory
+  // bound while they are saved, and means no frame is returned twice.
+  std::vector<ReplayFrame> takeFramesSince(std::uint64_t sinceNs);
+
+  // Drop every frame.
+  void clear();
+
+  std::size_t numFrames() const;
+  std::size_t numBytes() const;
+  std::uint64_t evictedCount() const;
+  std::uint64_t rejectedCount() const;
+};
+
+
+#endif // REPLAY_RING_H
@@ -7,23 +7,33 @@
 #include "screenshot-list.h"           // this module
 
 #include "dcx.h"                       // DCX
+#include "frame-source.h"              // parseFrameSource
 #include "json-util.h"                 // SAVE_KEY_FIELD_CTOR
 #include "json.hpp"                    // json::JSON
+#include "perceptual-hash.h"           // perceptualHash
+#include "perf-counters.h"             // perfCounter, etc.
+#include "qoi-codec.h"                 // decodeQOI, encodeQOI
+#include "sharpness.h"                 // imageSharpness
+#include "timeline.h"                  // TIMELINE_SPAN, etc.
+#include "trace-log.h"                 // flushTraceLog
 #include "trace.h"                     // TRACE2, etc.
 #include "winapi-util.h"               // WIDE_STRINGIZE, SELECT_RESTORE_OBJECT, GET_AND_RELEASE_HDC
 
 #include <windows.h>                   // Windows API
+#include <mmsystem.h>                  // timeBeginPeriod, timeEndPeriod
 
-#include <algorithm>                   // std::clamp
+#include <algorithm>                   // std::{clamp, find}
 #include <cassert>                     // assert
-#include <cstdio>                      // std::{remove, rename}
-#include <cstdlib>                     // std::{atoi, getenv, max}
-#include <cstring>                     // std::wstrlen
-#include <cwchar>                      // std::wcslen
+#include <cstdlib>                     // std::{atoi, getenv, strtoull}
+#include <cstring>                     // std::{strcmp, wstrlen}
+#include <cwchar>                      // std::{swprintf, wcslen}
 #include <fstream>                     // std::{ifstream, ofstream}
 #include <iostream>                    // std::{wcerr, flush}
 #include <memory>                      // std::make_unique
 #include <sstream>                     // std::wostringstream
+#include <string>                      // std::wstring
+#include <unordered_map>               // std::unordered_map
+#include <vector>                      // std::vector
 
 using json::JSON;
 
@@ -65,6 +75,52 @@ static bool const c_useDoubleBuffer = true;
 // Name of the file to load and save.
 static wchar_t const *c_saveFileName = L"shots/list.json";
 
+// Name of the file to which the File menu saves the timeline.
+static wchar_t const *c_timelineFileName = L"shots/timeline.json";
+
+// Message used by `runOnUIThread`.  Its `lParam` is an owning
+// `std::function<void ()>*`.
+static UINT const c_runOnUIThreadMsg = WM_APP;
+
+// Width in pixels of the thumbnails the capture pipeline makes.  It
+// matches the default list width, so the list is normally drawn from
+// thumbnails alone.
+static int const c_thumbnailWidth = 400;
+
+// ID and period of the timer that refreshes the statistics overlay.
+static UINT_PTR const c_statsTimerID = 1;
+static UINT const c_statsTimerPeriodMS = 1000;
+
+// ID and period of the timer that looks for shots to archive.
+static UINT_PTR const c_archiveTimerID = 2;
+static UINT const c_archiveTimerPeriodMS = 1000;
+
+// ID of the timer that grabs instant replay frames.  Its period is set
+// by `configureReplay`.
+static UINT_PTR const c_replayTimerID = 3;
+
+// ID of the timer that paces burst frames.  It is re-armed for each
+// frame.
+static UINT_PTR const c_burstTimerID = 4;
+
+// ID of the timer that takes automatic captures.  Its period is set by
+// `configureAutoCapture`.
+static UINT_PTR const c_autoCaptureTimerID = 5;
+
+// How long captures must pause before archiving starts.
+static std::uint64_t const c_archiveIdleNs = 5000000000ull;
+
+// While archiving, the list is saved at most this often, so that the
+// raw files it no longer names can be deleted.
+static std::uint64_t const c_archiveSaveIntervalNs = 60000000000ull;
+
+// Largest Hamming distance between perceptual hashes of shots that
+// `findSimilarShots` counts as similar, out of 64 bits.
+static int const c_similarMaxDistance = 10;
+
+// Number of shots `hashNextShotBatch` hashes in one pool task.
+static std::size_t const c_hashBatchSize = 256;
+
 
 SLMainWindow::SLMainWindow()
   : m_screenshots(),
@@ -72,26 +128,1720 @@ SLMainWindow::SLMainWindow()
     m_selectedIndex(-1),
     m_listScroll(0),
     m_hotkeysRegistered(false),
-    m_menuBar(nullptr)
+    m_showStats(false),
+    m_replayEnabled(false),
+    m_autoCaptureEnabled(false),
+    m_captureMonitor(0),
+    m_bmpFormat(BF_32),
+    m_menuBar(nullptr),
+    m_numMonitorMenuItems(0),
+    m_listLayout(),
+    m_captureRate(0),
+    m_prevCaptureCount(0),
+    m_prevStatsTimeNs(0),
+    m_stallWatchdog(nullptr),
+    m_replayRing(0, 0),
+    m_replayFPS(1),
+    m_replaySeconds(1),
+    m_replayBudget(),
+    m_replayEncodeInFlight(false),
+    m_contentIndex(),
+    m_threadPool(),
+    m_capturePipeline(),
+    m_lastShotId(0),
+    m_lastCaptureNs(0),
+    m_maxRawBacklogBytes(0),
+    m_archivesInFlight(0),
+    m_sharpnessScoresInFlight(0),
+    m_replacedRawFiles(),
+    m_lastListSaveNs(0),
+    m_burstFPS(1),
+    m_burstMaxFrames(1),
+    m_burstKey(0),
+    m_lastGroupId(0),
+    m_activeBurstId(0),
+    m_burstStartNs(0),
+    m_burstNextFrame(0),
+    m_burstCaptured(0),
+    m_burstLastFrameNs(0),
+    m_lastBurstSummary(),
+    m_groupSpans(),
+    m_expandedGroups(),
+    m_largeShotOffset(0),
+    m_autoCapturePeriodMS(10000),
+    m_autoCaptureThreshold(0),
+    m_lastAutoSignature(),
+    m_similarityIndex(),
+    m_shotsToHash(),
+    m_hashingShotBatch(false),
+    m_similarShotIds(),
+    m_clusterMaxDistance(-1),
+    m_blankFramePolicy(BFP_OFF)
+{}
+
+
+SLMainWindow::~SLMainWindow()
 {}
 
 
-SLMainWindow::~SLMainWindow()
-{}
+void SLMainWindow::captureScreen(int groupId, bool automatic)
+{
+  std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
+  shot->captureScreen();
+  addCapture(std::move(shot), PixelImage(), groupId, automatic);
+}
+
+
+void SLMainWindow::captureMonitors()
+{
+  std::vector<RECT> monitors = getMonitorRects();
+
+  int chosen = m_captureMonitor;
+  if (chosen >= (int)monitors.size()) {
+    TRACE1(L"monitor " << chosen+1 << L" is gone; using the primary");
+    chosen = 0;
+  }
+
+  if (chosen != c_allMonitors || monitors.size() == 1) {
+    RECT const &r = monitors[std::max(chosen, 0)];
+    std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
+    shot->captureRegion(r.left, r.top, r.right - r.left, r.bottom - r.top);
+    if (monitors.size() > 1) {
+      shot->m_monitor = chosen+1;
+    }
+    addCapture(std::move(shot), PixelImage(), 0 /*groupId*/,
+               false /*automatic*/);
+    return;
+  }
+
+  // Grab them all before handing any to the pipeline, so they show
+  // nearly the same moment, and so the pipeline has them all at once
+  // to spread over its workers.
+  std::vector<std::unique_ptr<Screenshot>> shots;
+  for (std::size_t i = 0; i < monitors.size(); ++i) {
+    RECT const &r = monitors[i];
+    shots.push_back(std::make_unique<Screenshot>());
+    shots.back()->captureRegion(r.left, r.top, r.right - r.left,
+                                r.bottom - r.top);
+    shots.back()->m_monitor = (int)i+1;
+  }
+
+  // Each is prepended, so add the last first, leaving the primary at
+  // the head of the group.
+  int groupId = ++m_lastGroupId;
+  for (std::size_t i = shots.size(); i-- > 0; ) {
+    addCapture(std::move(shots[i]), PixelImage(), groupId,
+               false /*automatic*/);
+  }
+}
+
+
+void SLMainWindow::setCaptureMonitor(int m)
+{
+  m_captureMonitor = std::max(m, (int)c_allMonitors);
+  setCaptureMonitorMenuItemCheckboxes();
+}
+
+
+void SLMainWindow::setBmpFormat(BmpFormat fmt)
+{
+  m_bmpFormat = fmt;
+  setBmpFormatMenuItemCheckboxes();
+}
+
+
+void SLMainWindow::captureRegion(CaptureRegion const &region)
+{
+  int x, y, w, h;
+  // Regions may lie on any monitor.  A part that falls in a gap
+  // between monitors comes out black.
+  RECT screen = virtualScreenRect();
+  if (!clipCaptureRegion(region, screen.left, screen.top,
+                         screen.right, screen.bottom, x, y, w, h)) {
+    TRACE1(L"capture region " << toWideString(region.m_name) <<
+           L" is off the screen");
+    return;
+  }
+
+  std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
+  shot->captureRegion(x, y, w, h);
+  shot->m_regionName = toWideString(region.m_name);
+  addCapture(std::move(shot), PixelImage(), 0 /*groupId*/,
+             false /*automatic*/);
+}
+
+
+void SLMainWindow::addCapture(std::unique_ptr<Screenshot> shot,
+                              PixelImage &&pixels, int groupId,
+                              bool automatic)
+{
+  shot->chooseFileName();
+  shot->m_shotId = ++m_lastShotId;
+  shot->m_groupId = groupId;
+  m_lastCaptureNs = perfNowNs();
+
+  if (m_capturePipeline) {
+    CaptureJobPtr job = std::make_shared<CaptureJob>();
+    job->m_id = shot->m_shotId;
+    job->m_fname = shot->m_fname;
+    job->m_bmpFormat = m_bmpFormat;
+    job->m_blankPolicy = automatic? m_blankFramePolicy : BFP_OFF;
+    job->m_image = pixels.empty()? shot->getPixels() : std::move(pixels);
+
+    CaptureJobPtr dropped;
+    switch (m_capturePipeline->submit(job, dropped)) {
+      case CapturePipeline::SR_QUEUED_AFTER_DROP:
+        // Its file was never written, so it cannot stay in the list.
+        TRACE1(L"capture queue full, discarded " << dropped->m_fname);
+        removeShot(dropped->m_id);
+        // fallthrough
+
+      case CapturePipeline::SR_QUEUED:
+      case CapturePipeline::SR_SPILLED:
+        shot->m_tier = Screenshot::ST_WRITING;
+        break;
+    }
+  }
+  else {
+    shot->writeToBMPFile(m_bmpFormat);
+    shot->m_tier = Screenshot::ST_RAW;
+    queueShotToHash(*shot);
+  }
+
+  prependShot(std::move(shot));
+  selectItem(0);
+  setVScrollInfo();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::createCapturePipeline(OverloadPolicy policy,
+                                         std::size_t queueCapacity,
+                                         std::size_t workers)
+{
+  assert(m_threadPool);
+  m_capturePipeline =
+    std::make_unique<CapturePipeline>(*m_threadPool, policy);
+  CapturePipeline &p = *m_capturePipeline;
+
+  // The stages before "write" only compute, so the monitors of one
+  // capture can go through them side by side.  Writing stays one at a
+  // time, which suits a single disk.
+  //
+  // GDI leaves the alpha channel zero.
+  p.addStage("convert", queueCapacity, [](CaptureJob &job) {
+    setOpaque(job.m_image);
+  }, workers);
+
+  // A black or loading screen is caught before anything else is spent
+  // on it.  Only automatic captures are checked.
+  p.addStage("blank", queueCapacity, [](CaptureJob &job) {
+    static PerfCounter &dropped = perfCounter("capture.blank.dropped");
+    static PerfCounter &marked = perfCounter("capture.blank.marked");
+
+    if (job.m_blankPolicy == BFP_OFF) {
+      return;
+    }
+
+    job.m_blank = classifyFrame(job.m_image);
+    if (job.m_blank != BK_NONE) {
+      if (job.m_blankPolicy == BFP_DROP) {
+        dropped.inc();
+        job.m_skip = true;
+      }
+      else {
+        marked.inc();
+      }
+    }
+  }, workers);
+
+  p.addStage("hash", queueCapacity, [](CaptureJob &job) {
+    job.m_hash = hashPixelContent(job.m_image);
+  }, workers);
+
+  p.addStage("thumbnail", queueCapacity, [](CaptureJob &job) {
+    job.m_thumbnail = downscaleImage(job.m_image, c_thumbnailWidth);
+    job.m_perceptualHash = perceptualHash(job.m_thumbnail);
+  }, workers);
+
+  p.addStage("sharpness", queueCapacity, [](CaptureJob &job) {
+    job.m_sharpness = imageSharpness(job.m_image);
+  }, workers);
+
+  // Encoding is done a band at a time as the file is written, so a
+  // whole encoded copy of the frame never exists.
+  //
+  // A capture identical to one already saved, as when the screen has
+  // not changed, shares that file instead.  Since this stage takes one
+  // job at a time, each file is in the index before the next capture
+  // looks.  Either way, the job leaves holding a reference, unless its
+  // hash collided, which `onCaptureProcessed` passes to the shot.
+  p.addStage("write", queueCapacity, [this](CaptureJob &job) {
+    std::wstring existing;
+    if (acquireSameContent(job.m_hash, job.m_image, existing)) {
+      job.m_fname = existing;
+      job.m_reusedFile = true;
+    }
+    else {
+      job.m_error =
+        writeBMPFileBanded(job.m_fname, job.m_image, job.m_bmpFormat);
+      if (job.m_error.empty() && !job.m_hash.empty()) {
+        m_contentIndex.add(job.m_hash, job.m_fname);
+      }
+    }
+
+    // Release the frame now rather than when the job finishes.
+    job.m_image = PixelImage();
+  });
+
+  p.addStage("index", queueCapacity, [this](CaptureJob &job) {
+    postCaptureResult(job);
+  });
+
+  // When the pipeline is full, skip straight to the file.  A BMP is
+  // little more than the raw pixels, so this is the cheap path.  What
+  // the other stages would have computed is filled in afterward, in
+  // the same task, except the content hash, so the capture never
+  // shares a file.
+  p.setSpillFunc([this](CaptureJob &job) {
+    setOpaque(job.m_image);
+    job.m_error =
+      writeBMPFileBanded(job.m_fname, job.m_image, job.m_bmpFormat);
+    if (job.m_error.empty()) {
+      job.m_thumbnail = downscaleImage(job.m_image, c_thumbnailWidth);
+      job.m_perceptualHash = perceptualHash(job.m_thumbnail);
+      job.m_sharpness = imageSharpness(job.m_image);
+    }
+    job.m_image = PixelImage();
+
+    postCaptureResult(job);
+  });
+}
+
+
+void SLMainWindow::postCaptureResult(CaptureJob &job)
+{
+  if (job.m_skip) {
+    // Nothing was written, so the shot just leaves the list.
+    runOnUIThread([this, id = job.m_id]() {
+      removeShot(id);
+    });
+    return;
+  }
+
+  runOnUIThread(
+    [this, id = job.m_id, hash = job.m_hash,
+     reusedFname = job.m_reusedFile? job.m_fname : std::wstring(),
+     thumbnail = std::move(job.m_thumbnail),
+     perceptualHash = job.m_perceptualHash,
+     sharpness = job.m_sharpness, blank = job.m_blank,
+     error = job.m_error]() mutable {
+      onCaptureProcessed(id, hash, reusedFname, std::move(thumbnail),
+                         perceptualHash, sharpness, blank, error);
+    });
+}
+
+
+void SLMainWindow::prependShot(std::unique_ptr<Screenshot> shot)
+{
+  m_screenshots.push_front(std::move(shot));
+
+  if (int id = m_screenshots[0]->m_groupId) {
+    // Another capture may have come between this burst frame and the
+    // previous one, in which case the frames before it become a group
+    // of their own.
+    auto it = m_groupSpans.find(id);
+    if (it != m_groupSpans.end() &&
+        (int)m_screenshots.size() - it->second.m_below -
+          it->second.m_size != 1) {
+      renumberGroup(id);
+    }
+    joinGroup(0, id);
+  }
+  m_listLayout.pushFront(itemLayoutHeight(0));
+
+  // If the new shot joined a collapsed group, the previous head is
+  // now hidden.
+  updateItemLayout(1);
+}
+
+
+Screenshot *SLMainWindow::findShot(std::uint64_t id)
+{
+  for (auto &shot : m_screenshots) {
+    if (shot->m_shotId == id) {
+      return shot.get();
+    }
+  }
+  return nullptr;
+}
+
+
+int SLMainWindow::findShotIndex(std::uint64_t id) const
+{
+  for (int i = 0; i < (int)m_screenshots.size(); ++i) {
+    if (m_screenshots[i]->m_shotId == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+void SLMainWindow::removeShot(std::uint64_t id)
+{
+  int index = findShotIndex(id);
+  if (index < 0) {
+    return;
+  }
+
+  Screenshot const &shot = *m_screenshots[index];
+  m_contentIndex.release(shot.m_contentHash);
+  m_similarityIndex.remove(id);
+
+  // Groups above the shot now have one fewer below them.
+  int below = (int)m_screenshots.size() - 1 - index;
+  for (auto &entry : m_groupSpans) {
+    if (entry.second.m_below > below) {
+      --entry.second.m_below;
+    }
+  }
+  if (shot.m_groupId) {
+    auto it = m_groupSpans.find(shot.m_groupId);
+    if (--it->second.m_size == 0) {
+      m_groupSpans.erase(it);
+    }
+  }
+
+  m_screenshots.erase(m_screenshots.begin() + index);
+  m_listLayout.erase(index);
+
+  // If it headed a collapsed group, the next member now does.
+  updateItemLayout(index);
+
+  boundSelectedIndex();
+  setVScrollInfo();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::onCaptureProcessed(std::uint64_t id,
+                                      ContentHash const &hash,
+                                      std::wstring const &reusedFname,
+                                      PixelImage &&thumbnail,
+                                      std::uint64_t perceptualHash,
+                                      double sharpness,
+                                      BlankKind blank,
+                                      std::string const &error)
+{
+  Screenshot *shot = findShot(id);
+  if (!shot) {
+    // Deleted while in the pipeline.  Drop the reference the write
+    // stage took for it.
+    if (error.empty()) {
+      m_contentIndex.release(hash);
+    }
+    return;
+  }
+
+  if (!error.empty()) {
+    TRACE1(L"writing " << shot->m_fname << L": " << toWideString(error));
+    shot->m_tier = Screenshot::ST_UNSAVED;
+    invalidateAllPixels();
+    return;
+  }
+
+  shot->m_tier = Screenshot::ST_RAW;
+  shot->m_contentHash = hash;
+  shot->m_thumbnail = std::move(thumbnail);
+  shot->m_perceptualHash = perceptualHash;
+  shot->m_hasPerceptualHash = true;
+  shot->m_sharpness = sharpness;
+  shot->m_hasSharpness = true;
+  shot->m_blank = blank;
+  indexSimilarity(*shot);
+  if (!reusedFname.empty()) {
+    useSharedFile(*shot, reusedFname);
+  }
+  clusterShot(findShotIndex(id));
+  invalidateAllPixels();
+}
+
+
+bool SLMainWindow::acquireSameContent(ContentHash &hash,
+                                      PixelImage const &img,
+                                      std::wstring &fname)
+{
+  static PerfCounter &mismatches = perfCounter("capture.hashMismatches");
+
+  std::wstring existing;
+  if (!m_contentIndex.acquire(hash, existing)) {
+    return false;
+  }
+
+  // The hash is not cryptographic, so the file is checked before the
+  // shot depends on it.  Reading it costs much less than writing.
+  if (imageFileHolds(existing, img)) {
+    fname = existing;
+    return true;
+  }
+
+  TRACE1(L"content hash " << toWideString(hash.toHex()) <<
+         L" of a new capture matches " << existing <<
+         L", but the file does not hold the same pixels");
+  mismatches.inc();
+  m_contentIndex.release(hash);
+  hash = ContentHash();
+  return false;
+}
+
+
+void SLMainWindow::useSharedFile(Screenshot &shot,
+                                 std::wstring const &fname)
+{
+  // The file may have been archived since it was found.  The shot's
+  // reference keeps the entry, which has the current name.
+  std::wstring current = fname;
+  m_contentIndex.lookup(shot.m_contentHash, current);
+
+  shot.m_fname = current;
+  shot.m_tier = isArchivalFileName(current)?
+    Screenshot::ST_ARCHIVED : Screenshot::ST_RAW;
+
+  static PerfCounter &reused = perfCounter("capture.reused");
+  reused.inc();
+}
+
+
+void SLMainWindow::runOnUIThread(std::function<void ()> func)
+{
+  auto *heapFunc = new std::function<void ()>(std::move(func));
+  if (!PostMessage(m_hwnd, c_runOnUIThreadMsg, 0, (LPARAM)heapFunc)) {
+    // The window is gone or its queue is full.
+    TRACE2(L"runOnUIThread: PostMessage failed");
+    delete heapFunc;
+  }
+}
+
+
+void SLMainWindow::runPendingUIThreadFuncs()
+{
+  MSG msg;
+  while (PeekMessage(&msg, m_hwnd, c_runOnUIThreadMsg,
+                     c_runOnUIThreadMsg, PM_REMOVE)) {
+    std::unique_ptr<std::function<void ()>> func(
+      (std::function<void ()>*)msg.lParam);
+    (*func)();
+  }
+}
+
+
+// ---------------------------- Archiving ----------------------------
+std::uint64_t SLMainWindow::rawBacklogBytes() const
+{
+  std::uint64_t total = 0;
+  for (auto const &shot : m_screenshots) {
+    if (shot->m_tier == Screenshot::ST_WRITING ||
+        shot->m_tier == Screenshot::ST_RAW ||
+        shot->m_tier == Screenshot::ST_ARCHIVING) {
+      // This is the size of the pixel data in a BMP of the current
+      // format.  Older files may have another, but this is only used
+      // as an estimate.
+      total += (std::uint64_t)bmpRowBytes(shot->m_width, m_bmpFormat) *
+               shot->m_height;
+    }
+  }
+  return total;
+}
+
+
+void SLMainWindow::archiveIdleShots()
+{
+  // One at a time is enough to keep up, and leaves the rest of the
+  // pool for captures.
+  if (!m_threadPool || m_archivesInFlight > 0) {
+    return;
+  }
+
+  // Oldest first, which is the end of the list.
+  Screenshot *next = nullptr;
+  for (auto it = m_screenshots.rbegin(); it != m_screenshots.rend();
+       ++it) {
+    if ((*it)->m_tier == Screenshot::ST_RAW && !(*it)->m_archiveFailed) {
+      next = it->get();
+      break;
+    }
+  }
+
+  // Rewriting the whole list is slow when it is long, so the raw files
+  // that archiving replaced are let go in batches: once a while has
+  // passed since the last save, and when there is nothing left to do.
+  if (!m_replacedRawFiles.empty() &&
+      (!next ||
+       perfNowNs() - m_lastListSaveNs >= c_archiveSaveIntervalNs)) {
+    std::string error = saveToFile(toNarrowString(c_saveFileName));
+    if (error.empty()) {
+      onListSaved();
+    }
+    else {
+      TRACE1(L"saving list after archiving: " << toWideString(error));
+    }
+  }
+
+  if (!next) {
+    return;
+  }
+
+  bool idle = perfNowNs() - m_lastCaptureNs >= c_archiveIdleNs &&
+              (!m_capturePipeline ||
+               m_capturePipeline->inFlightCount() == 0);
+  if (!idle && rawBacklogBytes() <= m_maxRawBacklogBytes) {
+    return;
+  }
+
+  startArchiving(*next);
+}
+
+
+void SLMainWindow::startArchiving(Screenshot &shot)
+{
+  assert(shot.m_tier == Screenshot::ST_RAW);
+  shot.m_tier = Screenshot::ST_ARCHIVING;
+  ++m_archivesInFlight;
+  invalidateAllPixels();
+
+  std::uint64_t id = shot.m_shotId;
+  std::wstring rawName = shot.m_fname;
+  std::wstring archName = archivalFileName(rawName);
+
+  m_threadPool->submit(TP_MAINTENANCE,
+    [this, id, rawName, archName](PoolTask const &task) {
+      std::string error;
+      if (task.isCancelled()) {
+        error = "cancelled";
+      }
+      else {
+        PERF_TIME_SCOPE("archive.ns");
+        error = archiveImageFile(rawName, archName);
+      }
+
+      runOnUIThread([this, id, rawName, archName, error] {
+        onShotArchived(id, rawName, archName, error);
+      });
+    });
+}
+
+
+void SLMainWindow::onShotArchived(std::uint64_t id,
+                                  std::wstring const &rawName,
+                                  std::wstring const &archName,
+                                  std::string const &error)
+{
+  --m_archivesInFlight;
+
+  // Shot `id` may have been deleted meanwhile, but others can share
+  // its file, and identical captures may have joined them.
+  std::vector<Screenshot*> sharers;
+  for (auto &shot : m_screenshots) {
+    if (shot->m_fname == rawName) {
+      sharers.push_back(shot.get());
+    }
+  }
+  if (sharers.empty()) {
+    // Deleted or reloaded meanwhile, so nothing refers to the new file.
+    if (error.empty()) {
+      DeleteFileW(archName.c_str());
+    }
+    return;
+  }
+
+  if (!error.empty()) {
+    TRACE1(L"archiving " << rawName << L": " << toWideString(error));
+    for (Screenshot *shot : sharers) {
+      shot->m_tier = Screenshot::ST_RAW;
+      shot->m_archiveFailed = true;
+    }
+    invalidateAllPixels();
+    return;
+  }
+
+  for (Screenshot *shot : sharers) {
+    shot->m_fname = archName;
+    shot->m_tier = Screenshot::ST_ARCHIVED;
+    m_contentIndex.rename(shot->m_contentHash, rawName, archName);
+  }
+  invalidateAllPixels();
+
+  // The saved list may still name the raw file, so it stays until the
+  // list is next saved.
+  m_replacedRawFiles.push_back(rawName);
+
+  static PerfCounter &archived = perfCounter("archive.count");
+  archived.inc();
+}
+
+
+void SLMainWindow::onListSaved()
+{
+  m_lastListSaveNs = perfNowNs();
+
+  for (std::wstring const &fname : m_replacedRawFiles) {
+    if (!DeleteFileW(fname.c_str())) {
+      TRACE1(L"DeleteFileW " << fname << L": " << getLastErrorMessage());
+    }
+  }
+  m_replacedRawFiles.clear();
+}
+
+
+// --------------------------- Instant replay --------------------------
+void SLMainWindow::configureReplay(int fps, int seconds,
+                                   std::size_t maxBytes, double cpuLimit)
+{
+  assert(!m_hwnd);
+  m_replayFPS = std::clamp(fps, 1, 30);
+  m_replaySeconds = std::max(1, seconds);
+  m_replayRing.setLimits(m_replayFPS * m_replaySeconds + 1, maxBytes);
+  m_replayBudget.setLimit(cpuLimit, perfNowNs());
+}
+
+
+void SLMainWindow::setReplayEnabled(bool e)
+{
+  if (e == m_replayEnabled) {
+    return;
+  }
+
+  m_replayEnabled = e;
+  if (e) {
+    // This does not set `GetLastError()` reliably, so just trace.
+    if (!SetTimer(m_hwnd, c_replayTimerID, 1000 / m_replayFPS, nullptr)) {
+      TRACE1(L"SetTimer failed");
+    }
+  }
+  else {
+    KillTimer(m_hwnd, c_replayTimerID);
+    m_replayRing.clear();
+  }
+
+  // F6 is a common game key, so only hold it while it does something.
+  if (m_hotkeysRegistered) {
+    if (e) {
+      registerOptionalHotkey(VK_F6, L"instant replay");
+    }
+    else {
+      unregisterOptionalHotkey(VK_F6);
+    }
+  }
+
+  setInstantReplayMenuItemCheckbox();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::onReplayTimer()
+{
+  static PerfCounter &skipped = perfCounter("replay.skipped");
+
+  // Skipping a frame leaves a gap in the replay, which is better than
+  // slowing down what is being recorded.
+  if (!m_threadPool || m_replayEncodeInFlight ||
+      m_replayBudget.delayNs(perfNowNs()) > 0) {
+    skipped.inc();
+    return;
+  }
+
+  TIMELINE_SPAN("replayGrab");
+  std::uint64_t cpuStart = threadCpuTimeNs();
+
+  ReplayFrame frame;
+  frame.m_timeNs = perfNowNs();
+  frame.m_wallTime = localFileTimeNow();
+
+  PixelImage image;
+  {
+    PERF_TIME_SCOPE("replay.grab.ns");
+    Screenshot grab;
+    grab.grabScreen();
+    image = grab.getPixels();
+  }
+  frame.m_width = image.m_width;
+  frame.m_height = image.m_height;
+
+  m_replayBudget.charge(threadCpuTimeNs() - cpuStart, perfNowNs());
+
+  m_replayEncodeInFlight = true;
+  m_threadPool->submit(TP_PREFETCH,
+    [this, image = std::move(image), frame = std::move(frame)]
+    (PoolTask const &) mutable {
+      std::uint64_t cpuStart = threadCpuTimeNs();
+      {
+        PERF_TIME_SCOPE("replay.encode.ns");
+
+        // GDI leaves the alpha channel zero.
+        setOpaque(image);
+
+        frame.m_data = m_replayRing.takeBuffer();
+        encodeQOI(image, frame.m_data);
+      }
+      m_replayRing.push(std::move(frame));
+
+      m_replayBudget.charge(threadCpuTimeNs() - cpuStart, perfNowNs());
+      m_replayEncodeInFlight = false;
+    });
+}
+
+
+void SLMainWindow::commitReplay()
+{
+  if (!m_replayEnabled || !m_threadPool) {
+    return;
+  }
+
+  std::vector<ReplayFrame> frames = m_replayRing.takeFramesSince(
+    perfNowNs() - (std::uint64_t)m_replaySeconds * 1000000000);
+  TRACE2(L"commitReplay: " << frames.size() << L" frames");
+  if (frames.empty()) {
+    return;
+  }
+
+  static PerfCounter &committed = perfCounter("replay.committed");
+  committed.add(frames.size());
+
+  // Names must be chosen on this thread.  The frames are already in
+  // the archival format, so they are written as it directly.
+  std::vector<std::wstring> names;
+  for (ReplayFrame const &frame : frames) {
+    names.push_back(chooseShotFileName(
+      fileTimeToSystemTime(frame.m_wallTime), L".qoi"));
+  }
+  createParentDirectoriesOf(names.front());
+
+  // The frames become a burst.  One task does them all, oldest first,
+  // so they arrive in order.
+  int burstId = ++m_lastGroupId;
+  m_threadPool->submit(TP_VISIBLE,
+    [this, burstId, frames = std::move(frames), names = std::move(names)]
+    (PoolTask const &task) {
+      for (std::size_t i = 0; i < frames.size(); ++i) {
+        if (task.isCancelled()) {
+          return;
+        }
+
+        PixelImage image;
+        if (!decodeQOI(frames[i].m_data, image)) {
+          // Not expected, since we encoded it.
+          TRACE1(L"replay frame " << names[i] << L" is malformed");
+          continue;
+        }
+
+        // As with captures, a frame identical to one already saved,
+        // which is common when the screen is still, shares its file.
+        ContentHash hash = hashPixelContent(image);
+        std::wstring fname = names[i];
+        bool reused = acquireSameContent(hash, image, fname);
+        std::string error;
+        if (!reused) {
+          error = writeImageFile(fname, frames[i].m_data);
+          if (error.empty() && !hash.empty()) {
+            m_contentIndex.add(hash, fname);
+          }
+        }
+        PixelImage thumbnail = downscaleImage(image, c_thumbnailWidth);
+        std::uint64_t pHash = perceptualHash(thumbnail);
+        double sharpness = imageSharpness(image);
+
+        runOnUIThread(
+          [this, fname, time = frames[i].m_wallTime, burstId,
+           image = std::move(image), thumbnail = std::move(thumbnail),
+           pHash, sharpness, hash, reused, error]() mutable {
+            addReplayShot(fname, time, burstId, std::move(image),
+                          std::move(thumbnail), pHash, sharpness, hash,
+                          reused, error);
+          });
+      }
+    });
+}
+
+
+void SLMainWindow::addReplayShot(std::wstring const &fname,
+                                 std::uint64_t captureTime,
+                                 int burstId,
+                                 PixelImage &&image,
+                                 PixelImage &&thumbnail,
+                                 std::uint64_t perceptualHash,
+                                 double sharpness,
+                                 ContentHash const &hash,
+                                 bool reused,
+                                 std::string const &error)
+{
+  std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
+  shot->setPixels(image);
+  shot->m_fname = fname;
+  shot->m_shotId = ++m_lastShotId;
+  shot->m_contentHash = hash;
+  shot->m_thumbnail = std::move(thumbnail);
+  shot->m_captureTime = captureTime;
+  shot->m_groupId = burstId;
+  shot->m_perceptualHash = perceptualHash;
+  shot->m_hasPerceptualHash = true;
+  shot->m_sharpness = sharpness;
+  shot->m_hasSharpness = true;
+  indexSimilarity(*shot);
+
+  if (reused) {
+    useSharedFile(*shot, fname);
+  }
+  else if (error.empty()) {
+    shot->m_tier = Screenshot::ST_ARCHIVED;
+  }
+  else {
+    TRACE1(L"writing " << fname << L": " << toWideString(error));
+    shot->m_tier = Screenshot::ST_UNSAVED;
+    shot->m_contentHash = ContentHash();
+  }
+
+  prependShot(std::move(shot));
+  selectItem(0);
+  setVScrollInfo();
+  invalidateAllPixels();
+}
+
+
+// ---------------------------- Auto-capture ---------------------------
+void SLMainWindow::configureAutoCapture(int seconds, double threshold)
+{
+  assert(!m_hwnd);
+  m_autoCapturePeriodMS = (UINT)std::max(1, seconds) * 1000;
+  m_autoCaptureThreshold = threshold;
+}
+
+
+void SLMainWindow::setAutoCaptureEnabled(bool e)
+{
+  if (e == m_autoCaptureEnabled) {
+    return;
+  }
+
+  m_autoCaptureEnabled = e;
+  if (e) {
+    // Compare the first frame against nothing, so it is kept.
+    m_lastAutoSignature = FrameSignature();
+
+    // This does not set `GetLastError()` reliably, so just trace.
+    if (!SetTimer(m_hwnd, c_autoCaptureTimerID, m_autoCapturePeriodMS,
+                  nullptr)) {
+      TRACE1(L"SetTimer failed");
+    }
+  }
+  else {
+    KillTimer(m_hwnd, c_autoCaptureTimerID);
+  }
+
+  setAutoCaptureMenuItemCheckbox();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::onAutoCaptureTimer()
+{
+  static PerfCounter &kept = perfCounter("auto.kept");
+  static PerfCounter &unchanged = perfCounter("auto.unchanged");
+
+  // With our own window in front, there is no game to capture.
+  if (GetForegroundWindow() == m_hwnd) {
+    return;
+  }
+
+  std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
+  shot->captureScreen();
+  PixelImage pixels = shot->getPixels();
+
+  // Decide before anything is named, encoded or written.
+  FrameSignature sig;
+  {
+    PERF_TIME_SCOPE("auto.signature.ns");
+    sig = computeFrameSignature(pixels);
+  }
+  if (!m_lastAutoSignature.empty() &&
+      signatureDifference(sig, m_lastAutoSignature) <=
+        m_autoCaptureThreshold) {
+    unchanged.inc();
+    return;
+  }
+
+  kept.inc();
+  m_lastAutoSignature = std::move(sig);
+  addCapture(std::move(shot), std::move(pixels), 0 /*groupId*/,
+             true /*automatic*/);
+}
+
+
+// ------------------------------- Bursts ------------------------------
+void SLMainWindow::configureBurst(int fps, int maxFrames)
+{
+  assert(!m_hwnd);
+  m_burstFPS = std::clamp(fps, 1, 30);
+  m_burstMaxFrames = std::max(1, maxFrames);
+}
+
+
+void SLMainWindow::toggleBurst()
+{
+  if (m_activeBurstId) {
+    stopBurst();
+  }
+  else {
+    startBurst();
+  }
+}
+
+
+void SLMainWindow::startBurst()
+{
+  if (m_activeBurstId) {
+    return;
+  }
+
+  // The default timer resolution, about 16 ms, is too coarse to pace
+  // frames 33 ms apart.
+  timeBeginPeriod(1);
+
+  m_activeBurstId = ++m_lastGroupId;
+  m_burstStartNs = perfNowNs();
+  m_burstNextFrame = 0;
+  m_burstCaptured = 0;
+  m_burstLastFrameNs = m_burstStartNs;
+  TRACE2(L"startBurst: " << m_activeBurstId);
+
+  // The first frame is due now.
+  onBurstTimer();
+}
+
+
+void SLMainWindow::stopBurst()
+{
+  if (!m_activeBurstId) {
+    return;
+  }
+
+  KillTimer(m_hwnd, c_burstTimerID);
+  timeEndPeriod(1);
+
+  double achieved = 0;
+  if (m_burstCaptured > 1) {
+    achieved = (m_burstCaptured - 1) * 1e9 /
+               (m_burstLastFrameNs - m_burstStartNs);
+  }
+
+  wchar_t buf[80];
+  std::swprintf(buf, TABLESIZE(buf), L"%d frames, %.1f of %d fps",
+                m_burstCaptured, achieved, m_burstFPS);
+  m_lastBurstSummary = buf;
+  TRACE2(L"stopBurst: " << m_activeBurstId << L": " << m_lastBurstSummary);
+
+  m_activeBurstId = 0;
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::onBurstTimer()
+{
+  static LatencyHistogram &lateness = perfHistogram("burst.late.ns");
+  static PerfCounter &skipped = perfCounter("burst.skipped");
+
+  std::uint64_t periodNs = 1000000000ull / m_burstFPS;
+  std::uint64_t now = perfNowNs();
+  std::uint64_t dueNs = m_burstStartNs + m_burstNextFrame * periodNs;
+
+  // Timers can fire a little early, in which case just re-arm.
+  if (now >= dueNs) {
+    // Frames a whole period or more late are skipped, so that a stall
+    // is not followed by a rush of frames.
+    std::uint64_t missed = (now - dueNs) / periodNs;
+    skipped.add(missed);
+    m_burstNextFrame += (int)missed;
+    lateness.record(now - dueNs - missed * periodNs);
+
+    if (m_burstNextFrame < m_burstMaxFrames) {
+      captureScreen(m_activeBurstId, true /*automatic*/);
+      ++m_burstCaptured;
+      m_burstLastFrameNs = now;
+    }
+    ++m_burstNextFrame;
+  }
+
+  if (m_burstNextFrame >= m_burstMaxFrames) {
+    stopBurst();
+    return;
+  }
+
+  // Deadlines are computed from the start rather than from the last
+  // frame, so timer error does not accumulate.  Re-arming a timer with
+  // the same ID replaces it.
+  std::uint64_t nextNs = m_burstStartNs + m_burstNextFrame * periodNs;
+  now = perfNowNs();
+  UINT delayMS = nextNs > now? (UINT)((nextNs - now + 999999) / 1000000) : 0;
+  if (!SetTimer(m_hwnd, c_burstTimerID, delayMS, nullptr)) {
+    TRACE1(L"SetTimer failed");
+    stopBurst();
+  }
+}
+
+
+// ------------------------------- Groups ------------------------------
+int SLMainWindow::groupHeadIndex(int index) const
+{
+  int id = m_screenshots.at(index)->m_groupId;
+  if (!id) {
+    return index;
+  }
+
+  GroupSpan const &span = m_groupSpans.at(id);
+  return (int)m_screenshots.size() - span.m_below - span.m_size;
+}
+
+
+int SLMainWindow::groupSize(int head) const
+{
+  int id = m_screenshots.at(head)->m_groupId;
+  return id? m_groupSpans.at(id).m_size : 1;
+}
+
+
+void SLMainWindow::joinGroup(int index, int id)
+{
+  m_screenshots.at(index)->m_groupId = id;
+
+  int below = (int)m_screenshots.size() - 1 - index;
+  auto it = m_groupSpans.find(id);
+  if (it == m_groupSpans.end()) {
+    m_groupSpans[id] = GroupSpan{below, 1};
+    return;
+  }
+
+  GroupSpan &span = it->second;
+  span.m_below = std::min(span.m_below, below);
+  ++span.m_size;
+}
+
+
+void SLMainWindow::renumberGroup(int id)
+{
+  auto it = m_groupSpans.find(id);
+  GroupSpan span = it->second;
+  m_groupSpans.erase(it);
+
+  int to = ++m_lastGroupId;
+  int head = (int)m_screenshots.size() - span.m_below - span.m_size;
+  for (int i = head; i < head+span.m_size; ++i) {
+    m_screenshots[i]->m_groupId = to;
+  }
+  m_groupSpans[to] = span;
+
+  if (m_expandedGroups.erase(id)) {
+    m_expandedGroups.insert(to);
+  }
+}
+
+
+void SLMainWindow::rebuildGroupSpans()
+{
+  m_groupSpans.clear();
+
+  // Oldest first, so `joinGroup` can tell when a group's members are
+  // not adjacent.
+  for (int i = (int)m_screenshots.size() - 1; i >= 0; --i) {
+    int id = m_screenshots[i]->m_groupId;
+    if (!id) {
+      continue;
+    }
+
+    if (i+1 == (int)m_screenshots.size() ||
+        m_screenshots[i+1]->m_groupId != id) {
+      if (m_groupSpans.count(id)) {
+        // An earlier run of this group.
+        renumberGroup(id);
+      }
+    }
+    joinGroup(i, id);
+  }
+}
+
+
+bool SLMainWindow::isItemHidden(int index) const
+{
+  int id = m_screenshots.at(index)->m_groupId;
+  return id && index > 0 && m_screenshots[index-1]->m_groupId == id &&
+         m_expandedGroups.count(id) == 0;
+}
+
+
+int SLMainWindow::nextShownIndex(int index, int step) const
+{
+  // Hidden items take no space, so the item at the pixel just past
+  // this one, or just before it, is the next one shown.
+  if (index < 0 && step < 0) {
+    return index;
+  }
+  int y = step > 0? m_listLayout.offset(index+1) :
+                    m_listLayout.offset(index) - 1;
+  if (y < 0) {
+    return index;
+  }
+
+  int i = m_listLayout.indexAt(y);
+  return i < m_listLayout.size()? i : index;
+}
+
+
+void SLMainWindow::toggleGroupExpanded()
+{
+  if (m_selectedIndex < 0) {
+    return;
+  }
+
+  int id = m_screenshots.at(m_selectedIndex)->m_groupId;
+  if (!id) {
+    return;
+  }
+
+  int head = groupHeadIndex(m_selectedIndex);
+  if (m_expandedGroups.erase(id)) {
+    // The selection may now be hidden.
+    updateGroupLayout(head);
+    selectItem(head);
+  }
+  else {
+    m_expandedGroups.insert(id);
+    updateGroupLayout(head);
+  }
+
+  m_largeShotOffset = 0;
+  scrollToSelectedIndex();
+  setVScrollInfo();
+  invalidateAllPixels();
+}
+
+
+std::wstring SLMainWindow::groupLabel(int head) const
+{
+  int n = groupSize(head);
+  Screenshot const &newest = *m_screenshots.at(head);
+  Screenshot const &oldest = *m_screenshots.at(head+n-1);
+  wchar_t const *sign =
+    m_expandedGroups.count(newest.m_groupId)? L"[-]" : L"[+]";
+
+  wchar_t buf[80];
+  if (newest.m_monitor) {
+    std::swprintf(buf, TABLESIZE(buf), L"%ls %d monitors", sign, n);
+  }
+  else if (newest.m_clustered) {
+    std::swprintf(buf, TABLESIZE(buf), L"%ls %d similar shots", sign, n);
+  }
+  else if (n > 1 && newest.m_captureTime > oldest.m_captureTime) {
+    // Capture times are in 100 ns units.
+    double fps = (n-1) * 1e7 / (newest.m_captureTime - oldest.m_captureTime);
+    std::swprintf(buf, TABLESIZE(buf), L"%ls burst: %d frames, %.1f fps",
+                  sign, n, fps);
+  }
+  else {
+    std::swprintf(buf, TABLESIZE(buf), L"%ls burst: %d frames", sign, n);
+  }
+  return buf;
+}
+
+
+int SLMainWindow::largeShotIndex() const
+{
+  if (m_selectedIndex < 0) {
+    return -1;
+  }
+
+  // The group may have lost members since the offset was chosen.
+  int n = groupSize(groupHeadIndex(m_selectedIndex));
+  return m_selectedIndex + std::clamp(m_largeShotOffset, 0, n-1);
+}
+
+
+void SLMainWindow::stepLargeShot(int step)
+{
+  if (m_selectedIndex < 0) {
+    return;
+  }
+
+  int id = m_screenshots.at(m_selectedIndex)->m_groupId;
+  if (!id) {
+    return;
+  }
+
+  int head = groupHeadIndex(m_selectedIndex);
+  int n = groupSize(head);
+  if (m_expandedGroups.count(id)) {
+    // Every member is in the list, so move the selection instead.
+    selectItem(head + (m_selectedIndex - head + step + n) % n);
+    return;
+  }
+
+  m_largeShotOffset = (m_largeShotOffset + step + n) % n;
+  invalidateAllPixels();
+}
+
+
+bool SLMainWindow::canCluster(Screenshot const &a,
+                              Screenshot const &b) const
+{
+  // Bursts and the monitors of one capture are already groups, which
+  // are not merged with others.
+  return m_clusterMaxDistance >= 0 &&
+         a.m_hasPerceptualHash && b.m_hasPerceptualHash &&
+         !a.m_discarded && !b.m_discarded &&
+         (!a.m_groupId || a.m_clustered) &&
+         (!b.m_groupId || b.m_clustered) &&
+         a.m_width == b.m_width && a.m_height == b.m_height &&
+         hammingDistance(a.m_perceptualHash, b.m_perceptualHash) <=
+           m_clusterMaxDistance;
+}
+
+
+void SLMainWindow::clusterShot(int index)
+{
+  if (index < 0) {
+    return;
+  }
+
+  int n = (int)m_screenshots.size();
+  bool changed = false;
+
+  // Compare with the older neighbor, then the newer one.  Captures
+  // usually finish in order, so the newer has no hash yet, but when it
+  // does, this shot may be what joins two groups.
+  for (int other : { index+1, index-1 }) {
+    if (other < 0 || other >= n) {
+      continue;
+    }
+
+    Screenshot &upper = *m_screenshots[std::min(index, other)];
+    Screenshot &lower = *m_screenshots[std::max(index, other)];
+    if ((upper.m_groupId && upper.m_groupId == lower.m_groupId) ||
+        !canCluster(upper, lower)) {
+      continue;
+    }
+
+    int upperIndex = std::min(index, other);
+    if (!upper.m_groupId) {
+      joinGroup(upperIndex,
+                lower.m_groupId? lower.m_groupId : ++m_lastGroupId);
+      upper.m_clustered = true;
+    }
+    if (!lower.m_groupId) {
+      joinGroup(upperIndex+1, upper.m_groupId);
+      lower.m_clustered = true;
+    }
+    else if (lower.m_groupId != upper.m_groupId) {
+      // Two groups meet.  The lower shot heads its group.
+      mergeGroup(std::max(index, other), lower.m_groupId, upper.m_groupId);
+    }
+    changed = true;
+  }
+
+  if (!changed) {
+    return;
+  }
+
+  for (int i = index-1; i <= index+1; ++i) {
+    updateItemLayout(i);
+  }
+
+  // If the selected shot was folded into a group, select the group
+  // but keep showing the shot.
+  if (m_selectedIndex >= 0 && isItemHidden(m_selectedIndex)) {
+    int selected = m_selectedIndex;
+    int head = groupHeadIndex(selected);
+    selectItem(head);
+    m_largeShotOffset = selected - head;
+  }
+
+  TRACE2(L"clusterShot: " << index << L" is in group " <<
+         m_screenshots[index]->m_groupId);
+  setVScrollInfo();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::mergeGroup(int head, int from, int to)
+{
+  m_expandedGroups.erase(from);
+
+  auto it = m_groupSpans.find(from);
+  int size = it->second.m_size;
+  GroupSpan &into = m_groupSpans.at(to);
+  into.m_below = std::min(into.m_below, it->second.m_below);
+  into.m_size += size;
+  m_groupSpans.erase(it);
+
+  for (int i = head; i < head+size; ++i) {
+    m_screenshots[i]->m_groupId = to;
+    m_screenshots[i]->m_clustered = true;
+    updateItemLayout(i);
+  }
+}
+
+
+void SLMainWindow::keepSharpestShots()
+{
+  if (m_sharpnessScoresInFlight > 0) {
+    // Already waiting for scores.
+    return;
+  }
+
+  // Reading every unscored file can take a while, so it is done on the
+  // pool, and the rest waits until it is.
+  int n = (int)m_screenshots.size();
+  for (int head = 0; head < n; head += groupSize(head)) {
+    // The monitors of one capture are different pictures.
+    Screenshot const &first = *m_screenshots[head];
+    int size = groupSize(head);
+    if (!first.m_groupId || first.m_monitor || size < 2) {
+      continue;
+    }
+
+    for (int i = head; i < head+size; ++i) {
+      Screenshot const &shot = *m_screenshots[i];
+      if (!shot.m_hasSharpness && shot.m_tier != Screenshot::ST_UNSAVED &&
+          m_threadPool) {
+        startScoringSharpness(shot);
+      }
+    }
+  }
+
+  if (m_sharpnessScoresInFlight > 0) {
+    TRACE2(L"keepSharpestShots: scoring " << m_sharpnessScoresInFlight <<
+           L" shots first");
+    return;
+  }
+  discardAllButSharpest();
+}
+
+
+void SLMainWindow::startScoringSharpness(Screenshot const &shot)
+{
+  ++m_sharpnessScoresInFlight;
+
+  m_threadPool->submit(TP_MAINTENANCE,
+    [this, id = shot.m_shotId, fname = shot.m_fname]
+    (PoolTask const &task) {
+      double sharpness = 0;
+      std::string error;
+      if (task.isCancelled()) {
+        error = "cancelled";
+      }
+      else {
+        PixelImage img;
+        error = readImagePixels(fname, img);
+        if (error.empty()) {
+          sharpness = imageSharpness(img);
+        }
+      }
+
+      runOnUIThread([this, id, sharpness, error] {
+        onSharpnessScored(id, sharpness, error);
+      });
+    });
+}
+
+
+void SLMainWindow::onSharpnessScored(std::uint64_t id, double sharpness,
+                                     std::string const &error)
+{
+  --m_sharpnessScoresInFlight;
+
+  // The shot may have been deleted meanwhile.
+  if (Screenshot *shot = findShot(id)) {
+    if (error.empty()) {
+      shot->m_sharpness = sharpness;
+      shot->m_hasSharpness = true;
+    }
+    else {
+      TRACE1(L"scoring the sharpness of " << shot->m_fname << L": " <<
+             toWideString(error));
+    }
+  }
+
+  if (m_sharpnessScoresInFlight == 0) {
+    discardAllButSharpest();
+  }
+}
+
+
+void SLMainWindow::discardAllButSharpest()
+{
+  TIMELINE_SPAN("discardAllButSharpest");
+
+  // The shot the large pane shows, and what to show once it is gone.
+  int shown = largeShotIndex();
+  std::uint64_t shownId = shown >= 0? m_screenshots[shown]->m_shotId : 0;
+
+  int discarded = 0;
+  int groups = 0;
+  int n = (int)m_screenshots.size();
+  for (int head = 0; head < n; ) {
+    // The loop below ungroups the members, so their number is needed
+    // first.
+    Screenshot const &first = *m_screenshots[head];
+    int size = groupSize(head);
+    if (!first.m_groupId || first.m_monitor || size < 2) {
+      head += size;
+      continue;
+    }
+
+    int best = head;
+    for (int i = head; i < head+size; ++i) {
+      if (m_screenshots[i]->m_sharpness > m_screenshots[best]->m_sharpness) {
+        best = i;
+      }
+    }
+
+    std::uint64_t bestId = m_screenshots[best]->m_shotId;
+    m_expandedGroups.erase(first.m_groupId);
+    m_groupSpans.erase(first.m_groupId);
+    for (int i = head; i < head+size; ++i) {
+      Screenshot &shot = *m_screenshots[i];
+      shot.m_groupId = 0;
+      shot.m_clustered = false;
+      if (i != best) {
+        shot.m_discarded = true;
+        m_similarityIndex.remove(shot.m_shotId);
+        m_similarShotIds.erase(shot.m_shotId);
+        ++discarded;
+        if (shot.m_shotId == shownId) {
+          shownId = bestId;
+        }
+      }
+    }
+
+    ++groups;
+    head += size;
+  }
+
+  if (!discarded) {
+    MessageBeep(MB_OK);
+    return;
+  }
+
+  // Every height may have changed, so set them all at once.
+  rebuildListLayout();
+
+  TRACE2(L"keepSharpestShots: discarded " << discarded << L" from " <<
+         groups << L" groups");
+
+  m_selectedIndex = -1;
+  if (shownId) {
+    selectShotById(shownId);
+  }
+  boundSelectedIndex();
+  setVScrollInfo();
+  invalidateAllPixels();
+}
 
 
-void SLMainWindow::captureScreen()
+void SLMainWindow::restoreDiscardedShots()
 {
-  std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
-  shot->captureScreen();
+  int restored = 0;
+  for (auto &shot : m_screenshots) {
+    if (shot->m_discarded) {
+      shot->m_discarded = false;
+      if (shot->m_hasPerceptualHash) {
+        indexSimilarity(*shot);
+      }
+      ++restored;
+    }
+  }
 
-  m_screenshots.push_front(std::move(shot));
-  selectItem(0);
+  if (!restored) {
+    MessageBeep(MB_OK);
+    return;
+  }
+
+  rebuildListLayout();
+
+  TRACE2(L"restoreDiscardedShots: restored " << restored);
+
+  boundSelectedIndex();
   setVScrollInfo();
   invalidateAllPixels();
 }
 
 
+// ----------------------------- Similarity ----------------------------
+void SLMainWindow::indexSimilarity(Screenshot const &shot)
+{
+  assert(shot.m_hasPerceptualHash);
+  m_similarityIndex.add(shot.m_shotId, shot.m_perceptualHash);
+}
+
+
+void SLMainWindow::queueShotToHash(Screenshot const &shot)
+{
+  m_shotsToHash.push_back({shot.m_shotId, shot.m_fname});
+  hashNextShotBatch();
+}
+
+
+void SLMainWindow::hashNextShotBatch()
+{
+  if (m_hashingShotBatch || m_shotsToHash.empty() || !m_threadPool) {
+    return;
+  }
+
+  // Batches keep the pool's queue and the message queue short even
+  // when the whole of a long list needs hashing.
+  std::vector<std::pair<std::uint64_t, std::wstring>> batch;
+  while (batch.size() < c_hashBatchSize && !m_shotsToHash.empty()) {
+    batch.push_back(std::move(m_shotsToHash.front()));
+    m_shotsToHash.pop_front();
+  }
+  m_hashingShotBatch = true;
+
+  m_threadPool->submit(TP_MAINTENANCE,
+    [this, batch = std::move(batch)](PoolTask const &task) {
+      std::vector<std::pair<std::uint64_t, std::uint64_t>> hashes;
+      int failed = 0;
+      for (auto const &[id, fname] : batch) {
+        if (task.isCancelled()) {
+          break;
+        }
+
+        // Hash a thumbnail as the pipeline does, since the full image
+        // can come out a bit or so different.
+        PixelImage img;
+        if (readImagePixels(fname, img).empty()) {
+          hashes.push_back({id,
+            perceptualHash(downscaleImage(img, c_thumbnailWidth))});
+        }
+        else {
+          // Such as a file archived since the batch was made.  The
+          // shot is hashed when the list is next loaded.
+          ++failed;
+        }
+      }
+
+      runOnUIThread([this, hashes = std::move(hashes), failed] {
+        onShotsHashed(hashes, failed);
+      });
+    });
+}
+
+
+void SLMainWindow::onShotsHashed(
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> const &hashes,
+  int failed)
+{
+  m_hashingShotBatch = false;
+  if (failed) {
+    TRACE1(L"could not read " << failed << L" shots to hash them");
+  }
+
+  // One pass over the list, rather than a search for each shot.
+  std::unordered_map<std::uint64_t, std::uint64_t> byId(
+    hashes.begin(), hashes.end());
+  for (auto &shot : m_screenshots) {
+    auto it = byId.find(shot->m_shotId);
+    if (it != byId.end() && !shot->m_hasPerceptualHash) {
+      shot->m_perceptualHash = it->second;
+      shot->m_hasPerceptualHash = true;
+      if (!shot->m_discarded) {
+        indexSimilarity(*shot);
+      }
+    }
+  }
+
+  if (m_shotsToHash.empty()) {
+    TRACE2(L"finished hashing shots; " << m_similarityIndex.size() <<
+           L" are indexed");
+  }
+  hashNextShotBatch();
+}
+
+
+void SLMainWindow::findSimilarShots()
+{
+  if (m_selectedIndex < 0) {
+    return;
+  }
+
+  TIMELINE_SPAN("findSimilarShots");
+  std::uint64_t start = perfNowNs();
+
+  // Shots still being hashed in the background are not in the index,
+  // so they are neither searched for nor found.
+  Screenshot const &selected = *m_screenshots.at(m_selectedIndex);
+  if (!selected.m_hasPerceptualHash) {
+    TRACE1(L"findSimilarShots: the selected shot is not hashed yet; " <<
+           m_shotsToHash.size() << L" shots are waiting");
+    MessageBeep(MB_OK);
+    return;
+  }
+  std::vector<SimilarityIndex::Match> matches = m_similarityIndex.query(
+    selected.m_perceptualHash, c_similarMaxDistance);
+
+  m_similarShotIds.clear();
+  for (SimilarityIndex::Match const &m : matches) {
+    if (m.m_id != selected.m_shotId) {
+      m_similarShotIds.insert(m.m_id);
+    }
+  }
+
+  TRACE1(L"findSimilarShots: " << m_similarShotIds.size() <<
+         L" of " << m_similarityIndex.size() << L" shots, " <<
+         m_similarityIndex.lastCandidates() << L" compared, in " <<
+         (perfNowNs() - start) / 1000 << L" us");
+
+  if (m_similarShotIds.empty()) {
+    MessageBeep(MB_OK);
+  }
+  else {
+    // Matches are nearest first, and the selected shot matches itself.
+    std::uint64_t nearest = matches[0].m_id != selected.m_shotId?
+      matches[0].m_id : matches[1].m_id;
+    selectShotById(nearest);
+  }
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::selectNextSimilarShot()
+{
+  // Start from the shot shown, which may be inside a collapsed group.
+  int current = largeShotIndex();
+  int n = (int)m_screenshots.size();
+  for (int k = 1; k <= n; ++k) {
+    int i = (current + k) % n;
+    if (m_similarShotIds.count(m_screenshots[i]->m_shotId)) {
+      selectShotById(m_screenshots[i]->m_shotId);
+      return;
+    }
+  }
+  MessageBeep(MB_OK);
+}
+
+
+void SLMainWindow::selectShotById(std::uint64_t id)
+{
+  for (int i = 0; i < (int)m_screenshots.size(); ++i) {
+    if (m_screenshots[i]->m_shotId == id) {
+      // In a collapsed group, select the group and show the shot in
+      // the large pane.
+      int head = isItemHidden(i)? groupHeadIndex(i) : i;
+      selectItem(head);
+      m_largeShotOffset = i - head;
+      invalidateAllPixels();
+      return;
+    }
+  }
+}
+
+
 void SLMainWindow::registerHotkeys()
 {
   if (!m_hotkeysRegistered) {
@@ -103,6 +1853,22 @@ void SLMainWindow::registerHotkeys()
         vk);                 // vk
     }
 
+    // F6 is only taken while there is a replay for it to keep.
+    if (m_replayEnabled) {
+      registerOptionalHotkey(VK_F6, L"instant replay");
+    }
+
+    if (m_burstKey) {
+      registerOptionalHotkey(m_burstKey, L"burst");
+    }
+
+    for (CaptureRegion const &region : m_captureRegions) {
+      if (region.m_vk) {
+        registerOptionalHotkey(region.m_vk,
+          L"region " + toWideString(region.m_name));
+      }
+    }
+
     TRACE2("registered hotkeys");
     m_hotkeysRegistered = true;
     setRegisterHotkeysMenuItemCheckbox();
@@ -119,6 +1885,20 @@ void SLMainWindow::unregisterHotkeys()
         vk);
     }
 
+    if (m_replayEnabled) {
+      unregisterOptionalHotkey(VK_F6);
+    }
+
+    if (m_burstKey) {
+      unregisterOptionalHotkey(m_burstKey);
+    }
+
+    for (CaptureRegion const &region : m_captureRegions) {
+      if (region.m_vk) {
+        unregisterOptionalHotkey(region.m_vk);
+      }
+    }
+
     TRACE2("unregistered hotkeys");
     m_hotkeysRegistered = false;
     setRegisterHotkeysMenuItemCheckbox();
@@ -126,6 +1906,23 @@ void SLMainWindow::unregisterHotkeys()
 }
 
 
+void SLMainWindow::registerOptionalHotkey(int vk, std::wstring const &what)
+{
+  // Another program may hold the key, which is not worth stopping for.
+  if (!RegisterHotKey(m_hwnd, vk, 0, vk)) {
+    TRACE1(L"RegisterHotKey for " << what << L": " <<
+           getLastErrorMessage());
+  }
+}
+
+
+void SLMainWindow::unregisterOptionalHotkey(int vk)
+{
+  // This fails if registering it did, which was reported then.
+  UnregisterHotKey(m_hwnd, vk);
+}
+
+
 void SLMainWindow::setHotkeysRegistered(bool r)
 {
   if (r != m_hotkeysRegistered) {
@@ -139,6 +1936,49 @@ void SLMainWindow::setHotkeysRegistered(bool r)
 }
 
 
+void SLMainWindow::setShowStats(bool s)
+{
+  if (s == m_showStats) {
+    return;
+  }
+
+  m_showStats = s;
+  if (s) {
+    // Start the rate calculation afresh.
+    m_captureRate = 0;
+    m_prevCaptureCount = perfCounter("capture.count").get();
+    m_prevStatsTimeNs = perfNowNs();
+
+    // This does not set `GetLastError()` reliably, so just trace.
+    if (!SetTimer(m_hwnd, c_statsTimerID, c_statsTimerPeriodMS, nullptr)) {
+      TRACE1(L"SetTimer failed");
+    }
+  }
+  else {
+    KillTimer(m_hwnd, c_statsTimerID);
+  }
+
+  setShowStatsMenuItemCheckbox();
+  invalidateAllPixels();
+}
+
+
+void SLMainWindow::onStatsTimer()
+{
+  std::uint64_t captures = perfCounter("capture.count").get();
+  std::uint64_t now = perfNowNs();
+
+  if (now > m_prevStatsTimeNs) {
+    m_captureRate = (double)(captures - m_prevCaptureCount) * 1e9 /
+                    (double)(now - m_prevStatsTimeNs);
+  }
+  m_prevCaptureCount = captures;
+  m_prevStatsTimeNs = now;
+
+  invalidateAllPixels();
+}
+
+
 void SLMainWindow::selectItem(int newIndex)
 {
   // Bound the index to the valid range.
@@ -148,10 +1988,26 @@ void SLMainWindow::selectItem(int newIndex)
   else {
     newIndex = std::max(0, newIndex);
     newIndex = std::min((int)m_screenshots.size() - 1, newIndex);
+
+    // Discarded shots take no space, so take the next one shown, or,
+    // at the end, the one before.
+    if (m_screenshots[newIndex]->m_discarded) {
+      int next = nextShownIndex(newIndex, +1);
+      newIndex = next != newIndex? next : nextShownIndex(newIndex, -1);
+      if (newIndex < 0 || m_screenshots[newIndex]->m_discarded) {
+        newIndex = -1;
+      }
+    }
+
+    // Select a collapsed group by its first member.
+    if (newIndex >= 0 && isItemHidden(newIndex)) {
+      newIndex = groupHeadIndex(newIndex);
+    }
   }
 
   if (newIndex != m_selectedIndex) {
     m_selectedIndex = newIndex;
+    m_largeShotOffset = 0;
     scrollToSelectedIndex();
     setVScrollInfo();
     invalidateAllPixels();
@@ -170,14 +2026,37 @@ void SLMainWindow::loadFromJSON(json::JSON const &obj)
 {
   // Clear any existing data before loading new data.
   m_screenshots.clear();
+  m_contentIndex.clear();
+  m_similarityIndex.clear();
+  m_similarShotIds.clear();
+  m_shotsToHash.clear();
   m_selectedIndex = -1;
   m_listScroll = 0;
 
+  // The list being loaded may name the raw files archiving replaced, so
+  // they have to stay.
+  m_replacedRawFiles.clear();
+
   if (obj.hasKey("screenshots")) {
     JSON arr = obj.at("screenshots");
     for (int i=0; i < arr.length(); ++i) {
       std::unique_ptr<Screenshot> shot = std::make_unique<Screenshot>();
       if (shot->loadFromJSON(arr.at(i))) {
+        shot->m_shotId = ++m_lastShotId;
+        if (!shot->m_contentHash.empty()) {
+          m_contentIndex.add(shot->m_contentHash, shot->m_fname);
+        }
+
+        // Lists saved before perceptual hashes were have none.
+        // Computing one reads the whole file, so that is done in the
+        // background, once the list is loaded.
+        if (!shot->m_hasPerceptualHash) {
+          m_shotsToHash.push_back({shot->m_shotId, shot->m_fname});
+        }
+        else if (!shot->m_discarded) {
+          indexSimilarity(*shot);
+        }
+        m_lastGroupId = std::max(m_lastGroupId, shot->m_groupId);
         m_screenshots.push_back(std::move(shot));
       }
       else {
@@ -191,6 +2070,16 @@ void SLMainWindow::loadFromJSON(json::JSON const &obj)
 
   LOAD_KEY_FIELD(listWidth, data.ToInt());
 
+  rebuildGroupSpans();
+
+  // Item heights depend on the width.
+  rebuildListLayout();
+
+  if (!m_shotsToHash.empty()) {
+    TRACE2(L"hashing " << m_shotsToHash.size() << L" older shots");
+    hashNextShotBatch();
+  }
+
   LOAD_KEY_FIELD(selectedIndex, data.ToInt());
 
   // The selected index might become invalid due to some images not
@@ -206,6 +2095,33 @@ void SLMainWindow::loadFromJSON(json::JSON const &obj)
   if (obj.hasKey("hotkeysRegistered")) {
     setHotkeysRegistered(obj.at("hotkeysRegistered").ToBool());
   }
+
+  if (obj.hasKey("showStats")) {
+    setShowStats(obj.at("showStats").ToBool());
+  }
+
+  if (obj.hasKey("replayEnabled")) {
+    setReplayEnabled(obj.at("replayEnabled").ToBool());
+  }
+
+  if (obj.hasKey("autoCaptureEnabled")) {
+    setAutoCaptureEnabled(obj.at("autoCaptureEnabled").ToBool());
+  }
+
+  if (obj.hasKey("captureMonitor")) {
+    setCaptureMonitor(obj.at("captureMonitor").ToInt());
+  }
+
+  if (obj.hasKey("bmpFormat")) {
+    BmpFormat fmt;
+    std::string name = obj.at("bmpFormat").ToString();
+    if (parseBmpFormat(name.c_str(), fmt)) {
+      setBmpFormat(fmt);
+    }
+    else {
+      TRACE1(L"unrecognized bmpFormat: " << toWideString(name));
+    }
+  }
 }
 
 
@@ -213,18 +2129,35 @@ json::JSON SLMainWindow::saveToJSON() const
 {
   JSON obj = json::Object();
 
+  // Shots without a finished file are left out, since loading could
+  // not find it.  `fileSave` waits for pending writes first, so this
+  // only matters for the saves made while archiving.
+  int selectedIndex = m_selectedIndex;
   {
     JSON shots = json::Array();
-    for (auto const &shot : m_screenshots) {
-      shots.append(shot->saveToJSON());
+    for (std::size_t i = 0; i < m_screenshots.size(); ++i) {
+      Screenshot const &shot = *m_screenshots[i];
+      if (shot.m_tier == Screenshot::ST_UNSAVED ||
+          shot.m_tier == Screenshot::ST_WRITING) {
+        if ((int)i < m_selectedIndex) {
+          --selectedIndex;
+        }
+        continue;
+      }
+      shots.append(shot.saveToJSON());
     }
     obj["screenshots"] = shots;
   }
 
   SAVE_KEY_FIELD_CTOR(listWidth);
-  SAVE_KEY_FIELD_CTOR(selectedIndex);
+  obj["selectedIndex"] = json::JSON(std::max(selectedIndex, -1));
   SAVE_KEY_FIELD_CTOR(listScroll);
   SAVE_KEY_FIELD_CTOR(hotkeysRegistered);
+  SAVE_KEY_FIELD_CTOR(showStats);
+  SAVE_KEY_FIELD_CTOR(replayEnabled);
+  SAVE_KEY_FIELD_CTOR(autoCaptureEnabled);
+  SAVE_KEY_FIELD_CTOR(captureMonitor);
+  obj["bmpFormat"] = json::JSON(std::string(bmpFormatName(m_bmpFormat)));
 
   return obj;
 }
@@ -232,6 +2165,8 @@ json::JSON SLMainWindow::saveToJSON() const
 
 std::string SLMainWindow::loadFromFile(std::string const &fname)
 {
+  TIMELINE_SPAN("loadFromFile");
+
   std::ifstream in(fname, std::ios::binary);
   if (!in) {
     return std::strerror(errno);
@@ -251,30 +2186,85 @@ std::string SLMainWindow::loadFromFile(std::string const &fname)
 
 std::string SLMainWindow::saveToFile(std::string const &fname) const
 {
+  TIMELINE_SPAN("saveToFile");
+
   JSON obj = saveToJSON();
 
   std::string serialized = obj.dump();
 
-  // Remove an existing backup.
-  std::string fnameBak = fname + ".bak";
-  std::remove(fnameBak.c_str());
-
-  // Atomically rename any existing file to the backup.
-  std::rename(fname.c_str(), fnameBak.c_str());
-
-  // Write the new file.
-  std::ofstream out(fname, std::ios::binary);
-  if (out) {
+  // Write the new contents under a temporary name, so a failure part
+  // way through leaves the existing file alone.
+  std::string fnameTmp = fname + ".tmp";
+  {
+    std::ofstream out(fnameTmp, std::ios::binary);
     out << serialized << "\n";
-    return "";
+    out.close();
+    if (!out) {
+      return std::strerror(errno);
+    }
   }
-  else {
-    return std::strerror(errno);
+
+  // Atomically swap it in, keeping the previous version as the backup.
+  // This runs while shots are being archived, so there must be no
+  // moment when the list is missing.
+  std::wstring wfname = toWideString(fname);
+  std::wstring wfnameTmp = toWideString(fnameTmp);
+  std::wstring wfnameBak = toWideString(fname + ".bak");
+  if (pathExists(wfname)) {
+    if (!ReplaceFileW(wfname.c_str(), wfnameTmp.c_str(),
+                      wfnameBak.c_str(), REPLACEFILE_IGNORE_MERGE_ERRORS,
+                      nullptr, nullptr)) {
+      return "ReplaceFileW: " + toNarrowString(getLastErrorMessage());
+    }
   }
+  else if (!MoveFileExW(wfnameTmp.c_str(), wfname.c_str(),
+                        MOVEFILE_WRITE_THROUGH)) {
+    return "MoveFileExW: " + toNarrowString(getLastErrorMessage());
+  }
+
+  return "";
 }
 
 
 // ----------------------------- Scrolling -----------------------------
+int SLMainWindow::itemLayoutHeight(int index) const
+{
+  if (isItemHidden(index) || m_screenshots[index]->m_discarded) {
+    return 0;
+  }
+  return m_screenshots[index]->heightForWidth(m_listWidth - c_listMargin*2) +
+         c_listMargin;
+}
+
+
+void SLMainWindow::updateItemLayout(int index)
+{
+  if (0 <= index && index < m_listLayout.size()) {
+    m_listLayout.setHeight(index, itemLayoutHeight(index));
+  }
+}
+
+
+void SLMainWindow::updateGroupLayout(int head)
+{
+  int n = groupSize(head);
+  for (int i = head; i < head+n; ++i) {
+    updateItemLayout(i);
+  }
+}
+
+
+void SLMainWindow::rebuildListLayout()
+{
+  std::vector<int> heights;
+  heights.reserve(m_screenshots.size());
+  for (int i = 0; i < (int)m_screenshots.size(); ++i) {
+    heights.push_back(itemLayoutHeight(i));
+  }
+  m_listLayout.assign(heights);
+}
+
+
 int SLMainWindow::getListContentHeight() const
 {
   int y, h;
@@ -288,27 +2278,21 @@ void SLMainWindow::getItemVerticalBounds(
   int &y,          // OUT
   int &h) const    // OUT
 {
-  y = 0;
-  h = 0;
-
-  int currentIndex = 0;
-  for (auto const &shot : m_screenshots) {
-    int shotHeight = shot->heightForWidth(m_listWidth - c_listMargin*2);
-
-    if (currentIndex == chosenIndex) {
-      // We'll say this item's height includes both the top and bottom
-      // margins, even though those overlap with adjacent elements.
-      h = shotHeight + c_listMargin*2;
-      return;
-    }
-
-    y += c_listMargin + shotHeight;
-    ++currentIndex;
+  if (chosenIndex < 0 || chosenIndex >= m_listLayout.size()) {
+    // Treat that as a request for the "bounds" of an item beyond the
+    // end.
+    y = m_listLayout.total() + c_listMargin;
+    h = 0;
+    return;
   }
 
-  // If we get here then `chosenIndex` is invalid.  Treat that as a
-  // request for the "bounds" of an item beyond the end.
-  y += c_listMargin;
+  y = m_listLayout.offset(chosenIndex);
+
+  // We'll say this item's height includes both the top and bottom
+  // margins, even though those overlap with adjacent elements.  A
+  // hidden item takes no space.
+  int layoutHeight = m_listLayout.height(chosenIndex);
+  h = layoutHeight? layoutHeight + c_listMargin : 0;
 }
 
 
@@ -442,24 +2426,222 @@ void SLMainWindow::drawDivider(DCX dcx) const
 
 void SLMainWindow::drawLargeShot(DCX dcx) const
 {
+  TIMELINE_SPAN("drawLargeShot");
+
   dcx.shrinkByMargin(c_largeShotMargin);
 
   if (m_screenshots.empty() || m_selectedIndex < 0) {
-    dcx.textOut(L"No screenshot selected");
+    dcx.textOut_moveTop(L"No screenshot selected");
+  }
+  else {
+    // Draw timestamp of selected screenshot, or of the member of its
+    // group chosen with Left and Right.
+    Screenshot const *sel = m_screenshots.at(largeShotIndex()).get();
+    std::wstring caption = sel->m_fname + L" (" +
+                           sel->storageDescription() + L")";
+    if (std::wstring ts = sel->timestampString(); !ts.empty()) {
+      caption += L" " + ts;
+    }
+    if (!sel->m_regionName.empty()) {
+      caption += L" [" + sel->m_regionName + L"]";
+    }
+    if (sel->m_monitor) {
+      caption += L" [monitor " + std::to_wstring(sel->m_monitor) + L"]";
+    }
+    dcx.textOut_moveTop(caption);
+
+    // Draw a larger version of the selected screenshot.
+    sel->drawToDCX_autoHeight(dcx);
+  }
+
+  if (m_showStats) {
+    drawStatsOverlay(dcx);
+  }
+}
+
+
+// Format a nanosecond duration with a unit suited to its magnitude.
+static std::wstring formatDuration(std::uint64_t ns)
+{
+  wchar_t buf[40];
+  if (ns < 10000) {
+    std::swprintf(buf, TABLESIZE(buf), L"%llu ns", (unsigned long long)ns);
+  }
+  else if (ns < 10000000) {
+    std::swprintf(buf, TABLESIZE(buf), L"%.1f us", ns / 1e3);
+  }
+  else {
+    std::swprintf(buf, TABLESIZE(buf), L"%.1f ms", ns / 1e6);
+  }
+  return buf;
+}
+
+
+// Format a byte count in MiB.
+static std::wstring formatMiB(double bytes)
+{
+  wchar_t buf[40];
+  std::swprintf(buf, TABLESIZE(buf), L"%.1f MiB", bytes / (1024.0*1024.0));
+  return buf;
+}
+
+
+// Sample the process-wide gauges that nothing else keeps up to date.
+static void updateProcessGauges()
+{
+  static PerfGauge &gdiHandles = perfGauge("process.gdiHandles");
+
+  // This returns 0 on failure, which is fine for display.
+  gdiHandles.set(GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS));
+}
+
+
+void SLMainWindow::drawStatsOverlay(DCX dcx) const
+{
+  updateProcessGauges();
+
+  LatencyHistogram const &paint = perfHistogram("paint.ns");
+  LatencyHistogram const &capture = perfHistogram("capture.ns");
+
+  std::vector<std::wstring> lines;
+  {
+    std::wostringstream oss;
+    oss << L"paint: p50 " << formatDuration(paint.percentile(0.50))
+        << L", p99 " << formatDuration(paint.percentile(0.99))
+        << L", max " << formatDuration(paint.max())
+        << L" (" << paint.count() << L" paints)";
+    lines.push_back(oss.str());
+  }
+  {
+    wchar_t rate[40];
+    std::swprintf(rate, TABLESIZE(rate), L"%.2f", m_captureRate);
+
+    std::wostringstream oss;
+    oss << L"captures: " << capture.count()
+        << L", " << rate << L"/s"
+        << L", p50 " << formatDuration(capture.percentile(0.50))
+        << L", max " << formatDuration(capture.max());
+    lines.push_back(oss.str());
+  }
+  lines.push_back(L"written: " +
+    formatMiB(perfCounter("io.bytesWritten").get()));
+  {
+    std::wostringstream oss;
+    oss << L"bitmaps: " << perfGauge("bitmaps.count").get()
+        << L", " << formatMiB(perfGauge("bitmaps.bytes").get());
+    lines.push_back(oss.str());
+  }
+  {
+    std::wostringstream oss;
+    oss << L"GDI objects: " << perfGauge("process.gdiHandles").get();
+    lines.push_back(oss.str());
+  }
+  if (m_threadPool) {
+    std::wostringstream oss;
+    oss << L"pool: " << m_threadPool->activeWorkerLimit() << L" of "
+        << m_threadPool->numWorkers() << L" workers, "
+        << m_threadPool->outstandingCount() << L" tasks";
+
+    CpuBudget &budget = m_threadPool->cpuBudget();
+    if (double limit = budget.limit(); limit > 0) {
+      oss << L", budget " << (int)(limit * 100 + 0.5) << L"% of a core, "
+          << formatDuration(std::max<std::int64_t>(0,
+               budget.balanceNs(perfNowNs()))) << L" left";
+    }
+    lines.push_back(oss.str());
+  }
+  if (m_capturePipeline) {
+    // Queue depth and capacity of each stage, starred if running.
+    std::wostringstream oss;
+    oss << L"pipeline (" << toString(m_capturePipeline->policy()) << L"):";
+    std::vector<CapturePipeline::StageStatus> stages =
+      m_capturePipeline->stageStatus();
+    stages.push_back(m_capturePipeline->spillStatus());
+    for (auto const &stage : stages) {
+      oss << L" " << stage.m_name << L" " << stage.m_depth << L"/"
+          << stage.m_capacity << (stage.m_running? L"*" : L"");
+    }
+    lines.push_back(oss.str());
+  }
+  {
+    int raw = 0;
+    int archived = 0;
+    for (auto const &shot : m_screenshots) {
+      raw += shot->m_tier == Screenshot::ST_RAW ||
+             shot->m_tier == Screenshot::ST_ARCHIVING;
+      archived += shot->m_tier == Screenshot::ST_ARCHIVED;
+    }
+
+    std::wostringstream oss;
+    oss << L"storage: " << raw << L" raw ("
+        << formatMiB(rawBacklogBytes()) << L" of "
+        << formatMiB(m_maxRawBacklogBytes) << L"), " << archived
+        << L" archived, "
+        << formatMiB(perfCounter("archive.bytesSaved").get())
+        << L" saved";
+    lines.push_back(oss.str());
+  }
+  if (m_activeBurstId || !m_lastBurstSummary.empty()) {
+    LatencyHistogram const &late = perfHistogram("burst.late.ns");
+
+    std::wostringstream oss;
+    oss << L"burst: ";
+    if (m_activeBurstId) {
+      oss << L"capturing, " << m_burstCaptured << L" frames";
+    }
+    else {
+      oss << m_lastBurstSummary;
+    }
+    oss << L", late p99 " << formatDuration(late.percentile(0.99))
+        << L", " << perfCounter("burst.skipped").get() << L" skipped";
+    lines.push_back(oss.str());
+  }
+  if (m_autoCaptureEnabled) {
+    LatencyHistogram const &sig = perfHistogram("auto.signature.ns");
+
+    std::wostringstream oss;
+    oss << L"auto: every " << m_autoCapturePeriodMS / 1000 << L" s, "
+        << perfCounter("auto.kept").get() << L" kept, "
+        << perfCounter("auto.unchanged").get() << L" unchanged, "
+        << L"signature p50 " << formatDuration(sig.percentile(0.50));
+    lines.push_back(oss.str());
+  }
+  if (m_replayEnabled) {
+    LatencyHistogram const &grab = perfHistogram("replay.grab.ns");
+    LatencyHistogram const &encode = perfHistogram("replay.encode.ns");
+
+    std::wostringstream oss;
+    oss << L"replay: " << m_replayRing.numFrames() << L" frames, "
+        << formatMiB(m_replayRing.numBytes()) << L", grab p50 "
+        << formatDuration(grab.percentile(0.50)) << L", encode p50 "
+        << formatDuration(encode.percentile(0.50)) << L", "
+        << perfCounter("replay.skipped").get() << L" skipped";
+    lines.push_back(oss.str());
+  }
+  {
+    std::wostringstream oss;
+    oss << L"dropped: " << perfCounter("pipeline.dropped").get()
+        << L", spilled: " << perfCounter("pipeline.spilled").get();
+    lines.push_back(oss.str());
   }
-  else {
-    // Draw timestamp of selected screenshot.
-    Screenshot const *sel = m_screenshots.at(m_selectedIndex).get();
-    dcx.textOut_moveTop(sel->m_fname);
 
-    // Draw a larger version of the selected screenshot.
-    sel->drawToDCX_autoHeight(dcx);
+  // Use the tooltip colors so the text stands out against any image.
+  COLORREF oldBk = SetBkColor(dcx.hdc, GetSysColor(COLOR_INFOBK));
+  COLORREF oldText = SetTextColor(dcx.hdc, GetSysColor(COLOR_INFOTEXT));
+
+  for (std::wstring const &line : lines) {
+    dcx.textOut_moveTop(line);
   }
+
+  SetTextColor(dcx.hdc, oldText);
+  SetBkColor(dcx.hdc, oldBk);
 }
 
 
 void SLMainWindow::drawShotList(DCX dcx) const
 {
+  TIMELINE_SPAN("drawShotList");
+
   // Implement scrolling by moving our cursor into negative territory.
   dcx.y = -m_listScroll;
 
@@ -474,11 +2656,27 @@ void SLMainWindow::drawShotList(DCX dcx) const
     dcx.textOut(L"No screenshots");
   }
   else {
-    int currentIndex = 0;
-    for (auto const &screenshot : m_screenshots) {
+    // Start with the first item that can be seen, including the
+    // highlight frame that extends into the margin above it.  Hidden
+    // items take no space in `m_listLayout`, so they are skipped
+    // without being visited.
+    int currentIndex =
+      m_listLayout.indexAt(m_listScroll - c_listHighlightFrameThickness);
+    int n = m_listLayout.size();
+    if (currentIndex < n) {
+      dcx.moveTopBy(m_listLayout.offset(currentIndex));
+    }
+
+    while (currentIndex < n) {
+      Screenshot const *screenshot = m_screenshots[currentIndex].get();
       int shotHeight = screenshot->heightForWidth(dcx.w);
 
-      if (currentIndex == m_selectedIndex) {
+      // Shots found by `findSimilarShots` get a frame too, in another
+      // color.
+      int frameColor =
+        currentIndex == m_selectedIndex? COLOR_HIGHLIGHT :
+        m_similarShotIds.count(screenshot->m_shotId)? COLOR_HOTLIGHT : -1;
+      if (frameColor >= 0) {
         // Compute the highlight rectangle by expanding what we will
         // draw as the screenshot.
         DCX dcxHighlight(dcx);
@@ -487,13 +2685,37 @@ void SLMainWindow::drawShotList(DCX dcx) const
 
         // Draw it first so the shot covers most of the highlight
         // rectangle, leaving just a rectangular frame.
-        dcxHighlight.fillRectSysColor(COLOR_HIGHLIGHT);
+        dcxHighlight.fillRectSysColor(frameColor);
       }
 
       screenshot->drawToDCX_autoHeight(dcx);
 
+      // Label the first member of each group, and any black or loading
+      // screen, in the overlay colors.
+      bool groupHead = screenshot->m_groupId &&
+                       groupHeadIndex(currentIndex) == currentIndex;
+      if (groupHead || screenshot->m_blank != BK_NONE) {
+        COLORREF oldBk = SetBkColor(dcx.hdc, GetSysColor(COLOR_INFOBK));
+        COLORREF oldText =
+          SetTextColor(dcx.hdc, GetSysColor(COLOR_INFOTEXT));
+        DCX dcxLabel(dcx);
+        if (groupHead) {
+          dcxLabel.textOut_moveTop(groupLabel(currentIndex));
+        }
+        if (screenshot->m_blank == BK_BLACK) {
+          dcxLabel.textOut(L"Black frame");
+        }
+        else if (screenshot->m_blank == BK_UNIFORM) {
+          dcxLabel.textOut(L"Loading screen?");
+        }
+        SetTextColor(dcx.hdc, oldText);
+        SetBkColor(dcx.hdc, oldBk);
+      }
+
       dcx.moveTopBy(shotHeight + c_listMargin);
-      ++currentIndex;
+      currentIndex = m_listLayout.indexAt(
+        m_listLayout.offset(currentIndex) +
+        m_listLayout.height(currentIndex));
 
       if (dcx.h <= 0) {
         break;
@@ -505,6 +2727,9 @@ void SLMainWindow::drawShotList(DCX dcx) const
 
 void SLMainWindow::onPaint()
 {
+  TIMELINE_SPAN("onPaint");
+  PERF_TIME_SCOPE("paint.ns");
+
   PAINTSTRUCT ps;
   HDC hdc;
   CALL_HANDLE_WINAPI(hdc, BeginPaint, m_hwnd, &ps);
@@ -555,39 +2780,86 @@ void SLMainWindow::onHotKey(WPARAM id, WPARAM fsModifiers, WPARAM vk)
 }
 
 
+SLMainWindow::AppKey const SLMainWindow::s_appKeys[] = {
+  // Q to quit.
+  { 'Q', [](SLMainWindow &w) {
+      TRACE2(L"Saw Q keypress.");
+      PostMessage(w.m_hwnd, WM_CLOSE, 0, 0);
+    } },
+
+  // Take a new screenshot.
+  { VK_F5, [](SLMainWindow &w) { w.captureMonitors(); } },
+
+  // Keep the last few seconds of instant replay.
+  { VK_F6, [](SLMainWindow &w) { w.commitReplay(); } },
+
+  // Discard the selected screenshot.  Its file stays on disk, but it no
+  // longer counts as a user of that file.
+  { VK_DELETE, [](SLMainWindow &w) {
+      if (!w.m_screenshots.empty() && w.m_selectedIndex >= 0) {
+        w.removeShot(w.m_screenshots[w.m_selectedIndex]->m_shotId);
+      }
+    } },
+
+  // Find shots that look like the selected one.
+  { 'S', [](SLMainWindow &w) { w.findSimilarShots(); } },
+
+  { VK_F3, [](SLMainWindow &w) { w.selectNextSimilarShot(); } },
+
+  // Keep the sharpest shot of each group.
+  { 'K', [](SLMainWindow &w) { w.keepSharpestShots(); } },
+
+  // Expand or collapse the selected burst.
+  { VK_RETURN, [](SLMainWindow &w) { w.toggleGroupExpanded(); } },
+
+  { VK_UP, [](SLMainWindow &w) {
+      w.selectItem(w.nextShownIndex(w.m_selectedIndex, -1));
+    } },
+
+  { VK_DOWN, [](SLMainWindow &w) {
+      w.selectItem(w.nextShownIndex(w.m_selectedIndex, +1));
+    } },
+
+  // Show the previous monitor or frame of the selected group.
+  { VK_LEFT, [](SLMainWindow &w) { w.stepLargeShot(-1); } },
+
+  { VK_RIGHT, [](SLMainWindow &w) { w.stepLargeShot(+1); } },
+};
+
+
+/*static*/ bool SLMainWindow::isAppKey(int vk)
+{
+  for (AppKey const &key : s_appKeys) {
+    if (key.m_vk == vk) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
 bool SLMainWindow::onKeyPress(int vk)
 {
   TRACE2(L"onKeyPress:" << vk);
 
-  switch (vk) {
-    case 'Q':
-      // Q to quit.
-      TRACE2(L"Saw Q keypress.");
-      PostMessage(m_hwnd, WM_CLOSE, 0, 0);
+  for (AppKey const &key : s_appKeys) {
+    if (key.m_vk == vk) {
+      key.m_action(*this);
       return true;
+    }
+  }
 
-    case VK_F5:
-      // Take a new screenshot.
-      captureScreen();
-      break;
-
-    case VK_DELETE:
-      // Discard the selected screenshot.
-      if (!m_screenshots.empty() && m_selectedIndex >= 0) {
-        m_screenshots.erase(m_screenshots.cbegin() + m_selectedIndex);
-        boundSelectedIndex();
-        setVScrollInfo();
-        invalidateAllPixels();
-      }
-      break;
-
-    case VK_UP:
-      selectItem(m_selectedIndex-1);
-      break;
+  if (m_burstKey && vk == m_burstKey) {
+    toggleBurst();
+    return true;
+  }
 
-    case VK_DOWN:
-      selectItem(m_selectedIndex+1);
+  // Capture the region bound to this key, if any.
+  for (CaptureRegion const &region : m_captureRegions) {
+    if (region.m_vk == vk) {
+      captureRegion(region);
       return true;
+    }
   }
 
   // Not handled.
@@ -601,13 +2873,40 @@ enum {
   // File
   IDM_LOAD = 1,
   IDM_SAVE,
+  IDM_SAVE_TIMELINE,
   IDM_QUIT,
 
   // Options
   IDM_REGISTER_HOTKEYS,
+  IDM_RECORD_TIMELINE,
+  IDM_SHOW_STATS,
+  IDM_INSTANT_REPLAY,
+  IDM_AUTO_CAPTURE,
 
   // Help
   IDM_ABOUT,
+
+  // Capture
+  IDM_CAPTURE_SCREEN,
+  IDM_CAPTURE_BURST,
+  IDM_CAPTURE_ALL_MONITORS,
+
+  // Find
+  IDM_FIND_SIMILAR,
+  IDM_FIND_NEXT_SIMILAR,
+
+  // Edit
+  IDM_KEEP_SHARPEST,
+  IDM_RESTORE_DISCARDED,
+
+  // Item `i` of `m_captureRegions` has this plus `i`.
+  IDM_CAPTURE_REGION_FIRST = 1000,
+
+  // Monitor `i` of `getMonitorRects()` has this plus `i`.
+  IDM_CAPTURE_MONITOR_FIRST = 2000,
+
+  // BMP format `f` has this plus `f`.
+  IDM_BMP_FORMAT_FIRST = 3000,
 };
 
 
@@ -621,16 +2920,106 @@ void SLMainWindow::createAppMenu()
 
     appendMenuW(menu, MF_STRING, IDM_LOAD, L"&Load from shots/list.json");
     appendMenuW(menu, MF_STRING, IDM_SAVE, L"&Save to shots/list.json");
+    appendMenuW(menu, MF_STRING, IDM_SAVE_TIMELINE,
+                L"Save &timeline to shots/timeline.json");
     appendMenuW(menu, MF_STRING, IDM_QUIT, L"&Quit");
 
     appendMenuW(m_menuBar, MF_POPUP, (UINT_PTR)menu, L"&File");
   }
 
+  // Capture
+  {
+    HMENU menu = createMenu();
+
+    appendMenuW(menu, MF_STRING, IDM_CAPTURE_SCREEN, L"&Screen\tF5");
+
+    // A burst has no key unless BURST_KEY names one.
+    {
+      std::wstring label = L"Start/stop &burst";
+      if (m_burstKey) {
+        label += L"\t" + toWideString(keyName(m_burstKey));
+      }
+      appendMenuW(menu, MF_STRING, IDM_CAPTURE_BURST, label.c_str());
+    }
+    for (std::size_t i = 0; i < m_captureRegions.size(); ++i) {
+      CaptureRegion const &region = m_captureRegions[i];
+
+      std::wostringstream oss;
+      oss << toWideString(region.m_name) << L" (" << region.m_width
+          << L"x" << region.m_height << L")";
+      if (region.m_vk) {
+        oss << L"\t" << toWideString(keyName(region.m_vk));
+      }
+      appendMenuW(menu, MF_STRING, IDM_CAPTURE_REGION_FIRST + i,
+                  oss.str().c_str());
+    }
+
+    // Which monitors F5 takes.  Monitors that come later are not
+    // listed until the next run.
+    std::vector<RECT> monitors = getMonitorRects();
+    m_numMonitorMenuItems = (int)monitors.size();
+    appendMenuW(menu, MF_SEPARATOR, 0, nullptr);
+    appendMenuW(menu, MF_STRING, IDM_CAPTURE_ALL_MONITORS,
+                L"&All monitors");
+    for (std::size_t i = 0; i < monitors.size(); ++i) {
+      RECT const &r = monitors[i];
+
+      std::wostringstream oss;
+      oss << L"Monitor &" << i+1 << L" (" << r.right - r.left << L"x"
+          << r.bottom - r.top << (i == 0? L", primary)" : L")");
+      appendMenuW(menu, MF_STRING, IDM_CAPTURE_MONITOR_FIRST + i,
+                  oss.str().c_str());
+    }
+
+    appendMenuW(m_menuBar, MF_POPUP, (UINT_PTR)menu, L"&Capture");
+  }
+
+  // Find
+  {
+    HMENU menu = createMenu();
+
+    appendMenuW(menu, MF_STRING, IDM_FIND_SIMILAR,
+                L"&Similar to selected\tS");
+    appendMenuW(menu, MF_STRING, IDM_FIND_NEXT_SIMILAR,
+                L"&Next similar\tF3");
+
+    appendMenuW(m_menuBar, MF_POPUP, (UINT_PTR)menu, L"F&ind");
+  }
+
+  // Edit
+  {
+    HMENU menu = createMenu();
+
+    appendMenuW(menu, MF_STRING, IDM_KEEP_SHARPEST,
+                L"&Keep sharpest of each group\tK");
+    appendMenuW(menu, MF_STRING, IDM_RESTORE_DISCARDED,
+                L"&Restore discarded shots");
+
+    appendMenuW(m_menuBar, MF_POPUP, (UINT_PTR)menu, L"&Edit");
+  }
+
   // Options
   {
     HMENU menu = createMenu();
 
     appendMenuW(menu, MF_STRING, IDM_REGISTER_HOTKEYS, L"Register &hotkeys");
+    appendMenuW(menu, MF_STRING, IDM_RECORD_TIMELINE, L"Record &timeline");
+    appendMenuW(menu, MF_STRING, IDM_SHOW_STATS, L"Show &statistics");
+    appendMenuW(menu, MF_STRING, IDM_INSTANT_REPLAY,
+                L"Instant &replay (F6 keeps it)");
+    appendMenuW(menu, MF_STRING, IDM_AUTO_CAPTURE,
+                L"&Auto-capture when the screen changes");
+
+    // Format of the files captures are first written as.
+    appendMenuW(menu, MF_SEPARATOR, 0, nullptr);
+    appendMenuW(menu, MF_STRING, IDM_BMP_FORMAT_FIRST + BF_32,
+                L"Save as &32-bit BMP");
+    appendMenuW(menu, MF_STRING, IDM_BMP_FORMAT_FIRST + BF_24,
+                L"Save as &24-bit BMP");
+    appendMenuW(menu, MF_STRING, IDM_BMP_FORMAT_FIRST + BF_16,
+                L"Save as &16-bit BMP");
+    appendMenuW(menu, MF_STRING, IDM_BMP_FORMAT_FIRST + BF_16_DITHERED,
+                L"Save as 16-bit BMP, &dithered");
 
     appendMenuW(m_menuBar, MF_POPUP, (UINT_PTR)menu, L"&Options");
   }
@@ -645,6 +3034,12 @@ void SLMainWindow::createAppMenu()
   }
 
   setMenu(m_hwnd, m_menuBar);
+  setRecordTimelineMenuItemCheckbox();
+  setShowStatsMenuItemCheckbox();
+  setInstantReplayMenuItemCheckbox();
+  setAutoCaptureMenuItemCheckbox();
+  setCaptureMonitorMenuItemCheckboxes();
+  setBmpFormatMenuItemCheckboxes();
 }
 
 
@@ -652,6 +3047,7 @@ void SLMainWindow::fileLoad()
 {
   std::string error = loadFromFile(toNarrowString(c_saveFileName));
   if (!error.empty()) {
+    StallWatchdog::ExemptScope exempt(m_stallWatchdog);
     MessageBox(m_hwnd,
       toWideString(error).c_str(),
       L"Error loading shots/list.json",
@@ -666,9 +3062,23 @@ void SLMainWindow::fileLoad()
 
 void SLMainWindow::fileSave()
 {
+  // Let pending captures reach the disk, so every file the list names
+  // exists.  Their results are then waiting in the message queue, and
+  // are applied now so the list records the file each shot ended up
+  // with, its hashes, and which captures were dropped.
+  if (m_capturePipeline) {
+    TIMELINE_SPAN("waitForCaptures");
+    m_capturePipeline->waitIdle();
+  }
+  runPendingUIThreadFuncs();
+
   createDirectoryIfNeeded(L"shots");
   std::string error = saveToFile(toNarrowString(c_saveFileName));
-  if (!error.empty()) {
+  if (error.empty()) {
+    onListSaved();
+  }
+  else {
+    StallWatchdog::ExemptScope exempt(m_stallWatchdog);
     MessageBox(m_hwnd,
       toWideString(error).c_str(),
       L"Error saving shots/list.json",
@@ -680,6 +3090,24 @@ void SLMainWindow::fileSave()
 }
 
 
+void SLMainWindow::fileSaveTimeline()
+{
+  createDirectoryIfNeeded(L"shots");
+  std::string error = saveTimelineToFile(toNarrowString(c_timelineFileName));
+  if (!error.empty()) {
+    StallWatchdog::ExemptScope exempt(m_stallWatchdog);
+    MessageBox(m_hwnd,
+      toWideString(error).c_str(),
+      L"Error saving shots/timeline.json",
+      MB_OK);
+  }
+  else {
+    TRACE2(L"wrote shots/timeline.json with " << timelineEventCount() <<
+           L" events");
+  }
+}
+
+
 void SLMainWindow::onCommand(int menuId)
 {
   TRACE2(L"onCommand: " << menuId);
@@ -693,6 +3121,38 @@ void SLMainWindow::onCommand(int menuId)
       fileSave();
       break;
 
+    case IDM_SAVE_TIMELINE:
+      fileSaveTimeline();
+      break;
+
+    case IDM_CAPTURE_SCREEN:
+      captureMonitors();
+      break;
+
+    case IDM_CAPTURE_BURST:
+      toggleBurst();
+      break;
+
+    case IDM_CAPTURE_ALL_MONITORS:
+      setCaptureMonitor(c_allMonitors);
+      break;
+
+    case IDM_FIND_SIMILAR:
+      findSimilarShots();
+      break;
+
+    case IDM_FIND_NEXT_SIMILAR:
+      selectNextSimilarShot();
+      break;
+
+    case IDM_KEEP_SHARPEST:
+      keepSharpestShots();
+      break;
+
+    case IDM_RESTORE_DISCARDED:
+      restoreDiscardedShots();
+      break;
+
     case IDM_QUIT:
       PostMessage(m_hwnd, WM_CLOSE, 0, 0);
       break;
@@ -701,7 +3161,25 @@ void SLMainWindow::onCommand(int menuId)
       setHotkeysRegistered(!m_hotkeysRegistered);
       break;
 
-    case IDM_ABOUT:
+    case IDM_RECORD_TIMELINE:
+      setTimelineEnabled(!g_timelineEnabled);
+      setRecordTimelineMenuItemCheckbox();
+      break;
+
+    case IDM_SHOW_STATS:
+      setShowStats(!m_showStats);
+      break;
+
+    case IDM_INSTANT_REPLAY:
+      setReplayEnabled(!m_replayEnabled);
+      break;
+
+    case IDM_AUTO_CAPTURE:
+      setAutoCaptureEnabled(!m_autoCaptureEnabled);
+      break;
+
+    case IDM_ABOUT: {
+      StallWatchdog::ExemptScope exempt(m_stallWatchdog);
       MessageBox(m_hwnd,
 
         L"Screenshot List v1.0\n"
@@ -712,6 +3190,22 @@ void SLMainWindow::onCommand(int menuId)
         L"About Screenshot List",
         MB_OK);
       break;
+    }
+
+    default:
+      if (menuId >= IDM_CAPTURE_REGION_FIRST &&
+          menuId < IDM_CAPTURE_REGION_FIRST + (int)m_captureRegions.size()) {
+        captureRegion(m_captureRegions[menuId - IDM_CAPTURE_REGION_FIRST]);
+      }
+      else if (menuId >= IDM_CAPTURE_MONITOR_FIRST &&
+               menuId < IDM_CAPTURE_MONITOR_FIRST + m_numMonitorMenuItems) {
+        setCaptureMonitor(menuId - IDM_CAPTURE_MONITOR_FIRST);
+      }
+      else if (menuId >= IDM_BMP_FORMAT_FIRST &&
+               menuId < IDM_BMP_FORMAT_FIRST + NUM_BMP_FORMATS) {
+        setBmpFormat((BmpFormat)(menuId - IDM_BMP_FORMAT_FIRST));
+      }
+      break;
   }
 }
 
@@ -724,10 +3218,62 @@ void SLMainWindow::setRegisterHotkeysMenuItemCheckbox()
 }
 
 
+void SLMainWindow::setRecordTimelineMenuItemCheckbox()
+{
+  CheckMenuItem(m_menuBar, IDM_RECORD_TIMELINE,
+    MF_BYCOMMAND | (g_timelineEnabled? MF_CHECKED : MF_UNCHECKED));
+}
+
+
+void SLMainWindow::setShowStatsMenuItemCheckbox()
+{
+  CheckMenuItem(m_menuBar, IDM_SHOW_STATS,
+    MF_BYCOMMAND | (m_showStats? MF_CHECKED : MF_UNCHECKED));
+}
+
+
+void SLMainWindow::setInstantReplayMenuItemCheckbox()
+{
+  CheckMenuItem(m_menuBar, IDM_INSTANT_REPLAY,
+    MF_BYCOMMAND | (m_replayEnabled? MF_CHECKED : MF_UNCHECKED));
+}
+
+
+void SLMainWindow::setAutoCaptureMenuItemCheckbox()
+{
+  CheckMenuItem(m_menuBar, IDM_AUTO_CAPTURE,
+    MF_BYCOMMAND | (m_autoCaptureEnabled? MF_CHECKED : MF_UNCHECKED));
+}
+
+
+void SLMainWindow::setCaptureMonitorMenuItemCheckboxes()
+{
+  CheckMenuItem(m_menuBar, IDM_CAPTURE_ALL_MONITORS,
+    MF_BYCOMMAND |
+    (m_captureMonitor == c_allMonitors? MF_CHECKED : MF_UNCHECKED));
+
+  for (int i = 0; i < m_numMonitorMenuItems; ++i) {
+    CheckMenuItem(m_menuBar, IDM_CAPTURE_MONITOR_FIRST + i,
+      MF_BYCOMMAND | (m_captureMonitor == i? MF_CHECKED : MF_UNCHECKED));
+  }
+}
+
+
+void SLMainWindow::setBmpFormatMenuItemCheckboxes()
+{
+  for (int f = 0; f < NUM_BMP_FORMATS; ++f) {
+    CheckMenuItem(m_menuBar, IDM_BMP_FORMAT_FIRST + f,
+      MF_BYCOMMAND | (m_bmpFormat == f? MF_CHECKED : MF_UNCHECKED));
+  }
+}
+
+
 // ------------------------ Messages generally -------------------------
 LRESULT CALLBACK SLMainWindow::handleMessage(
   UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
+  StallWatchdog::MessageScope stallScope(m_stallWatchdog, uMsg);
+
   switch (uMsg) {
     case WM_CREATE:
       // Set the window icon.
@@ -749,12 +3295,30 @@ LRESULT CALLBACK SLMainWindow::handleMessage(
 
       setVScrollInfo();
 
+      // This does not set `GetLastError()` reliably, so just trace.
+      if (!SetTimer(m_hwnd, c_archiveTimerID, c_archiveTimerPeriodMS,
+                    nullptr)) {
+        TRACE1(L"SetTimer failed");
+      }
+
       return 0;
 
     case WM_DESTROY:
       TRACE2(L"received WM_DESTROY");
 
       unregisterHotkeys();
+      stopBurst();
+      setShowStats(false);
+      KillTimer(m_hwnd, c_archiveTimerID);
+      KillTimer(m_hwnd, c_replayTimerID);
+      KillTimer(m_hwnd, c_autoCaptureTimerID);
+
+      // Stop background work so nothing more gets posted, then apply
+      // what already was, while the window still exists.  The pipeline
+      // finishes its captures first.
+      m_capturePipeline.reset();
+      m_threadPool.reset();
+      runPendingUIThreadFuncs();
 
       PostQuitMessage(0);
       return 0;
@@ -796,6 +3360,36 @@ LRESULT CALLBACK SLMainWindow::handleMessage(
     case WM_COMMAND:
       onCommand(LOWORD(wParam));
       return 0;
+
+    case c_runOnUIThreadMsg: {
+      std::unique_ptr<std::function<void ()>> func(
+        (std::function<void ()>*)lParam);
+      (*func)();
+      return 0;
+    }
+
+    case WM_TIMER:
+      if (wParam == c_statsTimerID) {
+        onStatsTimer();
+        return 0;
+      }
+      if (wParam == c_archiveTimerID) {
+        archiveIdleShots();
+        return 0;
+      }
+      if (wParam == c_replayTimerID) {
+        onReplayTimer();
+        return 0;
+      }
+      if (wParam == c_burstTimerID) {
+        onBurstTimer();
+        return 0;
+      }
+      if (wParam == c_autoCaptureTimerID) {
+        onAutoCaptureTimer();
+        return 0;
+      }
+      break;
   }
 
   return BaseWindow::handleMessage(uMsg, wParam, lParam);
@@ -803,6 +3397,46 @@ LRESULT CALLBACK SLMainWindow::handleMessage(
 
 
 // ------------------------------ Startup ------------------------------
+// Return the name of `uMsg` if it is known, otherwise its number in
+// hex.
+static std::wstring messageName(unsigned uMsg)
+{
+  if (char const *name = windowMessageName(uMsg)) {
+    return toWideString(name);
+  }
+
+  wchar_t buf[20];
+  std::swprintf(buf, TABLESIZE(buf), L"0x%04X", uMsg);
+  return buf;
+}
+
+
+// Report a UI thread stall.  This runs on the watchdog thread.
+static void reportStall(StallEvent const &ev)
+{
+  std::wostringstream oss;
+  oss << L"UI stall: " << messageName(ev.m_message);
+  if (ev.m_span) {
+    oss << L" in " << ev.m_span;
+  }
+
+  if (!ev.m_ended) {
+    static PerfCounter &stalls = perfCounter("ui.stalls");
+    stalls.inc();
+
+    TRACE1(oss.str() << L" has run for " << (ev.m_durationNs / 1000000) <<
+           L" ms");
+  }
+  else {
+    static LatencyHistogram &stallTimes = perfHistogram("ui.stall.ns");
+    stallTimes.record(ev.m_durationNs);
+
+    TRACE1(oss.str() << L" ended after " << (ev.m_durationNs / 1000000) <<
+           L" ms");
+  }
+}
+
+
 // If `envvar` is set, return its value as an integer.  Otherwise return
 // `defaultValue`.
 static int envIntOr(char const *envvar, int defaultValue)
@@ -816,6 +3450,45 @@ static int envIntOr(char const *envvar, int defaultValue)
 }
 
 
+// Set `priority` to the `THREAD_PRIORITY_XXX` value named by `name`,
+// one of "idle", "lowest", "below" or "normal".  Return false if it is
+// none of those.
+static bool parseThreadPriority(char const *name, int &priority /*OUT*/)
+{
+  static struct {
+    char const *m_name;
+    int m_priority;
+  } const table[] = {
+    { "idle",   THREAD_PRIORITY_IDLE },
+    { "lowest", THREAD_PRIORITY_LOWEST },
+    { "below",  THREAD_PRIORITY_BELOW_NORMAL },
+    { "normal", THREAD_PRIORITY_NORMAL },
+  };
+
+  for (auto const &entry : table) {
+    if (std::strcmp(name, entry.m_name) == 0) {
+      priority = entry.m_priority;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Apply the scheduling policy to the calling pool worker.  Failure is
+// not fatal since the worker can still do its job.
+static void initPoolWorker(int priority, DWORD_PTR affinity)
+{
+  if (!SetThreadPriority(GetCurrentThread(), priority)) {
+    TRACE1(L"SetThreadPriority: " << getLastErrorMessage());
+  }
+
+  if (affinity && !SetThreadAffinityMask(GetCurrentThread(), affinity)) {
+    TRACE1(L"SetThreadAffinityMask: " << getLastErrorMessage());
+  }
+}
+
+
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
                     PWSTR pCmdLine, int nCmdShow)
 {
@@ -825,9 +3498,189 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
 
   // Configure tracing level, with default of 1.
   g_tracingLevel = envIntOr("TRACE", 1);
+  if (g_tracingLevel > c_maxTracingLevel) {
+    TRACE1(L"TRACE=" << g_tracingLevel <<
+           L" exceeds the compiled-in maximum of " << c_maxTracingLevel);
+  }
+
+  // If TIMELINE names a file, record spans from the start, and write
+  // them to that file on exit.
+  char const *timelineFname = std::getenv("TIMELINE");
+  if (timelineFname && *timelineFname) {
+    setTimelineEnabled(true);
+  }
+  setTimelineThreadName("UI");
+
+  // Profile message dispatch unless MSG_PROFILE is 0.
+  BaseWindow::s_profileMessages = envIntOr("MSG_PROFILE", 1) != 0;
+
+  // Report messages that take longer than STALL_MS milliseconds, with
+  // a default of 250.  Zero disables the watchdog.
+  std::unique_ptr<StallWatchdog> stallWatchdog;
+  if (int stallMS = envIntOr("STALL_MS", 250); stallMS > 0) {
+    stallWatchdog = std::make_unique<StallWatchdog>(
+      (std::uint64_t)stallMS * 1000000, reportStall);
+    stallWatchdog->watchCurrentThread();
+  }
 
   // Create the window.
   SLMainWindow mainWindow;
+  mainWindow.m_stallWatchdog = stallWatchdog.get();
+
+  // Background workers: POOL_THREADS of them, defaulting to one fewer
+  // than the number of hardware threads.  They run at POOL_PRIORITY,
+  // on the cores in the hex mask POOL_AFFINITY if it is set, and their
+  // prefetch and maintenance tasks together use at most
+  // POOL_CPU_PERCENT percent of one core if that is set.
+  {
+    int priority = THREAD_PRIORITY_BELOW_NORMAL;
+    if (char const *name = std::getenv("POOL_PRIORITY");
+        name && *name && !parseThreadPriority(name, priority)) {
+      TRACE1(L"unrecognized POOL_PRIORITY: " << toWideString(name));
+    }
+
+    DWORD_PTR affinity = 0;
+    if (char const *mask = std::getenv("POOL_AFFINITY")) {
+      affinity = (DWORD_PTR)std::strtoull(mask, nullptr, 16);
+    }
+
+    mainWindow.m_threadPool = std::make_unique<ThreadPool>(
+      envIntOr("POOL_THREADS", ThreadPool::defaultWorkerCount()),
+      [priority, affinity](int) {
+        initPoolWorker(priority, affinity);
+      });
+
+    if (int percent = envIntOr("POOL_CPU_PERCENT", 0); percent > 0) {
+      mainWindow.m_threadPool->cpuBudget().setLimit(percent / 100.0,
+                                                    perfNowNs());
+    }
+  }
+
+  // Captures pass through the pipeline, whose computing stages each
+  // run up to CAPTURE_WORKERS at once, defaulting to the number of
+  // monitors (within the pool size), so one capture of every monitor
+  // is processed in parallel.  Each stage has CAPTURE_QUEUE slots,
+  // default 2 or the worker count if that is more.  CAPTURE_OVERLOAD
+  // says what happens when it is full: "block", "drop", or "spill"
+  // (the default), which writes the frame on the pool without the
+  // other stages, blocking only if that falls behind too.
+  {
+    OverloadPolicy policy = OP_SPILL;
+    if (char const *overload = std::getenv("CAPTURE_OVERLOAD");
+        overload && *overload && !parseOverloadPolicy(overload, policy)) {
+      TRACE1(L"unrecognized CAPTURE_OVERLOAD: " << toWideString(overload));
+    }
+
+    int workers = std::max(1, envIntOr("CAPTURE_WORKERS",
+      std::min(GetSystemMetrics(SM_CMONITORS),
+               mainWindow.m_threadPool->numWorkers())));
+    mainWindow.createCapturePipeline(policy,
+      std::max(1, envIntOr("CAPTURE_QUEUE", std::max(2, workers))),
+      workers);
+  }
+
+  // Raw captures are recompressed once captures pause, or sooner if
+  // they take more than RAW_BACKLOG_MB megabytes, default 1024.
+  mainWindow.m_maxRawBacklogBytes =
+    (std::uint64_t)std::max(0, envIntOr("RAW_BACKLOG_MB", 1024)) << 20;
+
+  // Instant replay, when enabled from the Options menu, grabs
+  // REPLAY_FPS frames per second (default 3) and keeps the last
+  // REPLAY_SECONDS (default 10) of them, in at most REPLAY_MB megabytes
+  // (default 256).  Grabbing and compressing together use at most
+  // REPLAY_CPU_PERCENT percent of one core (default 10).
+  mainWindow.configureReplay(
+    envIntOr("REPLAY_FPS", 3),
+    envIntOr("REPLAY_SECONDS", 10),
+    (std::size_t)std::max(1, envIntOr("REPLAY_MB", 256)) << 20,
+    std::clamp(envIntOr("REPLAY_CPU_PERCENT", 10), 1, 100) / 100.0);
+
+  // FRAME_SOURCE, if set, replaces the screen as the source of every
+  // capture, as described in frame-source.h.  "synthetic" renders a
+  // fake game, for benchmarking capture without one.
+  if (char const *spec = std::getenv("FRAME_SOURCE"); spec && *spec) {
+    std::unique_ptr<FrameSource> source;
+    std::string error = parseFrameSource(spec, source);
+    if (error.empty()) {
+      setFrameSource(std::move(source));
+    }
+    else {
+      TRACE1(L"FRAME_SOURCE: " << toWideString(error));
+    }
+  }
+
+  // CAPTURE_REGIONS lists parts of the screen to capture on their own,
+  // in the format described in capture-region.h.
+  if (char const *spec = std::getenv("CAPTURE_REGIONS"); spec && *spec) {
+    std::vector<CaptureRegion> regions;
+    std::string error = parseCaptureRegions(spec, regions);
+    for (CaptureRegion const &region : regions) {
+      if (error.empty() && SLMainWindow::isAppKey(region.m_vk)) {
+        error = region.m_name + ": the key is already used";
+      }
+    }
+
+    if (error.empty()) {
+      mainWindow.m_captureRegions = regions;
+    }
+    else {
+      TRACE1(L"CAPTURE_REGIONS: " << toWideString(error));
+    }
+  }
+
+  // Auto-capture, when enabled from the Options menu, grabs a frame
+  // every AUTO_CAPTURE_SECONDS (default 10) and keeps it if more than
+  // AUTO_CAPTURE_CHANGE percent (default 1) of the signature cells
+  // changed since the last one kept.
+  mainWindow.configureAutoCapture(
+    envIntOr("AUTO_CAPTURE_SECONDS", 10),
+    std::clamp(envIntOr("AUTO_CAPTURE_CHANGE", 1), 0, 100) / 100.0);
+
+  // The Capture menu, or the key named by BURST_KEY (none by default),
+  // starts a burst of BURST_FPS frames per second (default 15), which
+  // stops after BURST_SECONDS (default 3) or when started again.  The
+  // key is a global hotkey, so it is opt-in rather than taken from
+  // whatever game is running.
+  {
+    int fps = std::clamp(envIntOr("BURST_FPS", 15), 1, 30);
+    mainWindow.configureBurst(fps,
+      fps * std::max(1, envIntOr("BURST_SECONDS", 3)));
+
+    if (char const *name = std::getenv("BURST_KEY"); name && *name) {
+      int vk = parseKeyName(name);
+      bool taken = SLMainWindow::isAppKey(vk);
+      for (CaptureRegion const &region : mainWindow.m_captureRegions) {
+        taken = taken || region.m_vk == vk;
+      }
+
+      if (!vk) {
+        TRACE1(L"unrecognized BURST_KEY: " << toWideString(name));
+      }
+      else if (taken) {
+        TRACE1(L"BURST_KEY is already used: " << toWideString(name));
+      }
+      else {
+        mainWindow.m_burstKey = vk;
+      }
+    }
+  }
+
+  // Consecutive captures whose perceptual hashes differ in at most
+  // CLUSTER_DISTANCE bits (default 4) are collapsed into one group.  A
+  // negative value disables this.
+  mainWindow.m_clusterMaxDistance =
+    std::min(envIntOr("CLUSTER_DISTANCE", 4), 64);
+
+  // Black and loading screens among auto-captures and bursts are
+  // handled per BLANK_FRAMES: "off", "mark" (the default), which labels
+  // them in the list, or "drop", which discards them unsaved.
+  mainWindow.m_blankFramePolicy = BFP_MARK;
+  if (char const *blank = std::getenv("BLANK_FRAMES");
+      blank && *blank &&
+      !parseBlankFramePolicy(blank, mainWindow.m_blankFramePolicy)) {
+    TRACE1(L"unrecognized BLANK_FRAMES: " << toWideString(blank));
+  }
+
   CreateWindowExWArgs cw;
   cw.m_lpWindowName = L"Screenshot List";
   cw.m_x       = 200;
@@ -848,6 +3701,31 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     DispatchMessage(&msg);
   }
 
+  if (timelineFname && *timelineFname) {
+    std::string error = saveTimelineToFile(timelineFname);
+    if (!error.empty()) {
+      TRACE1(L"writing " << timelineFname << L": " << error);
+    }
+  }
+
+  // The report is longer than a trace record holds, so it is written
+  // directly, after the records before it.
+  if (BaseWindow::s_profileMessages && g_tracingLevel >= 2) {
+    flushTraceLog();
+    std::wcerr << L"message profile:\n"
+               << BaseWindow::messageProfileReport() << std::flush;
+  }
+
+  // If PERF_STATS names a file, write the performance statistics to it.
+  if (char const *statsFname = std::getenv("PERF_STATS");
+      statsFname && *statsFname) {
+    updateProcessGauges();
+    std::string error = savePerfCountersToFile(statsFname);
+    if (!error.empty()) {
+      TRACE1(L"writing " << statsFname << L": " << error);
+    }
+  }
+
   TRACE2(L"Returning from main");
   return 0;
 }
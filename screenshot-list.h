@@ -7,13 +7,44 @@
 #define SCREENSHOT_LIST_H
 
 #include "base-window.h"               // BaseWindow
+#include "blank-frame.h"               // BlankFramePolicy
+#include "capture-pipeline.h"          // CaptureJob, CapturePipeline
+#include "capture-region.h"            // CaptureRegion
+#include "content-index.h"             // ContentIndex
+#include "cpu-budget.h"                // CpuBudget
+#include "frame-signature.h"           // FrameSignature
 #include "json-fwd.h"                  // json::JSON
+#include "list-layout.h"               // ListLayout
+#include "replay-ring.h"               // ReplayRing
 #include "screenshot.h"                // Screenshot
+#include "similarity-index.h"          // SimilarityIndex
+#include "stall-watchdog.h"            // StallWatchdog
+#include "thread-pool.h"               // ThreadPool
 
 #include <windows.h>                   // Windows API
 
+#include <atomic>                      // std::atomic
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
 #include <deque>                       // std::deque
+#include <functional>                  // std::function
 #include <memory>                      // std::unique_ptr
+#include <set>                         // std::set
+#include <string>                      // std::string, std::wstring
+#include <unordered_map>               // std::unordered_map
+#include <utility>                     // std::pair
+#include <vector>                      // std::vector
+
+
+// Where a group of shots is in `SLMainWindow::m_screenshots`.
+struct GroupSpan {
+  // Number of shots below the oldest member.  Unlike the members'
+  // indices, this does not change when shots are prepended.
+  int m_below;
+
+  // Number of members.
+  int m_size;
+};
 
 
 // Main window of the screenshot list app.
@@ -35,27 +66,493 @@ public:      // model data (serialized to JSON)
   // If true, the hotkeys have been registered.
   bool m_hotkeysRegistered;
 
+  // If true, draw the performance statistics overlay on top of the
+  // large screenshot.
+  bool m_showStats;
+
+  // If true, the screen is grabbed continuously into `m_replayRing` so
+  // that the last few seconds can be kept after the fact.
+  bool m_replayEnabled;
+
+  // If true, a capture is taken every `m_autoCapturePeriodMS`, unless
+  // the screen has not changed since the last one.
+  bool m_autoCaptureEnabled;
+
+  // Which monitor `captureScreen` takes: an index into
+  // `getMonitorRects()`, so 0 is the primary, or `c_allMonitors`.
+  int m_captureMonitor;
+
+  // Pixel format of the BMP files captures are written as.
+  BmpFormat m_bmpFormat;
+
 public:      // ui data (ephemeral)
   // The menu bar of the main window.  It is conceptually owned by this
   // object, but because it is assigned as the window's menu, the window
   // destroys it automatically on shutdown.
   HMENU m_menuBar;
 
+  // Number of monitors listed in the Capture menu.
+  int m_numMonitorMenuItems;
+
+  // Space each item takes in the list: its height plus the margin
+  // below it, or 0 if it is hidden in a collapsed group.  Whatever
+  // changes the list, the groups, or which groups are expanded updates
+  // it, through `updateItemLayout` or `rebuildListLayout`.
+  ListLayout m_listLayout;
+
+  // Captures per second over the last statistics timer interval.
+  double m_captureRate;
+
+  // Value of the "capture.count" counter, and of `perfNowNs()`, at the
+  // last statistics timer tick.
+  std::uint64_t m_prevCaptureCount;
+  std::uint64_t m_prevStatsTimeNs;
+
+  // If not null, the watchdog timing each message this window handles.
+  // It is owned by `wWinMain`.
+  StallWatchdog *m_stallWatchdog;
+
+  // Recent frames for instant replay.  Replay tasks refer to it and
+  // to the members below, so they are declared before the pool, which
+  // is thus destroyed first.
+  ReplayRing m_replayRing;
+
+  // Frames grabbed per second, and seconds of them kept.
+  int m_replayFPS;
+  int m_replaySeconds;
+
+  // Bounds the CPU time spent grabbing and compressing replay frames.
+  CpuBudget m_replayBudget;
+
+  // True while a replay frame is being compressed on the pool.  At
+  // most one is, so grabs cannot pile up behind a busy pool.
+  std::atomic<bool> m_replayEncodeInFlight;
+
+  // Files of the shots in the list, by content, so that identical
+  // captures share one.  The capture pipeline and replay tasks use it,
+  // so it too is declared before the pool.
+  ContentIndex m_contentIndex;
+
+  // Pool for background work, created by `wWinMain`.  It is destroyed
+  // with the window, before anything its tasks might refer to.
+  std::unique_ptr<ThreadPool> m_threadPool;
+
+  // Carries each capture from the grab to disk on `m_threadPool`.
+  // Created by `createCapturePipeline`.  If null, captures are written
+  // synchronously.
+  std::unique_ptr<CapturePipeline> m_capturePipeline;
+
+  // Last `Screenshot::m_shotId` assigned.
+  std::uint64_t m_lastShotId;
+
+  // When the last capture was taken, on the `perfNowNs` clock.
+  std::uint64_t m_lastCaptureNs;
+
+  // Once raw files take more than this many bytes, they are archived
+  // even if captures are still being taken.
+  std::uint64_t m_maxRawBacklogBytes;
+
+  // Number of archiving tasks submitted and not yet reported back.
+  int m_archivesInFlight;
+
+  // Number of sharpness scoring tasks submitted by `keepSharpestShots`
+  // and not yet reported back.
+  int m_sharpnessScoresInFlight;
+
+  // Raw files that archiving has replaced, but which the saved list may
+  // still name.  They are deleted by `onListSaved`.
+  std::vector<std::wstring> m_replacedRawFiles;
+
+  // When the list was last saved, on the `perfNowNs` clock.
+  std::uint64_t m_lastListSaveNs;
+
+  // Burst rate, and most frames in one burst.
+  int m_burstFPS;
+  int m_burstMaxFrames;
+
+  // Key that starts and stops a burst, or 0 for none.  Set by
+  // `wWinMain` from BURST_KEY.
+  int m_burstKey;
+
+  // Last `Screenshot::m_groupId` assigned.
+  int m_lastGroupId;
+
+  // Burst being captured, or 0 if none is.
+  int m_activeBurstId;
+
+  // When the active burst started, on the `perfNowNs` clock.  Frame `k`
+  // is due `k` periods later.
+  std::uint64_t m_burstStartNs;
+
+  // Index of the next frame due, and number of frames captured, in the
+  // active burst.  They differ when frames are skipped for being late.
+  int m_burstNextFrame;
+  int m_burstCaptured;
+
+  // When the latest burst frame was captured.
+  std::uint64_t m_burstLastFrameNs;
+
+  // Requested and achieved rates of the last burst, for the overlay.
+  std::wstring m_lastBurstSummary;
+
+  // Position of each group in the list, by `Screenshot::m_groupId`.
+  // Each group is one run of adjacent shots.
+  std::unordered_map<int, GroupSpan> m_groupSpans;
+
+  // Groups the list shows in full.  The others show only their newest
+  // member.
+  std::set<int> m_expandedGroups;
+
+  // Which member of the selected group the large pane shows, as an
+  // offset from the selected item, while the group is collapsed.
+  int m_largeShotOffset;
+
+  // Interval between automatic captures.
+  UINT m_autoCapturePeriodMS;
+
+  // Fraction of `FrameSignature` cells that must change for an
+  // automatic capture to be kept.
+  double m_autoCaptureThreshold;
+
+  // Signature of the last automatic capture kept, or empty.
+  FrameSignature m_lastAutoSignature;
+
+  // Screen regions that can be captured on their own, each from the
+  // Capture menu and optionally its own hotkey.  Set by `wWinMain`.
+  std::vector<CaptureRegion> m_captureRegions;
+
+  // Perceptual hashes of the shots in the list, by `m_shotId`.
+  SimilarityIndex m_similarityIndex;
+
+  // IDs and files of shots, such as those loaded from lists saved
+  // before perceptual hashes were, still to be hashed.  Until they
+  // are, they are not in `m_similarityIndex`.
+  std::deque<std::pair<std::uint64_t, std::wstring>> m_shotsToHash;
+
+  // True while a batch taken from `m_shotsToHash` is being hashed.
+  bool m_hashingShotBatch;
+
+  // Shots found by the last `findSimilarShots`, which are highlighted.
+  std::set<std::uint64_t> m_similarShotIds;
+
+  // Largest Hamming distance between the perceptual hashes of
+  // consecutive captures for `clusterShot` to group them, or -1 to not
+  // group any.
+  int m_clusterMaxDistance;
+
+  // What happens to black and loading screens among automatic
+  // captures.  Set by `wWinMain`.
+  BlankFramePolicy m_blankFramePolicy;
+
+public:      // class data
+  // `m_captureMonitor` value meaning every monitor.
+  static int const c_allMonitors = -1;
+
 public:      // methods
   SLMainWindow();
   ~SLMainWindow();
 
-  // Take a screen capture and prepend it to the "to do" list.
-  void captureScreen();
+  // Take a capture of the primary screen and prepend it to the "to do"
+  // list, as part of group `groupId` if that is not 0.  `automatic` is
+  // as for `addCapture`.
+  void captureScreen(int groupId = 0, bool automatic = false);
+
+  // Capture what `m_captureMonitor` says.  For all monitors, each is a
+  // separate shot, and they are added as one group, so the pipeline
+  // processes them in parallel.
+  void captureMonitors();
+
+  // Choose what `captureMonitors` takes, and check it in the menu.
+  void setCaptureMonitor(int m);
+
+  // Choose the format new captures are written in, and check it in
+  // the menu.
+  void setBmpFormat(BmpFormat fmt);
+
+  // Capture `region` of the screen, clipped to it, and prepend it to
+  // the list like `captureScreen`.
+  void captureRegion(CaptureRegion const &region);
+
+  // Name `shot`, which has just been captured, and prepend it to the
+  // list, saving it through the pipeline if there is one.  `pixels` is
+  // its image if the caller already has it, or empty.  If `automatic`,
+  // as for bursts and auto-capture, the pipeline applies
+  // `m_blankFramePolicy` to it.
+  void addCapture(std::unique_ptr<Screenshot> shot, PixelImage &&pixels,
+                  int groupId, bool automatic);
+
+  // Create `m_capturePipeline`, each stage of which queues up to
+  // `queueCapacity` captures.  The CPU-bound stages each process up
+  // to `workers` captures at once.
+  void createCapturePipeline(OverloadPolicy policy,
+                             std::size_t queueCapacity,
+                             std::size_t workers);
+
+  // Add `shot` at the top of the list.
+  void prependShot(std::unique_ptr<Screenshot> shot);
+
+  // Return the shot whose `m_shotId` is `id`, or null if it is no
+  // longer in the list.
+  Screenshot *findShot(std::uint64_t id);
+
+  // Return the index of the shot whose `m_shotId` is `id`, or -1.
+  int findShotIndex(std::uint64_t id) const;
+
+  // Remove the shot with `id` from the list, if it is there.
+  void removeShot(std::uint64_t id);
+
+  // Runs on a pool worker: pass the results in `job`, the last thing
+  // the pipeline does with it, to the UI thread.
+  void postCaptureResult(CaptureJob &job);
+
+  // Store what the pipeline computed for capture `id`.  `error` is
+  // non-empty if it could not be saved.  If `reusedFname` is not
+  // empty, the capture was not written because an identical one had
+  // been saved there.
+  void onCaptureProcessed(std::uint64_t id, ContentHash const &hash,
+                          std::wstring const &reusedFname,
+                          PixelImage &&thumbnail,
+                          std::uint64_t perceptualHash,
+                          double sharpness, BlankKind blank,
+                          std::string const &error);
+
+  // Point `shot`, whose `m_contentHash` matched that of the shots in
+  // `fname`, at the file they share.
+  void useSharedFile(Screenshot &shot, std::wstring const &fname);
+
+  // If `m_contentIndex` has a file for `hash`, the hash of `img`, that
+  // holds the same pixels, take a reference to it, set `fname` to it,
+  // and return true.  If its file holds other pixels, which takes a
+  // hash collision, clear `hash` so `img` stays out of the index, and
+  // return false.  This can be called on any thread.
+  bool acquireSameContent(ContentHash &hash /*INOUT*/,
+                          PixelImage const &img,
+                          std::wstring &fname /*OUT*/);
+
+  // ---------------------------- Archiving ----------------------------
+  // Total size of the raw files of shots in the list.
+  std::uint64_t rawBacklogBytes() const;
+
+  // Handle the archive timer: if captures have paused, or the raw
+  // backlog is over its limit, start recompressing the oldest raw shot.
+  // Also save the list now and then while raw files await deletion.
+  void archiveIdleShots();
+
+  // Recompress `shot` into the archival format on the pool.
+  void startArchiving(Screenshot &shot);
+
+  // Switch shot `id` from `rawName` to `archName`, which the pool has
+  // just written, unless `error` says it failed.
+  void onShotArchived(std::uint64_t id, std::wstring const &rawName,
+                      std::wstring const &archName,
+                      std::string const &error);
+
+  // Called after the list is saved: delete `m_replacedRawFiles`, which
+  // it no longer names.
+  void onListSaved();
+
+  // -------------------------- Instant replay -------------------------
+  // Grab `fps` frames per second, keeping the last `seconds` of them in
+  // at most `maxBytes`, and using at most `cpuLimit` of one core.  Call
+  // this before creating the window.
+  void configureReplay(int fps, int seconds, std::size_t maxBytes,
+                       double cpuLimit);
+
+  // Start or stop grabbing replay frames.  Stopping discards them.
+  void setReplayEnabled(bool e);
+
+  // Handle the replay timer: grab a frame and compress it on the pool,
+  // unless the previous one is still going or the budget is spent.
+  void onReplayTimer();
+
+  // Save the last `m_replaySeconds` of replay frames and add them to
+  // the list as shots.
+  void commitReplay();
+
+  // Add a replay frame grabbed at `captureTime`, and saved as `fname`
+  // unless `error` says it could not be, to the list as part of burst
+  // `burstId`.  If `reused`, it was identical to a shot already saved
+  // as `fname`, and was not written.
+  void addReplayShot(std::wstring const &fname, std::uint64_t captureTime,
+                     int burstId, PixelImage &&image,
+                     PixelImage &&thumbnail, std::uint64_t perceptualHash,
+                     double sharpness, ContentHash const &hash,
+                     bool reused, std::string const &error);
+
+  // --------------------------- Auto-capture --------------------------
+  // Capture every `seconds`, keeping a frame only if more than
+  // `threshold` of its signature cells changed.  Call this before
+  // creating the window.
+  void configureAutoCapture(int seconds, double threshold);
+
+  // Start or stop automatic capture.
+  void setAutoCaptureEnabled(bool e);
+
+  // Handle the auto-capture timer: grab a frame, and keep it if it
+  // differs enough from the last one kept.
+  void onAutoCaptureTimer();
+
+  // ------------------------------ Bursts -----------------------------
+  // Capture up to `maxFrames` frames at `fps` frames per second when a
+  // burst is started.  Call this before creating the window.
+  void configureBurst(int fps, int maxFrames);
+
+  // Start a burst, or stop the one in progress.
+  void toggleBurst();
+  void startBurst();
+  void stopBurst();
+
+  // Handle the burst timer: capture the frame that is due, if any, and
+  // arm the timer for the next one.
+  void onBurstTimer();
+
+  // ------------------------------ Groups -----------------------------
+  // Return the index of the first member of the group containing the
+  // item at `index`, which is `index` itself if it is not in a group.
+  int groupHeadIndex(int index) const;
+
+  // Number of members of the group whose first member is at `head`.
+  int groupSize(int head) const;
+
+  // Put the shot at `index`, which is next to group `id` or is its
+  // first member, in that group.
+  void joinGroup(int index, int id);
+
+  // Move the members of group `id` to a new group, so that `id` can be
+  // reused for a run of shots elsewhere in the list.
+  void renumberGroup(int id);
+
+  // Recompute `m_groupSpans` from the list, splitting groups whose
+  // members are not adjacent.
+  void rebuildGroupSpans();
+
+  // True if the item at `index` is not shown because it is in a
+  // collapsed group.  Only the first member of those is shown.
+  bool isItemHidden(int index) const;
+
+  // Starting at `index`, move by `step` (1 or -1) until reaching a
+  // shown item, and return its index.  Return `index` if there is none.
+  int nextShownIndex(int index, int step) const;
+
+  // Expand or collapse the group containing the selected item.
+  void toggleGroupExpanded();
+
+  // Describe the group whose first member is at `head`.
+  std::wstring groupLabel(int head) const;
+
+  // Index of the item the large pane shows, or -1 for none.  This is
+  // the selected item, or, in a collapsed group, the member chosen by
+  // `stepLargeShot`.
+  int largeShotIndex() const;
+
+  // Show the next (`step` is 1) or previous (-1) member of the
+  // selected group in the large pane, wrapping around.  The others
+  // keep their bitmaps, so switching does not decode anything.
+  void stepLargeShot(int step);
+
+  // True if `a` and `b`, which are adjacent in the list, can be in the
+  // same group because they look alike.
+  bool canCluster(Screenshot const &a, Screenshot const &b) const;
+
+  // Put the shot at `index`, whose perceptual hash has just been
+  // computed, in one group with its neighbors if they look alike.
+  // Only the neighbors are compared, so a run of near-duplicates is
+  // built up one capture at a time without rescanning the list.
+  void clusterShot(int index);
+
+  // Move every member of group `from`, which starts at `head`, into
+  // group `to`.
+  void mergeGroup(int head, int from, int to);
+
+  // In each burst and each run of similar shots, keep only the
+  // sharpest member, which then stands alone.  The others are marked
+  // discarded, which hides them until `restoreDiscardedShots`.  Members
+  // without a sharpness, as in lists saved before it was recorded, are
+  // scored on the pool first, and this then runs again.
+  void keepSharpestShots();
+
+  // Compute the sharpness of `shot` from its file on the pool, and
+  // report to `onSharpnessScored`.
+  void startScoringSharpness(Screenshot const &shot);
+
+  // Store the sharpness computed for shot `id`, unless `error` says
+  // there is none.  Once the last is in, finish `keepSharpestShots`.
+  void onSharpnessScored(std::uint64_t id, double sharpness,
+                         std::string const &error);
+
+  // The part of `keepSharpestShots` after scoring.  Members whose
+  // scoring failed count as least sharp.
+  void discardAllButSharpest();
+
+  // Show again every shot `keepSharpestShots` discarded.  They come
+  // back on their own rather than in their old groups.
+  void restoreDiscardedShots();
+
+  // ---------------------------- Similarity ---------------------------
+  // Add `shot`, which must have a perceptual hash, to
+  // `m_similarityIndex`.
+  void indexSimilarity(Screenshot const &shot);
+
+  // Queue `shot`, which lacks a perceptual hash, for
+  // `hashNextShotBatch`.
+  void queueShotToHash(Screenshot const &shot);
+
+  // Unless a batch is already being hashed, start hashing the next few
+  // of `m_shotsToHash` from their files on the pool.
+  void hashNextShotBatch();
+
+  // Store the perceptual hashes, by shot ID, computed for the last
+  // batch, `failed` of whose files could not be read, and start the
+  // next batch.
+  void onShotsHashed(
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> const &hashes,
+    int failed);
+
+  // Highlight the shots that look like the selected one, and select
+  // the most similar.
+  void findSimilarShots();
+
+  // Select the next highlighted shot after the one shown, wrapping
+  // around.
+  void selectNextSimilarShot();
+
+  // Select the shot with `id`, or, if it is in a collapsed group, the
+  // group, showing the shot in the large pane.
+  void selectShotById(std::uint64_t id);
+
+  // Arrange for `func` to run on the UI thread.  This can be called
+  // from any thread, and is how pool tasks deliver results.  If the
+  // window has been destroyed, `func` is discarded without running.
+  void runOnUIThread(std::function<void ()> func);
+
+  // Run, in order, the functions passed to `runOnUIThread` that have
+  // not run yet.  This is for when their results are needed right away,
+  // as before saving.  Call it on the UI thread.
+  void runPendingUIThreadFuncs();
 
   // Register/unregister our global hotkeys.
   void registerHotkeys();
   void unregisterHotkeys();
 
+  // Register `vk` as a hotkey, tracing, not failing, if that cannot be
+  // done.  `what` names its use for the trace.  These are for the keys
+  // other programs may want, such as the region and replay keys.
+  void registerOptionalHotkey(int vk, std::wstring const &what);
+
+  // Undo `registerOptionalHotkey`, whether or not it worked.
+  void unregisterOptionalHotkey(int vk);
+
   // If `r`, then register the hotkeys; otherwise, unregister them.
   // Does nothing if `r` equals `m_hotkeysRegistered`.
   void setHotkeysRegistered(bool r);
 
+  // Show or hide the statistics overlay, starting or stopping the timer
+  // that refreshes it.
+  void setShowStats(bool s);
+
+  // Handle the statistics timer: recompute the capture rate and redraw.
+  void onStatsTimer();
+
   // Select the item at `newIndex`.  If it is out of range, the index is
   // set to the appropriate endpoint, or -1 if there are no list
   // elements.  Then the window is redrawn if the selection has changed.
@@ -77,6 +574,19 @@ public:      // methods
   std::string saveToFile(std::string const &fname) const;
 
   // ---------------------------- Scrolling ----------------------------
+  // Space item `index` takes in `m_listLayout`.
+  int itemLayoutHeight(int index) const;
+
+  // Recompute the space item `index` takes, if it is in the list.
+  void updateItemLayout(int index);
+
+  // Recompute the space each member of the group headed by `head`
+  // takes, as when it is expanded or collapsed.
+  void updateGroupLayout(int head);
+
+  // Recompute the space every item takes.
+  void rebuildListLayout();
+
   // Return the number of pixels that the list would occupy if the
   // window were infinitely tall.
   int getListContentHeight() const;
@@ -118,16 +628,36 @@ public:      // methods
   // Draw the list of all shots on the right side.
   void drawShotList(DCX dcx) const;
 
+  // Draw the performance statistics in the top left of `dcx`.
+  void drawStatsOverlay(DCX dcx) const;
+
   // Handle `WM_PAINT`.
   void onPaint();
 
   // ------------------------- Keyboard input --------------------------
+  // A key the app itself handles.
+  struct AppKey {
+    // Virtual key code.
+    int m_vk;
+
+    // What it does.
+    void (*m_action)(SLMainWindow &w);
+  };
+
+  // The keys the app handles, whether pressed in the window or
+  // registered as hotkeys.  `onKeyPress` dispatches through this, and
+  // capture regions cannot be bound to any of them.
+  static AppKey const s_appKeys[];
+
   // Handle `WM_HOTKEY`.
   void onHotKey(WPARAM id, WPARAM fsModifiers, WPARAM vk);
 
   // Handle `WM_KEYDOWN`.  Return true if handled.
   bool onKeyPress(int vk);
 
+  // True if `vk` is in `s_appKeys`.
+  static bool isAppKey(int vk);
+
   // ------------------------------ Menu -------------------------------
   // Create the application menu bar and associate it with the window.
   void createAppMenu();
@@ -135,6 +665,7 @@ public:      // methods
   // Menu actions.
   void fileLoad();
   void fileSave();
+  void fileSaveTimeline();
 
   // Handle menu command `menuId`.
   void onCommand(int menuId);
@@ -143,6 +674,25 @@ public:      // methods
   // based on the current value of `m_hotkeysRegistered`.
   void setRegisterHotkeysMenuItemCheckbox();
 
+  // Same for `IDM_RECORD_TIMELINE` and `g_timelineEnabled`.
+  void setRecordTimelineMenuItemCheckbox();
+
+  // Same for `IDM_SHOW_STATS` and `m_showStats`.
+  void setShowStatsMenuItemCheckbox();
+
+  // Same for `IDM_INSTANT_REPLAY` and `m_replayEnabled`.
+  void setInstantReplayMenuItemCheckbox();
+
+  // Same for `IDM_AUTO_CAPTURE` and `m_autoCaptureEnabled`.
+  void setAutoCaptureMenuItemCheckbox();
+
+  // Check the Capture menu item matching `m_captureMonitor`, and
+  // uncheck the others.
+  void setCaptureMonitorMenuItemCheckboxes();
+
+  // Same for the Options menu item matching `m_bmpFormat`.
+  void setBmpFormatMenuItemCheckboxes();
+
   // ----------------------- Messages generally ------------------------
   // BaseWindow methods.
   virtual LRESULT handleMessage(
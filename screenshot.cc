@@ -3,23 +3,84 @@
 
 #include "screenshot.h"                // this module
 
+#include "band-writer.h"               // BandWriter
+#include "frame-source.h"              // FrameSource
 #include "json.hpp"                    // json::JSON
+#include "perceptual-hash.h"           // parsePerceptualHash, etc.
+#include "perf-counters.h"             // perfCounter, etc.
+#include "qoi-codec.h"                 // decodeQOI, encodeQOI
+#include "timeline.h"                  // TIMELINE_SPAN
 #include "trace.h"                     // TRACE2
 #include "winapi-util.h"               // CompatibleDC, etc.
 
+#include <algorithm>                   // std::{max, min}
 #include <cassert>                     // assert
 #include <cmath>                       // std::ceil
-#include <cwchar>                      // std::swprintf
-#include <string>                      // std::wstring
+#include <cstdint>                     // std::{int64_t, uint64_t}
+#include <cstdlib>                     // std::strtoull
+#include <cwchar>                      // std::{swprintf, wcslen}
+#include <functional>                  // std::function
+#include <set>                         // std::set
+#include <string>                      // std::{to_string, wstring}
 
 #include <windows.h>                   // GetLocalTime, etc.
 
 
+// File name extensions of the two storage formats.
+static wchar_t const c_rawExtension[] = L".bmp";
+static wchar_t const c_archivalExtension[] = L".qoi";
+
+// If not null, where captures come from instead of the screen.
+static std::unique_ptr<FrameSource> s_frameSource;
+
+// Rows per band when writing BMP files.  At 4K this is 1 MiB.
+static int const c_bmpBandRows = 64;
+
+
+// Function that puts `numRows` rows of an image, in BMP file order
+// starting `firstRow` rows from the bottom, into `dest`.
+using FillBandFunc =
+  std::function<void (int firstRow, int numRows, unsigned char *dest)>;
+
+static std::string writeBandedBMP(std::wstring const &fname,
+                                  int width, int height, BmpFormat fmt,
+                                  FillBandFunc const &fillBand);
+
+
+// Adjust the bitmap memory gauges for a `w` by `h` bitmap being
+// acquired (`sign` is 1) or released (-1).  Bitmaps compatible with the
+// screen are 32 bits per pixel on any display we care about.
+static void accountBitmap(int w, int h, int sign)
+{
+  static PerfGauge &bitmapCount = perfGauge("bitmaps.count");
+  static PerfGauge &bitmapBytes = perfGauge("bitmaps.bytes");
+
+  bitmapCount.add(sign);
+  bitmapBytes.add(sign * (std::int64_t)w * h * 4);
+}
+
+
 Screenshot::Screenshot()
   : m_bitmap(nullptr),
     m_width(0),
     m_height(0),
-    m_fname()
+    m_fname(),
+    m_tier(ST_UNSAVED),
+    m_archiveFailed(false),
+    m_shotId(0),
+    m_contentHash(),
+    m_perceptualHash(0),
+    m_hasPerceptualHash(false),
+    m_sharpness(0),
+    m_hasSharpness(false),
+    m_blank(BK_NONE),
+    m_thumbnail(),
+    m_captureTime(0),
+    m_groupId(0),
+    m_clustered(false),
+    m_monitor(0),
+    m_regionName(),
+    m_discarded(false)
 {}
 
 
@@ -34,23 +95,69 @@ void Screenshot::clear()
   if (m_bitmap) {
     CALL_BOOL_WINAPI(DeleteObject, m_bitmap);
     m_bitmap = nullptr;
+    accountBitmap(m_width, m_height, -1);
   }
   m_width = 0;
   m_height = 0;
   m_fname.clear();
+  m_tier = ST_UNSAVED;
+  m_archiveFailed = false;
+  m_shotId = 0;
+  m_contentHash = ContentHash();
+  m_perceptualHash = 0;
+  m_hasPerceptualHash = false;
+  m_sharpness = 0;
+  m_hasSharpness = false;
+  m_blank = BK_NONE;
+  m_thumbnail = PixelImage();
 }
 
 
 void Screenshot::captureScreen()
 {
+  RECT r = primaryScreenRect();
+  captureRegion(0, 0, r.right, r.bottom);
+}
+
+
+void Screenshot::captureRegion(int x, int y, int w, int h)
+{
+  TIMELINE_SPAN("captureScreen");
+  PERF_TIME_SCOPE("capture.ns");
+
+  static PerfCounter &captureCount = perfCounter("capture.count");
+  captureCount.inc();
+
+  grabRegion(x, y, w, h);
+  m_captureTime = localFileTimeNow();
+}
+
+
+void Screenshot::grabScreen()
+{
+  RECT r = primaryScreenRect();
+  grabRegion(0, 0, r.right, r.bottom);
+}
+
+
+void Screenshot::grabRegion(int x, int y, int w, int h)
+{
+  if (s_frameSource) {
+    PixelImage img;
+    s_frameSource->grabRegion(x, y, w, h, img);
+    setPixels(img);
+    return;
+  }
+
   clear();
 
   GET_AND_RELEASE_HDC(hdcScreen, NULL);
 
-  m_width = GetSystemMetrics(SM_CXSCREEN);
-  m_height = GetSystemMetrics(SM_CYSCREEN);
+  m_width = w;
+  m_height = h;
 
-  // Screenshot with result going to a memory DC.
+  // Screenshot with result going to a memory DC.  Only the rectangle
+  // is copied, so a small region costs proportionally less.
   BitmapDC memDC(hdcScreen, m_width, m_height);
   CALL_BOOL_WINAPI(BitBlt,
     memDC.getDC(),                     // hdcDest
@@ -58,40 +165,234 @@ void Screenshot::captureScreen()
     m_width,                           // wDest
     m_height,                          // hDest
     hdcScreen,                         // hdcSrc
-    0, 0,                              // xSrc, ySrc
+    x, y,                              // xSrc, ySrc
     SRCCOPY);                          // rop
 
   // Take ownership of the bitmap.
   m_bitmap = memDC.releaseBitmap();
+  accountBitmap(m_width, m_height, +1);
+}
 
-  // Chose an unused file name.
-  chooseFileName();
 
-  // Create any directories needed for the name.
-  createParentDirectoriesOf(m_fname);
+PixelImage Screenshot::getPixels() const
+{
+  TIMELINE_SPAN("GetDIBits");
+
+  assert(m_bitmap);
+  PixelImage img(m_width, m_height);
 
-  // Save the image to the chosen name.
-  writeToBMPFile();
+  BITMAPINFOHEADER bmiHeader{};
+  bmiHeader.biSize = sizeof(bmiHeader);
+  bmiHeader.biWidth = m_width;
+  bmiHeader.biHeight = -m_height;      // Negative means top-down.
+  bmiHeader.biPlanes = 1;
+  bmiHeader.biBitCount = 32;
+  bmiHeader.biCompression = BI_RGB;
+
+  // The GDI object was originally created using the screen as a
+  // source, so we need another screen DC to decode it.
+  GET_AND_RELEASE_HDC(hdcScreen, NULL);
+
+  // The documentation nonsensically says this function can "return"
+  // `ERROR_INVALID_PARAMETER`.  How?  It does not say it sets
+  // `GetLastError()`, and in my experience, if the function does not
+  // say it sets GLE then it does not.  And anyway there is evidently
+  // only one possible error code it can "return", which means it
+  // conveys no information.  So I treat this function as not being
+  // able to return any error information.
+  CALL_BOOL_WINAPI_NLE(GetDIBits,
+    hdcScreen,                         // hdc: DC with which the GDI object is compatible.
+    m_bitmap,                          // hbm: Input GDI object.
+    0,                                 // start: First scan (sic) line.
+    (UINT)m_height,                    // cLines: Number of lines.
+    img.m_pixels.data(),               // lpvBits: Array to write to.
+    (BITMAPINFO*)&bmiHeader,           // lpbmi: Desired output format.
+    DIB_RGB_COLORS);                   // usage: Whether to use a palette (here, no).
+
+  return img;
 }
 
 
-bool Screenshot::loadFromJSON(json::JSON const &obj)
+void Screenshot::setPixels(PixelImage const &img)
 {
-  std::wstring fname = toWideString(obj.ToString());
+  clear();
 
-  if (readFromBMPFile(fname)) {
-    m_fname = fname;
-    return true;
+  GET_AND_RELEASE_HDC(hdcScreen, NULL);
+  HBITMAP hbmp = createCompatibleBitmap(hdcScreen, img.m_width,
+                                        img.m_height);
+
+  BITMAPINFOHEADER bmiHeader{};
+  bmiHeader.biSize = sizeof(bmiHeader);
+  bmiHeader.biWidth = img.m_width;
+  bmiHeader.biHeight = -img.m_height;  // Negative means top-down.
+  bmiHeader.biPlanes = 1;
+  bmiHeader.biBitCount = 32;
+  bmiHeader.biCompression = BI_RGB;
+
+  // Like `GetDIBits`, this does not set `GetLastError()`.
+  CALL_BOOL_WINAPI_NLE(SetDIBits,
+    hdcScreen,                         // hdc
+    hbmp,                              // hbm
+    0,                                 // start
+    (UINT)img.m_height,                // cLines
+    img.m_pixels.data(),               // lpBits
+    (BITMAPINFO*)&bmiHeader,           // lpbmi
+    DIB_RGB_COLORS);                   // ColorUse
+
+  m_bitmap = hbmp;
+  m_width = img.m_width;
+  m_height = img.m_height;
+  accountBitmap(m_width, m_height, +1);
+}
+
+
+std::wstring Screenshot::storageDescription() const
+{
+  switch (m_tier) {
+    default:
+      assert(!"invalid tier");
+      // fallthrough
+    case ST_UNSAVED:   return L"not saved";
+    case ST_WRITING:   return L"writing";
+    case ST_RAW:       return L"raw BMP";
+    case ST_ARCHIVING: return L"raw BMP, archiving";
+    case ST_ARCHIVED:  return L"archived QOI";
   }
-  else {
+}
+
+
+std::wstring Screenshot::timestampString() const
+{
+  if (!m_captureTime) {
+    return std::wstring();
+  }
+
+  SYSTEMTIME st = fileTimeToSystemTime(m_captureTime);
+
+  wchar_t buf[40];
+  swprintf(buf, TABLESIZE(buf),
+    L"%04d-%02d-%02d %02d:%02d:%02d.%03d",
+    (int)st.wYear,
+    (int)st.wMonth,
+    (int)st.wDay,
+    (int)st.wHour,
+    (int)st.wMinute,
+    (int)st.wSecond,
+    (int)st.wMilliseconds);
+  return buf;
+}
+
+
+bool Screenshot::loadFromJSON(json::JSON const &obj)
+{
+  if (obj.JSONType() == json::JSON::Class::String) {
+    return readFromFile(toWideString(obj.ToString()));
+  }
+
+  if (!obj.hasKey("fname") ||
+      !readFromFile(toWideString(obj.at("fname").ToString()))) {
     return false;
   }
+
+  // JSON integers here are only 32 bits on Windows, so the time is
+  // stored as a string.
+  if (obj.hasKey("captureTime")) {
+    m_captureTime = std::strtoull(
+      obj.at("captureTime").ToString().c_str(), nullptr, 10);
+  }
+
+  // Groups were once only bursts.
+  if (obj.hasKey("groupId")) {
+    m_groupId = obj.at("groupId").ToInt();
+  }
+  else if (obj.hasKey("burstId")) {
+    m_groupId = obj.at("burstId").ToInt();
+  }
+
+  if (obj.hasKey("clustered")) {
+    m_clustered = obj.at("clustered").ToBool();
+  }
+
+  if (obj.hasKey("monitor")) {
+    m_monitor = obj.at("monitor").ToInt();
+  }
+
+  if (obj.hasKey("region")) {
+    m_regionName = toWideString(obj.at("region").ToString());
+  }
+
+  // Also too wide for a JSON integer.
+  if (obj.hasKey("contentHash")) {
+    std::string hex = obj.at("contentHash").ToString();
+    if (!ContentHash::fromHex(hex, m_contentHash)) {
+      TRACE1(L"ignoring malformed contentHash: " << toWideString(hex));
+    }
+  }
+
+  if (obj.hasKey("perceptualHash")) {
+    std::string hex = obj.at("perceptualHash").ToString();
+    m_hasPerceptualHash = parsePerceptualHash(hex, m_perceptualHash);
+    if (!m_hasPerceptualHash) {
+      TRACE1(L"ignoring malformed perceptualHash: " << toWideString(hex));
+    }
+  }
+
+  if (obj.hasKey("sharpness")) {
+    bool ok;
+    m_sharpness = obj.at("sharpness").ToFloat(ok);
+    m_hasSharpness = ok;
+  }
+
+  if (obj.hasKey("blank")) {
+    std::string kind = obj.at("blank").ToString();
+    if (!parseBlankKind(kind, m_blank)) {
+      TRACE1(L"ignoring unrecognized blank: " << toWideString(kind));
+    }
+  }
+
+  if (obj.hasKey("discarded")) {
+    m_discarded = obj.at("discarded").ToBool();
+  }
+
+  return true;
 }
 
 
 json::JSON Screenshot::saveToJSON() const
 {
-  return json::JSON(toNarrowString(m_fname));
+  json::JSON obj = json::Object();
+  obj["fname"] = json::JSON(toNarrowString(m_fname));
+  if (m_captureTime) {
+    obj["captureTime"] = json::JSON(std::to_string(m_captureTime));
+  }
+  if (m_groupId) {
+    obj["groupId"] = json::JSON(m_groupId);
+  }
+  if (m_clustered) {
+    obj["clustered"] = json::JSON(true);
+  }
+  if (m_monitor) {
+    obj["monitor"] = json::JSON(m_monitor);
+  }
+  if (!m_regionName.empty()) {
+    obj["region"] = json::JSON(toNarrowString(m_regionName));
+  }
+  if (!m_contentHash.empty()) {
+    obj["contentHash"] = json::JSON(m_contentHash.toHex());
+  }
+  if (m_hasPerceptualHash) {
+    obj["perceptualHash"] = json::JSON(perceptualHashToHex(m_perceptualHash));
+  }
+  if (m_hasSharpness) {
+    obj["sharpness"] = json::JSON(m_sharpness);
+  }
+  if (m_blank != BK_NONE) {
+    obj["blank"] = json::JSON(std::string(toString(m_blank)));
+  }
+  if (m_discarded) {
+    obj["discarded"] = json::JSON(true);
+  }
+  return obj;
 }
 
 
@@ -109,16 +410,6 @@ void Screenshot::drawToDC(HDC hdc, int x, int y, int w, int h) const
     return;
   }
 
-  CompatibleHDC memDC(hdc);
-
-  // Select the screenshot into the memory DC so the bitmap will act
-  // as its data source.
-  SELECT_RESTORE_OBJECT(memDC.m_hdc, m_bitmap);
-
-  // Change the awful default B+W stretching mode to something that
-  // works properly with color images.
-  SetStretchBltMode(hdc, HALFTONE);
-
   // Aspect ratio of the source image.
   float srcAR = (float)m_width / (float)m_height;
 
@@ -127,7 +418,8 @@ void Screenshot::drawToDC(HDC hdc, int x, int y, int w, int h) const
 
   if (srcAR < destAR) {
     // Source is narrower, so draw bars on left and right.
-    int properWidth = (int)(h * srcAR);
+    // At least one pixel, since a small region can be very narrow.
+    int properWidth = std::max(1, (int)(h * srcAR));
     int excess = w - properWidth;
     int leftBarW = excess / 2;
     int rightBarW = excess - leftBarW;
@@ -139,15 +431,12 @@ void Screenshot::drawToDC(HDC hdc, int x, int y, int w, int h) const
     fillRectBG(hdc, x+leftBarW+properWidth, y, rightBarW, h);
 
     // Image.
-    CALL_BOOL_WINAPI(StretchBlt,
-      hdc, x+leftBarW, y, properWidth, h,        // dest, x, y, w, h
-      memDC.m_hdc, 0, 0, m_width, m_height,      // src, x, y, w, h
-      SRCCOPY);                                  // rop
+    stretchImage(hdc, x+leftBarW, y, properWidth, h);
   }
 
   else if (srcAR > destAR) {
     // Source is wider, so draw bars on top and bottom.
-    int properHeight = (int)(w / srcAR);
+    int properHeight = std::max(1, (int)(w / srcAR));
     int excess = h - properHeight;
     int topBarH = excess / 2;
     int bottomBarH = excess - topBarH;
@@ -159,19 +448,56 @@ void Screenshot::drawToDC(HDC hdc, int x, int y, int w, int h) const
     fillRectBG(hdc, x, y+topBarH+properHeight, w, bottomBarH);
 
     // Image.
-    CALL_BOOL_WINAPI(StretchBlt,
-      hdc, x, y+topBarH, w, properHeight,        // dest, x, y, w, h
-      memDC.m_hdc, 0, 0, m_width, m_height,      // src, x, y, w, h
-      SRCCOPY);                                  // rop
+    stretchImage(hdc, x, y+topBarH, w, properHeight);
   }
 
   else {
     // Matching aspect ratios, no need for bars.
-    CALL_BOOL_WINAPI(StretchBlt,
+    stretchImage(hdc, x, y, w, h);
+  }
+}
+
+
+void Screenshot::stretchImage(HDC hdc, int x, int y, int w, int h) const
+{
+  // Change the awful default B+W stretching mode to something that
+  // works properly with color images.
+  SetStretchBltMode(hdc, HALFTONE);
+
+  if (!m_thumbnail.empty() && w <= m_thumbnail.m_width) {
+    // Shrinking the thumbnail is much cheaper than shrinking the full
+    // image, and looks the same.
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = m_thumbnail.m_width;
+    bmi.bmiHeader.biHeight = -m_thumbnail.m_height;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    // This returns the number of lines drawn, or 0 on failure, without
+    // setting `GetLastError()`.
+    CALL_BOOL_WINAPI_NLE(StretchDIBits,
       hdc, x, y, w, h,                           // dest, x, y, w, h
-      memDC.m_hdc, 0, 0, m_width, m_height,      // src, x, y, w, h
+      0, 0,                                      // src x, y
+      m_thumbnail.m_width,                       // src w
+      m_thumbnail.m_height,                      // src h
+      m_thumbnail.m_pixels.data(),               // bits
+      &bmi, DIB_RGB_COLORS,                      // format
       SRCCOPY);                                  // rop
+    return;
   }
+
+  CompatibleHDC memDC(hdc);
+
+  // Select the screenshot into the memory DC so the bitmap will act
+  // as its data source.
+  SELECT_RESTORE_OBJECT(memDC.m_hdc, m_bitmap);
+
+  CALL_BOOL_WINAPI(StretchBlt,
+    hdc, x, y, w, h,                             // dest, x, y, w, h
+    memDC.m_hdc, 0, 0, m_width, m_height,        // src, x, y, w, h
+    SRCCOPY);                                    // rop
 }
 
 
@@ -202,10 +528,259 @@ int Screenshot::heightForWidth(int w) const
 
 void Screenshot::chooseFileName()
 {
-  // Choose the name based on the current time.
+  // Choose the name based on the capture time.
+  std::uint64_t t = m_captureTime? m_captureTime : localFileTimeNow();
+  m_fname = chooseShotFileName(fileTimeToSystemTime(t), c_rawExtension);
+
+  // Create any directories needed for the name.
+  createParentDirectoriesOf(m_fname);
+}
+
+
+
+void Screenshot::writeToBMPFile(BmpFormat fmt) const
+{
+  TIMELINE_SPAN("writeToBMPFile");
+
+  assert(m_bitmap);
+  GET_AND_RELEASE_HDC(hdcScreen, NULL);
+
+  // A positive height asks for bottom-up rows, as in the file, and
+  // makes `start` count from the bottom.
+  BITMAPINFOHEADER bmiHeader{};
+  bmiHeader.biSize = sizeof(bmiHeader);
+  bmiHeader.biWidth = m_width;
+  bmiHeader.biHeight = m_height;
+  bmiHeader.biPlanes = 1;
+  bmiHeader.biBitCount = 32;
+  bmiHeader.biCompression = BI_RGB;
+
+  // For the smaller formats, the rows are read as 32 bpp into this and
+  // packed from there.  GDI could produce 24 bpp itself, but not 5-6-5
+  // with dithering, and its conversion is not vectorized.
+  std::vector<std::uint32_t> band;
+  if (fmt != BF_32) {
+    band.resize((std::size_t)m_width * c_bmpBandRows);
+  }
+
+  std::string error = writeBandedBMP(m_fname, m_width, m_height, fmt,
+    [&](int firstRow, int numRows, unsigned char *dest) {
+      void *bits = fmt == BF_32? (void*)dest : (void*)band.data();
+
+      // As in `getPixels`, there is no error information.
+      CALL_BOOL_WINAPI_NLE(GetDIBits,
+        hdcScreen,                     // hdc
+        m_bitmap,                      // hbm
+        (UINT)firstRow,                // start
+        (UINT)numRows,                 // cLines
+        bits,                          // lpvBits
+        (BITMAPINFO*)&bmiHeader,       // lpbmi
+        DIB_RGB_COLORS);               // usage
+
+      if (fmt != BF_32) {
+        std::size_t rowBytes = bmpRowBytes(m_width, fmt);
+        for (int i = 0; i < numRows; ++i) {
+          encodeBMPRow(band.data() + (std::size_t)i * m_width, m_width,
+                       m_height - 1 - firstRow - i,
+                       dest + i * rowBytes, fmt);
+        }
+      }
+    });
+  if (!error.empty()) {
+    die(toWideString(error).c_str());
+  }
+}
+
+
+bool Screenshot::readFromBMPFile(std::wstring const &fname)
+{
+  TIMELINE_SPAN("readFromBMPFile");
+  PERF_TIME_SCOPE("io.readBMP.ns");
+
+  HBITMAP hbmp = (HBITMAP)LoadImageW(
+    NULL,                    // hInst
+    fname.c_str(),           // name
+    IMAGE_BITMAP,            // type
+    0, 0,                    // cx, cy (take size from file)
+    LR_DEFAULTCOLOR | LR_LOADFROMFILE);
+  if (!hbmp) {
+    // No reason is provided.
+    TRACE1(L"LoadImageW of " << fname << " failed");
+    return false;
+  }
+
+  // Get image dimensions.
+  BITMAP bmp{};
+  CALL_BOOL_WINAPI_NLE(GetObject, hbmp, sizeof(bmp), &bmp);
+
+  // Discard any existing bitmap.
+  clear();
+
+  // Acquire the new details.
+  m_bitmap = hbmp;
+  m_width = bmp.bmWidth;
+  m_height = bmp.bmHeight;
+  m_fname = fname;
+  accountBitmap(m_width, m_height, +1);
+
+  return true;
+}
+
+
+bool Screenshot::readFromFile(std::wstring const &fname)
+{
+  if (!isArchivalFileName(fname)) {
+    if (!readFromBMPFile(fname)) {
+      return false;
+    }
+    m_tier = ST_RAW;
+    return true;
+  }
+
+  TIMELINE_SPAN("readFromQOIFile");
+  PERF_TIME_SCOPE("io.readQOI.ns");
+
+  std::vector<unsigned char> bytes;
+  std::string error = readImageFile(fname, bytes);
+  if (!error.empty()) {
+    TRACE1(L"reading " << fname << L": " << toWideString(error));
+    return false;
+  }
+
+  PixelImage img;
+  if (!decodeQOI(bytes, img)) {
+    TRACE1(L"reading " << fname << L": malformed QOI data");
+    return false;
+  }
+
+  setPixels(img);
+  m_fname = fname;
+  m_tier = ST_ARCHIVED;
+  return true;
+}
+
+
+bool isArchivalFileName(std::wstring const &fname)
+{
+  std::size_t extLen = std::wcslen(c_archivalExtension);
+  return fname.size() >= extLen &&
+         fname.compare(fname.size() - extLen, extLen,
+                       c_archivalExtension) == 0;
+}
+
+
+std::wstring archivalFileName(std::wstring const &fname)
+{
+  std::size_t dot = fname.find_last_of(L'.');
+  std::size_t slash = fname.find_last_of(L"/\\");
+  if (dot == std::wstring::npos ||
+      (slash != std::wstring::npos && dot < slash)) {
+    return fname + c_archivalExtension;
+  }
+  return fname.substr(0, dot) + c_archivalExtension;
+}
+
+
+std::uint64_t localFileTimeNow()
+{
   SYSTEMTIME st;
   GetLocalTime(&st);
 
+  FILETIME ft;
+  SystemTimeToFileTime(&st, &ft);
+  return ((std::uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+
+SYSTEMTIME fileTimeToSystemTime(std::uint64_t fileTime)
+{
+  FILETIME ft;
+  ft.dwLowDateTime = (DWORD)fileTime;
+  ft.dwHighDateTime = (DWORD)(fileTime >> 32);
+
+  SYSTEMTIME st = {};
+  FileTimeToSystemTime(&ft, &st);
+  return st;
+}
+
+
+// `EnumDisplayMonitors` callback appending to a `std::vector<RECT>`.
+static BOOL CALLBACK addMonitorRect(HMONITOR hMonitor, HDC, LPRECT,
+                                    LPARAM lParam)
+{
+  auto &rects = *reinterpret_cast<std::vector<RECT>*>(lParam);
+
+  MONITORINFO info = {};
+  info.cbSize = sizeof(info);
+  if (!GetMonitorInfo(hMonitor, &info)) {
+    TRACE1(L"GetMonitorInfo: " << getLastErrorMessage());
+    return TRUE;
+  }
+
+  if (info.dwFlags & MONITORINFOF_PRIMARY) {
+    rects.insert(rects.begin(), info.rcMonitor);
+  }
+  else {
+    rects.push_back(info.rcMonitor);
+  }
+  return TRUE;
+}
+
+
+void setFrameSource(std::unique_ptr<FrameSource> source)
+{
+  s_frameSource = std::move(source);
+}
+
+
+RECT primaryScreenRect()
+{
+  if (s_frameSource) {
+    return RECT{0, 0, s_frameSource->width(), s_frameSource->height()};
+  }
+  return RECT{0, 0, GetSystemMetrics(SM_CXSCREEN),
+              GetSystemMetrics(SM_CYSCREEN)};
+}
+
+
+std::vector<RECT> getMonitorRects()
+{
+  std::vector<RECT> rects;
+  if (s_frameSource) {
+    rects.push_back(primaryScreenRect());
+  }
+  else if (!EnumDisplayMonitors(nullptr, nullptr, addMonitorRect,
+                                reinterpret_cast<LPARAM>(&rects)) ||
+           rects.empty()) {
+    TRACE1(L"EnumDisplayMonitors failed; using the primary screen");
+    rects.assign(1, primaryScreenRect());
+  }
+  return rects;
+}
+
+
+RECT virtualScreenRect()
+{
+  std::vector<RECT> monitors = getMonitorRects();
+  RECT ret = monitors.front();
+  for (RECT const &r : monitors) {
+    ret.left = std::min(ret.left, r.left);
+    ret.top = std::min(ret.top, r.top);
+    ret.right = std::max(ret.right, r.right);
+    ret.bottom = std::max(ret.bottom, r.bottom);
+  }
+  return ret;
+}
+
+
+std::wstring chooseShotFileName(SYSTEMTIME const &st,
+                                wchar_t const *extension)
+{
+  // Stems chosen earlier.  Files are written in the background, so a
+  // name can be taken before its file exists.  Stems rather than whole
+  // names, since a shot can end up in either format.
+  static std::set<std::wstring> s_chosenStems;
+
   // Disambiguation loop.
   for (int suffixNumber = 1; suffixNumber < 100; ++suffixNumber) {
     // Normally there is no suffix.
@@ -220,7 +795,7 @@ void Screenshot::chooseFileName()
     wchar_t buf[80];
 
     swprintf(buf, TABLESIZE(buf),
-      L"shots/%04d-%02d-%02dT%02d-%02d-%02d%ls.bmp",
+      L"shots/%04d-%02d-%02dT%02d-%02d-%02d%ls",
       (int)st.wYear,
       (int)st.wMonth,
       (int)st.wDay,
@@ -228,135 +803,262 @@ void Screenshot::chooseFileName()
       (int)st.wMinute,
       (int)st.wSecond,
       suffix);
-    TRACE2(L"buf: " << buf);
+    TRACE2(L"stem: " << buf);
 
-    if (!pathExists(buf)) {
-      m_fname = std::wstring(buf);
-      return;
+    std::wstring stem(buf);
+    if (!pathExists(stem + c_rawExtension) &&
+        !pathExists(stem + c_archivalExtension) &&
+        s_chosenStems.insert(stem).second) {
+      return stem + extension;
     }
   }
 
-  die(L"Screenshot::chooseFileName: failed to pick a unique file name");
+  die(L"chooseShotFileName: failed to pick a unique file name");
+  return std::wstring();
 }
 
 
-
-// Based in part on
-// https://learn.microsoft.com/en-us/windows/win32/gdi/capturing-an-image
-void Screenshot::writeToBMPFile() const
+std::string writeImageFile(std::wstring const &fname,
+                           std::vector<unsigned char> const &bytes)
 {
-  assert(m_bitmap);
+  TIMELINE_SPAN("writeFile");
+  PERF_TIME_SCOPE("io.writeBMP.ns");
 
-  // Get image dimensions, etc.
-  BITMAP bmp{};
-  CALL_BOOL_WINAPI_NLE(GetObject, m_bitmap, sizeof(bmp), &bmp);
+  HANDLE hFile = CreateFileW(
+    fname.c_str(),                     // lpFileName
+    GENERIC_WRITE,                     // dwDesiredAccess
+    0,                                 // dwShareMode
+    NULL,                              // lpSecurityAttributes
+    CREATE_ALWAYS,                     // dwCreationDisposition
+    FILE_ATTRIBUTE_NORMAL,             // dwFlagsAndAttributes
+    NULL);                             // hTemplateFile
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return "CreateFileW: " + toNarrowString(getLastErrorMessage());
+  }
+  HandleCloser hFile_closer(hFile);
 
-  // Prepare the second part of the header.
-  BITMAPINFOHEADER bmiHeader{};
-  bmiHeader.biSize = sizeof(bmiHeader);
-  bmiHeader.biWidth = bmp.bmWidth;
-  bmiHeader.biHeight = bmp.bmHeight;
-  bmiHeader.biPlanes = 1;
-  bmiHeader.biBitCount = 32;
-  bmiHeader.biCompression = BI_RGB;
-  bmiHeader.biSizeImage = 0;
-  bmiHeader.biXPelsPerMeter = 0;
-  bmiHeader.biYPelsPerMeter = 0;
-  bmiHeader.biClrUsed = 0;
-  bmiHeader.biClrImportant = 0;
+  DWORD written = 0;
+  if (!WriteFile(hFile, bytes.data(), (DWORD)bytes.size(), &written,
+                 NULL) ||
+      written != bytes.size()) {
+    return "WriteFile: " + toNarrowString(getLastErrorMessage());
+  }
+
+  hFile_closer.close();
 
-  // Total size in bytes of the pixel data.
-  std::size_t pixelDataSizeBytes =
-    ((bmp.bmWidth * bmiHeader.biBitCount + 31) / 32) * 4 * bmp.bmHeight;
+  static PerfCounter &bytesWritten = perfCounter("io.bytesWritten");
+  bytesWritten.add(bytes.size());
 
-  // Allocate memory to store it.
-  std::vector<char> pixelData(pixelDataSizeBytes, 0);
+  return "";
+}
 
-  // Extract the image data from the GDI object.
-  {
-    // The GDI object was originally created using the screen as a
-    // source, so we need another screen DC to decode it.
-    GET_AND_RELEASE_HDC(hdcScreen, NULL);
-
-    // The documentation nonsensically says this function can "return"
-    // `ERROR_INVALID_PARAMETER`.  How?  It does not say it sets
-    // `GetLastError()`, and in my experience, if the function does not
-    // say it sets GLE then it does not.  And anyway there is evidently
-    // only one possible error code it can "return", which means it
-    // conveys no information.  So I treat this function as not being
-    // able to return any error information.
-    CALL_BOOL_WINAPI_NLE(GetDIBits,
-      hdcScreen,                       // hdc: DC with which the GDI object is compatible.
-      m_bitmap,                        // hbm: Input GDI object.
-      0,                               // start: First scan (sic) line.
-      (UINT)bmp.bmHeight,              // cLines: Number of lines.
-      pixelData.data(),                // lpvBits: Array to write to.
-      (BITMAPINFO*)&bmiHeader,         // lpbmi: Desired output format.
-      DIB_RGB_COLORS);                 // usage: Whether to use a palette (here, no).
-  }
-
-  // Prepare the first part of the header.
-  BITMAPFILEHEADER bmfHeader{};
-  bmfHeader.bfType = 0x4D42;           // "BM", in little-endian.
-  bmfHeader.bfSize =                   // Total file size in bytes.
-    sizeof(bmfHeader) +                  // header 1
-    sizeof(bmiHeader) +                  // header 2
-    pixelDataSizeBytes;                  // pixel data
-  bmfHeader.bfReserved1 = 0;
-  bmfHeader.bfReserved2 = 0;
-  bmfHeader.bfOffBits =                // Offset to pixel data.
-    sizeof(bmfHeader) +                  // header 1
-    sizeof(bmiHeader);                   // header 2
-
-  // Create the file.
-  HANDLE hFile;
-  CALL_HANDLE_WINAPI(hFile, CreateFileW,
-    m_fname.c_str(),                   // lpFileName
+
+// Write a `width` by `height` BMP file in `fmt` to `fname`, getting
+// its rows a band at a time from `fillBand`.  Each band is written by a
+// `BandWriter` thread while `fillBand` produces the next.
+static std::string writeBandedBMP(std::wstring const &fname,
+                                  int width, int height, BmpFormat fmt,
+                                  FillBandFunc const &fillBand)
+{
+  TIMELINE_SPAN("writeFile");
+  PERF_TIME_SCOPE("io.writeBMP.ns");
+
+  HANDLE hFile = CreateFileW(
+    fname.c_str(),                     // lpFileName
     GENERIC_WRITE,                     // dwDesiredAccess
     0,                                 // dwShareMode
     NULL,                              // lpSecurityAttributes
     CREATE_ALWAYS,                     // dwCreationDisposition
     FILE_ATTRIBUTE_NORMAL,             // dwFlagsAndAttributes
     NULL);                             // hTemplateFile
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return "CreateFileW: " + toNarrowString(getLastErrorMessage());
+  }
   HandleCloser hFile_closer(hFile);
 
-  // Write the image data.
-  writeFile(hFile, &bmfHeader, sizeof(bmfHeader));
-  writeFile(hFile, &bmiHeader, sizeof(bmiHeader));
-  writeFile(hFile, pixelData.data(), pixelData.size());
+  std::uint64_t offset = 0;
+  std::string error;
+  {
+    BandWriter writer([hFile](std::vector<unsigned char> const &buffer) {
+      DWORD written = 0;
+      if (!WriteFile(hFile, buffer.data(), (DWORD)buffer.size(), &written,
+                     NULL) ||
+          written != buffer.size()) {
+        return "WriteFile: " + toNarrowString(getLastErrorMessage());
+      }
+      return std::string();
+    });
+
+    // The header goes at the start of the first band.
+    std::vector<unsigned char> buffer = encodeBMPHeader(width, height, fmt);
+    std::size_t rowBytes = bmpRowBytes(width, fmt);
+    for (int row = 0; row == 0 || row < height; ) {
+      int numRows = std::min(c_bmpBandRows, height - row);
+      std::size_t at = row == 0? buffer.size() : 0;
+      buffer.resize(at + numRows * rowBytes);
+      fillBand(row, numRows, buffer.data() + at);
+
+      offset += buffer.size();
+      if (!writer.write(buffer)) {
+        break;
+      }
+      row += numRows;
+    }
+
+    error = writer.finish();
+  }
+  if (!error.empty()) {
+    return error;
+  }
 
   hFile_closer.close();
+
+  static PerfCounter &bytesWritten = perfCounter("io.bytesWritten");
+  bytesWritten.add(offset);
+
+  return "";
 }
 
 
-bool Screenshot::readFromBMPFile(std::wstring const &fname)
+std::string writeBMPFileBanded(std::wstring const &fname,
+                               PixelImage const &img, BmpFormat fmt)
 {
-  HBITMAP hbmp = (HBITMAP)LoadImageW(
-    NULL,                    // hInst
-    fname.c_str(),           // name
-    IMAGE_BITMAP,            // type
-    0, 0,                    // cx, cy (take size from file)
-    LR_DEFAULTCOLOR | LR_LOADFROMFILE);
-  if (!hbmp) {
-    // No reason is provided.
-    TRACE1(L"LoadImageW of " << fname << " failed");
+  return writeBandedBMP(fname, img.m_width, img.m_height, fmt,
+    [&img, fmt](int firstRow, int numRows, unsigned char *dest) {
+      encodeBMPRows(img, firstRow, numRows, dest, fmt);
+    });
+}
+
+
+std::string readImageFile(std::wstring const &fname,
+                          std::vector<unsigned char> &bytes /*OUT*/)
+{
+  TIMELINE_SPAN("readFile");
+
+  HANDLE hFile = CreateFileW(
+    fname.c_str(),                     // lpFileName
+    GENERIC_READ,                      // dwDesiredAccess
+    FILE_SHARE_READ,                   // dwShareMode
+    NULL,                              // lpSecurityAttributes
+    OPEN_EXISTING,                     // dwCreationDisposition
+    FILE_ATTRIBUTE_NORMAL,             // dwFlagsAndAttributes
+    NULL);                             // hTemplateFile
+  if (hFile == INVALID_HANDLE_VALUE) {
+    return "CreateFileW: " + toNarrowString(getLastErrorMessage());
+  }
+  HandleCloser hFile_closer(hFile);
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(hFile, &size)) {
+    return "GetFileSizeEx: " + toNarrowString(getLastErrorMessage());
+  }
+  if (size.QuadPart > 0x7FFFFFFF) {
+    return "file is too large";
+  }
+
+  bytes.resize((std::size_t)size.QuadPart);
+  DWORD numRead = 0;
+  if (!ReadFile(hFile, bytes.data(), (DWORD)bytes.size(), &numRead,
+                NULL) ||
+      numRead != bytes.size()) {
+    return "ReadFile: " + toNarrowString(getLastErrorMessage());
+  }
+
+  return "";
+}
+
+
+std::string readImagePixels(std::wstring const &fname,
+                            PixelImage &img /*OUT*/)
+{
+  std::vector<unsigned char> bytes;
+  std::string error = readImageFile(fname, bytes);
+  if (!error.empty()) {
+    return error;
+  }
+
+  bool ok = isArchivalFileName(fname)?
+    decodeQOI(bytes, img) : decodeBMP(bytes, img);
+  if (!ok) {
+    return "cannot decode the file";
+  }
+  return "";
+}
+
+
+bool imageFileHolds(std::wstring const &fname, PixelImage const &img)
+{
+  TIMELINE_SPAN("imageFileHolds");
+
+  PixelImage stored;
+  std::string error = readImagePixels(fname, stored);
+  if (!error.empty()) {
+    TRACE2(L"reading " << fname << L": " << toWideString(error));
     return false;
   }
 
-  // Get image dimensions.
-  BITMAP bmp{};
-  CALL_BOOL_WINAPI_NLE(GetObject, hbmp, sizeof(bmp), &bmp);
+  if (stored.m_width != img.m_width || stored.m_height != img.m_height) {
+    return false;
+  }
+  if (stored.m_pixels == img.m_pixels) {
+    return true;
+  }
 
-  // Discard any existing bitmap.
-  clear();
+  // A 16 bpp file, or its archived copy, keeps less than the capture
+  // did, so compare what `img` becomes in each 16 bpp format.
+  for (BmpFormat fmt : { BF_16, BF_16_DITHERED }) {
+    PixelImage reduced;
+    if (decodeBMP(encodeBMP(img, fmt), reduced) &&
+        reduced.m_pixels == stored.m_pixels) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  // Acquire the new details.
-  m_bitmap = hbmp;
-  m_width = bmp.bmWidth;
-  m_height = bmp.bmHeight;
-  m_fname = fname;
 
-  return true;
+std::string archiveImageFile(std::wstring const &rawName,
+                             std::wstring const &archName)
+{
+  TIMELINE_SPAN("archiveImageFile");
+
+  std::vector<unsigned char> raw;
+  std::string error = readImageFile(rawName, raw);
+  if (!error.empty()) {
+    return error;
+  }
+
+  PixelImage img;
+  if (!decodeBMP(raw, img)) {
+    return "unsupported BMP format";
+  }
+
+  std::vector<unsigned char> encoded;
+  {
+    PERF_TIME_SCOPE("archive.encode.ns");
+    encoded = encodeQOI(img);
+  }
+
+  std::wstring tmpName = archName + L".tmp";
+  error = writeImageFile(tmpName, encoded);
+  if (!error.empty()) {
+    DeleteFileW(tmpName.c_str());
+    return error;
+  }
+
+  if (!MoveFileExW(tmpName.c_str(), archName.c_str(),
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+    error = "MoveFileExW: " + toNarrowString(getLastErrorMessage());
+    DeleteFileW(tmpName.c_str());
+    return error;
+  }
+
+  static PerfCounter &bytesSaved = perfCounter("archive.bytesSaved");
+  if (raw.size() > encoded.size()) {
+    bytesSaved.add(raw.size() - encoded.size());
+  }
+
+  return "";
 }
 
 
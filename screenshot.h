@@ -4,19 +4,47 @@
 #ifndef SCREENSHOT_H
 #define SCREENSHOT_H
 
+#include "blank-frame.h"               // BlankKind
 #include "dcx.h"                       // DCX
 #include "json-fwd.h"                  // json::JSON
+#include "pixel-image.h"               // ContentHash, PixelImage
 #include "winapi-util.h"               // NO_OBJECT_COPIES
 
-#include <string>                      // std::wstring
+#include <cstdint>                     // std::uint64_t
+#include <memory>                      // std::unique_ptr
+#include <string>                      // std::{string, wstring}
+#include <vector>                      // std::vector
 
-#include <windows.h>                   // HBITMAP
+#include <windows.h>                   // HBITMAP, SYSTEMTIME
 
 
+class FrameSource;                     // frame-source.h
+
 // A single in-game screenshot, and some miscellaneous related data.
 class Screenshot {
   NO_OBJECT_COPIES(Screenshot);
 
+public:      // types
+  // Where the image file is in its life cycle.  Captures are first
+  // written raw (BMP), which is fast, and later recompressed in the
+  // background into the archival format (QOI).
+  enum StorageTier {
+    // No file, because it has not been captured or could not be saved.
+    ST_UNSAVED,
+
+    // The capture pipeline is writing the raw file.
+    ST_WRITING,
+
+    // `m_fname` is a raw file.
+    ST_RAW,
+
+    // `m_fname` is a raw file, and the archival copy is being made.
+    ST_ARCHIVING,
+
+    // `m_fname` is an archival file.
+    ST_ARCHIVED,
+  };
+
 public:      // data
   // The screenshot bitmap, as a GDI object compatible with the DC
   // obtained from `GetDC(null)` (representing the screen).
@@ -29,9 +57,71 @@ public:      // data
   // Name of the file to which the image has been saved.  The name
   // format is "YYYY-MM-DDThh-mm-ssU.bmp" format, where 'T' is literal,
   // and 'U' is a suffix string appended to make the name unique when
-  // needed.
+  // needed.  Once archived, the extension is ".qoi" instead.
   std::wstring m_fname;
 
+  StorageTier m_tier;
+
+  // If true, recompressing this shot failed, so it stays raw for the
+  // rest of the session.
+  bool m_archiveFailed;
+
+  // Nonzero once the shot is in a list, identifying it to background
+  // work that reports back later.
+  std::uint64_t m_shotId;
+
+  // Hash of the pixels, or empty if it has not been computed.  Shots
+  // with the same hash share a file; see `ContentIndex`.
+  ContentHash m_contentHash;
+
+  // Perceptual hash of the image, if `m_hasPerceptualHash`.  See
+  // `perceptualHash`.
+  std::uint64_t m_perceptualHash;
+  bool m_hasPerceptualHash;
+
+  // Sharpness of the image, if `m_hasSharpness`.  See
+  // `imageSharpness`.
+  double m_sharpness;
+  bool m_hasSharpness;
+
+  // If not `BK_NONE`, the capture was found to be a black or loading
+  // screen, and is marked for review.
+  BlankKind m_blank;
+
+  // Reduced copy of the image for drawing the list, or empty if the
+  // capture pipeline has not produced one.
+  PixelImage m_thumbnail;
+
+  // Local time the image was grabbed, in 100 ns units since 1601 (the
+  // `FILETIME` scale), or 0 if unknown.
+  std::uint64_t m_captureTime;
+
+  // If nonzero, the group this shot belongs to: a burst, the monitors
+  // of one capture, or a run of captures that look alike.  The members
+  // of a group are adjacent in the list.
+  int m_groupId;
+
+  // True if the group is a run of captures put together because each
+  // looks like the one before it, which later captures can join.
+  bool m_clustered;
+
+  // If nonzero, the number, from 1 with the primary first, of the
+  // monitor this is an image of.
+  int m_monitor;
+
+  // Name of the `CaptureRegion` this is an image of, or empty for the
+  // whole screen.
+  std::wstring m_regionName;
+
+  // If true, the shot was set aside by "keep sharpest", and is not
+  // shown until it is restored.  It keeps its file meanwhile.
+  bool m_discarded;
+
+private:     // methods
+  // Stretch the image to fill the given rectangle, using the thumbnail
+  // when it is big enough.
+  void stretchImage(HDC hdc, int x, int y, int w, int h) const;
+
 public:
   // Initally empty.
   Screenshot();
@@ -41,10 +131,38 @@ public:
   // Empty this container.
   void clear();
 
-  // Capture the current screen contents.
+  // Capture the current screen contents and record the time.  This
+  // neither names nor writes the file.  If a frame source is installed
+  // with `setFrameSource`, this and the other capture methods take the
+  // next frame from it instead.
   void captureScreen();
 
-  // Deserialize from JSON.  Return false if there is a problem loading
+  // Same, but capture only the `w` by `h` rectangle at `x`, `y`, which
+  // must be within the screen.
+  void captureRegion(int x, int y, int w, int h);
+
+  // Capture the current screen contents only, leaving `m_fname` and
+  // `m_captureTime` alone.
+  void grabScreen();
+
+  // Same for a rectangle, as for `captureRegion`.
+  void grabRegion(int x, int y, int w, int h);
+
+  // Return a copy of the bitmap's pixels.
+  PixelImage getPixels() const;
+
+  // Replace the bitmap with one holding `img`.
+  void setPixels(PixelImage const &img);
+
+  // Describe `m_tier` and the file format, like "raw BMP".
+  std::wstring storageDescription() const;
+
+  // Format `m_captureTime` to the millisecond, like
+  // "2024-05-06 07:08:09.123", or return an empty string if unknown.
+  std::wstring timestampString() const;
+
+  // Deserialize from JSON, either an object or, as older lists have
+  // it, just the file name.  Return false if there is a problem loading
   // the data.  (There is no indication of a failure reason.)
   bool loadFromJSON(json::JSON const &obj);
 
@@ -68,16 +186,101 @@ public:
   // image to be shown with its proper aspect ratio.
   int heightForWidth(int w) const;
 
-  // Choose a unique value for `m_fname`.
+  // Choose a unique value for `m_fname`, one that names no existing
+  // file and was not chosen earlier in this session, and create its
+  // directory.
   void chooseFileName();
 
-  // Write the image to a `m_fname` in BMP format.
-  void writeToBMPFile() const;
+  // Write the image to a `m_fname` in BMP format `fmt`.  The rows are
+  // read out of the bitmap a band at a time, so no full copy of the
+  // image is made.
+  void writeToBMPFile(BmpFormat fmt) const;
 
   // Read new image data from a BMP file.  Return true and set
   // `m_fname` on success.
   bool readFromBMPFile(std::wstring const &fname);
+
+  // Read new image data from a BMP or QOI file, according to its
+  // extension, and set `m_tier` to match.  Return true and set
+  // `m_fname` on success.
+  bool readFromFile(std::wstring const &fname);
 };
 
 
+// True if `fname` has the extension of the archival format.
+bool isArchivalFileName(std::wstring const &fname);
+
+// Return `fname` with its extension replaced by the archival one.
+std::wstring archivalFileName(std::wstring const &fname);
+
+// Return the current local time in the units of
+// `Screenshot::m_captureTime`.
+std::uint64_t localFileTimeNow();
+
+// Convert such a time to calendar form.
+SYSTEMTIME fileTimeToSystemTime(std::uint64_t fileTime);
+
+// Take captures from `source` rather than the screen, or from the
+// screen again if it is null.  Call this on the UI thread.
+void setFrameSource(std::unique_ptr<FrameSource> source);
+
+// Return the rectangle of the primary screen, whose top left is 0, 0,
+// or of a whole frame if a frame source is installed.
+RECT primaryScreenRect();
+
+// Return the rectangles of the display monitors, in virtual-screen
+// coordinates, primary first.  If they cannot be enumerated, or a
+// frame source is installed, return just `primaryScreenRect()`.
+std::vector<RECT> getMonitorRects();
+
+// Return the smallest rectangle containing all of `getMonitorRects()`.
+RECT virtualScreenRect();
+
+// Return an unused name, under "shots", for a shot taken at local time
+// `st` and stored in the format of `extension` (e.g., L".qoi").  The
+// name is unique across both formats and among names returned earlier.
+// This must be called on the UI thread.
+std::wstring chooseShotFileName(SYSTEMTIME const &st,
+                                wchar_t const *extension);
+
+
+// Write `bytes` to `fname`, replacing any existing file.  This can be
+// called on any thread.  Return a non-empty error message on failure.
+std::string writeImageFile(std::wstring const &fname,
+                           std::vector<unsigned char> const &bytes);
+
+// Write `img` to `fname` as a BMP file in `fmt`, a band of rows at a
+// time.
+// While a writer thread writes one band, the next is converted into a
+// second buffer, so the memory needed beyond `img` is two bands rather
+// than a whole encoded copy.  This can be called on any thread.
+// Return a non-empty error message on failure.
+std::string writeBMPFileBanded(std::wstring const &fname,
+                               PixelImage const &img, BmpFormat fmt);
+
+// Read all of `fname` into `bytes`.  This can be called on any thread.
+// Return a non-empty error message on failure.
+std::string readImageFile(std::wstring const &fname,
+                          std::vector<unsigned char> &bytes /*OUT*/);
+
+// Read and decode `fname`, a raw or archival file, into `img`.  This
+// can be called on any thread.  Return a non-empty error message on
+// failure.
+std::string readImagePixels(std::wstring const &fname,
+                            PixelImage &img /*OUT*/);
+
+// Return true if `fname`, a raw or archival file, can be read and holds
+// the pixels of `img`, as reduced by the format if it is 16 bpp.  This
+// can be called on any thread.
+bool imageFileHolds(std::wstring const &fname, PixelImage const &img);
+
+// Recompress the raw file `rawName` into the archival file `archName`.
+// The new file is written under a temporary name and then renamed, so
+// `archName` is either complete or absent.  `rawName` is left alone.
+// This can be called on any thread.  Return a non-empty error message
+// on failure.
+std::string archiveImageFile(std::wstring const &rawName,
+                             std::wstring const &archName);
+
+
 #endif // SCREENSHOT_H
@@ -0,0 +1,219 @@
+// sharpness-test.cc
+// Tests for `sharpness`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times 4K frames.
+
+#include "sharpness.h"                 // module under test
+
+#include "frame-source.h"              // SyntheticFrameSource
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <cstdint>                     // std::{int64_t, uint32_t}
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937
+#include <string>                      // std::string
+
+
+// Average each pixel with the `n-1` to its left, as a horizontal pan
+// smears a frame.
+static PixelImage motionBlur(PixelImage const &img, int n)
+{
+  PixelImage out(img.m_width, img.m_height);
+  for (int y = 0; y < img.m_height; ++y) {
+    for (int x = 0; x < img.m_width; ++x) {
+      std::uint32_t sums[3] = {};
+      int count = 0;
+      for (int k = 0; k < n && k <= x; ++k, ++count) {
+        std::uint32_t p = img.at(x-k, y);
+        for (int c = 0; c < 3; ++c) {
+          sums[c] += (p >> (8*c)) & 0xFF;
+        }
+      }
+      out.row(y)[x] = (sums[0] / count) | ((sums[1] / count) << 8) |
+                      ((sums[2] / count) << 16);
+    }
+  }
+  return out;
+}
+
+
+// What `halfLuminance` computes, written out directly.
+static LumaPlane referenceHalfLuminance(PixelImage const &img)
+{
+  auto avg = [](int a, int b) { return (a + b + 1) / 2; };
+
+  LumaPlane plane;
+  if (img.m_width < 2 || img.m_height < 2) {
+    return plane;
+  }
+
+  plane.m_width = img.m_width / 2;
+  plane.m_height = img.m_height / 2;
+  for (int y = 0; y < plane.m_height; ++y) {
+    for (int x = 0; x < plane.m_width; ++x) {
+      int ch[3];
+      for (int c = 0; c < 3; ++c) {
+        auto get = [&](int dx, int dy) {
+          return (int)(img.at(2*x + dx, 2*y + dy) >> (8*c)) & 0xFF;
+        };
+        ch[c] = avg(avg(get(0, 0), get(0, 1)), avg(get(1, 0), get(1, 1)));
+      }
+      int luma = avg(avg(ch[0], ch[2]), ch[1]);
+      plane.m_pixels.push_back((unsigned char)luma);
+    }
+  }
+  return plane;
+}
+
+
+// What `laplacianVariance` computes, written out directly.
+static double referenceVariance(LumaPlane const &p)
+{
+  if (p.m_width < 3 || p.m_height < 3) {
+    return 0;
+  }
+
+  std::int64_t sum = 0, sumSq = 0;
+  for (int y = 1; y+1 < p.m_height; ++y) {
+    for (int x = 1; x+1 < p.m_width; ++x) {
+      int lap = 4*p.row(y)[x] - p.row(y)[x-1] - p.row(y)[x+1] -
+                p.row(y-1)[x] - p.row(y+1)[x];
+      sum += lap;
+      sumSq += lap * lap;
+    }
+  }
+  double n = (double)(p.m_width-2) * (p.m_height-2);
+  return sumSq / n - (sum / n) * (sum / n);
+}
+
+
+// Sizes on either side of the 16-pixel vector width.
+static void testAgainstReference()
+{
+  std::mt19937 rng(3);
+  for (int w = 0; w <= 70; w += (w < 40? 1 : 7)) {
+    for (int h : { 0, 1, 2, 5, 8 }) {
+      PixelImage img = randomImage(w, h, rng);
+      LumaPlane plane = halfLuminance(img);
+      LumaPlane expect = referenceHalfLuminance(img);
+      EXPECT(plane.m_width == expect.m_width &&
+             plane.m_height == expect.m_height &&
+             plane.m_pixels == expect.m_pixels);
+      EXPECT(laplacianVariance(plane) == referenceVariance(expect));
+    }
+  }
+
+  // A long row crosses the point where the vector lanes are flushed.
+  LumaPlane wide;
+  wide.m_width = 9000;
+  wide.m_height = 3;
+  for (int i = 0; i < wide.m_width * wide.m_height; ++i) {
+    wide.m_pixels.push_back((i / wide.m_width) == 1 && i % 2? 255 : 0);
+  }
+  EXPECT(laplacianVariance(wide) == referenceVariance(wide));
+}
+
+
+static void testKnownValues()
+{
+  // Flat images have no detail.
+  PixelImage flat(40, 30);
+  for (std::uint32_t &p : flat.m_pixels) {
+    p = 0x406080;
+  }
+  EXPECT(imageSharpness(flat) == 0);
+  EXPECT(imageSharpness(PixelImage()) == 0);
+  EXPECT(imageSharpness(PixelImage(5, 5)) == 0);
+
+  // A checkerboard of 2x2 white and black blocks halves to alternating
+  // 255 and 0, whose Laplacian is +-1020.
+  PixelImage checker(64, 64);
+  for (int y = 0; y < 64; ++y) {
+    for (int x = 0; x < 64; ++x) {
+      checker.row(y)[x] = ((x/2 + y/2) % 2)? 0xFFFFFF : 0;
+    }
+  }
+  EXPECT(imageSharpness(checker) == 1020.0 * 1020.0);
+}
+
+
+// Blurring a frame lowers its score, more so with more blur.
+static void testBlurRanks()
+{
+  SyntheticFrameSource src(480, 270, 7);
+  PixelImage frame = grabFrame(src);
+  double sharp = imageSharpness(frame);
+  double slight = imageSharpness(motionBlur(frame, 3));
+  double heavy = imageSharpness(motionBlur(frame, 9));
+  EXPECT(sharp > slight);
+  EXPECT(slight > heavy);
+  EXPECT(heavy > 0);
+}
+
+
+// Time scoring 4K frames, in total and by step.
+static void bench()
+{
+  SyntheticFrameSource src(3840, 2160);
+  PixelImage frame = grabFrame(src);
+
+  using Clock = std::chrono::steady_clock;
+  int const reps = 50;
+  double fromSteps = 0;
+  double whole = 0;
+
+  auto start = Clock::now();
+  LumaPlane plane;
+  for (int i = 0; i < reps; ++i) {
+    plane = halfLuminance(frame);
+  }
+  double halfMs = std::chrono::duration<double, std::milli>(
+    Clock::now() - start).count() / reps;
+
+  start = Clock::now();
+  for (int i = 0; i < reps; ++i) {
+    fromSteps = laplacianVariance(plane);
+  }
+  double lapMs = std::chrono::duration<double, std::milli>(
+    Clock::now() - start).count() / reps;
+
+  start = Clock::now();
+  for (int i = 0; i < reps; ++i) {
+    whole = imageSharpness(frame);
+  }
+  double totalMs = std::chrono::duration<double, std::milli>(
+    Clock::now() - start).count() / reps;
+
+  std::cout << "3840x2160: halfLuminance " << halfMs
+            << " ms, laplacianVariance " << lapMs
+            << " ms, imageSharpness " << totalMs << " ms\n";
+  EXPECT(fromSteps == whole);
+}
+
+
+int main(int argc, char **argv)
+{
+  testAgainstReference();
+  testKnownValues();
+  testBlurRanks();
+
+  if (s_failures) {
+    std::cout << "sharpness-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "sharpness-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,197 @@
+// sharpness.cc
+// Code for `sharpness` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "sharpness.h"                 // this module
+
+#include <cstdint>                     // std::{int32_t, int64_t, uint32_t}
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_avg_epu8, etc.
+#endif
+
+
+// Rounded average of two bytes, as `_mm_avg_epu8` computes it.
+static inline std::uint32_t avgByte(std::uint32_t a, std::uint32_t b)
+{
+  return (a + b + 1) >> 1;
+}
+
+
+// Byte `k` of `v`.
+static inline std::uint32_t byteOf(std::uint32_t v, int k)
+{
+  return (v >> (8*k)) & 0xFF;
+}
+
+
+// Luminance of the 2x2 block whose left pixels are `top[0]` and
+// `bottom[0]`.  The vector kernel computes the same.
+static inline unsigned char blockLuma(std::uint32_t const *top,
+                                      std::uint32_t const *bottom)
+{
+  std::uint32_t ch[3];
+  for (int k = 0; k < 3; ++k) {
+    ch[k] = avgByte(avgByte(byteOf(top[0], k), byteOf(bottom[0], k)),
+                    avgByte(byteOf(top[1], k), byteOf(bottom[1], k)));
+  }
+  return (unsigned char)avgByte(avgByte(ch[0], ch[2]), ch[1]);
+}
+
+
+#ifdef __SSE2__
+// Luminance of the four 2x2 blocks whose pixels are at `top[0..7]` and
+// `bottom[0..7]`, in the low byte of each 32-bit lane.
+static inline __m128i blockLuma4(std::uint32_t const *top,
+                                 std::uint32_t const *bottom)
+{
+  __m128i v0 = _mm_avg_epu8(_mm_loadu_si128((__m128i const*)top),
+                            _mm_loadu_si128((__m128i const*)bottom));
+  __m128i v1 = _mm_avg_epu8(_mm_loadu_si128((__m128i const*)(top+4)),
+                            _mm_loadu_si128((__m128i const*)(bottom+4)));
+
+  // Separate the left and right pixels of each block.
+  __m128 f0 = _mm_castsi128_ps(v0);
+  __m128 f1 = _mm_castsi128_ps(v1);
+  __m128i left = _mm_castps_si128(
+    _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i right = _mm_castps_si128(
+    _mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i p = _mm_avg_epu8(left, right);
+
+  // Byte 0 becomes avg(avg(B, R), G).
+  __m128i br = _mm_avg_epu8(p, _mm_srli_epi32(p, 16));
+  __m128i y = _mm_avg_epu8(br, _mm_srli_epi32(p, 8));
+  return _mm_and_si128(y, _mm_set1_epi32(0xFF));
+}
+#endif // __SSE2__
+
+
+LumaPlane halfLuminance(PixelImage const &img)
+{
+  LumaPlane plane;
+  int w = img.m_width / 2;
+  int h = img.m_height / 2;
+  if (w <= 0 || h <= 0) {
+    return plane;
+  }
+
+  plane.m_width = w;
+  plane.m_height = h;
+  plane.m_pixels.resize((std::size_t)w * h);
+
+  for (int y = 0; y < h; ++y) {
+    std::uint32_t const *top = img.row(2*y);
+    std::uint32_t const *bottom = img.row(2*y + 1);
+    unsigned char *out = plane.m_pixels.data() + (std::size_t)y * w;
+    int x = 0;
+
+#ifdef __SSE2__
+    for (; x + 16 <= w; x += 16) {
+      __m128i a = blockLuma4(top + 2*x,      bottom + 2*x);
+      __m128i b = blockLuma4(top + 2*x + 8,  bottom + 2*x + 8);
+      __m128i c = blockLuma4(top + 2*x + 16, bottom + 2*x + 16);
+      __m128i d = blockLuma4(top + 2*x + 24, bottom + 2*x + 24);
+      _mm_storeu_si128((__m128i*)(out + x),
+        _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+#endif // __SSE2__
+
+    for (; x < w; ++x) {
+      out[x] = blockLuma(top + 2*x, bottom + 2*x);
+    }
+  }
+
+  return plane;
+}
+
+
+double laplacianVariance(LumaPlane const &plane)
+{
+  int const w = plane.m_width;
+  int const h = plane.m_height;
+  if (w < 3 || h < 3) {
+    return 0;
+  }
+
+  // The Laplacian is at most 4*255 in magnitude, so these cannot
+  // overflow for any plausible image.
+  std::int64_t sum = 0;
+  std::int64_t sumSq = 0;
+
+  for (int y = 1; y+1 < h; ++y) {
+    unsigned char const *up = plane.row(y-1);
+    unsigned char const *mid = plane.row(y);
+    unsigned char const *down = plane.row(y+1);
+    int x = 1;
+
+#ifdef __SSE2__
+    // Each 32-bit lane gains at most four squares, about 2^22, per
+    // iteration, so the lanes are added into the totals every 256
+    // iterations, and at the end of the row.
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const ones = _mm_set1_epi16(1);
+    while (x + 17 <= w) {
+      __m128i sumAcc = zero;
+      __m128i sqAcc = zero;
+      for (int k = 0; k < 256 && x + 17 <= w; ++k, x += 16) {
+        __m128i c = _mm_loadu_si128((__m128i const*)(mid + x));
+        __m128i l = _mm_loadu_si128((__m128i const*)(mid + x - 1));
+        __m128i r = _mm_loadu_si128((__m128i const*)(mid + x + 1));
+        __m128i u = _mm_loadu_si128((__m128i const*)(up + x));
+        __m128i d = _mm_loadu_si128((__m128i const*)(down + x));
+
+        // Widen to 16 bits, low and high halves.
+        __m128i lapLo = _mm_sub_epi16(
+          _mm_slli_epi16(_mm_unpacklo_epi8(c, zero), 2),
+          _mm_add_epi16(
+            _mm_add_epi16(_mm_unpacklo_epi8(l, zero),
+                          _mm_unpacklo_epi8(r, zero)),
+            _mm_add_epi16(_mm_unpacklo_epi8(u, zero),
+                          _mm_unpacklo_epi8(d, zero))));
+        __m128i lapHi = _mm_sub_epi16(
+          _mm_slli_epi16(_mm_unpackhi_epi8(c, zero), 2),
+          _mm_add_epi16(
+            _mm_add_epi16(_mm_unpackhi_epi8(l, zero),
+                          _mm_unpackhi_epi8(r, zero)),
+            _mm_add_epi16(_mm_unpackhi_epi8(u, zero),
+                          _mm_unpackhi_epi8(d, zero))));
+
+        sumAcc = _mm_add_epi32(sumAcc, _mm_add_epi32(
+          _mm_madd_epi16(lapLo, ones), _mm_madd_epi16(lapHi, ones)));
+        sqAcc = _mm_add_epi32(sqAcc, _mm_add_epi32(
+          _mm_madd_epi16(lapLo, lapLo), _mm_madd_epi16(lapHi, lapHi)));
+      }
+
+      alignas(16) std::int32_t sums[4];
+      alignas(16) std::int32_t squares[4];
+      _mm_store_si128((__m128i*)sums, sumAcc);
+      _mm_store_si128((__m128i*)squares, sqAcc);
+      for (int i = 0; i < 4; ++i) {
+        sum += sums[i];
+        sumSq += squares[i];
+      }
+    }
+#endif // __SSE2__
+
+    for (; x+1 < w; ++x) {
+      int lap = 4*mid[x] - mid[x-1] - mid[x+1] - up[x] - down[x];
+      sum += lap;
+      sumSq += lap * lap;
+    }
+  }
+
+  double n = (double)(w-2) * (h-2);
+  double mean = sum / n;
+  return sumSq / n - mean * mean;
+}
+
+
+double imageSharpness(PixelImage const &img)
+{
+  return laplacianVariance(halfLuminance(img));
+}
+
+
+// EOF
@@ -0,0 +1,64 @@
+// sharpness.h
+// Sharpness of an image, to tell clear frames from motion-blurred ones.
+
+// See license.txt for copyright and terms of use.
+
+// In fast motion, many frames of a burst are smeared.  Blur removes
+// the fine detail that makes adjacent pixels differ, so a standard
+// measure of sharpness is the variance of the Laplacian of the
+// luminance: large where there are crisp edges, small where they have
+// been smeared out.  The value is only meaningful relative to other
+// frames of the same scene, such as the members of one burst.
+//
+// The Laplacian is taken on a half-resolution luminance plane.  Blur
+// worth caring about spans several pixels, so halving keeps it visible
+// while quartering the work, and averaging each 2x2 block suppresses
+// dithering and compression noise that would otherwise count as
+// detail.  Luminance is approximated as (B + 2G + R) / 4, computed with
+// byte averages.
+//
+// With SSE2, 16 pixels are processed at a time, which takes under 2 ms
+// for a 4K frame on one core (see the "bench" mode of
+// `sharpness-test`).
+//
+// This module does not depend on the Windows API.
+
+#ifndef SHARPNESS_H
+#define SHARPNESS_H
+
+#include "pixel-image.h"               // PixelImage
+
+#include <cstddef>                     // std::size_t
+#include <vector>                      // std::vector
+
+
+// 8-bit single-channel image, top row first, with no row padding.
+struct LumaPlane {
+  int m_width = 0;
+  int m_height = 0;
+
+  // `m_width * m_height` values.
+  std::vector<unsigned char> m_pixels;
+
+  bool empty() const { return m_pixels.empty(); }
+
+  unsigned char const *row(int y) const
+    { return m_pixels.data() + (std::size_t)y * m_width; }
+};
+
+
+// Return the luminance of `img` at half its width and height, each
+// value the average of a 2x2 block.  An odd last row or column is
+// dropped.
+LumaPlane halfLuminance(PixelImage const &img);
+
+// Return the variance of the 4-neighbor Laplacian over the interior of
+// `plane`, or 0 if it has no interior.
+double laplacianVariance(LumaPlane const &plane);
+
+// Sharpness of `img`: `laplacianVariance(halfLuminance(img))`.  A flat
+// image scores 0.
+double imageSharpness(PixelImage const &img);
+
+
+#endif // SHARPNESS_H
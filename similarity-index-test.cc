@@ -0,0 +1,197 @@
+// similarity-index-test.cc
+// Tests for `similarity-index`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times queries against 100,000 entries, comparing with a linear
+// scan.
+
+#include "similarity-index.h"          // module under test
+
+#include "perceptual-hash.h"           // hammingDistance
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937_64
+#include <string>                      // std::string
+
+
+// `h` with `n` distinct bits, chosen by `rng`, flipped.
+static std::uint64_t flipBits(std::uint64_t h, int n, std::mt19937_64 &rng)
+{
+  std::uint64_t orig = h;
+  while (hammingDistance(h, orig) < n) {
+    h ^= (std::uint64_t)1 << (rng() % 64);
+  }
+  return h;
+}
+
+
+// Matches of a linear scan, in the order `query` gives.
+static std::vector<SimilarityIndex::Match> scan(
+  std::vector<std::uint64_t> const &hashes, std::uint64_t hash,
+  int maxDistance)
+{
+  std::vector<SimilarityIndex::Match> ret;
+  for (int d = 0; d <= maxDistance; ++d) {
+    for (std::size_t id = 0; id < hashes.size(); ++id) {
+      if (hashes[id] != ~(std::uint64_t)0 &&
+          hammingDistance(hashes[id], hash) == d) {
+        ret.push_back(SimilarityIndex::Match{id, d});
+      }
+    }
+  }
+  return ret;
+}
+
+
+static bool sameMatches(std::vector<SimilarityIndex::Match> const &a,
+                        std::vector<SimilarityIndex::Match> const &b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (a[i].m_id != b[i].m_id || a[i].m_distance != b[i].m_distance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+static void testSmall()
+{
+  SimilarityIndex index;
+  index.add(1, 0x0000);
+  index.add(2, 0x0003);
+  index.add(3, 0xFFFF0000FFFF0000ull);
+  EXPECT(index.size() == 3);
+
+  std::vector<SimilarityIndex::Match> m = index.query(0x0001, 1);
+  EXPECT(m.size() == 2);
+  EXPECT(m.size() == 2 && m[0].m_id == 1 && m[1].m_id == 2);
+  EXPECT(m.size() == 2 && m[0].m_distance == 1);
+
+  // Replacing a hash.
+  index.add(2, 0xFFFF0000FFFF0001ull);
+  EXPECT(index.size() == 3);
+  m = index.query(0xFFFF0000FFFF0000ull, 2);
+  EXPECT(m.size() == 2 && m[0].m_id == 3 && m[1].m_id == 2);
+
+  index.remove(3);
+  index.remove(3);
+  m = index.query(0xFFFF0000FFFF0000ull, 2);
+  EXPECT(m.size() == 1 && m[0].m_id == 2);
+
+  EXPECT(index.query(0, -1).empty());
+
+  index.clear();
+  EXPECT(index.size() == 0);
+  EXPECT(index.query(0, 64).empty());
+}
+
+
+// Clusters of near hashes among random ones.  The index finds what a
+// linear scan does, at every distance, after adds and removes.
+static void testAgainstScan()
+{
+  std::mt19937_64 rng(17);
+  std::vector<std::uint64_t> hashes;
+  for (int i = 0; i < 3000; ++i) {
+    hashes.push_back(i % 3 == 0 || hashes.empty()?
+      rng() : flipBits(hashes[rng() % hashes.size()], rng() % 12, rng));
+  }
+
+  SimilarityIndex index;
+  for (std::size_t id = 0; id < hashes.size(); ++id) {
+    index.add(id, hashes[id]);
+  }
+
+  // Removed entries are marked with all ones, which random hashes are
+  // not expected to be within 20 bits of.
+  for (std::size_t id = 0; id < hashes.size(); id += 7) {
+    index.remove(id);
+    hashes[id] = ~(std::uint64_t)0;
+  }
+
+  for (int q = 0; q < 40; ++q) {
+    std::uint64_t hash = flipBits(hashes[rng() % hashes.size()], q % 5,
+                                  rng);
+    for (int d : { 0, 3, 4, 9, 15, 20 }) {
+      EXPECT(sameMatches(index.query(hash, d), scan(hashes, hash, d)));
+    }
+  }
+}
+
+
+// Time queries against 100,000 hashes: random ones, and some clusters
+// of near neighbors as bursts give.
+static void bench()
+{
+  int const n = 100000;
+  std::mt19937_64 rng(3);
+  std::vector<std::uint64_t> hashes;
+  SimilarityIndex index;
+  for (int i = 0; i < n; ++i) {
+    std::uint64_t h = i % 4 == 0 || hashes.empty()?
+      rng() : flipBits(hashes[rng() % hashes.size()], rng() % 8, rng);
+    hashes.push_back(h);
+    index.add(i, h);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  for (int d : { 4, 8, 10, 12, 15 }) {
+    int const queries = 200;
+    std::size_t matches = 0, candidates = 0;
+    auto start = Clock::now();
+    for (int q = 0; q < queries; ++q) {
+      matches += index.query(hashes[(q * 7919) % n], d).size();
+      candidates += index.lastCandidates();
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+      Clock::now() - start).count() / queries;
+
+    start = Clock::now();
+    std::size_t scanned = 0;
+    for (int q = 0; q < queries; ++q) {
+      std::uint64_t hash = hashes[(q * 7919) % n];
+      for (std::uint64_t h : hashes) {
+        scanned += hammingDistance(h, hash) <= d;
+      }
+    }
+    double scanMs = std::chrono::duration<double, std::milli>(
+      Clock::now() - start).count() / queries;
+
+    std::cout << "distance " << d << ": " << ms << " ms per query, "
+              << (double)matches / queries << " matches, "
+              << (double)candidates / queries << " candidates; scan "
+              << scanMs << " ms\n";
+    EXPECT(scanned == matches);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testSmall();
+  testAgainstScan();
+
+  if (s_failures) {
+    std::cout << "similarity-index-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "similarity-index-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,162 @@
+// similarity-index.cc
+// Code for `similarity-index` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "similarity-index.h"          // this module
+
+#include "perceptual-hash.h"           // hammingDistance
+
+#include <algorithm>                   // std::sort
+
+
+// Above this many bits per chunk, probing every nearby chunk value
+// costs more than comparing with every entry.
+static int const c_maxProbeBits = 2;
+
+
+// Chunk `c` of `hash`.
+static inline std::uint16_t chunkOf(std::uint64_t hash, int c)
+{
+  return (std::uint16_t)(hash >> (16 * c));
+}
+
+
+// Call `func` with `v` and every value differing from it in at most
+// `bits` of the bits from `firstBit` up.
+template <class FUNC>
+static void forEachNearby(std::uint16_t v, int firstBit, int bits,
+                          FUNC const &func)
+{
+  func(v);
+  if (bits == 0) {
+    return;
+  }
+  for (int b = firstBit; b < 16; ++b) {
+    forEachNearby((std::uint16_t)(v ^ (1u << b)), b+1, bits-1, func);
+  }
+}
+
+
+SimilarityIndex::SimilarityIndex()
+  : m_tables(),
+    m_entries(),
+    m_positions(),
+    m_lastCandidates(0)
+{}
+
+
+void SimilarityIndex::add(std::uint64_t id, std::uint64_t hash)
+{
+  remove(id);
+
+  m_positions[id] = m_entries.size();
+  m_entries.push_back(Entry{hash, id});
+  for (int c = 0; c < c_numChunks; ++c) {
+    m_tables[c][chunkOf(hash, c)].push_back(Entry{hash, id});
+  }
+}
+
+
+void SimilarityIndex::remove(std::uint64_t id)
+{
+  auto it = m_positions.find(id);
+  if (it == m_positions.end()) {
+    return;
+  }
+
+  std::size_t pos = it->second;
+  std::uint64_t hash = m_entries[pos].m_hash;
+  m_positions.erase(it);
+  m_entries[pos] = m_entries.back();
+  m_entries.pop_back();
+  if (pos < m_entries.size()) {
+    m_positions[m_entries[pos].m_id] = pos;
+  }
+
+  for (int c = 0; c < c_numChunks; ++c) {
+    auto bucket = m_tables[c].find(chunkOf(hash, c));
+    std::vector<Entry> &entries = bucket->second;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].m_id == id) {
+        entries[i] = entries.back();
+        entries.pop_back();
+        break;
+      }
+    }
+    if (entries.empty()) {
+      m_tables[c].erase(bucket);
+    }
+  }
+}
+
+
+void SimilarityIndex::clear()
+{
+  for (ChunkTable &table : m_tables) {
+    table.clear();
+  }
+  m_entries.clear();
+  m_positions.clear();
+}
+
+
+std::vector<SimilarityIndex::Match> SimilarityIndex::query(
+  std::uint64_t hash, int maxDistance) const
+{
+  std::vector<Match> ret;
+  m_lastCandidates = 0;
+  if (maxDistance < 0) {
+    return ret;
+  }
+
+  int probeBits = maxDistance / c_numChunks;
+  if (probeBits > c_maxProbeBits) {
+    for (Entry const &e : m_entries) {
+      int d = hammingDistance(e.m_hash, hash);
+      if (d <= maxDistance) {
+        ret.push_back(Match{e.m_id, d});
+      }
+    }
+    m_lastCandidates = m_entries.size();
+  }
+  else {
+    for (int c = 0; c < c_numChunks; ++c) {
+      forEachNearby(chunkOf(hash, c), 0, probeBits,
+        [&](std::uint16_t value) {
+          auto bucket = m_tables[c].find(value);
+          if (bucket == m_tables[c].end()) {
+            return;
+          }
+
+          for (Entry const &e : bucket->second) {
+            // An entry close enough in an earlier chunk was found
+            // through that one.
+            bool seen = false;
+            for (int prev = 0; prev < c && !seen; ++prev) {
+              seen = hammingDistance(chunkOf(e.m_hash, prev),
+                                     chunkOf(hash, prev)) <= probeBits;
+            }
+            if (seen) {
+              continue;
+            }
+
+            ++m_lastCandidates;
+            int d = hammingDistance(e.m_hash, hash);
+            if (d <= maxDistance) {
+              ret.push_back(Match{e.m_id, d});
+            }
+          }
+        });
+    }
+  }
+
+  std::sort(ret.begin(), ret.end(), [](Match const &a, Match const &b) {
+    return a.m_distance != b.m_distance?
+             a.m_distance < b.m_distance : a.m_id < b.m_id;
+  });
+  return ret;
+}
+
+
+// EOF
@@ -0,0 +1,96 @@
+// similarity-index.h
+// Index of perceptual hashes for finding near neighbors quickly.
+
+// See license.txt for copyright and terms of use.
+
+// Finding the shots whose perceptual hashes are within some Hamming
+// distance of a given one by comparing against every shot is fast for
+// a few hundred, but the list can hold a hundred thousand.
+//
+// This uses multi-index hashing.  Each 64-bit hash is split into four
+// 16-bit chunks, and each chunk has a table from chunk value to the
+// entries having it.  If two hashes differ in at most `r` bits, some
+// chunk differs in at most `r/4` of them, so a query need only look up
+// the chunk values within `r/4` bits of its own, in each table, and
+// check the entries found.  For the distances that mean "similar",
+// that is a few hundred lookups, and the entries found are mostly
+// matches.  Wider queries just compare with every entry.
+//
+// This is used only on the UI thread, so it has no lock.
+//
+// This module does not depend on the Windows API.
+
+#ifndef SIMILARITY_INDEX_H
+#define SIMILARITY_INDEX_H
+
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::{uint16_t, uint64_t}
+#include <unordered_map>               // std::unordered_map
+#include <vector>                      // std::vector
+
+
+class SimilarityIndex {
+  NO_OBJECT_COPIES(SimilarityIndex);
+
+public:      // types
+  // One result of `query`.
+  struct Match {
+    // Identifies what was added, as passed to `add`.
+    std::uint64_t m_id;
+
+    // Hamming distance from the query hash.
+    int m_distance;
+  };
+
+  // Number of chunks each hash is split into.
+  static int const c_numChunks = 4;
+
+private:     // types
+  struct Entry {
+    std::uint64_t m_hash;
+    std::uint64_t m_id;
+  };
+
+  // Entries by the value of one chunk of their hash.
+  using ChunkTable = std::unordered_map<std::uint16_t, std::vector<Entry>>;
+
+private:     // data
+  ChunkTable m_tables[c_numChunks];
+
+  // Every entry, in no particular order, for queries too wide for the
+  // tables to help.
+  std::vector<Entry> m_entries;
+
+  // Index in `m_entries` of each entry, by id.
+  std::unordered_map<std::uint64_t, std::size_t> m_positions;
+
+  // Number of candidate entries checked by the last `query`.
+  mutable std::size_t m_lastCandidates;
+
+public:      // methods
+  SimilarityIndex();
+
+  // Add `hash` under `id`, replacing any hash `id` already has.
+  void add(std::uint64_t id, std::uint64_t hash);
+
+  // Remove `id`, if it is present.
+  void remove(std::uint64_t id);
+
+  // Remove everything.
+  void clear();
+
+  // Return the entries whose hashes are within `maxDistance` bits of
+  // `hash`, nearest first, and by id among equals.
+  std::vector<Match> query(std::uint64_t hash, int maxDistance) const;
+
+  // Number of entries.
+  std::size_t size() const { return m_entries.size(); }
+
+  // Number of entries the last `query` compared with its hash.
+  std::size_t lastCandidates() const { return m_lastCandidates; }
+};
+
+
+#endif // SIMILARITY_INDEX_H
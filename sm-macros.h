@@ -0,0 +1,34 @@
+// sm-macros.h
+// Preprocessor utilities that do not depend on the Windows API.
+
+// See license.txt for copyright and terms of use.
+
+// These originally come from smbase/sm-macros.h.
+
+#ifndef SM_MACROS_H
+#define SM_MACROS_H
+
+// Concatenate tokens.  Unlike plain '##', this works for __LINE__.  It
+// is the same as BOOST_PP_CAT.
+#define SMBASE_PP_CAT(a,b) SMBASE_PP_CAT2(a,b)
+#define SMBASE_PP_CAT2(a,b) a##b
+
+
+// put at the top of a class for which the default copy ctor
+// and operator= are not desired; then don't define these functions
+#define NO_OBJECT_COPIES(name)   \
+  private:                       \
+    name(name&);                 \
+    void operator=(name&) /*user ;*/
+
+
+// Number of entries in an array.
+#define TABLESIZE(tbl) (sizeof(tbl)/sizeof((tbl)[0]))
+
+
+// Stringize an argument as a wide string.
+#define WIDE_STRINGIZE_HELPER(x) L ## x
+#define WIDE_STRINGIZE(x) WIDE_STRINGIZE_HELPER(#x)
+
+
+#endif // SM_MACROS_H
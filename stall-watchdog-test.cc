@@ -0,0 +1,140 @@
+// stall-watchdog-test.cc
+// Tests for `stall-watchdog`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.  It sleeps, so it takes about a
+// second to run.
+
+#include "stall-watchdog.h"            // module under test
+
+#include "test-util.h"                 // EXPECT
+#include "timeline.h"                  // TIMELINE_SPAN
+
+#include <cstring>                     // std::strcmp
+#include <iostream>                    // std::cout
+#include <mutex>                       // std::{mutex, lock_guard}
+#include <vector>                      // std::vector
+
+
+// Threshold used by all tests.
+static std::uint64_t const c_thresholdNs = 20 * 1000000;
+
+// Events reported so far.
+static std::mutex s_eventsMutex;
+static std::vector<StallEvent> s_events;
+
+
+static void recordEvent(StallEvent const &ev)
+{
+  std::lock_guard<std::mutex> lock(s_eventsMutex);
+  s_events.push_back(ev);
+}
+
+
+static std::vector<StallEvent> takeEvents()
+{
+  std::lock_guard<std::mutex> lock(s_eventsMutex);
+  std::vector<StallEvent> ret;
+  ret.swap(s_events);
+  return ret;
+}
+
+
+// Quick messages are not reported.
+static void testNoStall(StallWatchdog &wd)
+{
+  for (int i = 0; i < 20; ++i) {
+    StallWatchdog::MessageScope scope(&wd, 1);
+    sleepMs(1);
+  }
+  sleepMs(50);
+  EXPECT(takeEvents().empty());
+}
+
+
+// A slow message is reported with its span, then again with the total.
+static void testStall(StallWatchdog &wd)
+{
+  {
+    StallWatchdog::MessageScope scope(&wd, 15);
+    TIMELINE_SPAN("outer");
+    {
+      TIMELINE_SPAN("slowWork");
+      sleepMs(100);
+    }
+  }
+  sleepMs(50);
+
+  std::vector<StallEvent> events = takeEvents();
+  EXPECT(events.size() == 2);
+  if (events.size() == 2) {
+    EXPECT(!events[0].m_ended);
+    EXPECT(events[0].m_message == 15);
+    EXPECT(events[0].m_span && std::strcmp(events[0].m_span, "slowWork") == 0);
+    EXPECT(events[0].m_durationNs >= c_thresholdNs);
+
+    EXPECT(events[1].m_ended);
+    EXPECT(events[1].m_message == 15);
+    EXPECT(events[1].m_durationNs >= 100 * 1000000);
+    EXPECT(events[1].m_durationNs < 1000 * 1000000);
+  }
+}
+
+
+// Exempt waits are not reported, but messages nested in them are.
+static void testExempt(StallWatchdog &wd)
+{
+  {
+    StallWatchdog::MessageScope scope(&wd, 273);
+    StallWatchdog::ExemptScope exempt(&wd);
+    sleepMs(100);
+    EXPECT(takeEvents().empty());
+
+    {
+      StallWatchdog::MessageScope nested(&wd, 786);
+      sleepMs(100);
+    }
+  }
+  sleepMs(50);
+
+  std::vector<StallEvent> events = takeEvents();
+  EXPECT(events.size() == 2);
+  if (events.size() == 2) {
+    EXPECT(events[0].m_message == 786);
+    EXPECT(events[0].m_span == nullptr);
+    EXPECT(events[1].m_ended);
+  }
+}
+
+
+// A null watchdog is allowed.
+static void testNull()
+{
+  StallWatchdog::MessageScope scope(nullptr, 1);
+  StallWatchdog::ExemptScope exempt(nullptr);
+}
+
+
+int main()
+{
+  {
+    StallWatchdog wd(c_thresholdNs, recordEvent);
+    wd.watchCurrentThread();
+
+    testNoStall(wd);
+    testStall(wd);
+    testExempt(wd);
+  }
+  testNull();
+
+  if (s_failures) {
+    std::cout << "stall-watchdog-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "stall-watchdog-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,176 @@
+// stall-watchdog.cc
+// Code for `stall-watchdog` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "stall-watchdog.h"            // this module
+
+#include "timeline.h"                  // t_timelineActiveSpan
+
+#include <algorithm>                   // std::max
+#include <cassert>                     // assert
+#include <chrono>                      // std::chrono
+#include <utility>                     // std::move
+
+
+// Current time in nanoseconds on the clock used for all durations.
+static std::uint64_t nowNs()
+{
+  return TimelineSpan::timelineNowNs();
+}
+
+
+StallWatchdog::StallWatchdog(std::uint64_t thresholdNs, Handler handler)
+  : m_thresholdNs(thresholdNs),
+    // Looking four times per threshold bounds the detection delay at
+    // 25% of the threshold.
+    m_pollNs(std::max<std::uint64_t>(thresholdNs / 4, 1000000)),
+    m_handler(std::move(handler)),
+    m_frames(),
+    m_mutex(),
+    m_busy(false),
+    m_message(0),
+    m_startNs(0),
+    m_changeCount(0),
+    m_changeNs(0),
+    m_cv(),
+    m_stopRequested(false),
+    m_thread()
+{
+  m_thread = std::thread(&StallWatchdog::threadMain, this);
+}
+
+
+StallWatchdog::~StallWatchdog()
+{
+  assert(m_frames.empty());
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopRequested = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+
+  if (t_timelineActiveSpan == &m_activeSpan) {
+    t_timelineActiveSpan = nullptr;
+  }
+}
+
+
+void StallWatchdog::watchCurrentThread()
+{
+  t_timelineActiveSpan = &m_activeSpan;
+}
+
+
+void StallWatchdog::publish(std::uint64_t now)
+{
+  if (m_frames.empty()) {
+    m_busy = false;
+  }
+  else {
+    Frame const &top = m_frames.back();
+    m_busy = !top.m_exempt;
+    m_message = top.m_message;
+    m_startNs = top.m_startNs;
+  }
+  ++m_changeCount;
+  m_changeNs = now;
+}
+
+
+void StallWatchdog::enterMessage(unsigned message)
+{
+  std::uint64_t now = nowNs();
+  m_frames.push_back(Frame{message, now, false});
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  publish(now);
+}
+
+
+void StallWatchdog::leaveMessage()
+{
+  assert(!m_frames.empty());
+
+  std::uint64_t now = nowNs();
+  m_frames.pop_back();
+  if (!m_frames.empty()) {
+    // The outer message was pumping, not stuck, so time it afresh.
+    m_frames.back().m_startNs = now;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  publish(now);
+}
+
+
+void StallWatchdog::setExempt(bool exempt)
+{
+  if (m_frames.empty()) {
+    return;
+  }
+
+  std::uint64_t now = nowNs();
+  m_frames.back().m_exempt = exempt;
+  m_frames.back().m_startNs = now;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  publish(now);
+}
+
+
+void StallWatchdog::threadMain()
+{
+  // The stall being tracked, if `stalled`.  It is identified by the
+  // change count at the time it started; when that changes, the stall
+  // is over.
+  bool stalled = false;
+  std::uint64_t stallChangeCount = 0;
+  StallEvent stall{};
+  std::uint64_t stallStartNs = 0;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stopRequested) {
+    m_cv.wait_for(lock, std::chrono::nanoseconds(m_pollNs));
+    if (m_stopRequested) {
+      break;
+    }
+
+    std::uint64_t now = nowNs();
+    StallEvent report{};
+    bool haveReport = false;
+
+    if (stalled && m_changeCount != stallChangeCount) {
+      // The stalled message has returned, or a nested one started.
+      stall.m_ended = true;
+      stall.m_durationNs = m_changeNs - stallStartNs;
+      report = stall;
+      haveReport = true;
+      stalled = false;
+    }
+    else if (!stalled && m_busy && now - m_startNs >= m_thresholdNs) {
+      stalled = true;
+      stallChangeCount = m_changeCount;
+      stallStartNs = m_startNs;
+      stall.m_ended = false;
+      stall.m_message = m_message;
+      stall.m_span = m_activeSpan.load(std::memory_order_relaxed);
+      stall.m_durationNs = now - m_startNs;
+      report = stall;
+      haveReport = true;
+    }
+
+    if (haveReport) {
+      // Do not hold the lock while the handler runs, since it might be
+      // slow and the watched thread would then block on it.
+      lock.unlock();
+      m_handler(report);
+      lock.lock();
+    }
+  }
+}
+
+
+// EOF
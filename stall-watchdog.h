@@ -0,0 +1,186 @@
+// stall-watchdog.h
+// Detect when a thread spends too long handling one message.
+
+// See license.txt for copyright and terms of use.
+
+// The watched thread brackets each message it handles with a
+// `StallWatchdog::MessageScope`.  A background thread polls that state,
+// and when one message has been in progress for longer than the
+// threshold, it reports the message and the innermost `TimelineSpan`
+// that was open, then reports again with the total duration once the
+// message finally returns.
+//
+// Nested dispatch (a modal loop, or `SendMessage` to ourselves) counts
+// as progress: when a nested message returns, the outer one's clock
+// restarts.  Waiting for the user in a modal dialog is not a stall, so
+// such waits should be wrapped in a `StallWatchdog::ExemptScope`.
+//
+// This module does not depend on the Windows API.
+
+#ifndef STALL_WATCHDOG_H
+#define STALL_WATCHDOG_H
+
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <atomic>                      // std::atomic
+#include <condition_variable>          // std::condition_variable
+#include <cstdint>                     // std::uint64_t
+#include <functional>                  // std::function
+#include <mutex>                       // std::mutex
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+
+// What the watchdog reports.
+struct StallEvent {
+  // False when the stall is first detected, true when the message has
+  // returned.
+  bool m_ended;
+
+  // Message that was being handled.
+  unsigned m_message;
+
+  // Name of the innermost open span when the stall was detected, or
+  // null if there was none.
+  char const *m_span;
+
+  // How long the message had been running: so far if `!m_ended`, and
+  // in total if `m_ended`.
+  std::uint64_t m_durationNs;
+};
+
+
+class StallWatchdog {
+  NO_OBJECT_COPIES(StallWatchdog);
+
+public:      // types
+  using Handler = std::function<void (StallEvent const &)>;
+
+  // Time the handling of one message.  `watchdog` may be null, in which
+  // case this does nothing.
+  class MessageScope {
+    NO_OBJECT_COPIES(MessageScope);
+
+  private:     // data
+    StallWatchdog *m_watchdog;
+
+  public:      // methods
+    MessageScope(StallWatchdog *watchdog, unsigned message)
+      : m_watchdog(watchdog)
+    {
+      if (m_watchdog) {
+        m_watchdog->enterMessage(message);
+      }
+    }
+
+    ~MessageScope()
+    {
+      if (m_watchdog) {
+        m_watchdog->leaveMessage();
+      }
+    }
+  };
+
+  // Suspend timing of the current message, for example while a modal
+  // dialog waits for the user.  Messages dispatched during the scope
+  // are still timed.
+  class ExemptScope {
+    NO_OBJECT_COPIES(ExemptScope);
+
+  private:     // data
+    StallWatchdog *m_watchdog;
+
+  public:      // methods
+    explicit ExemptScope(StallWatchdog *watchdog)
+      : m_watchdog(watchdog)
+    {
+      if (m_watchdog) {
+        m_watchdog->setExempt(true);
+      }
+    }
+
+    ~ExemptScope()
+    {
+      if (m_watchdog) {
+        m_watchdog->setExempt(false);
+      }
+    }
+  };
+
+private:     // types
+  // One message being handled on the watched thread.
+  struct Frame {
+    unsigned m_message;
+    std::uint64_t m_startNs;
+    bool m_exempt;
+  };
+
+private:     // data
+  // Reporting threshold, and how often the watchdog thread looks.
+  std::uint64_t const m_thresholdNs;
+  std::uint64_t const m_pollNs;
+
+  // Called on the watchdog thread for each report.
+  Handler const m_handler;
+
+  // Innermost open span of the watched thread.  This is what
+  // `t_timelineActiveSpan` points at on that thread.
+  std::atomic<char const*> m_activeSpan{nullptr};
+
+  // Messages in progress on the watched thread, outermost first.  Only
+  // that thread touches this.
+  std::vector<Frame> m_frames;
+
+  // Protects the published state below, and `m_stopRequested`.
+  std::mutex m_mutex;
+
+  // Innermost frame, as of the last change.  `m_busy` is false if
+  // there are no frames or the innermost one is exempt.
+  bool m_busy;
+  unsigned m_message;
+  std::uint64_t m_startNs;
+
+  // Incremented on every change, and the time of the last change.
+  std::uint64_t m_changeCount;
+  std::uint64_t m_changeNs;
+
+  // Wakes the watchdog thread early to stop.
+  std::condition_variable m_cv;
+  bool m_stopRequested;
+
+  // Started by the constructor.
+  std::thread m_thread;
+
+private:     // methods
+  // Publish the innermost frame.  Caller must hold `m_mutex`.
+  void publish(std::uint64_t now);
+
+  // Body of the watchdog thread.
+  void threadMain();
+
+public:      // methods
+  // Start watching, reporting messages that take at least
+  // `thresholdNs` to `handler`.  The watched thread is the one that
+  // calls `watchCurrentThread`.
+  StallWatchdog(std::uint64_t thresholdNs, Handler handler);
+
+  // Stop the watchdog thread.  This must be called on the watched
+  // thread, if there is one, and with no messages in progress.
+  ~StallWatchdog();
+
+  // Make the calling thread the watched one, publishing its spans.
+  void watchCurrentThread();
+
+  // Record entry to and exit from handling `message`.  Normally these
+  // are called by `MessageScope`.
+  void enterMessage(unsigned message);
+  void leaveMessage();
+
+  // Mark the innermost message as exempt or not.
+  void setExempt(bool exempt);
+
+  std::uint64_t thresholdNs() const { return m_thresholdNs; }
+};
+
+
+#endif // STALL_WATCHDOG_H
@@ -0,0 +1,76 @@
+// test-util.h
+// Checks shared by the portable tests.
+
+// See license.txt for copyright and terms of use.
+
+// Each test program is one `*-test.cc` file that includes this header,
+// uses `EXPECT` for its checks, and exits nonzero from `main` if
+// `s_failures` is not zero.  The helpers below are ones several tests
+// need.  They are inline, so a test that does not call one need not
+// link what it uses.
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include "frame-source.h"              // FrameSource
+#include "pixel-image.h"               // PixelImage
+
+#include <chrono>                      // std::chrono
+#include <cstdint>                     // std::uint32_t
+#include <iostream>                    // std::cout
+#include <random>                      // std::mt19937
+#include <thread>                      // std::this_thread
+
+
+// Number of failed checks.
+static int s_failures = 0;
+
+// Check that `cond` is true, reporting it if not.
+#define EXPECT(cond)                                         \
+  do {                                                       \
+    if (!(cond)) {                                           \
+      std::cout << __FILE__ << ":" << __LINE__               \
+                << ": failed: " << #cond << "\n";            \
+      ++s_failures;                                          \
+    }                                                        \
+  } while (0)
+
+
+inline void sleepMs(int ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+
+// Return a `w` by `h` image whose every pixel is `color`.
+inline PixelImage solidImage(int w, int h, std::uint32_t color)
+{
+  PixelImage img(w, h);
+  for (std::uint32_t &p : img.m_pixels) {
+    p = color;
+  }
+  return img;
+}
+
+
+// Return a `w` by `h` image of random pixels from `rng`.
+inline PixelImage randomImage(int w, int h, std::mt19937 &rng)
+{
+  PixelImage img(w, h);
+  for (std::uint32_t &p : img.m_pixels) {
+    p = rng();
+  }
+  return img;
+}
+
+
+// Return the whole of the next frame of `src`.
+inline PixelImage grabFrame(FrameSource &src)
+{
+  PixelImage img;
+  src.grabRegion(0, 0, src.width(), src.height(), img);
+  return img;
+}
+
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,322 @@
+// thread-pool-test.cc
+// Tests for `thread-pool`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "thread-pool.h"               // module under test
+
+#include "cpu-budget.h"                // threadCpuTimeNs
+#include "perf-counters.h"             // perfNowNs
+#include "test-util.h"                 // EXPECT
+
+#include <atomic>                      // std::atomic
+#include <iostream>                    // std::cout
+#include <memory>                      // std::shared_ptr
+#include <mutex>                       // std::{mutex, lock_guard}
+#include <set>                         // std::set
+#include <vector>                      // std::vector
+
+
+// Submit a task that occupies a worker until `release` is set or the
+// task is cancelled, and wait for it to start.
+static std::shared_ptr<PoolTask> blockWorker(ThreadPool &pool,
+                                             std::atomic<bool> &release)
+{
+  std::shared_ptr<PoolTask> task = pool.submit(TP_CAPTURE,
+    [&release](PoolTask const &self) {
+      while (!release && !self.isCancelled()) {
+        sleepMs(1);
+      }
+    });
+  while (task->state() == PoolTask::S_QUEUED) {
+    sleepMs(1);
+  }
+  return task;
+}
+
+
+// Every task runs exactly once.
+static void testRunsAll()
+{
+  ThreadPool pool(4);
+  EXPECT(pool.numWorkers() == 4);
+
+  std::atomic<int> count{0};
+  std::vector<std::shared_ptr<PoolTask>> tasks;
+  for (int i = 0; i < 1000; ++i) {
+    tasks.push_back(pool.submit((TaskPriority)(i % NUM_TASK_PRIORITIES),
+      [&count](PoolTask const &) { ++count; }));
+  }
+  pool.waitIdle();
+
+  EXPECT(count == 1000);
+  EXPECT(pool.outstandingCount() == 0);
+  for (auto const &t : tasks) {
+    EXPECT(t->state() == PoolTask::S_DONE);
+  }
+}
+
+
+// Queued tasks run in priority order, FIFO within a priority.
+static void testPriority()
+{
+  ThreadPool pool(1);
+
+  std::atomic<bool> release{false};
+  blockWorker(pool, release);
+
+  std::mutex mutex;
+  std::vector<int> order;
+  auto note = [&](int n) {
+    return [&, n](PoolTask const &) {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(n);
+    };
+  };
+
+  pool.submit(TP_MAINTENANCE, note(4));
+  pool.submit(TP_PREFETCH, note(3));
+  pool.submit(TP_VISIBLE, note(2));
+  pool.submit(TP_CAPTURE, note(0));
+  pool.submit(TP_CAPTURE, note(1));
+
+  release = true;
+  pool.waitIdle();
+
+  EXPECT((order == std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+
+// Cancelling a queued task stops it from running; cancelling a running
+// one lets it see the request.
+static void testCancel()
+{
+  ThreadPool pool(1);
+
+  std::atomic<bool> release{false};
+  std::shared_ptr<PoolTask> blocker = blockWorker(pool, release);
+
+  std::atomic<bool> ran{false};
+  std::shared_ptr<PoolTask> queued = pool.submit(TP_VISIBLE,
+    [&ran](PoolTask const &) { ran = true; });
+
+  EXPECT(queued->cancel());
+  EXPECT(queued->state() == PoolTask::S_CANCELLED);
+  EXPECT(queued->isFinished());
+
+  // The blocker is running, so it can only be asked to stop.
+  EXPECT(!blocker->cancel());
+  pool.waitIdle();
+
+  EXPECT(!ran);
+  EXPECT(blocker->state() == PoolTask::S_DONE);
+}
+
+
+// Work spawned by a worker gets stolen by the others.
+static void testStealing()
+{
+  ThreadPool pool(4);
+
+  std::mutex mutex;
+  std::set<int> workers;
+
+  pool.submit(TP_VISIBLE, [&](PoolTask const &) {
+    for (int i = 0; i < 64; ++i) {
+      pool.submit(TP_VISIBLE, [&](PoolTask const &) {
+        sleepMs(1);
+        std::lock_guard<std::mutex> lock(mutex);
+        workers.insert(ThreadPool::currentWorkerIndex());
+      });
+    }
+  });
+  pool.waitIdle();
+
+  EXPECT(workers.size() > 1);
+  EXPECT(ThreadPool::currentWorkerIndex() == -1);
+}
+
+
+// Only workers under the limit take tasks.
+static void testActiveLimit()
+{
+  ThreadPool pool(4);
+  pool.setActiveWorkerLimit(1);
+  EXPECT(pool.activeWorkerLimit() == 1);
+
+  std::mutex mutex;
+  std::set<int> workers;
+  for (int i = 0; i < 50; ++i) {
+    pool.submit(TP_PREFETCH, [&](PoolTask const &) {
+      std::lock_guard<std::mutex> lock(mutex);
+      workers.insert(ThreadPool::currentWorkerIndex());
+    });
+  }
+  pool.waitIdle();
+
+  EXPECT((workers == std::set<int>{0}));
+
+  pool.setActiveWorkerLimit(100);
+  EXPECT(pool.activeWorkerLimit() == 4);
+}
+
+
+// Destroying the pool cancels what has not started and asks running
+// tasks to stop.
+static void testShutdown()
+{
+  std::atomic<int> ran{0};
+  std::shared_ptr<PoolTask> blocker;
+  std::vector<std::shared_ptr<PoolTask>> queued;
+  {
+    ThreadPool pool(1);
+
+    std::atomic<bool> neverReleased{false};
+    blocker = blockWorker(pool, neverReleased);
+
+    for (int i = 0; i < 10; ++i) {
+      queued.push_back(pool.submit(TP_MAINTENANCE,
+        [&ran](PoolTask const &) { ++ran; }));
+    }
+  }
+
+  EXPECT(blocker->isCancelled());
+  EXPECT(ran == 0);
+  for (auto const &t : queued) {
+    EXPECT(t->state() == PoolTask::S_CANCELLED);
+  }
+}
+
+
+// Each worker runs the init function once, before any task.
+static void testWorkerInit()
+{
+  std::mutex mutex;
+  std::set<int> initialized;
+  std::atomic<bool> sawUninitialized{false};
+  {
+    ThreadPool pool(3, [&](int index) {
+      std::lock_guard<std::mutex> lock(mutex);
+      initialized.insert(index);
+    });
+    for (int i = 0; i < 30; ++i) {
+      pool.submit(TP_CAPTURE, [&](PoolTask const &) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!initialized.count(ThreadPool::currentWorkerIndex())) {
+          sawUninitialized = true;
+        }
+      });
+    }
+    pool.waitIdle();
+  }
+
+  EXPECT(initialized == (std::set<int>{0, 1, 2}));
+  EXPECT(!sawUninitialized);
+}
+
+
+// Tasks under a CPU budget are delayed, not dropped.
+static void testCpuBudget()
+{
+  ThreadPool pool(2);
+
+  // Half a core, averaged over 100 ms, so 50 ms of initial credit.
+  std::uint64_t const ms = 1000000;
+  pool.cpuBudget().setWindow(100 * ms, perfNowNs());
+  pool.cpuBudget().setLimit(0.5, perfNowNs());
+
+  std::atomic<int> ran{0};
+  std::uint64_t start = perfNowNs();
+  for (int i = 0; i < 10; ++i) {
+    pool.submit(TP_MAINTENANCE, [&](PoolTask const &) {
+      std::uint64_t cpuStart = threadCpuTimeNs();
+      while (threadCpuTimeNs() - cpuStart < 20 * ms) {}
+      ++ran;
+    });
+  }
+  pool.waitIdle();
+  std::uint64_t elapsed = perfNowNs() - start;
+
+  // 200 ms of work, less 50 ms of credit, at half a core.
+  EXPECT(ran == 10);
+  EXPECT(elapsed >= 250 * ms);
+}
+
+
+// Capture work is neither held back by a budget in debt nor charged to
+// it.
+static void testCpuBudgetExempt()
+{
+  ThreadPool pool(1);
+
+  // A tenth of a core, averaged over 100 ms, so 10 ms of initial
+  // credit, which the first maintenance task overspends.
+  std::uint64_t const ms = 1000000;
+  pool.cpuBudget().setWindow(100 * ms, perfNowNs());
+  pool.cpuBudget().setLimit(0.1, perfNowNs());
+
+  std::atomic<int> ran{0};
+  for (int i = 0; i < 3; ++i) {
+    pool.submit(TP_MAINTENANCE, [&](PoolTask const &) {
+      std::uint64_t cpuStart = threadCpuTimeNs();
+      while (threadCpuTimeNs() - cpuStart < 20 * ms) {}
+      ++ran;
+    });
+  }
+  while (ran == 0) {
+    sleepMs(1);
+  }
+
+  // The budget now needs about 100 ms to recover, but capture work
+  // runs straight away.
+  std::atomic<std::uint64_t> latency{0};
+  std::atomic<int> ranBefore{-1};
+  std::uint64_t submitted = perfNowNs();
+  pool.submit(TP_CAPTURE, [&](PoolTask const &) {
+    latency = perfNowNs() - submitted;
+    ranBefore = ran.load();
+    std::uint64_t cpuStart = threadCpuTimeNs();
+    while (threadCpuTimeNs() - cpuStart < 20 * ms) {}
+  });
+  pool.waitIdle();
+
+  EXPECT(ran == 3);
+  EXPECT(ranBefore == 1);
+  EXPECT(latency < 50 * ms);
+
+  // With the budget full again, a capture task leaves it full.
+  pool.cpuBudget().setLimit(0, perfNowNs());
+  pool.cpuBudget().setLimit(0.1, perfNowNs());
+  pool.submit(TP_CAPTURE, [&](PoolTask const &) {
+    std::uint64_t cpuStart = threadCpuTimeNs();
+    while (threadCpuTimeNs() - cpuStart < 20 * ms) {}
+  });
+  pool.waitIdle();
+  EXPECT(pool.cpuBudget().balanceNs(perfNowNs()) == 10 * (std::int64_t)ms);
+}
+
+
+int main()
+{
+  testRunsAll();
+  testPriority();
+  testCancel();
+  testStealing();
+  testActiveLimit();
+  testShutdown();
+  testWorkerInit();
+  testCpuBudget();
+  testCpuBudgetExempt();
+
+  if (s_failures) {
+    std::cout << "thread-pool-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "thread-pool-test: ok\n";
+  return 0;
+}
+
+
+// EOF
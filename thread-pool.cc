@@ -0,0 +1,343 @@
+// thread-pool.cc
+// Code for `thread-pool` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "thread-pool.h"               // this module
+
+#include "perf-counters.h"             // perfNowNs, etc.
+
+#include <algorithm>                   // std::{clamp, max}
+#include <cassert>                     // assert
+#include <chrono>                      // std::chrono
+#include <utility>                     // std::move
+
+
+// The pool the calling thread works for, if any, and its index there.
+static thread_local ThreadPool *t_pool = nullptr;
+static thread_local int t_workerIndex = -1;
+
+
+// ----------------------------- PoolTask ------------------------------
+PoolTask::PoolTask(TaskPriority priority, Func func)
+  : m_func(std::move(func)),
+    m_priority(priority),
+    m_state(S_QUEUED),
+    m_cancelRequested(false)
+{}
+
+
+bool PoolTask::cancel()
+{
+  m_cancelRequested.store(true, std::memory_order_relaxed);
+
+  State expect = S_QUEUED;
+  return m_state.compare_exchange_strong(expect, S_CANCELLED);
+}
+
+
+void PoolTask::run()
+{
+  State expect = S_QUEUED;
+  if (!m_state.compare_exchange_strong(expect, S_RUNNING)) {
+    // Cancelled.
+    assert(expect == S_CANCELLED);
+  }
+  else {
+    m_func(*this);
+    m_state.store(S_DONE);
+  }
+
+  // Release whatever the work captured now rather than when the last
+  // handle goes away.
+  m_func = nullptr;
+}
+
+
+// ---------------------------- ThreadPool -----------------------------
+ThreadPool::ThreadPool(int numWorkers, WorkerInitFunc workerInit)
+  : m_cpuBudget(),
+    m_shared(),
+    m_workers(),
+    m_activeLimit(std::max(1, numWorkers)),
+    m_queuedCount(0),
+    m_outstandingCount(0),
+    m_queuedUnbudgetedCount(0),
+    m_sleepMutex(),
+    m_workCV(),
+    m_idleCV(),
+    m_stopRequested(false)
+{
+  numWorkers = std::max(1, numWorkers);
+
+  // Create all the workers before starting any, since they look at
+  // each other's deques.
+  for (int i = 0; i < numWorkers; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+  for (int i = 0; i < numWorkers; ++i) {
+    m_workers[i]->m_thread = std::thread([this, i, workerInit] {
+      if (workerInit) {
+        workerInit(i);
+      }
+      workerMain(i);
+    });
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_stopRequested = true;
+  }
+  m_workCV.notify_all();
+
+  for (auto &w : m_workers) {
+    std::lock_guard<std::mutex> lock(w->m_local.m_mutex);
+    if (w->m_current) {
+      w->m_current->cancel();
+    }
+  }
+
+  for (auto &w : m_workers) {
+    w->m_thread.join();
+  }
+
+  // Cancel whatever is left.
+  auto cancelAll = [](TaskQueues &queues) {
+    std::lock_guard<std::mutex> lock(queues.m_mutex);
+    for (auto &q : queues.m_queues) {
+      for (TaskPtr const &task : q) {
+        task->cancel();
+        task->run();
+      }
+      q.clear();
+    }
+  };
+  cancelAll(m_shared);
+  for (auto &w : m_workers) {
+    cancelAll(w->m_local);
+  }
+}
+
+
+/*static*/ int ThreadPool::defaultWorkerCount()
+{
+  return std::max(1, (int)std::thread::hardware_concurrency() - 1);
+}
+
+
+void ThreadPool::setActiveWorkerLimit(int n)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_activeLimit = std::clamp(n, 1, numWorkers());
+  }
+  m_workCV.notify_all();
+}
+
+
+std::shared_ptr<PoolTask> ThreadPool::submit(TaskPriority priority,
+                                             PoolTask::Func func)
+{
+  assert(0 <= priority && priority < NUM_TASK_PRIORITIES);
+
+  TaskPtr task = std::make_shared<PoolTask>(priority, std::move(func));
+
+  // Count first, so the count never lags the queues and a worker that
+  // sees zero can safely sleep.
+  ++m_outstandingCount;
+  ++m_queuedCount;
+  if (priority < c_firstBudgetedPriority) {
+    ++m_queuedUnbudgetedCount;
+  }
+
+  TaskQueues &queues =
+    t_pool == this? m_workers[t_workerIndex]->m_local : m_shared;
+  {
+    std::lock_guard<std::mutex> lock(queues.m_mutex);
+    queues.m_queues[priority].push_back(task);
+  }
+
+  wakeOne();
+  return task;
+}
+
+
+void ThreadPool::wakeOne()
+{
+  // Taking the lock orders this with a worker's check of the counts
+  // before it sleeps.
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+  }
+  m_workCV.notify_one();
+}
+
+
+void ThreadPool::waitIdle()
+{
+  assert(t_pool != this);
+
+  std::unique_lock<std::mutex> lock(m_sleepMutex);
+  m_idleCV.wait(lock, [this] { return m_outstandingCount == 0; });
+}
+
+
+/*static*/ int ThreadPool::currentWorkerIndex()
+{
+  return t_workerIndex;
+}
+
+
+/*static*/ ThreadPool::TaskPtr ThreadPool::takeFront(
+  TaskQueues &queues, int p)
+{
+  std::lock_guard<std::mutex> lock(queues.m_mutex);
+  std::deque<TaskPtr> &q = queues.m_queues[p];
+  if (q.empty()) {
+    return nullptr;
+  }
+  TaskPtr ret = std::move(q.front());
+  q.pop_front();
+  return ret;
+}
+
+
+/*static*/ ThreadPool::TaskPtr ThreadPool::takeBack(
+  TaskQueues &queues, int p)
+{
+  std::lock_guard<std::mutex> lock(queues.m_mutex);
+  std::deque<TaskPtr> &q = queues.m_queues[p];
+  if (q.empty()) {
+    return nullptr;
+  }
+  TaskPtr ret = std::move(q.back());
+  q.pop_back();
+  return ret;
+}
+
+
+ThreadPool::TaskPtr ThreadPool::findTask(int index,
+                                         std::uint64_t &throttleNs)
+{
+  int n = numWorkers();
+  throttleNs = 0;
+
+  for (int p = 0; p < NUM_TASK_PRIORITIES; ++p) {
+    if (p == c_firstBudgetedPriority) {
+      throttleNs = m_cpuBudget.delayNs(perfNowNs());
+      if (throttleNs > 0) {
+        return nullptr;
+      }
+    }
+
+    // Newest of our own.
+    if (TaskPtr t = takeBack(m_workers[index]->m_local, p)) {
+      return t;
+    }
+
+    // Oldest submitted from outside.
+    if (TaskPtr t = takeFront(m_shared, p)) {
+      return t;
+    }
+
+    // Oldest of another worker's, starting with our neighbor so the
+    // thieves spread out.
+    for (int i = 1; i < n; ++i) {
+      if (TaskPtr t = takeFront(m_workers[(index + i) % n]->m_local, p)) {
+        return t;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+
+void ThreadPool::workerMain(int index)
+{
+  t_pool = this;
+  t_workerIndex = index;
+  Worker &self = *m_workers[index];
+
+  static PerfCounter &cpuTime = perfCounter("pool.cpu.ns");
+  static LatencyHistogram &throttled = perfHistogram("pool.throttled.ns");
+
+  for (;;) {
+    TaskPtr task;
+    std::uint64_t throttleNs = 0;
+    if (index < m_activeLimit.load()) {
+      task = findTask(index, throttleNs);
+    }
+
+    if (task) {
+      --m_queuedCount;
+      bool budgeted = task->priority() >= c_firstBudgetedPriority;
+      if (!budgeted) {
+        --m_queuedUnbudgetedCount;
+      }
+      if (m_stopRequested) {
+        // The pool is shutting down.
+        task->cancel();
+      }
+      {
+        std::lock_guard<std::mutex> lock(self.m_local.m_mutex);
+        self.m_current = task;
+      }
+
+      std::uint64_t cpuStart = threadCpuTimeNs();
+      task->run();
+      std::uint64_t cpuUsed = threadCpuTimeNs() - cpuStart;
+      if (budgeted) {
+        m_cpuBudget.charge(cpuUsed, perfNowNs());
+      }
+      cpuTime.add(cpuUsed);
+
+      {
+        std::lock_guard<std::mutex> lock(self.m_local.m_mutex);
+        self.m_current.reset();
+      }
+      task.reset();
+
+      if (--m_outstandingCount == 0) {
+        {
+          std::lock_guard<std::mutex> lock(m_sleepMutex);
+        }
+        m_idleCV.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    if (throttleNs > 0) {
+      // Only more urgent work is worth waking for before the budget
+      // recovers.
+      std::uint64_t start = perfNowNs();
+      m_workCV.wait_for(lock, std::chrono::nanoseconds(throttleNs),
+        [this, index] {
+          return m_stopRequested ||
+                 (m_queuedUnbudgetedCount > 0 &&
+                  index < m_activeLimit.load());
+        });
+      throttled.record(perfNowNs() - start);
+    }
+    else {
+      m_workCV.wait(lock, [this, index] {
+        return m_stopRequested ||
+               (m_queuedCount > 0 && index < m_activeLimit.load());
+      });
+    }
+    if (m_stopRequested) {
+      break;
+    }
+  }
+
+  t_pool = nullptr;
+  t_workerIndex = -1;
+}
+
+
+// EOF
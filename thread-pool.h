@@ -0,0 +1,246 @@
+// thread-pool.h
+// Work-stealing thread pool with priority classes and cancellation.
+
+// See license.txt for copyright and terms of use.
+
+// All background image work (capture, encoding, decoding, scaling)
+// goes through one `ThreadPool` so it competes in one place, under one
+// worker limit, rather than across ad-hoc threads.
+//
+// Each worker has its own deque per priority.  Tasks submitted from a
+// worker go on that worker's deque and it takes them back newest-first,
+// which keeps follow-on work on a warm cache.  Tasks submitted from
+// other threads go on a shared queue.  An idle worker takes the
+// highest-priority task it can find: its own deques first, then the
+// shared queue, then the oldest task from another worker.
+//
+// Prefetch and maintenance tasks run under the pool's `CpuBudget`: they
+// are only started while it has credit, and are charged the CPU time
+// they used.  Capture and visible work is neither charged nor delayed,
+// and while the budget is in debt, workers skip the budgeted tasks
+// rather than waiting on one, so they stay free for urgent work.
+// Thread priority and core affinity are platform matters, so the
+// creator supplies them through a function each worker runs first.
+//
+// This module does not depend on the Windows API.  To deliver results
+// to the UI thread, a task should post them there; see
+// `SLMainWindow::runOnUIThread`.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "cpu-budget.h"                // CpuBudget
+#include "sm-macros.h"                 // NO_OBJECT_COPIES
+
+#include <atomic>                      // std::atomic
+#include <condition_variable>          // std::condition_variable
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::uint64_t
+#include <deque>                       // std::deque
+#include <functional>                  // std::function
+#include <memory>                      // std::{shared_ptr, unique_ptr}
+#include <mutex>                       // std::mutex
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+
+// Priority classes, most urgent first.
+enum TaskPriority {
+  // Work a capture in progress is waiting on.
+  TP_CAPTURE,
+
+  // Thumbnails and other results the user can currently see.
+  TP_VISIBLE,
+
+  // Results the user will probably want soon.
+  TP_PREFETCH,
+
+  // Recompression, indexing and other housekeeping.
+  TP_MAINTENANCE,
+
+  NUM_TASK_PRIORITIES
+};
+
+
+// Tasks at this priority or less urgent run under the pool's
+// `CpuBudget`.
+TaskPriority const c_firstBudgetedPriority = TP_PREFETCH;
+
+
+// One unit of work.  The submitter gets a shared pointer to it, which it
+// can use to cancel it or see whether it is done.
+class PoolTask {
+  NO_OBJECT_COPIES(PoolTask);
+
+public:      // types
+  // The work to do.  It receives its own task so that long work can
+  // poll `isCancelled`.
+  using Func = std::function<void (PoolTask const &)>;
+
+  enum State {
+    S_QUEUED,
+    S_RUNNING,
+    S_DONE,
+
+    // Cancelled before it started, so it will never run.
+    S_CANCELLED,
+  };
+
+private:     // data
+  Func m_func;
+
+  TaskPriority const m_priority;
+
+  std::atomic<State> m_state;
+
+  // Set by `cancel`, even if the task has already started.
+  std::atomic<bool> m_cancelRequested;
+
+  friend class ThreadPool;
+
+public:      // methods
+  PoolTask(TaskPriority priority, Func func);
+
+  TaskPriority priority() const { return m_priority; }
+
+  State state() const { return m_state.load(); }
+
+  // True once the task has finished running or been cancelled.
+  bool isFinished() const
+    { State s = state(); return s == S_DONE || s == S_CANCELLED; }
+
+  // Ask the task not to run, or, if it is running, to stop early.
+  // Returns true if it had not started, in which case it never will.
+  bool cancel();
+
+  // True if `cancel` has been called.  Long-running work should check
+  // this periodically and return early.
+  bool isCancelled() const
+    { return m_cancelRequested.load(std::memory_order_relaxed); }
+
+private:     // methods
+  // Run the task unless it was cancelled.  Called by the pool.
+  void run();
+};
+
+
+class ThreadPool {
+  NO_OBJECT_COPIES(ThreadPool);
+
+public:      // types
+  // Run by each worker, with its index, before it takes any tasks.
+  using WorkerInitFunc = std::function<void (int)>;
+
+private:     // types
+  using TaskPtr = std::shared_ptr<PoolTask>;
+
+  // Tasks of each priority.
+  struct TaskQueues {
+    std::mutex m_mutex;
+    std::deque<TaskPtr> m_queues[NUM_TASK_PRIORITIES];
+  };
+
+  // A worker thread and its deques.
+  struct Worker {
+    TaskQueues m_local;
+
+    // Task being run, if any.  Guarded by `m_local.m_mutex`.
+    TaskPtr m_current;
+
+    std::thread m_thread;
+  };
+
+private:     // data
+  // Limits the CPU time budgeted tasks together may use.
+  CpuBudget m_cpuBudget;
+
+  // Tasks submitted from outside the pool.
+  TaskQueues m_shared;
+
+  // Fixed once constructed.
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  // Only workers with index below this take tasks.
+  std::atomic<int> m_activeLimit;
+
+  // Number of tasks queued but not yet taken, and the number queued or
+  // running.
+  std::atomic<std::size_t> m_queuedCount;
+  std::atomic<std::size_t> m_outstandingCount;
+
+  // Number of queued tasks more urgent than `c_firstBudgetedPriority`,
+  // which wake a worker that is waiting for the budget.
+  std::atomic<std::size_t> m_queuedUnbudgetedCount;
+
+  // Protects sleeping and waking: idle workers, including those waiting
+  // for the budget, wait on `m_workCV`, and `waitIdle` waits on
+  // `m_idleCV`.
+  std::mutex m_sleepMutex;
+  std::condition_variable m_workCV;
+  std::condition_variable m_idleCV;
+
+  // Set by the destructor.
+  std::atomic<bool> m_stopRequested;
+
+private:     // methods
+  // Body of worker `index`.
+  void workerMain(int index);
+
+  // Find the next task for worker `index`, or return null.  Budgeted
+  // tasks are only taken while `m_cpuBudget` has credit.  Otherwise,
+  // set `throttleNs` to how long until it will.
+  TaskPtr findTask(int index, std::uint64_t &throttleNs /*OUT*/);
+
+  // Remove and return a task from the front (oldest) or back (newest)
+  // of `queues`, at exactly priority `p`, or return null.
+  static TaskPtr takeFront(TaskQueues &queues, int p);
+  static TaskPtr takeBack(TaskQueues &queues, int p);
+
+  // Wake one idle worker.
+  void wakeOne();
+
+public:      // methods
+  // Start `numWorkers` threads (at least 1), each of which first runs
+  // `workerInit` if it is not empty.
+  explicit ThreadPool(int numWorkers,
+                      WorkerInitFunc workerInit = WorkerInitFunc());
+
+  // Cancel queued tasks and join the workers.  Running tasks are asked
+  // to stop, and are waited for.
+  ~ThreadPool();
+
+  // A reasonable worker count for this machine: one fewer than the
+  // number of hardware threads, leaving one for the game, but at least
+  // one.
+  static int defaultWorkerCount();
+
+  int numWorkers() const { return (int)m_workers.size(); }
+
+  // Limit how many workers take tasks, between 1 and `numWorkers()`.
+  // Workers above the limit finish their current task and then idle.
+  void setActiveWorkerLimit(int n);
+  int activeWorkerLimit() const { return m_activeLimit.load(); }
+
+  // The budget prefetch and maintenance tasks run under.  It initially
+  // has no limit.
+  CpuBudget &cpuBudget() { return m_cpuBudget; }
+
+  // Queue `func` to run at `priority`.  This can be called from any
+  // thread, including workers.
+  std::shared_ptr<PoolTask> submit(TaskPriority priority,
+                                   PoolTask::Func func);
+
+  // Number of tasks queued or running.
+  std::size_t outstandingCount() const { return m_outstandingCount.load(); }
+
+  // Block until no tasks are queued or running.  Must not be called
+  // from a worker.
+  void waitIdle();
+
+  // Return the index of the calling worker in the pool it belongs to,
+  // or -1 if it is not a pool worker.
+  static int currentWorkerIndex();
+};
+
+
+#endif // THREAD_POOL_H
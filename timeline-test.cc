@@ -0,0 +1,115 @@
+// timeline-test.cc
+// Tests for `timeline`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.
+
+#include "timeline.h"                  // module under test
+
+#include "json.hpp"                    // json::JSON
+#include "test-util.h"                 // EXPECT
+
+#include <iostream>                    // std::cout
+#include <string>                      // std::string
+#include <thread>                      // std::thread
+
+using json::JSON;
+
+
+// Return the first complete event in `doc` called `name`, or null.
+static JSON const *findEvent(JSON const &doc, std::string const &name)
+{
+  JSON const &events = doc.at("traceEvents");
+  for (int i = 0; i < events.length(); ++i) {
+    JSON const &ev = events.at(i);
+    if (ev.at("ph").ToString() == "X" && ev.at("name").ToString() == name) {
+      return &ev;
+    }
+  }
+  return nullptr;
+}
+
+
+static void testSpans()
+{
+  clearTimeline();
+
+  // Not recorded while disabled.
+  {
+    TIMELINE_SPAN("ignored");
+  }
+  EXPECT(timelineEventCount() == 0);
+
+  setTimelineEnabled(true);
+  setTimelineThreadName("main");
+
+  {
+    TIMELINE_SPAN("outer");
+    sleepMs(2);
+    {
+      TIMELINE_SPAN("inner \"quoted\"");
+      sleepMs(2);
+    }
+  }
+
+  std::thread worker([]() {
+    setTimelineThreadName("worker");
+    TIMELINE_SPAN("work");
+    sleepMs(1);
+  });
+  worker.join();
+
+  setTimelineEnabled(false);
+  EXPECT(timelineEventCount() == 3);
+  EXPECT(timelineDroppedCount() == 0);
+
+  JSON doc = JSON::Load(timelineToChromeJSON());
+  JSON const *outer = findEvent(doc, "outer");
+  JSON const *inner = findEvent(doc, "inner \\\"quoted\\\"");
+  JSON const *work = findEvent(doc, "work");
+  EXPECT(outer && inner && work);
+  if (!outer || !inner || !work) {
+    return;
+  }
+
+  // Nesting is visible in the times.
+  double outerStart = outer->at("ts").ToFloat();
+  double outerEnd = outerStart + outer->at("dur").ToFloat();
+  double innerStart = inner->at("ts").ToFloat();
+  double innerEnd = innerStart + inner->at("dur").ToFloat();
+  EXPECT(outerStart <= innerStart && innerEnd <= outerEnd);
+  EXPECT(inner->at("dur").ToFloat() >= 2000.0);
+
+  // Threads are distinguished and named.
+  EXPECT(outer->at("tid").ToInt() == inner->at("tid").ToInt());
+  EXPECT(outer->at("tid").ToInt() != work->at("tid").ToInt());
+
+  int names = 0;
+  JSON const &events = doc.at("traceEvents");
+  for (int i = 0; i < events.length(); ++i) {
+    if (events.at(i).at("ph").ToString() == "M") {
+      ++names;
+    }
+  }
+  EXPECT(names == 2);
+
+  clearTimeline();
+  EXPECT(timelineEventCount() == 0);
+}
+
+
+int main()
+{
+  testSpans();
+
+  if (s_failures) {
+    std::cout << "timeline-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "timeline-test: ok\n";
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,209 @@
+// timeline.cc
+// Code for `timeline` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "timeline.h"                  // this module
+
+#include <algorithm>                   // std::min
+#include <cerrno>                      // errno
+#include <chrono>                      // std::chrono
+#include <cstring>                     // std::strerror
+#include <fstream>                     // std::ofstream
+#include <iomanip>                     // std::setprecision
+#include <map>                         // std::map
+#include <mutex>                       // std::{mutex, lock_guard}
+#include <sstream>                     // std::ostringstream
+#include <vector>                      // std::vector
+
+
+std::atomic<bool> g_timelineEnabled{false};
+
+thread_local std::atomic<char const*> *t_timelineActiveSpan = nullptr;
+
+
+// Maximum number of events kept.  At 32 bytes each this bounds the
+// buffer at 8 MiB.
+static std::size_t const c_maxEvents = 256 * 1024;
+
+// Protects the data below.
+static std::mutex s_mutex;
+
+// Finished spans, in the order they finished.
+static std::vector<TimelineEvent> s_events;
+
+// Number of events discarded because `s_events` was full.
+static std::size_t s_dropped = 0;
+
+// Names given to threads, by ID.
+static std::map<std::uint32_t, char const *> s_threadNames;
+
+// Next thread ID to hand out.
+static std::atomic<std::uint32_t> s_nextThreadID{1};
+
+
+// ---------------------------- TimelineSpan ----------------------------
+/*static*/ std::uint64_t TimelineSpan::timelineNowNs()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void TimelineSpan::finish()
+{
+  TimelineEvent ev;
+  ev.m_name = m_name;
+  ev.m_startNs = m_startNs;
+  ev.m_durationNs = timelineNowNs() - m_startNs;
+  ev.m_tid = timelineThreadID();
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  if (s_events.size() < c_maxEvents) {
+    s_events.push_back(ev);
+  }
+  else {
+    ++s_dropped;
+  }
+}
+
+
+// ------------------------------ Control ------------------------------
+std::uint32_t timelineThreadID()
+{
+  static thread_local std::uint32_t tid = s_nextThreadID++;
+  return tid;
+}
+
+
+void setTimelineThreadName(char const *name)
+{
+  std::uint32_t tid = timelineThreadID();
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_threadNames[tid] = name;
+}
+
+
+void setTimelineEnabled(bool enabled)
+{
+  g_timelineEnabled.store(enabled);
+}
+
+
+void clearTimeline()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_events.clear();
+  s_dropped = 0;
+}
+
+
+std::size_t timelineEventCount()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_events.size();
+}
+
+
+std::size_t timelineDroppedCount()
+{
+  std::lock_guard<std::mutex> lock(s_mutex);
+  return s_dropped;
+}
+
+
+// ------------------------------- Export -------------------------------
+// Write `s` as a JSON string literal.
+static void writeJSONString(std::ostream &os, char const *s)
+{
+  os << '"';
+  for (; *s; ++s) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    }
+    else if (c < 0x20) {
+      os << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+         << (int)c << std::dec << std::setfill(' ');
+    }
+    else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+
+std::string timelineToChromeJSON()
+{
+  std::vector<TimelineEvent> events;
+  std::map<std::uint32_t, char const *> threadNames;
+  std::size_t dropped;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    events = s_events;
+    threadNames = s_threadNames;
+    dropped = s_dropped;
+  }
+
+  // Make times relative to the earliest start so the numbers are small.
+  std::uint64_t origin = events.empty()? 0 : events.front().m_startNs;
+  for (TimelineEvent const &ev : events) {
+    origin = std::min(origin, ev.m_startNs);
+  }
+
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(3);
+  oss << "{\"traceEvents\":[\n";
+
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) {
+      oss << ",\n";
+    }
+    first = false;
+  };
+
+  // Thread names are "metadata" events.
+  for (auto const &kv : threadNames) {
+    separator();
+    oss << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+        << kv.first << ",\"args\":{\"name\":";
+    writeJSONString(oss, kv.second);
+    oss << "}}";
+  }
+
+  // Each span is a "complete" event, with times in microseconds.
+  for (TimelineEvent const &ev : events) {
+    separator();
+    oss << "{\"name\":";
+    writeJSONString(oss, ev.m_name);
+    oss << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.m_tid
+        << ",\"ts\":" << (ev.m_startNs - origin) / 1000.0
+        << ",\"dur\":" << ev.m_durationNs / 1000.0 << "}";
+  }
+
+  oss << "\n],\n\"displayTimeUnit\":\"ms\",\n"
+      << "\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+
+  return oss.str();
+}
+
+
+std::string saveTimelineToFile(std::string const &fname)
+{
+  std::string serialized = timelineToChromeJSON();
+
+  std::ofstream out(fname, std::ios::binary);
+  if (out) {
+    out << serialized;
+    return "";
+  }
+  else {
+    return std::strerror(errno);
+  }
+}
+
+
+// EOF
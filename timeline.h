@@ -0,0 +1,134 @@
+// timeline.h
+// Record timed spans and export them as Chrome trace events.
+
+// See license.txt for copyright and terms of use.
+
+// A `TimelineSpan` measures the lifetime of a scope.  While recording
+// is enabled, each finished span is appended, with its thread, to an
+// in-memory buffer, which can then be written in the Chrome
+// `trace_event` JSON format and loaded into chrome://tracing or
+// https://ui.perfetto.dev to see where a session's time went.
+//
+// When recording is disabled, a span costs one relaxed atomic load,
+// plus a thread-local load to see whether the thread publishes its
+// active span (see `t_timelineActiveSpan`).
+//
+// This module does not depend on the Windows API.
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "sm-macros.h"                 // SMBASE_PP_CAT
+
+#include <atomic>                      // std::atomic
+#include <cstddef>                     // std::size_t
+#include <cstdint>                     // std::{uint32_t, uint64_t}
+#include <string>                      // std::string
+
+
+// True while finished spans are being recorded.
+extern std::atomic<bool> g_timelineEnabled;
+
+// If not null, the calling thread stores the name of its innermost open
+// span here, or null when no span is open, so that another thread (the
+// stall watchdog) can see what this one is doing.  Spans are published
+// whether or not recording is enabled.
+extern thread_local std::atomic<char const*> *t_timelineActiveSpan;
+
+
+// One finished span.
+struct TimelineEvent {
+  // Span name.  This must be a string with static storage duration,
+  // normally a literal.
+  char const *m_name;
+
+  // Start time and duration in nanoseconds.  The start is relative to
+  // an arbitrary fixed origin.
+  std::uint64_t m_startNs;
+  std::uint64_t m_durationNs;
+
+  // Small integer identifying the thread; see `timelineThreadID`.
+  std::uint32_t m_tid;
+};
+
+
+// Measure the time from construction to destruction.
+class TimelineSpan {
+  TimelineSpan(TimelineSpan const &obj) = delete;
+  TimelineSpan &operator=(TimelineSpan const &obj) = delete;
+
+private:     // data
+  // Static name of the span.
+  char const *m_name;
+
+  // Start time, or 0 if recording was disabled when the span began.
+  std::uint64_t m_startNs;
+
+  // Active span published before this one, restored on destruction.
+  // Only meaningful if `t_timelineActiveSpan` is set.
+  char const *m_outerActiveSpan;
+
+public:      // methods
+  explicit TimelineSpan(char const *name)
+    : m_name(name),
+      m_startNs(g_timelineEnabled.load(std::memory_order_relaxed)?
+                  timelineNowNs() : 0),
+      m_outerActiveSpan(nullptr)
+  {
+    if (std::atomic<char const*> *active = t_timelineActiveSpan) {
+      m_outerActiveSpan = active->exchange(name, std::memory_order_relaxed);
+    }
+  }
+
+  ~TimelineSpan()
+  {
+    if (std::atomic<char const*> *active = t_timelineActiveSpan) {
+      active->store(m_outerActiveSpan, std::memory_order_relaxed);
+    }
+    if (m_startNs) {
+      finish();
+    }
+  }
+
+  // Current time on the timeline clock, in nanoseconds.
+  static std::uint64_t timelineNowNs();
+
+private:     // methods
+  // Record the event.
+  void finish();
+};
+
+
+// Time the rest of the enclosing scope as a span called `name`.
+#define TIMELINE_SPAN(name) \
+  TimelineSpan SMBASE_PP_CAT(timelineSpan_,__LINE__)(name) /* user ; */
+
+
+// Return the small integer, assigned sequentially on first use,
+// identifying the calling thread in timeline events.
+std::uint32_t timelineThreadID();
+
+// Name the calling thread in exported timelines.  `name` must have
+// static storage duration.
+void setTimelineThreadName(char const *name);
+
+// Start or stop recording spans.  Stopping keeps what was recorded.
+void setTimelineEnabled(bool enabled);
+
+// Discard all recorded events.
+void clearTimeline();
+
+// Number of events recorded, and the number dropped because the
+// buffer was full.
+std::size_t timelineEventCount();
+std::size_t timelineDroppedCount();
+
+// Return the recorded events as a Chrome `trace_event` JSON document.
+std::string timelineToChromeJSON();
+
+// Write `timelineToChromeJSON()` to `fname`.  Return a non-empty error
+// message on failure.
+std::string saveTimelineToFile(std::string const &fname);
+
+
+#endif // TIMELINE_H
@@ -0,0 +1,192 @@
+// trace-log-test.cc
+// Tests for `trace-log`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.  With "bench", it also measures
+// the cost of recording on the calling thread.
+
+#include "trace-log.h"                 // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <iostream>                    // std::{cout, wostream}
+#include <sstream>                     // std::wostringstream
+#include <string>                      // std::{string, wstring}
+#include <thread>                      // std::thread
+#include <vector>                      // std::vector
+
+
+// Capture output in `s_out` for the duration of a test.
+static std::wostringstream s_out;
+
+static std::wstring takeOutput()
+{
+  flushTraceLog();
+  std::wstring ret = s_out.str();
+  s_out.str(L"");
+  return ret;
+}
+
+
+// Something that is not stored in binary form.
+enum class Color { RED };
+
+static std::wostream &operator<<(std::wostream &os, Color)
+{
+  return os << L"red";
+}
+
+
+// Records must format the same way `std::wcerr << msg` would have.
+static void testFormatting()
+{
+  int i = -3;
+  unsigned long long u = 18446744073709551615ull;
+  wchar_t buf[20] = L"buffer";
+  std::wstring ws = L"wide";
+  std::string ns = "narrow";
+
+  TRACE_LOG_RECORD(1, L"int:" << i << " u=" << u << L' ' << 'c');
+  TRACE_LOG_RECORD(1, L"d=" << 1.5 << L" b=" << true << L" " << buf);
+  TRACE_LOG_RECORD(1, ws << L"," << ns << L"," << Color::RED);
+
+  EXPECT(takeOutput() ==
+    L"int:-3 u=18446744073709551615 c\n"
+    L"d=1.5 b=1 buffer\n"
+    L"wide,narrow,red\n");
+}
+
+
+// A record longer than a slot is cut off with "...".
+static void testTruncation()
+{
+  std::wstring big(1000, L'x');
+  TRACE_LOG_RECORD(1, L"big:" << big << L"never");
+  std::wstring out = takeOutput();
+  EXPECT(out.substr(0, 8) == L"big:xxxx");
+  EXPECT(out.size() < 300);
+  EXPECT(out.substr(out.size()-4) == L"...\n");
+}
+
+
+// Records from several threads all arrive, in order per thread.
+static void testThreads()
+{
+  int const numThreads = 4;
+  int const perThread = 200;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < perThread; ++i) {
+        TRACE_LOG_RECORD(1, L"t" << t << L" " << i);
+      }
+    });
+  }
+  for (auto &th : threads) {
+    th.join();
+  }
+
+  std::wistringstream in(takeOutput());
+  std::vector<int> next(numThreads, 0);
+  std::wstring line;
+  int count = 0;
+  while (std::getline(in, line)) {
+    int t = line[1] - L'0';
+    int i = std::stoi(line.substr(3));
+    EXPECT(0 <= t && t < numThreads && next[t] == i);
+    next[t] = i+1;
+    ++count;
+  }
+  EXPECT(count == numThreads * perThread);
+}
+
+
+// Overfilling a ring drops records and reports that.
+static void testDrops()
+{
+  std::uint64_t before = traceLogDroppedCount();
+
+  // This records far faster than the drain thread, which wakes every
+  // 10 ms, can keep up with.
+  for (int i = 0; i < 5000; ++i) {
+    TRACE_LOG_RECORD(1, L"flood " << i);
+  }
+
+  std::wstring out = takeOutput();
+  if (traceLogDroppedCount() > before) {
+    EXPECT(out.find(L"records dropped]") != std::wstring::npos);
+  }
+}
+
+
+// Measure recording cost on the calling thread, in batches that fit in
+// the ring so nothing is dropped.
+static void bench()
+{
+  int const batch = 512;
+  int const batches = 2000;
+
+  std::wostream nullOut(nullptr);
+  setTraceLogOutput(&nullOut);
+
+  using Clock = std::chrono::steady_clock;
+  Clock::duration asyncTime{};
+  for (int b = 0; b < batches; ++b) {
+    auto start = Clock::now();
+    for (int i = 0; i < batch; ++i) {
+      TRACE_LOG_RECORD(3, L"setVScrollInfo:" <<
+        L" contentHeight=" << i << L" max=" << b << L" pos=" << 7);
+    }
+    asyncTime += Clock::now() - start;
+    flushTraceLog();
+  }
+
+  auto start = Clock::now();
+  for (int b = 0; b < batches; ++b) {
+    for (int i = 0; i < batch; ++i) {
+      nullOut << L"setVScrollInfo:" <<
+        L" contentHeight=" << i << L" max=" << b << L" pos=" << 7
+        << std::endl;
+    }
+  }
+  Clock::duration syncTime = Clock::now() - start;
+
+  auto nsPer = [&](Clock::duration d) {
+    return std::chrono::duration<double, std::nano>(d).count() /
+           (batch * batches);
+  };
+  std::cout << "async record:        " << nsPer(asyncTime) << " ns\n";
+  std::cout << "format+endl inline:  " << nsPer(syncTime)
+            << " ns (to a null stream; a console is far slower)\n";
+
+  setTraceLogOutput(&s_out);
+}
+
+
+int main(int argc, char **argv)
+{
+  setTraceLogOutput(&s_out);
+
+  testFormatting();
+  testTruncation();
+  testThreads();
+  testDrops();
+
+  if (s_failures) {
+    std::cout << "trace-log-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "trace-log-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
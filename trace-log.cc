@@ -0,0 +1,370 @@
+// trace-log.cc
+// Code for `trace-log` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "trace-log.h"                 // this module
+
+#include <algorithm>                   // std::{min, stable_sort}
+#include <atomic>                      // std::atomic
+#include <chrono>                      // std::chrono
+#include <condition_variable>          // std::condition_variable
+#include <iostream>                    // std::wcerr
+#include <mutex>                       // std::{mutex, lock_guard, unique_lock}
+#include <thread>                      // std::thread
+#include <utility>                     // std::pair
+#include <vector>                      // std::vector
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>               // __rdtsc
+#endif
+
+
+// ------------------------------- Rings -------------------------------
+// Size in bytes of one ring slot, including the header.
+static std::size_t const c_slotSize = 256;
+
+// Number of slots in each thread's ring.  Must be a power of 2.
+static std::uint32_t const c_ringSlots = 1024;
+
+
+// Ring of record slots written by one thread.
+struct TraceRing {
+  // Index (modulo `c_ringSlots`) of the next slot the producer will
+  // fill.  Only the producer writes it.
+  std::atomic<std::uint32_t> m_head{0};
+
+  // Index of the next slot the consumer will read.  Only the consumer
+  // writes it.  Kept on its own cache line so the two sides do not
+  // contend.
+  alignas(64) std::atomic<std::uint32_t> m_tail{0};
+
+  // Record storage.
+  alignas(64) unsigned char m_slots[c_ringSlots][c_slotSize];
+};
+
+
+// Protects `s_rings` and the drain thread state below.
+static std::mutex s_registryMutex;
+
+// Every ring ever created.  Neither the rings nor this list are ever
+// freed, since a thread might still be recording while the process
+// exits.
+static std::vector<TraceRing*> &s_rings = *new std::vector<TraceRing*>;
+
+// This thread's ring, created on first use.
+static thread_local TraceRing *t_ring = nullptr;
+
+// Scratch slot used when the ring is full, so the record can be built
+// and then discarded without any special cases in the `put` methods.
+static thread_local unsigned char t_discardSlot[c_slotSize];
+
+// Number of records discarded.
+static std::atomic<std::uint64_t> s_dropped{0};
+
+// Serializes consumers.
+static std::mutex s_drainMutex;
+
+// Where formatted records go.  Guarded by `s_drainMutex`.
+static std::wostream *s_output = &std::wcerr;
+
+// Background drain thread, its wakeup signal, and its stop request.
+static std::thread s_drainThread;
+static std::condition_variable s_drainCV;
+static bool s_stopRequested = false;
+
+// True once the program has started exiting.  After that, records are
+// written synchronously.
+static std::atomic<bool> s_shutDown{false};
+
+
+static void drainThreadMain();
+
+
+// Create and register the current thread's ring.
+static TraceRing *createRing()
+{
+  TraceRing *ring = new TraceRing;
+
+  std::lock_guard<std::mutex> lock(s_registryMutex);
+  s_rings.push_back(ring);
+
+  // Start the drain thread when the first ring appears.
+  if (!s_drainThread.joinable() && !s_shutDown) {
+    s_drainThread = std::thread(drainThreadMain);
+  }
+
+  return ring;
+}
+
+
+// Write all published records, merged across threads by timestamp.
+static void drainAll()
+{
+  std::lock_guard<std::mutex> drainLock(s_drainMutex);
+
+  std::vector<TraceRing*> rings;
+  {
+    std::lock_guard<std::mutex> lock(s_registryMutex);
+    rings = s_rings;
+  }
+
+  std::vector<std::pair<std::uint64_t, std::wstring>> lines;
+  for (TraceRing *ring : rings) {
+    std::uint32_t tail = ring->m_tail.load(std::memory_order_relaxed);
+    std::uint32_t head = ring->m_head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      unsigned char const *slot = ring->m_slots[tail % c_ringSlots];
+      TraceRecordHeader const *header = (TraceRecordHeader const*)slot;
+      lines.emplace_back(header->m_timestamp,
+        formatTraceRecordBody(slot + sizeof(TraceRecordHeader),
+                              header->m_size));
+    }
+    ring->m_tail.store(tail, std::memory_order_release);
+  }
+
+  if (lines.empty()) {
+    return;
+  }
+
+  std::stable_sort(lines.begin(), lines.end(),
+    [](auto const &a, auto const &b) { return a.first < b.first; });
+
+  for (auto const &line : lines) {
+    *s_output << line.second << L'\n';
+  }
+
+  static std::uint64_t reportedDrops = 0;
+  if (std::uint64_t drops = s_dropped.load(); drops != reportedDrops) {
+    *s_output << L"[trace: " << (drops - reportedDrops)
+              << L" records dropped]\n";
+    reportedDrops = drops;
+  }
+
+  s_output->flush();
+}
+
+
+static void drainThreadMain()
+{
+  std::unique_lock<std::mutex> lock(s_registryMutex);
+  while (!s_stopRequested) {
+    s_drainCV.wait_for(lock, std::chrono::milliseconds(10));
+
+    lock.unlock();
+    drainAll();
+    lock.lock();
+  }
+}
+
+
+// Stops the drain thread and writes what remains when the program
+// exits.
+static struct TraceLogShutdown {
+  ~TraceLogShutdown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(s_registryMutex);
+      s_shutDown = true;
+      s_stopRequested = true;
+    }
+    s_drainCV.notify_all();
+    if (s_drainThread.joinable()) {
+      s_drainThread.join();
+    }
+    drainAll();
+  }
+} s_traceLogShutdown;
+
+
+// ---------------------------- TraceRecord ----------------------------
+std::uint64_t traceTimestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+
+TraceRecord::TraceRecord(TraceSite const *site)
+{
+  TraceRing *ring = t_ring;
+  if (!ring) {
+    ring = t_ring = createRing();
+  }
+
+  unsigned char *slot;
+  std::uint32_t head = ring->m_head.load(std::memory_order_relaxed);
+  std::uint32_t tail = ring->m_tail.load(std::memory_order_acquire);
+  if (head - tail < c_ringSlots) {
+    slot = ring->m_slots[head % c_ringSlots];
+  }
+  else {
+    s_dropped.fetch_add(1, std::memory_order_relaxed);
+    slot = t_discardSlot;
+  }
+
+  m_header = (TraceRecordHeader*)slot;
+  m_header->m_timestamp = traceTimestamp();
+  m_header->m_site = site;
+  m_cur = slot + sizeof(TraceRecordHeader);
+  m_end = slot + c_slotSize - 1;
+}
+
+
+TraceRecord::~TraceRecord()
+{
+  m_header->m_size = m_cur - (unsigned char*)(m_header+1);
+
+  if ((unsigned char*)m_header == t_discardSlot) {
+    return;
+  }
+
+  TraceRing *ring = t_ring;
+  ring->m_head.fetch_add(1, std::memory_order_release);
+
+  if (s_shutDown.load(std::memory_order_relaxed)) {
+    drainAll();
+  }
+}
+
+
+void TraceRecord::putArray(Tag tag, void const *data, std::size_t count,
+                           std::size_t elementSize)
+{
+  std::ptrdiff_t const overhead = 1 + sizeof(std::uint16_t);
+  std::ptrdiff_t avail = m_end - m_cur;
+  if (avail < overhead) {
+    putTruncated();
+    return;
+  }
+
+  std::uint16_t n = (std::uint16_t)std::min(
+    { count, (avail - overhead) / elementSize, (std::size_t)0xFFFF });
+
+  *m_cur++ = tag;
+  std::memcpy(m_cur, &n, sizeof(n));
+  m_cur += sizeof(n);
+  std::memcpy(m_cur, data, n * elementSize);
+  m_cur += n * elementSize;
+
+  if (n < count) {
+    putTruncated();
+  }
+}
+
+
+void TraceRecord::putTruncated()
+{
+  if (m_cur <= m_end) {
+    *m_cur++ = T_TRUNCATED;
+  }
+
+  // Make all further arguments fail to fit.
+  m_end = m_cur - 1;
+}
+
+
+// ---------------------------- Formatting -----------------------------
+// Read a `T` from `p` and advance it.
+template <typename T>
+static T readValue(unsigned char const *&p)
+{
+  T ret;
+  std::memcpy(&ret, p, sizeof(T));
+  p += sizeof(T);
+  return ret;
+}
+
+
+std::wstring formatTraceRecordBody(unsigned char const *body,
+                                   std::size_t size)
+{
+  std::wostringstream oss;
+
+  unsigned char const *p = body;
+  unsigned char const *end = body + size;
+  while (p < end) {
+    switch ((TraceRecord::Tag)*p++) {
+      case TraceRecord::T_SIGNED:
+        oss << readValue<std::int64_t>(p);
+        break;
+
+      case TraceRecord::T_UNSIGNED:
+        oss << readValue<std::uint64_t>(p);
+        break;
+
+      case TraceRecord::T_DOUBLE:
+        oss << readValue<double>(p);
+        break;
+
+      case TraceRecord::T_WCHAR:
+        oss << readValue<wchar_t>(p);
+        break;
+
+      case TraceRecord::T_WSTRING: {
+        std::uint16_t n = readValue<std::uint16_t>(p);
+        std::wstring s(n, L'\0');
+        std::memcpy(s.data(), p, n * sizeof(wchar_t));
+        p += n * sizeof(wchar_t);
+        oss << s;
+        break;
+      }
+
+      case TraceRecord::T_STRING: {
+        std::uint16_t n = readValue<std::uint16_t>(p);
+        oss << std::string((char const*)p, n).c_str();
+        p += n;
+        break;
+      }
+
+      case TraceRecord::T_WLITERAL: {
+        wchar_t const *lit = readValue<wchar_t const*>(p);
+        std::uint32_t n = readValue<std::uint32_t>(p);
+        oss.write(lit, n);
+        break;
+      }
+
+      case TraceRecord::T_LITERAL: {
+        char const *lit = readValue<char const*>(p);
+        std::uint32_t n = readValue<std::uint32_t>(p);
+        oss << std::string(lit, n).c_str();
+        break;
+      }
+
+      case TraceRecord::T_TRUNCATED:
+      default:
+        oss << L"...";
+        return oss.str();
+    }
+  }
+
+  return oss.str();
+}
+
+
+// ------------------------------ Control ------------------------------
+void flushTraceLog()
+{
+  drainAll();
+}
+
+
+void setTraceLogOutput(std::wostream *os)
+{
+  drainAll();
+
+  std::lock_guard<std::mutex> lock(s_drainMutex);
+  s_output = os;
+}
+
+
+std::uint64_t traceLogDroppedCount()
+{
+  return s_dropped.load(std::memory_order_relaxed);
+}
+
+
+// EOF
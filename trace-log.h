@@ -0,0 +1,233 @@
+// trace-log.h
+// Asynchronous binary log behind the `TRACE` macros.
+
+// See license.txt for copyright and terms of use.
+
+// Writing each diagnostic with `std::wcerr << ... << std::endl` means
+// formatting and flushing on the thread that issues it, which, at high
+// tracing levels, is enough to make scrolling stutter.  Instead, a
+// `TraceRecord` copies its arguments in compact binary form (a tag
+// byte and the raw value) into a ring buffer owned by the calling
+// thread.  A background thread drains the rings, formats the records,
+// and writes them out in timestamp order.
+//
+// Each thread's ring has a single producer (that thread) and a single
+// consumer (whoever holds the drain lock), so recording is lock free.
+// If a ring is full, the record is dropped and counted rather than
+// blocking the caller.
+//
+// This module does not depend on the Windows API.
+
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <cstddef>                     // std::{size_t, ptrdiff_t}
+#include <cstdint>                     // std::uint64_t
+#include <cstring>                     // std::{memcpy, strlen}
+#include <cwchar>                      // std::wcslen
+#include <iosfwd>                      // std::wostream
+#include <sstream>                     // std::wostringstream
+#include <string>                      // std::{string, wstring}
+#include <type_traits>                 // std::is_integral_v, etc.
+
+
+// Static description of one place that emits trace records.  The
+// address of the instance serves as the call-site ID in each record.
+struct TraceSite {
+  // Source location, from `__FILE__` and `__LINE__`.
+  char const *m_file;
+  int m_line;
+
+  // Tracing level of the call site.
+  int m_level;
+};
+
+
+// Fixed part of a record, at the start of a ring slot.
+struct TraceRecordHeader {
+  // Time the record was made, in `traceTimestamp()` ticks.
+  std::uint64_t m_timestamp;
+
+  // Where it was made.
+  TraceSite const *m_site;
+
+  // Number of bytes of argument data following the header.
+  std::uint32_t m_size;
+};
+
+
+// Read the trace clock.  This is the cheapest monotonic-enough counter
+// available, namely the TSC on x86.
+std::uint64_t traceTimestamp();
+
+
+// One record being built.  Construct it, stream arguments into it with
+// `<<`, and it is published when destroyed.  Normally this is only used
+// via `TRACE_LOG_RECORD`.
+class TraceRecord {
+  TraceRecord(TraceRecord const &obj) = delete;
+  TraceRecord &operator=(TraceRecord const &obj) = delete;
+
+public:      // types
+  // Tag preceding each argument in the record body.
+  enum Tag : unsigned char {
+    T_SIGNED,                          // std::int64_t
+    T_UNSIGNED,                        // std::uint64_t
+    T_DOUBLE,                          // double
+    T_WCHAR,                           // wchar_t
+    T_WSTRING,                         // std::uint16_t count, wchar_t[]
+    T_STRING,                          // std::uint16_t count, char[]
+    T_WLITERAL,                        // wchar_t const *, std::uint32_t count
+    T_LITERAL,                         // char const *, std::uint32_t count
+    T_TRUNCATED,                       // No payload; nothing follows.
+  };
+
+private:     // data
+  // The slot header being filled in.
+  TraceRecordHeader *m_header;
+
+  // Next byte of argument data to write, and the end of the space
+  // available.  One byte beyond `m_end` is always left for
+  // `T_TRUNCATED`, after which `m_end` is set below `m_cur`.
+  unsigned char *m_cur;
+  unsigned char *m_end;
+
+private:     // funcs
+  // Copy `n` bytes of `data` after `tag`, or mark the record truncated
+  // if they do not fit.
+  void putFixed(Tag tag, void const *data, std::size_t n)
+  {
+    if (m_end - m_cur < (std::ptrdiff_t)(1 + n)) {
+      putTruncated();
+      return;
+    }
+    *m_cur++ = tag;
+    std::memcpy(m_cur, data, n);
+    m_cur += n;
+  }
+
+  // Store the address and length of a string literal.
+  void putLiteral(Tag tag, void const *literal, std::uint32_t count)
+  {
+    std::size_t const n = sizeof(literal) + sizeof(count);
+    if (m_end - m_cur < (std::ptrdiff_t)(1 + n)) {
+      putTruncated();
+      return;
+    }
+    *m_cur++ = tag;
+    std::memcpy(m_cur, &literal, sizeof(literal));
+    std::memcpy(m_cur + sizeof(literal), &count, sizeof(count));
+    m_cur += n;
+  }
+
+  // Store as much of the `count` elements at `data` as will fit.
+  void putArray(Tag tag, void const *data, std::size_t count,
+                std::size_t elementSize);
+
+  // Write `T_TRUNCATED` and ignore any further arguments.
+  void putTruncated();
+
+public:      // funcs
+  // Reserve a ring slot for a record from `site`.
+  explicit TraceRecord(TraceSite const *site);
+
+  // Publish the record to the drain thread.
+  ~TraceRecord();
+
+  void putSigned(long long v)
+    { std::int64_t x = v; putFixed(T_SIGNED, &x, sizeof(x)); }
+  void putUnsigned(unsigned long long v)
+    { std::uint64_t x = v; putFixed(T_UNSIGNED, &x, sizeof(x)); }
+  void putDouble(double v)
+    { putFixed(T_DOUBLE, &v, sizeof(v)); }
+  void putWChar(wchar_t c)
+    { putFixed(T_WCHAR, &c, sizeof(c)); }
+  void putWide(wchar_t const *s, std::size_t len)
+    { putArray(T_WSTRING, s, len, sizeof(wchar_t)); }
+  void putNarrow(char const *s, std::size_t len)
+    { putArray(T_STRING, s, len, sizeof(char)); }
+
+  // Append `value`.  Strings and arithmetic types are stored in binary
+  // and formatted later.  Anything else is formatted with `<<` here,
+  // on the calling thread, and stored as a string.
+  //
+  // A `const` character array is assumed to be a string literal, and
+  // only its address is stored.  Do not pass a `const` local array.
+  //
+  template <typename T>
+  TraceRecord &operator<<(T &&value)
+  {
+    using U = std::remove_reference_t<T>;
+    using V = std::remove_cv_t<U>;
+
+    if constexpr (std::is_array_v<U> &&
+                  std::is_const_v<std::remove_extent_t<U>>) {
+      using E = std::remove_cv_t<std::remove_extent_t<U>>;
+      static_assert(std::is_same_v<E, wchar_t> || std::is_same_v<E, char>);
+      putLiteral(std::is_same_v<E, wchar_t>? T_WLITERAL : T_LITERAL,
+                 value, std::extent_v<U> - 1);
+    }
+    else if constexpr (std::is_same_v<V, wchar_t> || std::is_same_v<V, char>) {
+      putWChar((wchar_t)value);
+    }
+    else if constexpr (std::is_integral_v<V> && std::is_signed_v<V>) {
+      putSigned(value);
+    }
+    else if constexpr (std::is_integral_v<V>) {
+      putUnsigned(value);
+    }
+    else if constexpr (std::is_floating_point_v<V>) {
+      putDouble(value);
+    }
+    else if constexpr (std::is_same_v<V, std::wstring>) {
+      putWide(value.data(), value.size());
+    }
+    else if constexpr (std::is_same_v<V, std::string>) {
+      putNarrow(value.data(), value.size());
+    }
+    else if constexpr (std::is_convertible_v<U &, wchar_t const *>) {
+      wchar_t const *s = value;
+      putWide(s, s? std::wcslen(s) : 0);
+    }
+    else if constexpr (std::is_convertible_v<U &, char const *>) {
+      char const *s = value;
+      putNarrow(s, s? std::strlen(s) : 0);
+    }
+    else {
+      std::wostringstream oss;
+      oss << value;
+      std::wstring s = oss.str();
+      putWide(s.data(), s.size());
+    }
+    return *this;
+  }
+};
+
+
+// Record `msg`, a chain of values separated by `<<`, as coming from a
+// site at `level`.  This does not check the current tracing level.
+#define TRACE_LOG_RECORD(level, msg)                                \
+  {                                                                 \
+    static TraceSite const traceSite_ = { __FILE__, __LINE__, (level) }; \
+    TraceRecord(&traceSite_) << msg;                                \
+  }
+
+
+// Block until every record published before the call has been written
+// out.  This is called automatically at program exit.
+void flushTraceLog();
+
+// Direct formatted records to `os` instead of `std::wcerr`.  This is
+// meant for tests.  The caller retains ownership of `os`.
+void setTraceLogOutput(std::wostream *os);
+
+// Number of records dropped so far because a ring was full.
+std::uint64_t traceLogDroppedCount();
+
+// Format the record body of `size` bytes at `body` as the original
+// `<<` chain would have.
+std::wstring formatTraceRecordBody(unsigned char const *body,
+                                   std::size_t size);
+
+
+#endif // TRACE_LOG_H
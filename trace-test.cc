@@ -0,0 +1,139 @@
+// trace-test.cc
+// Tests for `trace`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API.  It is compiled as if for a
+// release build that only keeps level 1.  With "bench", it also times
+// a loop shaped like the list painting code with and without the
+// trace calls that level 1 eliminates.
+
+#define TRACE_MAX_LEVEL 1
+#include "trace.h"                     // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <cmath>                       // std::ceil
+#include <iostream>                    // std::cout
+#include <sstream>                     // std::wostringstream
+#include <string>                      // std::string
+
+
+// Number of times `sideEffect` has run.
+static int s_sideEffects = 0;
+
+static int sideEffect()
+{
+  return ++s_sideEffects;
+}
+
+
+// Levels above the maximum are not evaluated even when the run-time
+// level asks for them, while those within it still obey it.
+static void testLevels()
+{
+  std::wostringstream out;
+  setTraceLogOutput(&out);
+
+  g_tracingLevel = 3;
+  TRACE3(L"three " << sideEffect());
+  TRACE2(L"two " << sideEffect());
+  EXPECT(s_sideEffects == 0);
+
+  TRACE1(L"one " << sideEffect());
+  EXPECT(s_sideEffects == 1);
+
+  g_tracingLevel = 0;
+  TRACE1(L"one " << sideEffect());
+  EXPECT(s_sideEffects == 1);
+
+  flushTraceLog();
+  EXPECT(out.str() == L"one 1\n");
+
+  setTraceLogOutput(&std::wcerr);
+  g_tracingLevel = 1;
+}
+
+
+// Stand-in for `Screenshot::heightForWidth`.
+static int heightForWidth(int i, int w)
+{
+  return (int)std::ceil((float)(1080 + i%7) * (float)w / 1920.0f);
+}
+
+
+// Time a loop like `SLMainWindow::drawShotList`, at level 1, in three
+// forms: no trace call, a `TRACE3` that is compiled out, and what a
+// `TRACE3` used to cost, namely a test of `g_tracingLevel`.
+static void bench()
+{
+  int const items = 1000;
+  int const iters = 20000;
+
+  using Clock = std::chrono::steady_clock;
+  auto nsPer = [&](Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(
+      Clock::now() - start).count() / ((double)items * iters);
+  };
+
+  // Make the loop bound opaque so the three loops are comparable.
+  int volatile w = 390;
+  long long sum = 0;
+
+  auto start = Clock::now();
+  for (int k = 0; k < iters; ++k) {
+    for (int i = 0; i < items; ++i) {
+      int h = heightForWidth(i, w);
+      sum += h;
+    }
+  }
+  std::cout << "no trace:            " << nsPer(start) << " ns/item\n";
+
+  start = Clock::now();
+  for (int k = 0; k < iters; ++k) {
+    for (int i = 0; i < items; ++i) {
+      int h = heightForWidth(i, w);
+      TRACE3(L"item " << i << L" h=" << h);
+      sum += h;
+    }
+  }
+  std::cout << "compiled-out TRACE3: " << nsPer(start) << " ns/item\n";
+
+  start = Clock::now();
+  for (int k = 0; k < iters; ++k) {
+    for (int i = 0; i < items; ++i) {
+      int h = heightForWidth(i, w);
+      if (g_tracingLevel >= 3) {
+        TRACE_LOG_RECORD(3, L"item " << i << L" h=" << h);
+      }
+      sum += h;
+    }
+  }
+  std::cout << "run-time TRACE3:     " << nsPer(start) << " ns/item\n";
+
+  if (sum == 0) {
+    std::cout << "unexpected\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testLevels();
+
+  if (s_failures) {
+    std::cout << "trace-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "trace-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
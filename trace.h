@@ -4,9 +4,8 @@
 #ifndef TRACE_H
 #define TRACE_H
 
-#include "winapi-util.h"               // WIDE_STRINGIZE
-
-#include <iostream>                    // std::{wcerr, endl}
+#include "sm-macros.h"                 // WIDE_STRINGIZE
+#include "trace-log.h"                 // TRACE_LOG_RECORD
 
 
 // Level of diagnostics to print.
@@ -22,10 +21,29 @@
 extern int g_tracingLevel;
 
 
-// Write a diagnostic message.
-#define TRACE(level, msg)           \
-  if (g_tracingLevel >= (level)) {  \
-    std::wcerr << msg << std::endl; \
+// Highest level of diagnostics compiled into the program.  Calls above
+// it generate no code at all, regardless of `g_tracingLevel`, so a
+// release build can use `-DTRACE_MAX_LEVEL=1` to drop the high-volume
+// levels from paint and scroll paths.  Within this limit, the level is
+// still chosen at run time.
+#ifndef TRACE_MAX_LEVEL
+#  define TRACE_MAX_LEVEL 3
+#endif
+constexpr int c_maxTracingLevel = TRACE_MAX_LEVEL;
+
+
+// Write a diagnostic message.  The arguments are captured in binary
+// form and written to stderr asynchronously; see `trace-log.h`.
+//
+// `level` must be a constant expression.  Using `if constexpr` rather
+// than relying on the optimizer means the call is gone even in a `-O0`
+// build.
+//
+#define TRACE(level, msg)                        \
+  if constexpr ((level) <= c_maxTracingLevel) {  \
+    if (g_tracingLevel >= (level)) {             \
+      TRACE_LOG_RECORD((level), msg)             \
+    }                                            \
   }
 
 #define TRACE1(msg) TRACE(1, msg)
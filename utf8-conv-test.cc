@@ -0,0 +1,220 @@
+// utf8-conv-test.cc
+// Tests for `utf8-conv`.
+
+// See license.txt for copyright and terms of use.
+
+// This does not use the Windows API, so it can be built and run on any
+// platform.  With no arguments, it runs the tests.  With "bench", it
+// also times the conversion of typical screenshot file names against
+// the `std::wstring_convert` approach it replaced.
+
+#include "utf8-conv.h"                 // module under test
+
+#include "test-util.h"                 // EXPECT
+
+#include <chrono>                      // std::chrono
+#include <codecvt>                     // std::codecvt_utf8_utf16
+#include <cstdlib>                     // std::rand
+#include <iostream>                    // std::cout
+#include <locale>                      // std::wstring_convert
+#include <string>                      // std::{string, wstring}
+
+
+// Convert, expecting success.
+static std::wstring toW(std::string const &s)
+{
+  std::wstring ret;
+  EXPECT(utf8ToUtf16(s.data(), s.size(), ret));
+  return ret;
+}
+
+static std::string toN(std::wstring const &s)
+{
+  std::string ret;
+  EXPECT(utf16ToUtf8(s.data(), s.size(), ret));
+  return ret;
+}
+
+
+// Return true if `s` is rejected as UTF-8.
+static bool rejects8(std::string const &s)
+{
+  std::wstring dummy;
+  return !utf8ToUtf16(s.data(), s.size(), dummy);
+}
+
+static bool rejects16(std::wstring const &s)
+{
+  std::string dummy;
+  return !utf16ToUtf8(s.data(), s.size(), dummy);
+}
+
+
+static void testAscii()
+{
+  // Exercise every length around the vector block sizes.
+  for (int len = 0; len < 70; ++len) {
+    std::string n;
+    std::wstring w;
+    for (int i = 0; i < len; ++i) {
+      n += (char)('!' + (i % 90));
+      w += (wchar_t)('!' + (i % 90));
+    }
+    EXPECT(toW(n) == w);
+    EXPECT(toN(w) == n);
+  }
+}
+
+
+static void testMultiByte()
+{
+  // 2, 3 and 4 byte sequences.
+  EXPECT(toW("\xC3\xA9") == std::wstring(1, (wchar_t)0xE9));
+  EXPECT(toW("\xE2\x82\xAC") == std::wstring(1, (wchar_t)0x20AC));
+
+  std::wstring pair;
+  pair += (wchar_t)0xD83D;
+  pair += (wchar_t)0xDE00;
+  EXPECT(toW("\xF0\x9F\x98\x80") == pair);
+  EXPECT(toN(pair) == "\xF0\x9F\x98\x80");
+
+  // Extremes of each length.
+  for (std::string s : { "\x7F", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80",
+                         "\xEF\xBF\xBF", "\xF0\x90\x80\x80",
+                         "\xF4\x8F\xBF\xBF" }) {
+    EXPECT(toN(toW(s)) == s);
+  }
+
+  // Non-ASCII at every offset within and across vector blocks.
+  for (int pos = 0; pos < 40; ++pos) {
+    std::string n(40, 'a');
+    n.insert(pos, "\xE6\x97\xA5");
+    std::wstring w(40, L'a');
+    w.insert(w.begin() + pos, (wchar_t)0x65E5);
+    EXPECT(toW(n) == w);
+    EXPECT(toN(w) == n);
+  }
+}
+
+
+static void testInvalid()
+{
+  EXPECT(rejects8("\x80"));                  // Lone continuation.
+  EXPECT(rejects8("\xC0\x80"));              // Overlong NUL.
+  EXPECT(rejects8("\xC1\xBF"));              // Overlong.
+  EXPECT(rejects8("\xE0\x9F\xBF"));          // Overlong.
+  EXPECT(rejects8("\xF0\x8F\xBF\xBF"));      // Overlong.
+  EXPECT(rejects8("\xED\xA0\x80"));          // Encoded surrogate.
+  EXPECT(rejects8("\xF4\x90\x80\x80"));      // Above U+10FFFF.
+  EXPECT(rejects8("\xF5\x80\x80\x80"));      // Bad lead byte.
+  EXPECT(rejects8("\xFF"));                  // Bad lead byte.
+  EXPECT(rejects8("\xE2\x82"));              // Truncated.
+  EXPECT(rejects8("\xC3\x28"));              // Bad continuation.
+  EXPECT(rejects8(std::string(20, 'x') + "\xE2\x82"));
+
+  EXPECT(rejects16(std::wstring(1, (wchar_t)0xD800)));
+  EXPECT(rejects16(std::wstring(1, (wchar_t)0xDC00)));
+  EXPECT(rejects16(std::wstring(L"ab") + (wchar_t)0xD800 + L"cd"));
+  EXPECT(rejects16(std::wstring(20, L'x') + (wchar_t)0xDFFF));
+}
+
+
+// Compare against the standard library on random valid text.
+static void testRandom()
+{
+  std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+
+  std::srand(1);
+  for (int iter = 0; iter < 2000; ++iter) {
+    std::wstring w;
+    int len = std::rand() % 50;
+    for (int i = 0; i < len; ++i) {
+      int kind = std::rand() % 8;
+      if (kind < 4) {
+        w += (wchar_t)(0x20 + std::rand() % 0x5F);
+      }
+      else if (kind < 6) {
+        w += (wchar_t)(0x80 + std::rand() % 0x780);
+      }
+      else if (kind < 7) {
+        w += (wchar_t)(0xE000 + std::rand() % 0x1000);
+      }
+      else {
+        w += (wchar_t)(0xD800 + std::rand() % 0x400);
+        w += (wchar_t)(0xDC00 + std::rand() % 0x400);
+      }
+    }
+
+    std::string expectN = converter.to_bytes(w);
+    EXPECT(toN(w) == expectN);
+    EXPECT(toW(expectN) == w);
+  }
+}
+
+
+// Time `iters` round trips of a typical file name.
+static void bench()
+{
+  std::string name = "shots/2024-05-17T21-04-33s02.bmp";
+  int const iters = 1000000;
+
+  using Clock = std::chrono::steady_clock;
+  auto nsPer = [&](Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(
+      Clock::now() - start).count() / iters;
+  };
+
+  std::size_t sink = 0;
+
+  {
+    auto start = Clock::now();
+    for (int i = 0; i < iters; ++i) {
+      std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> c1;
+      std::wstring w = c1.from_bytes(name);
+      std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> c2;
+      sink += c2.to_bytes(w).size();
+    }
+    std::cout << "wstring_convert: " << nsPer(start) << " ns/round trip\n";
+  }
+
+  {
+    auto start = Clock::now();
+    std::wstring w;
+    std::string n;
+    for (int i = 0; i < iters; ++i) {
+      utf8ToUtf16(name.data(), name.size(), w);
+      utf16ToUtf8(w.data(), w.size(), n);
+      sink += n.size();
+    }
+    std::cout << "utf8-conv:       " << nsPer(start) << " ns/round trip\n";
+  }
+
+  // Keep the loops from being optimized away.
+  if (sink == 0) {
+    std::cout << "unexpected\n";
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  testAscii();
+  testMultiByte();
+  testInvalid();
+  testRandom();
+
+  if (s_failures) {
+    std::cout << "utf8-conv-test: " << s_failures << " failures\n";
+    return 2;
+  }
+  std::cout << "utf8-conv-test: ok\n";
+
+  if (argc >= 2 && std::string(argv[1]) == "bench") {
+    bench();
+  }
+
+  return 0;
+}
+
+
+// EOF
@@ -0,0 +1,236 @@
+// utf8-conv.cc
+// Code for `utf8-conv` module.
+
+// See license.txt for copyright and terms of use.
+
+#include "utf8-conv.h"                 // this module
+
+#include <algorithm>                   // std::min
+#include <cstdint>                     // std::uint32_t
+
+#ifdef __SSE2__
+#  include <emmintrin.h>               // _mm_loadu_si128, etc.
+#endif
+
+
+// ------------------------------- SIMD --------------------------------
+#ifdef __SSE2__
+// Zero-extend the 16 bytes in `v` to `wchar_t` and store them at `d`.
+static inline void storeWidened16(wchar_t *d, __m128i v)
+{
+  __m128i const zero = _mm_setzero_si128();
+  __m128i lo = _mm_unpacklo_epi8(v, zero);
+  __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+  if constexpr (sizeof(wchar_t) == 2) {
+    _mm_storeu_si128((__m128i*)(d+0), lo);
+    _mm_storeu_si128((__m128i*)(d+8), hi);
+  }
+  else {
+    _mm_storeu_si128((__m128i*)(d+0),  _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(d+4),  _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(d+8),  _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i*)(d+12), _mm_unpackhi_epi16(hi, zero));
+  }
+}
+
+
+// If the 8 code units at `p` are all ASCII, set the low 8 bytes of
+// `packed` to them and return true.  Otherwise return false.
+static inline bool loadAscii8(wchar_t const *p, __m128i &packed)
+{
+  __m128i const zero = _mm_setzero_si128();
+
+  if constexpr (sizeof(wchar_t) == 2) {
+    __m128i v = _mm_loadu_si128((__m128i const*)p);
+    __m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xFF80));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) {
+      return false;
+    }
+    packed = _mm_packus_epi16(v, v);
+  }
+  else {
+    __m128i a = _mm_loadu_si128((__m128i const*)(p+0));
+    __m128i b = _mm_loadu_si128((__m128i const*)(p+4));
+    __m128i high = _mm_and_si128(_mm_or_si128(a, b),
+                                 _mm_set1_epi32((int)0xFFFFFF80));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, zero)) != 0xFFFF) {
+      return false;
+    }
+    packed = _mm_packus_epi16(_mm_packs_epi32(a, b), zero);
+  }
+
+  return true;
+}
+#endif // __SSE2__
+
+
+// -------------------------- UTF-8 -> UTF-16 --------------------------
+bool utf8ToUtf16(char const *src, std::size_t len, std::wstring &dest)
+{
+  unsigned char const *s = reinterpret_cast<unsigned char const*>(src);
+  unsigned char const *end = s + len;
+
+  // Every input byte yields at most one code unit, so this is enough
+  // space.  We shrink to the actual size at the end.
+  dest.resize(len);
+  wchar_t *d = dest.data();
+
+  while (s < end) {
+#ifdef __SSE2__
+    // Convert blocks of 16 ASCII bytes.
+    while (end - s >= 16) {
+      __m128i v = _mm_loadu_si128((__m128i const*)s);
+      if (int mask = _mm_movemask_epi8(v)) {
+        // Copy the ASCII prefix, then let the scalar code below deal
+        // with the first non-ASCII byte.
+        for (int n = __builtin_ctz(mask); n > 0; --n) {
+          *d++ = *s++;
+        }
+        break;
+      }
+      storeWidened16(d, v);
+      s += 16;
+      d += 16;
+    }
+    if (s == end) {
+      break;
+    }
+#endif // __SSE2__
+
+    std::uint32_t c = *s;
+    if (c < 0x80) {
+      *d++ = (wchar_t)c;
+      ++s;
+      continue;
+    }
+
+    // Decode the lead byte.  C0 and C1 can only begin overlong forms,
+    // and F5 and above would encode values beyond U+10FFFF.
+    std::size_t n;
+    std::uint32_t cp;
+    if (0xC2 <= c && c <= 0xDF) {
+      n = 2;
+      cp = c & 0x1F;
+    }
+    else if (0xE0 <= c && c <= 0xEF) {
+      n = 3;
+      cp = c & 0x0F;
+    }
+    else if (0xF0 <= c && c <= 0xF4) {
+      n = 4;
+      cp = c & 0x07;
+    }
+    else {
+      return false;
+    }
+
+    if ((std::size_t)(end - s) < n) {
+      return false;                    // Truncated.
+    }
+    for (std::size_t k = 1; k < n; ++k) {
+      std::uint32_t b = s[k];
+      if ((b & 0xC0) != 0x80) {
+        return false;                  // Not a continuation byte.
+      }
+      cp = (cp << 6) | (b & 0x3F);
+    }
+
+    if (n == 3 && (cp < 0x800 || (0xD800 <= cp && cp <= 0xDFFF))) {
+      return false;                    // Overlong or surrogate.
+    }
+    if (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) {
+      return false;                    // Overlong or out of range.
+    }
+    s += n;
+
+    if (cp < 0x10000) {
+      *d++ = (wchar_t)cp;
+    }
+    else {
+      cp -= 0x10000;
+      *d++ = (wchar_t)(0xD800 + (cp >> 10));
+      *d++ = (wchar_t)(0xDC00 + (cp & 0x3FF));
+    }
+  }
+
+  dest.resize(d - dest.data());
+  return true;
+}
+
+
+// -------------------------- UTF-16 -> UTF-8 --------------------------
+bool utf16ToUtf8(wchar_t const *src, std::size_t len, std::string &dest)
+{
+  // A code unit yields at most three bytes, and a surrogate pair (two
+  // units) yields four.
+  dest.resize(len * 3);
+  char *d = dest.data();
+
+  std::size_t i = 0;
+  while (i < len) {
+    // Index at which to go back to trying the vector path.
+    std::size_t scalarEnd = len;
+
+#ifdef __SSE2__
+    // Convert blocks of 8 ASCII code units.
+    __m128i packed;
+    while (len - i >= 8 && loadAscii8(src+i, packed)) {
+      _mm_storel_epi64((__m128i*)d, packed);
+      i += 8;
+      d += 8;
+    }
+
+    // Convert at least the next block with the scalar code.
+    scalarEnd = std::min(len, i+8);
+#endif // __SSE2__
+
+    while (i < scalarEnd) {
+      std::uint32_t u = (std::uint32_t)src[i];
+
+      if (u < 0x80) {
+        *d++ = (char)u;
+        i += 1;
+      }
+      else if (u < 0x800) {
+        *d++ = (char)(0xC0 | (u >> 6));
+        *d++ = (char)(0x80 | (u & 0x3F));
+        i += 1;
+      }
+      else if (0xD800 <= u && u <= 0xDBFF) {
+        // High surrogate; it must be followed by a low surrogate.
+        if (i+1 >= len) {
+          return false;
+        }
+        std::uint32_t u2 = (std::uint32_t)src[i+1];
+        if (!(0xDC00 <= u2 && u2 <= 0xDFFF)) {
+          return false;
+        }
+        std::uint32_t cp = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+        *d++ = (char)(0xF0 | (cp >> 18));
+        *d++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *d++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *d++ = (char)(0x80 | (cp & 0x3F));
+        i += 2;
+      }
+      else if (0xDC00 <= u && u <= 0xDFFF) {
+        return false;                  // Unpaired low surrogate.
+      }
+      else if (u <= 0xFFFF) {
+        *d++ = (char)(0xE0 | (u >> 12));
+        *d++ = (char)(0x80 | ((u >> 6) & 0x3F));
+        *d++ = (char)(0x80 | (u & 0x3F));
+        i += 1;
+      }
+      else {
+        return false;                  // Not a UTF-16 code unit.
+      }
+    }
+  }
+
+  dest.resize(d - dest.data());
+  return true;
+}
+
+
+// EOF
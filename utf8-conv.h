@@ -0,0 +1,39 @@
+// utf8-conv.h
+// Conversion between UTF-8 and UTF-16.
+
+// See license.txt for copyright and terms of use.
+
+// This module does not depend on the Windows API, so it can be built
+// and tested on any platform.  On Windows, `wchar_t` is a UTF-16 code
+// unit.  Elsewhere it is wider, but these functions still produce and
+// consume UTF-16 code units (including surrogate pairs) so that the
+// behavior, and the tests, are the same everywhere.
+
+#ifndef UTF8_CONV_H
+#define UTF8_CONV_H
+
+#include <cstddef>                     // std::size_t
+#include <string>                      // std::{string, wstring}
+
+
+// Decode the `len` bytes of UTF-8 at `src`, replacing the contents of
+// `dest` with the equivalent UTF-16 code units.  Return false if the
+// input is not valid UTF-8 (overlong forms, encoded surrogates, code
+// points above U+10FFFF, and truncated sequences are all rejected), in
+// which case the contents of `dest` are unspecified.
+//
+// Runs of ASCII are converted 16 bytes at a time.
+//
+bool utf8ToUtf16(char const *src, std::size_t len, std::wstring &dest);
+
+// Encode the `len` UTF-16 code units at `src` as UTF-8, replacing the
+// contents of `dest`.  Return false if the input contains an unpaired
+// surrogate or a unit that is not a valid UTF-16 code unit, in which
+// case the contents of `dest` are unspecified.
+//
+// Runs of ASCII are converted 8 code units at a time.
+//
+bool utf16ToUtf8(wchar_t const *src, std::size_t len, std::string &dest);
+
+
+#endif // UTF8_CONV_H
@@ -5,14 +5,16 @@
 
 #include "winapi-util.h"               // this module
 
+#include "trace-log.h"                 // flushTraceLog
+#include "utf8-conv.h"                 // utf8ToUtf16, utf16ToUtf8
+
 #include <windows.h>                   // winapi
 
-#include <codecvt>                     // std::wstring_convert
 #include <cstdlib>                     // std::exit
 #include <exception>                   // std::exception
 #include <iostream>                    // std::{wcerr, clog, endl}
-#include <locale>                      // std::wstring_convert
 #include <sstream>                     // std::wostreamstream
+#include <stdexcept>                   // std::range_error
 #include <string>                      // std::wstring
 
 
@@ -87,6 +89,10 @@ std::wstring getHRErrorMessage(HRESULT hr)
 void winapiDie(wchar_t const *functionName)
 {
   DWORD code = GetLastError();
+
+  // Let any trace output that led up to this appear before the error.
+  flushTraceLog();
+
   std::wcerr << functionName << L": " << getErrorMessage(code) << L"\n";
   std::exit(2);
 }
@@ -94,6 +100,7 @@ void winapiDie(wchar_t const *functionName)
 
 void winapiDieNLE(wchar_t const *functionName)
 {
+  flushTraceLog();
   std::wcerr << functionName << L" failed.\n";
   std::exit(2);
 }
@@ -101,6 +108,7 @@ void winapiDieNLE(wchar_t const *functionName)
 
 void winapiDieHR(wchar_t const *functionName, HRESULT hr)
 {
+  flushTraceLog();
   std::wcerr << functionName << L": " << getHRErrorMessage(hr) << L"\n";
   std::exit(2);
 }
@@ -108,27 +116,32 @@ void winapiDieHR(wchar_t const *functionName, HRESULT hr)
 
 void die(wchar_t const *msg)
 {
+  flushTraceLog();
   std::wcerr << msg << L"\n";
   std::exit(2);
 }
 
 
 // ------------------------------ Strings ------------------------------
-// https://stackoverflow.com/questions/2573834/c-convert-string-or-char-to-wstring-or-wchar-t
-//
-// Oof, this is all deprecated in C++17 and removed in C++26!
-//
+// These used to construct a `std::wstring_convert`, which is deprecated
+// and also slow enough to show up when saving and loading a long list.
 std::wstring toWideString(std::string const &str)
 {
-  std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-  return converter.from_bytes(str);
+  std::wstring ret;
+  if (!utf8ToUtf16(str.data(), str.size(), ret)) {
+    throw std::range_error("toWideString: invalid UTF-8");
+  }
+  return ret;
 }
 
 
 std::string toNarrowString(std::wstring const &str)
 {
-  std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t> converter;
-  return converter.to_bytes(str);
+  std::string ret;
+  if (!utf16ToUtf8(str.data(), str.size(), ret)) {
+    throw std::range_error("toNarrowString: invalid UTF-16");
+  }
+  return ret;
 }
 
 
@@ -379,6 +392,73 @@ void appendMenuW(
 }
 
 
+// ----------------------------- Messages ------------------------------
+char const *windowMessageName(UINT uMsg)
+{
+  switch (uMsg) {
+    #define CASE(msg) case msg: return #msg;
+    CASE(WM_CREATE)
+    CASE(WM_DESTROY)
+    CASE(WM_MOVE)
+    CASE(WM_SIZE)
+    CASE(WM_ACTIVATE)
+    CASE(WM_SETFOCUS)
+    CASE(WM_KILLFOCUS)
+    CASE(WM_PAINT)
+    CASE(WM_CLOSE)
+    CASE(WM_QUIT)
+    CASE(WM_ERASEBKGND)
+    CASE(WM_SHOWWINDOW)
+    CASE(WM_ACTIVATEAPP)
+    CASE(WM_SETCURSOR)
+    CASE(WM_MOUSEACTIVATE)
+    CASE(WM_GETMINMAXINFO)
+    CASE(WM_GETOBJECT)
+    CASE(WM_WINDOWPOSCHANGING)
+    CASE(WM_WINDOWPOSCHANGED)
+    CASE(WM_GETICON)
+    CASE(WM_SETICON)
+    CASE(WM_NCCREATE)
+    CASE(WM_NCDESTROY)
+    CASE(WM_NCCALCSIZE)
+    CASE(WM_NCHITTEST)
+    CASE(WM_NCPAINT)
+    CASE(WM_NCACTIVATE)
+    CASE(WM_NCMOUSEMOVE)
+    CASE(WM_NCLBUTTONDOWN)
+    CASE(WM_KEYDOWN)
+    CASE(WM_KEYUP)
+    CASE(WM_CHAR)
+    CASE(WM_SYSKEYDOWN)
+    CASE(WM_SYSKEYUP)
+    CASE(WM_SYSCHAR)
+    CASE(WM_COMMAND)
+    CASE(WM_SYSCOMMAND)
+    CASE(WM_TIMER)
+    CASE(WM_VSCROLL)
+    CASE(WM_INITMENU)
+    CASE(WM_INITMENUPOPUP)
+    CASE(WM_MENUSELECT)
+    CASE(WM_ENTERIDLE)
+    CASE(WM_MOUSEMOVE)
+    CASE(WM_LBUTTONDOWN)
+    CASE(WM_LBUTTONUP)
+    CASE(WM_MOUSEWHEEL)
+    CASE(WM_CAPTURECHANGED)
+    CASE(WM_ENTERSIZEMOVE)
+    CASE(WM_EXITSIZEMOVE)
+    CASE(WM_IME_SETCONTEXT)
+    CASE(WM_IME_NOTIFY)
+    CASE(WM_NCMOUSELEAVE)
+    CASE(WM_MOUSELEAVE)
+    CASE(WM_HOTKEY)
+    #undef CASE
+  }
+
+  return nullptr;
+}
+
+
 // ------------------------------- Files -------------------------------
 void writeFile(HANDLE hFile, void const *data, std::size_t size)
 {
@@ -6,35 +6,13 @@
 #ifndef WINAPI_UTIL_H
 #define WINAPI_UTIL_H
 
+#include "sm-macros.h"                 // NO_OBJECT_COPIES, etc.
+
 #include <windows.h>                   // winapi
 
 #include <string>                      // std::{string, wstring}
 
 
-// ------------------------------ Macros -------------------------------
-// Concatenate tokens.  Unlike plain '##', this works for __LINE__.  It
-// is the same as BOOST_PP_CAT.
-#define SMBASE_PP_CAT(a,b) SMBASE_PP_CAT2(a,b)
-#define SMBASE_PP_CAT2(a,b) a##b
-
-
-// put at the top of a class for which the default copy ctor
-// and operator= are not desired; then don't define these functions
-#define NO_OBJECT_COPIES(name)   \
-  private:                       \
-    name(name&);                 \
-    void operator=(name&) /*user ;*/
-
-
-// Number of entries in an array.
-#define TABLESIZE(tbl) (sizeof(tbl)/sizeof((tbl)[0]))
-
-
-// Stringize an argument as a wide string.
-#define WIDE_STRINGIZE_HELPER(x) L ## x
-#define WIDE_STRINGIZE(x) WIDE_STRINGIZE_HELPER(#x)
-
-
 // -------------------------- Error handling ---------------------------
 // Get the string corresponding to `errorCode`.  This string is a
 // complete sentence, and does *not* end with a newline.
@@ -105,10 +83,11 @@ void die(wchar_t const *msg);
 
 // ------------------------------ Strings ------------------------------
 // Convert from narrow string, assumed to use UTF-8 encoding, to wide
-// string.
+// string.  Throw `std::range_error` if `str` is not valid UTF-8.
 std::wstring toWideString(std::string const &str);
 
-// Convert wide string to UTF-8.
+// Convert wide string to UTF-8.  Throw `std::range_error` if `str`
+// contains an unpaired surrogate.
 std::string toNarrowString(std::wstring const &str);
 
 
@@ -345,6 +324,12 @@ void appendMenuW(
   LPCWSTR  lpNewItem);
 
 
+// ----------------------------- Messages ------------------------------
+// Return the name of window message `uMsg`, such as "WM_PAINT", or null
+// if it is not one of the common system messages this knows about.
+char const *windowMessageName(UINT uMsg);
+
+
 // ------------------------------- Files -------------------------------
 // Like `WriteFile`, but without the useless arguments, and with error
 // checking.